@@ -0,0 +1,84 @@
+#include "libmsr.h"
+#include "internals.h"
+
+/* Upper bound on threads for one call; more than this is rarely useful for memory-bound work */
+#define MSR_BATCH_MAX_THREADS 64
+
+typedef LIBMSRSTATUS (LIBMSRDECL *MSRRECORDPROC)(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest);
+
+typedef struct {
+    const LIBMSRTRACKSET *Set;
+    MSRRECORDPROC Proc;
+    UINT BitsPerChar;
+    SIZE_T First;
+    SIZE_T Last;
+} MSRBATCHRANGE;
+
+static void LIBMSRDECL _MSRBatchWorker(void *Arg)
+{
+    MSRBATCHRANGE *Range = (MSRBATCHRANGE *)Arg;
+    const LIBMSRTRACKSET *Set = Range->Set;
+    SIZE_T i;
+
+    for (i = Range->First; i < Range->Last; ++i) {
+        Set->Statuses[i] = Range->Proc(Range->BitsPerChar,
+            Set->Input + Set->Offsets[i], Set->Lengths[i], Set->Output + Set->Offsets[i]);
+    }
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRBatchRun(const LIBMSRTRACKSET *pSet, UINT BitsPerChar, UINT ThreadCount, MSRRECORDPROC Proc)
+{
+    MSRBATCHRANGE Ranges[MSR_BATCH_MAX_THREADS];
+    MSRTHREAD Threads[MSR_BATCH_MAX_THREADS];
+    BOOL Started[MSR_BATCH_MAX_THREADS];
+    SIZE_T PerThread;
+    UINT i;
+
+    if (BitsPerChar < 5 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    if (ThreadCount == 0) {
+        ThreadCount = _MSRCpuCount();
+    }
+    if (ThreadCount > MSR_BATCH_MAX_THREADS) {
+        ThreadCount = MSR_BATCH_MAX_THREADS;
+    }
+    if (ThreadCount > pSet->Count) {
+        ThreadCount = pSet->Count ? (UINT)pSet->Count : 1;
+    }
+
+    /* Contiguous ranges keep each thread on its own stretch of memory */
+    PerThread = (pSet->Count + ThreadCount - 1) / ThreadCount;
+    for (i = 0; i < ThreadCount; ++i) {
+        Ranges[i].Set = pSet;
+        Ranges[i].Proc = Proc;
+        Ranges[i].BitsPerChar = BitsPerChar;
+        Ranges[i].First = i * PerThread < pSet->Count ? i * PerThread : pSet->Count;
+        Ranges[i].Last = Ranges[i].First + PerThread < pSet->Count ? Ranges[i].First + PerThread : pSet->Count;
+    }
+
+    /* The calling thread takes the first range; a thread that fails to start is done inline */
+    for (i = 1; i < ThreadCount; ++i) {
+        Started[i] = _MSRThreadCreate(_MSRBatchWorker, &Ranges[i], &Threads[i]) >= 0;
+    }
+    _MSRBatchWorker(&Ranges[0]);
+    for (i = 1; i < ThreadCount; ++i) {
+        if (Started[i]) {
+            _MSRThreadJoin(Threads[i]);
+        }
+        else {
+            _MSRBatchWorker(&Ranges[i]);
+        }
+    }
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRBatchDecode(const LIBMSRTRACKSET *pSet, UINT BitsPerChar, UINT ThreadCount)
+{
+    return _MSRBatchRun(pSet, BitsPerChar, ThreadCount, _MSRDecodeRecord);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRBatchEncode(const LIBMSRTRACKSET *pSet, UINT BitsPerChar, UINT ThreadCount)
+{
+    return _MSRBatchRun(pSet, BitsPerChar, ThreadCount, _MSREncodeRecord);
+}
@@ -0,0 +1,287 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+/* Start and end sentinels of the ISO character sets, as data values without parity */
+#define MSR_ISO5_START 0x0B     /* ';' */
+#define MSR_ISO7_START 0x05     /* '%' */
+#define MSR_ISO5_END 0x0F       /* '?' */
+#define MSR_ISO7_END 0x1F       /* '?' */
+
+/* A view of a bitstream in swipe order; reversed streams are read from the far end */
+typedef struct {
+    const BYTE *Bits;
+    SIZE_T BitCount;
+    BOOL Reverse;
+} MSRBITCURSOR;
+
+static UINT _MSRBitAt(const MSRBITCURSOR *Cursor, SIZE_T Pos)
+{
+    if (Cursor->Reverse) {
+        Pos = Cursor->BitCount - 1 - Pos;
+    }
+    return (Cursor->Bits[Pos >> 3] >> (7 - (Pos & 7))) & 1;
+}
+
+/* Character starting at Pos, first bit in bit 0 like the device writes it */
+static BYTE _MSRCharAt(const MSRBITCURSOR *Cursor, SIZE_T Pos, UINT BitsPerChar)
+{
+    BYTE Value = 0;
+    UINT i;
+
+    for (i = 0; i < BitsPerChar; ++i) {
+        Value |= _MSRBitAt(Cursor, Pos + i) << i;
+    }
+    return Value;
+}
+
+/* Skip the blank media before the data; returns BitCount if the rest is all zeros */
+static SIZE_T _MSRFirstOne(const MSRBITCURSOR *Cursor, SIZE_T Pos)
+{
+    SIZE_T Phys;
+
+    while (Pos < Cursor->BitCount) {
+        Phys = Cursor->Reverse ? Cursor->BitCount - 1 - Pos : Pos;
+        if (Cursor->Bits[Phys >> 3] == 0) {
+            /* Step over the rest of a zero byte at once */
+            Pos += Cursor->Reverse ? (Phys & 7) + 1 : 8 - (Phys & 7);
+            continue;
+        }
+        if (_MSRBitAt(Cursor, Pos)) {
+            return Pos;
+        }
+        Pos++;
+    }
+    return Cursor->BitCount;
+}
+
+static SIZE_T _MSRFindChar(const MSRBITCURSOR *Cursor, SIZE_T Pos, UINT BitsPerChar, BYTE Char)
+{
+    BYTE Mask = (BYTE)((1 << BitsPerChar) - 1);
+    BYTE Window = 0;
+    SIZE_T Filled = 0;
+    SIZE_T First;
+
+    /* Every character with odd parity has a one bit, so nothing can end before the first one */
+    First = _MSRFirstOne(Cursor, Pos);
+    if (First >= Cursor->BitCount) {
+        return Cursor->BitCount;
+    }
+    if (First >= Pos + BitsPerChar - 1) {
+        Pos = First - (BitsPerChar - 1);
+    }
+    /* Window holds the last BitsPerChar bits, the newest in the top bit */
+    for (; Pos < Cursor->BitCount; ++Pos) {
+        Window = (BYTE)((Window >> 1) | (_MSRBitAt(Cursor, Pos) << (BitsPerChar - 1))) & Mask;
+        if (++Filled >= BitsPerChar && Window == Char) {
+            return Pos + 1 - BitsPerChar;
+        }
+    }
+    return Cursor->BitCount;
+}
+
+static BYTE _MSRAddParity(BYTE Value, UINT BitsPerChar)
+{
+    return Value | (ComputeParity(Value) << (BitsPerChar - 1));
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRBitsFromRaw(UINT BitsPerChar, const BYTE *Source, SIZE_T SourceLen, BYTE *Bits, SIZE_T *pBitCount)
+{
+    SIZE_T BitCount = 0;
+    SIZE_T i;
+    UINT j;
+
+    if (BitsPerChar < 1 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    if (BitsPerChar == 8) {
+        memmove(Bits, Source, SourceLen);
+        *pBitCount = SourceLen * 8;
+        return LIBMSR_OK;
+    }
+    for (i = 0; i < SourceLen; ++i) {
+        BYTE Raw = Source[i];
+
+        /* The first bit of a raw character is its top bit */
+        for (j = BitsPerChar; j-- > 0; ++BitCount) {
+            if (!(BitCount & 7)) {
+                Bits[BitCount >> 3] = 0;
+            }
+            Bits[BitCount >> 3] |= ((Raw >> j) & 1) << (7 - (BitCount & 7));
+        }
+    }
+    *pBitCount = BitCount;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRBitsReverse(const BYTE *Bits, SIZE_T BitCount, BYTE *Dest)
+{
+    MSRBITCURSOR Cursor;
+    SIZE_T i;
+
+    Cursor.Bits = Bits;
+    Cursor.BitCount = BitCount;
+    Cursor.Reverse = TRUE;
+    if (Bits == Dest) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    memset(Dest, 0, (BitCount + 7) >> 3);
+    for (i = 0; i < BitCount; ++i) {
+        Dest[i >> 3] |= _MSRBitAt(&Cursor, i) << (7 - (i & 7));
+    }
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRBitsFindChar(const BYTE *Bits, SIZE_T BitCount, SIZE_T StartBit,
+    UINT BitsPerChar, BYTE Value, BOOL Reverse, SIZE_T *pOffset)
+{
+    MSRBITCURSOR Cursor;
+    SIZE_T Offset;
+
+    if (BitsPerChar < 2 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Cursor.Bits = Bits;
+    Cursor.BitCount = BitCount;
+    Cursor.Reverse = Reverse;
+    Offset = _MSRFindChar(&Cursor, StartBit, BitsPerChar, _MSRAddParity(Value, BitsPerChar));
+    if (Offset >= BitCount) {
+        return LIBMSR_SENTINEL_NOT_FOUND;
+    }
+    *pOffset = Offset;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRBitsFrame(const BYTE *Bits, SIZE_T BitCount, SIZE_T Offset,
+    UINT BitsPerChar, BOOL Reverse, BYTE *Dest, SIZE_T *pCount)
+{
+    MSRBITCURSOR Cursor;
+    SIZE_T Count = 0;
+
+    if (BitsPerChar < 1 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Cursor.Bits = Bits;
+    Cursor.BitCount = BitCount;
+    Cursor.Reverse = Reverse;
+    for (; Offset + BitsPerChar <= BitCount; Offset += BitsPerChar) {
+        Dest[Count++] = _MSRCharAt(&Cursor, Offset, BitsPerChar);
+    }
+    *pCount = Count;
+    return LIBMSR_OK;
+}
+
+/* Decode one direction of a track into Dest; see MSRBitsDecodeTrack. */
+static LIBMSRSTATUS _MSRBitsDecode(const MSRBITCURSOR *Cursor, UINT BitsPerChar, BYTE *Dest, SIZE_T DestSize, SIZE_T *pLength)
+{
+    BYTE DataMask = (BYTE)((1 << (BitsPerChar - 1)) - 1);
+    BYTE Base = BitsPerChar == 5 ? 0x30 : BitsPerChar == 7 ? 0x20 : 0;
+    BYTE End = BitsPerChar == 5 ? MSR_ISO5_END : MSR_ISO7_END;
+    BOOL IsIso = Base != 0;
+    BOOL ParityError = FALSE;
+    BYTE Lrc = 0;
+    BYTE Char;
+    SIZE_T Length = 0;
+    SIZE_T Pos;
+
+    if (IsIso) {
+        Pos = _MSRFindChar(Cursor, 0, BitsPerChar, _MSRAddParity(BitsPerChar == 5 ? MSR_ISO5_START : MSR_ISO7_START, BitsPerChar));
+    }
+    else {
+        Pos = _MSRFirstOne(Cursor, 0);
+    }
+    if (Pos >= Cursor->BitCount) {
+        return LIBMSR_SENTINEL_NOT_FOUND;
+    }
+
+    for (;; Pos += BitsPerChar) {
+        if (Pos + BitsPerChar > Cursor->BitCount) {
+            /* Ran off the end without seeing the end of the data */
+            return LIBMSR_SENTINEL_NOT_FOUND;
+        }
+        Char = _MSRCharAt(Cursor, Pos, BitsPerChar);
+        if (!IsIso && Char == 0) {
+            /* Without sentinels, the data ends at blank media and the LRC is the last character */
+            if (Length == 0) {
+                return LIBMSR_SENTINEL_NOT_FOUND;
+            }
+            Length--;
+            break;
+        }
+        if (_MSRAddParity(Char & DataMask, BitsPerChar) != Char) {
+            ParityError = TRUE;
+        }
+        Lrc ^= Char & DataMask;
+        if (Length + 1 >= DestSize) {
+            return LIBMSR_BUFFER_TOO_SMALL;
+        }
+        Dest[Length++] = (Char & DataMask) + Base;
+        if (IsIso && (Char & DataMask) == End) {
+            Pos += BitsPerChar;
+            if (Pos + BitsPerChar > Cursor->BitCount) {
+                return LIBMSR_SENTINEL_NOT_FOUND;
+            }
+            Char = _MSRCharAt(Cursor, Pos, BitsPerChar);
+            if (_MSRAddParity(Char & DataMask, BitsPerChar) != Char) {
+                ParityError = TRUE;
+            }
+            Lrc ^= Char & DataMask;
+            break;
+        }
+    }
+    Dest[Length] = 0x00;
+    *pLength = Length;
+
+    if (ParityError) {
+        return LIBMSR_PARITY_ERROR;
+    }
+    if (Lrc != 0) {
+        return LIBMSR_LRC_ERROR;
+    }
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRBitsDecodeTrack(const BYTE *Bits, SIZE_T BitCount, UINT BitsPerChar, UINT Directions,
+    BYTE *Dest, SIZE_T DestSize, SIZE_T *pLength, UINT *pDirection)
+{
+    MSRBITCURSOR Cursor;
+    LIBMSRSTATUS Status = LIBMSR_SENTINEL_NOT_FOUND;
+    LIBMSRSTATUS FirstStatus = LIBMSR_SENTINEL_NOT_FOUND;
+    UINT FirstDirection = 0;
+    UINT LastDirection = 0;
+    UINT Direction;
+
+    if (BitsPerChar < 5 || BitsPerChar > 8 || !(Directions & (LIBMSR_BITS_FORWARD | LIBMSR_BITS_REVERSE))) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Cursor.Bits = Bits;
+    Cursor.BitCount = BitCount;
+
+    for (Direction = LIBMSR_BITS_FORWARD; Direction <= LIBMSR_BITS_REVERSE; Direction <<= 1) {
+        if (!(Directions & Direction)) {
+            continue;
+        }
+        Cursor.Reverse = Direction == LIBMSR_BITS_REVERSE;
+        Status = _MSRBitsDecode(&Cursor, BitsPerChar, Dest, DestSize, pLength);
+        LastDirection = Direction;
+        if (Status >= 0) {
+            *pDirection = Direction;
+            return Status;
+        }
+        /* Remember the first direction that found data, in case neither decodes cleanly */
+        if (!FirstDirection && (Status == LIBMSR_PARITY_ERROR || Status == LIBMSR_LRC_ERROR)) {
+            FirstDirection = Direction;
+            FirstStatus = Status;
+        }
+    }
+    if (FirstDirection && FirstDirection != LastDirection) {
+        Cursor.Reverse = FirstDirection == LIBMSR_BITS_REVERSE;
+        FirstStatus = _MSRBitsDecode(&Cursor, BitsPerChar, Dest, DestSize, pLength);
+    }
+    if (FirstDirection) {
+        *pDirection = FirstDirection;
+        return FirstStatus;
+    }
+    return Status;
+}
@@ -0,0 +1,346 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <tchar.h>
+#else
+#define _tfopen fopen
+#endif
+
+/*** Recorder ***/
+
+typedef struct {
+    const LIBMSRTRANSPORT *Inner;
+    void *InnerPort;
+    FILE *File;
+    MSRTIME Start;
+} MSRRECORDER, *LPMSRRECORDER;
+
+static void _MSRCaptureEvent(LPMSRRECORDER Recorder, BYTE Kind, const void *Data, SIZE_T Length)
+{
+    LIBMSRCAPTUREEVENT Event;
+
+    memset(&Event, 0, sizeof(Event));
+    Event.TimeMs = (UINT)(_MSRGetTime() - Recorder->Start);
+    Event.Kind = Kind;
+    Event.Length = (UINT)Length;
+    fwrite(&Event, sizeof(Event), 1, Recorder->File);
+    fwrite(Data, 1, Length, Recorder->File);
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRecorderRead(void *Port, BYTE *Buffer, SIZE_T Count, UINT TimeoutMs, SIZE_T *pBytesRead)
+{
+    LPMSRRECORDER Recorder = (LPMSRRECORDER)Port;
+    LIBMSRSTATUS Status;
+
+    Status = Recorder->Inner->Read(Recorder->InnerPort, Buffer, Count, TimeoutMs, pBytesRead);
+    if (Status < 0) {
+        _MSRCaptureEvent(Recorder, LIBMSR_CAPTURE_ERROR, &Status, sizeof(Status));
+    }
+    else {
+        _MSRCaptureEvent(Recorder, LIBMSR_CAPTURE_READ, Buffer, *pBytesRead);
+    }
+    return Status;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRecorderWrite(void *Port, const BYTE *Buffer, SIZE_T Count, SIZE_T *pBytesWritten)
+{
+    LPMSRRECORDER Recorder = (LPMSRRECORDER)Port;
+    LIBMSRSTATUS Status;
+
+    Status = Recorder->Inner->Write(Recorder->InnerPort, Buffer, Count, pBytesWritten);
+    if (Status < 0) {
+        _MSRCaptureEvent(Recorder, LIBMSR_CAPTURE_ERROR, &Status, sizeof(Status));
+    }
+    else {
+        _MSRCaptureEvent(Recorder, LIBMSR_CAPTURE_WRITE, Buffer, *pBytesWritten);
+    }
+    return Status;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRecorderPurge(void *Port)
+{
+    LPMSRRECORDER Recorder = (LPMSRRECORDER)Port;
+
+    return Recorder->Inner->Purge(Recorder->InnerPort);
+}
+
+static void LIBMSRDECL _MSRRecorderClose(void *Port)
+{
+    LPMSRRECORDER Recorder = (LPMSRRECORDER)Port;
+
+    Recorder->Inner->Close(Recorder->InnerPort);
+    fclose(Recorder->File);
+    _MSRFree(Recorder);
+}
+
+static int LIBMSRDECL _MSRRecorderGetFd(void *Port)
+{
+    LPMSRRECORDER Recorder = (LPMSRRECORDER)Port;
+
+    return Recorder->Inner->GetFd ? Recorder->Inner->GetFd(Recorder->InnerPort) : -1;
+}
+
+static const LIBMSRTRANSPORT _MSRRecorderTransport = {
+    _MSRRecorderRead,
+    _MSRRecorderWrite,
+    _MSRRecorderPurge,
+    _MSRRecorderClose,
+    _MSRRecorderGetFd,
+};
+
+LIBMSRSTATUS LIBMSRAPI MSRCaptureWrap(LPTSTR CapturePath, const LIBMSRTRANSPORT *Inner, void *InnerPort,
+    const LIBMSRTRANSPORT **pTransport, void **pPort)
+{
+    LPMSRRECORDER Recorder;
+    LIBMSRCAPTUREHEADER Header;
+
+    Recorder = _MSRAlloc(sizeof(*Recorder));
+    if (!Recorder) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Recorder->File = _tfopen(CapturePath, TEXT("wb"));
+    if (!Recorder->File) {
+        _MSRFree(Recorder);
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    Header.Magic = LIBMSR_CAPTURE_MAGIC;
+    Header.Version = LIBMSR_CAPTURE_VERSION;
+    fwrite(&Header, sizeof(Header), 1, Recorder->File);
+    Recorder->Inner = Inner;
+    Recorder->InnerPort = InnerPort;
+    Recorder->Start = _MSRGetTime();
+    *pTransport = &_MSRRecorderTransport;
+    *pPort = Recorder;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSROpenRecorded(LPTSTR PortName, LPTSTR CapturePath, LIBMSRHANDLE *pHandle)
+{
+    LIBMSRSTATUS Status;
+    const LIBMSRTRANSPORT *Transport;
+    const LIBMSRTRANSPORT *Recorder;
+    void *Port;
+    void *RecorderPort;
+
+    Status = _MSRSerialOpen(PortName, &Transport, &Port);
+    if (Status < 0) {
+        return Status;
+    }
+    Status = MSRCaptureWrap(CapturePath, Transport, Port, &Recorder, &RecorderPort);
+    if (Status < 0) {
+        Transport->Close(Port);
+        return Status;
+    }
+    Status = MSROpenTransport(Recorder, RecorderPort, pHandle);
+    if (Status < 0) {
+        Recorder->Close(RecorderPort);
+    }
+    return Status;
+}
+
+/*** Replay ***/
+
+typedef struct {
+    const BYTE *Capture;
+    SIZE_T Length;
+    /* Set if the capture was loaded by the library and is freed with the handle */
+    BYTE *Owned;
+    /* Next event, and how much of its data has been used */
+    SIZE_T Position;
+    SIZE_T Used;
+} MSRREPLAY, *LPMSRREPLAY;
+
+/* Copy out the current event; FALSE at the end of the capture.
+ * Events sit at any offset in the buffer, so they are never read in place.
+ */
+static BOOL _MSRReplayEvent(LPMSRREPLAY Replay, LIBMSRCAPTUREEVENT *Event)
+{
+    for (;;) {
+        if (Replay->Length - Replay->Position < sizeof(LIBMSRCAPTUREEVENT)) {
+            return FALSE;
+        }
+        memcpy(Event, Replay->Capture + Replay->Position, sizeof(LIBMSRCAPTUREEVENT));
+        if (Event->Length > Replay->Length - Replay->Position - sizeof(LIBMSRCAPTUREEVENT)) {
+            return FALSE;
+        }
+        /* Empty reads and writes carry nothing to replay */
+        if (Event->Length > 0 || Event->Kind == LIBMSR_CAPTURE_ERROR) {
+            return TRUE;
+        }
+        Replay->Position += sizeof(LIBMSRCAPTUREEVENT);
+    }
+}
+
+/* Data of the current event not used yet */
+static const BYTE *_MSRReplayData(LPMSRREPLAY Replay)
+{
+    return Replay->Capture + Replay->Position + sizeof(LIBMSRCAPTUREEVENT) + Replay->Used;
+}
+
+static void _MSRReplayConsume(LPMSRREPLAY Replay, const LIBMSRCAPTUREEVENT *Event, SIZE_T Count)
+{
+    Replay->Used += Count;
+    if (Replay->Used >= Event->Length) {
+        Replay->Position += sizeof(LIBMSRCAPTUREEVENT) + Event->Length;
+        Replay->Used = 0;
+    }
+}
+
+static LIBMSRSTATUS _MSRReplayError(LPMSRREPLAY Replay, const LIBMSRCAPTUREEVENT *Event)
+{
+    LIBMSRSTATUS Status = LIBMSR_FILE_CORRUPT;
+
+    if (Event->Length == sizeof(Status)) {
+        memcpy(&Status, _MSRReplayData(Replay), sizeof(Status));
+    }
+    _MSRReplayConsume(Replay, Event, Event->Length);
+    return Status;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRReplayRead(void *Port, BYTE *Buffer, SIZE_T Count, UINT TimeoutMs, SIZE_T *pBytesRead)
+{
+    LPMSRREPLAY Replay = (LPMSRREPLAY)Port;
+    LIBMSRCAPTUREEVENT Event;
+
+    /* Timing is not replayed; a read that timed out is an event of its own */
+    (void)TimeoutMs;
+    if (!_MSRReplayEvent(Replay, &Event) || Event.Kind == LIBMSR_CAPTURE_WRITE) {
+        /* The device never sent anything more at this point */
+        return LIBMSR_TIMEOUT;
+    }
+    if (Event.Kind == LIBMSR_CAPTURE_ERROR) {
+        return _MSRReplayError(Replay, &Event);
+    }
+    /* Hand out the data in the chunks it was read in, so parsers see the same boundaries */
+    if (Count > Event.Length - Replay->Used) {
+        Count = Event.Length - Replay->Used;
+    }
+    memcpy(Buffer, _MSRReplayData(Replay), Count);
+    _MSRReplayConsume(Replay, &Event, Count);
+    *pBytesRead = Count;
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRReplayWrite(void *Port, const BYTE *Buffer, SIZE_T Count, SIZE_T *pBytesWritten)
+{
+    LPMSRREPLAY Replay = (LPMSRREPLAY)Port;
+    LIBMSRCAPTUREEVENT Event;
+    BOOL Found = _MSRReplayEvent(Replay, &Event);
+
+    if (Found && Event.Kind == LIBMSR_CAPTURE_ERROR) {
+        return _MSRReplayError(Replay, &Event);
+    }
+    /* The library must send what it sent when the capture was made */
+    if (!Found || Event.Kind != LIBMSR_CAPTURE_WRITE) {
+        return LIBMSR_REPLAY_MISMATCH;
+    }
+    if (Count > Event.Length - Replay->Used) {
+        Count = Event.Length - Replay->Used;
+    }
+    if (memcmp(Buffer, _MSRReplayData(Replay), Count)) {
+        return LIBMSR_REPLAY_MISMATCH;
+    }
+    _MSRReplayConsume(Replay, &Event, Count);
+    *pBytesWritten = Count;
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRReplayPurge(void *Port)
+{
+    /* Whatever a purge dropped was never read, so it is not in the capture */
+    (void)Port;
+    return LIBMSR_OK;
+}
+
+static void LIBMSRDECL _MSRReplayClose(void *Port)
+{
+    LPMSRREPLAY Replay = (LPMSRREPLAY)Port;
+
+    if (Replay->Owned) {
+        _MSRFree(Replay->Owned);
+    }
+    _MSRFree(Replay);
+}
+
+static const LIBMSRTRANSPORT _MSRReplayTransport = {
+    _MSRReplayRead,
+    _MSRReplayWrite,
+    _MSRReplayPurge,
+    _MSRReplayClose,
+    NULL,
+};
+
+static LIBMSRSTATUS _MSRReplayOpen(const BYTE *Capture, SIZE_T Length, BYTE *Owned, LIBMSRHANDLE *pHandle)
+{
+    LPMSRREPLAY Replay;
+    LIBMSRCAPTUREHEADER Header;
+    LIBMSRSTATUS Status;
+
+    if (Length < sizeof(Header)) {
+        return LIBMSR_FILE_CORRUPT;
+    }
+    memcpy(&Header, Capture, sizeof(Header));
+    if (Header.Magic != LIBMSR_CAPTURE_MAGIC || Header.Version != LIBMSR_CAPTURE_VERSION) {
+        return LIBMSR_FILE_CORRUPT;
+    }
+    Replay = _MSRAlloc(sizeof(*Replay));
+    if (!Replay) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Replay->Capture = Capture;
+    Replay->Length = Length;
+    Replay->Owned = Owned;
+    Replay->Position = sizeof(Header);
+    Status = MSROpenTransport(&_MSRReplayTransport, Replay, pHandle);
+    if (Status < 0) {
+        _MSRFree(Replay);
+    }
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSROpenReplayBuffer(const BYTE *Capture, SIZE_T Length, LIBMSRHANDLE *pHandle)
+{
+    return _MSRReplayOpen(Capture, Length, NULL, pHandle);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSROpenReplay(LPTSTR CapturePath, LIBMSRHANDLE *pHandle)
+{
+    FILE *File;
+    BYTE *Capture;
+    long Length;
+    LIBMSRSTATUS Status;
+
+    File = _tfopen(CapturePath, TEXT("rb"));
+    if (!File) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    if (fseek(File, 0, SEEK_END) < 0 || (Length = ftell(File)) < 0 || fseek(File, 0, SEEK_SET) < 0) {
+        Status = LIBMSR_FILE_IO_FAILED;
+        goto fail1;
+    }
+    Capture = _MSRAlloc(Length ? Length : 1);
+    if (!Capture) {
+        Status = LIBMSR_MEM_ALLOC_FAILED;
+        goto fail1;
+    }
+    if (fread(Capture, 1, Length, File) != (SIZE_T)Length) {
+        Status = LIBMSR_FILE_IO_FAILED;
+        goto fail2;
+    }
+    Status = _MSRReplayOpen(Capture, Length, Capture, pHandle);
+    if (Status < 0) {
+        goto fail2;
+    }
+    fclose(File);
+    return LIBMSR_OK;
+
+fail2:
+    _MSRFree(Capture);
+fail1:
+    fclose(File);
+    return Status;
+}
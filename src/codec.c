@@ -1,45 +1,468 @@
 #include "libmsr.h"
 #include "internals.h"
 
-LIBMSRSTATUS LIBMSRAPI ISO7811ToAscii(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+static const BYTE BitReverseTable[256] = {
+    0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
+    0x08, 0x88, 0x48, 0xC8, 0x28, 0xA8, 0x68, 0xE8, 0x18, 0x98, 0x58, 0xD8, 0x38, 0xB8, 0x78, 0xF8,
+    0x04, 0x84, 0x44, 0xC4, 0x24, 0xA4, 0x64, 0xE4, 0x14, 0x94, 0x54, 0xD4, 0x34, 0xB4, 0x74, 0xF4,
+    0x0C, 0x8C, 0x4C, 0xCC, 0x2C, 0xAC, 0x6C, 0xEC, 0x1C, 0x9C, 0x5C, 0xDC, 0x3C, 0xBC, 0x7C, 0xFC,
+    0x02, 0x82, 0x42, 0xC2, 0x22, 0xA2, 0x62, 0xE2, 0x12, 0x92, 0x52, 0xD2, 0x32, 0xB2, 0x72, 0xF2,
+    0x0A, 0x8A, 0x4A, 0xCA, 0x2A, 0xAA, 0x6A, 0xEA, 0x1A, 0x9A, 0x5A, 0xDA, 0x3A, 0xBA, 0x7A, 0xFA,
+    0x06, 0x86, 0x46, 0xC6, 0x26, 0xA6, 0x66, 0xE6, 0x16, 0x96, 0x56, 0xD6, 0x36, 0xB6, 0x76, 0xF6,
+    0x0E, 0x8E, 0x4E, 0xCE, 0x2E, 0xAE, 0x6E, 0xEE, 0x1E, 0x9E, 0x5E, 0xDE, 0x3E, 0xBE, 0x7E, 0xFE,
+    0x01, 0x81, 0x41, 0xC1, 0x21, 0xA1, 0x61, 0xE1, 0x11, 0x91, 0x51, 0xD1, 0x31, 0xB1, 0x71, 0xF1,
+    0x09, 0x89, 0x49, 0xC9, 0x29, 0xA9, 0x69, 0xE9, 0x19, 0x99, 0x59, 0xD9, 0x39, 0xB9, 0x79, 0xF9,
+    0x05, 0x85, 0x45, 0xC5, 0x25, 0xA5, 0x65, 0xE5, 0x15, 0x95, 0x55, 0xD5, 0x35, 0xB5, 0x75, 0xF5,
+    0x0D, 0x8D, 0x4D, 0xCD, 0x2D, 0xAD, 0x6D, 0xED, 0x1D, 0x9D, 0x5D, 0xDD, 0x3D, 0xBD, 0x7D, 0xFD,
+    0x03, 0x83, 0x43, 0xC3, 0x23, 0xA3, 0x63, 0xE3, 0x13, 0x93, 0x53, 0xD3, 0x33, 0xB3, 0x73, 0xF3,
+    0x0B, 0x8B, 0x4B, 0xCB, 0x2B, 0xAB, 0x6B, 0xEB, 0x1B, 0x9B, 0x5B, 0xDB, 0x3B, 0xBB, 0x7B, 0xFB,
+    0x07, 0x87, 0x47, 0xC7, 0x27, 0xA7, 0x67, 0xE7, 0x17, 0x97, 0x57, 0xD7, 0x37, 0xB7, 0x77, 0xF7,
+    0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF,
+};
+
+/* Returns the bit that makes the parity of x odd */
+BYTE ComputeParity(BYTE x)
+{
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return (x & 1) == 0;
+}
+
+/*** Track tables ***/
+
+/*
+ * MSRDecodeTrack and MSREncodeTrack map each byte through one table per BPC,
+ * built by the preprocessor from the definitions below.
+ * ISO character sets exist for 5 and 7 BPC; 6 and 8 BPC only strip or add parity.
+ */
+
+#define MSR_REV8(x) ((((x) & 0x01) << 7) | (((x) & 0x02) << 5) | (((x) & 0x04) << 3) | (((x) & 0x08) << 1) | \
+    (((x) & 0x10) >> 1) | (((x) & 0x20) >> 3) | (((x) & 0x40) >> 5) | (((x) & 0x80) >> 7))
+#define MSR_PARITY8(x) (((x) ^ ((x) >> 1) ^ ((x) >> 2) ^ ((x) >> 3) ^ ((x) >> 4) ^ ((x) >> 5) ^ ((x) >> 6) ^ ((x) >> 7)) & 1)
+#define MSR_ISO_BASE(bpc) ((bpc) == 5 ? 0x30 : (bpc) == 7 ? 0x20 : 0)
+
+/* Raw byte as read from the device, after bit reversal and alignment */
+#define MSR_RAW_CHAR(x, bpc) (MSR_REV8(x) >> (8 - (bpc)))
+#define MSR_DATA_MASK(bpc) ((1 << ((bpc) - 1)) - 1)
+
+/* Decoded character in bits 0-6; bit 7 is set on a parity error.
+ * All-zero characters are blank media (leading/trailing zeros), not errors.
+ */
+#define MSR_DECODE_ENTRY(x, bpc) (BYTE)(((MSR_RAW_CHAR(x, bpc) & MSR_DATA_MASK(bpc)) + MSR_ISO_BASE(bpc)) | \
+    ((MSR_RAW_CHAR(x, bpc) != 0 && !MSR_PARITY8(MSR_RAW_CHAR(x, bpc))) << 7))
+#define MSR_DECODE_PARITY_ERROR 0x80
+
+/* Character with its odd parity bit, ready for MSRCardWriteRaw */
+#define MSR_ENCODE_CHAR(x, bpc) (((x) - MSR_ISO_BASE(bpc)) & 0xFF)
+#define MSR_ENCODE_ENTRY(x, bpc) (BYTE)(MSR_ENCODE_CHAR(x, bpc) | ((!MSR_PARITY8(MSR_ENCODE_CHAR(x, bpc)) << ((bpc) - 1)) & 0xFF))
+
+#define MSR_TABLE4(F, x, bpc) F(x, bpc), F((x) + 1, bpc), F((x) + 2, bpc), F((x) + 3, bpc)
+#define MSR_TABLE16(F, x, bpc) MSR_TABLE4(F, x, bpc), MSR_TABLE4(F, (x) + 4, bpc), \
+    MSR_TABLE4(F, (x) + 8, bpc), MSR_TABLE4(F, (x) + 12, bpc)
+#define MSR_TABLE64(F, x, bpc) MSR_TABLE16(F, x, bpc), MSR_TABLE16(F, (x) + 16, bpc), \
+    MSR_TABLE16(F, (x) + 32, bpc), MSR_TABLE16(F, (x) + 48, bpc)
+#define MSR_TABLE256(F, bpc) { MSR_TABLE64(F, 0, bpc), MSR_TABLE64(F, 64, bpc), \
+    MSR_TABLE64(F, 128, bpc), MSR_TABLE64(F, 192, bpc) }
+
+/* Indexed by BPC - 5 */
+static const BYTE DecodeTables[4][256] = {
+    MSR_TABLE256(MSR_DECODE_ENTRY, 5),
+    MSR_TABLE256(MSR_DECODE_ENTRY, 6),
+    MSR_TABLE256(MSR_DECODE_ENTRY, 7),
+    MSR_TABLE256(MSR_DECODE_ENTRY, 8),
+};
+
+static const BYTE EncodeTables[4][256] = {
+    MSR_TABLE256(MSR_ENCODE_ENTRY, 5),
+    MSR_TABLE256(MSR_ENCODE_ENTRY, 6),
+    MSR_TABLE256(MSR_ENCODE_ENTRY, 7),
+    MSR_TABLE256(MSR_ENCODE_ENTRY, 8),
+};
+
+/* Non-zero where a character that is not blank has even parity */
+#define MSR_BAD_PARITY_ENTRY(x, bpc) (BYTE)((x) != 0 && !MSR_PARITY8(x))
+static const BYTE BadParityTable[256] = MSR_TABLE256(MSR_BAD_PARITY_ENTRY, 0);
+
+/*** Scalar kernels ***/
+
+static void LIBMSRDECL _MSRUnpackScalar(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
 {
     BYTE CharMask = (1 << (BitsPerChar - 1)) - 1;
-    while (SourceLen-- > 0) {
+    UINT Shift = 8 - BitsPerChar;
+
+    while (Length-- > 0) {
+        *Dest++ = (BitReverseTable[*Source++] >> Shift) & CharMask;
+    }
+}
+
+static void LIBMSRDECL _MSRPackScalar(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    while (Length-- > 0) {
         BYTE ch;
 
-        ch = (*Source++) & CharMask;
-        switch (BitsPerChar) {
-        case 5:
-            ch = 0x30 + ch;
-            break;
-        case 7:
-            ch = 0x20 + ch;
-            break;
-        default:
-            return LIBMSR_INVALID_ARGUMENT;
-        }
+        ch = *Source++;
+        ch |= ComputeParity(ch) << (BitsPerChar - 1);
         *Dest++ = ch;
     }
+}
+
+static void LIBMSRDECL _MSRToAsciiScalar(BYTE CharMask, BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    while (Length-- > 0) {
+        *Dest++ = (*Source++ & CharMask) + Base;
+    }
+}
+
+static void LIBMSRDECL _MSRFromAsciiScalar(BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    while (Length-- > 0) {
+        *Dest++ = *Source++ - Base;
+    }
+}
+
+static SIZE_T LIBMSRDECL _MSRCheckScalar(BYTE CharBits, const BYTE *Source, SIZE_T Length, BYTE *pLrc)
+{
+    SIZE_T Bad = Length;
+    BYTE Lrc = 0;
+    SIZE_T i;
+
+    for (i = 0; i < Length; ++i) {
+        BYTE ch = Source[i] & CharBits;
+
+        if (Bad == Length && BadParityTable[ch]) {
+            Bad = i;
+        }
+        Lrc ^= ch;
+    }
+    *pLrc = Lrc;
+    return Bad;
+}
+
+const MSRCODECKERNELS _MSRCodecScalar = {
+    LIBMSR_CODEC_SCALAR,
+    _MSRUnpackScalar,
+    _MSRPackScalar,
+    _MSRToAsciiScalar,
+    _MSRFromAsciiScalar,
+    _MSRCheckScalar,
+};
+
+/*** Dispatch ***/
+
+static const MSRCODECKERNELS *_MSRCodec;
+
+static UINT LIBMSRDECL _MSRCodecBestLevel(void)
+{
+#ifdef MSR_CODEC_X86
+    UINT Level = _MSRCodecCpuLevel();
+
+#ifndef MSR_CODEC_AVX2
+    if (Level > LIBMSR_CODEC_SSSE3) {
+        Level = LIBMSR_CODEC_SSSE3;
+    }
+#endif
+    return Level;
+#else
+    return LIBMSR_CODEC_SCALAR;
+#endif
+}
+
+static const MSRCODECKERNELS *LIBMSRDECL _MSRCodecForLevel(UINT Level)
+{
+    switch (Level) {
+    case LIBMSR_CODEC_SCALAR:
+        return &_MSRCodecScalar;
+#ifdef MSR_CODEC_X86
+    case LIBMSR_CODEC_SSSE3:
+        return &_MSRCodecSsse3;
+#ifdef MSR_CODEC_AVX2
+    case LIBMSR_CODEC_AVX2:
+        return &_MSRCodecAvx2;
+#endif
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static const MSRCODECKERNELS *LIBMSRDECL _MSRGetCodec(void)
+{
+    /* Threads racing here all pick the same kernels, so no locking is needed */
+    if (!_MSRCodec) {
+        _MSRCodec = _MSRCodecForLevel(_MSRCodecBestLevel());
+    }
+    return _MSRCodec;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRSetCodecLevel(UINT Level)
+{
+    const MSRCODECKERNELS *Kernels;
+    UINT Best = _MSRCodecBestLevel();
+
+    if (Level == LIBMSR_CODEC_AUTO) {
+        Level = Best;
+    }
+    if (Level > Best) {
+        return LIBMSR_NOT_SUPPORTED;
+    }
+    Kernels = _MSRCodecForLevel(Level);
+    if (!Kernels) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    _MSRCodec = Kernels;
     return LIBMSR_OK;
 }
 
-LIBMSRSTATUS LIBMSRAPI AsciiToISO7811(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+LIBMSRSTATUS LIBMSRAPI MSRGetCodecLevel(UINT *pLevel)
 {
-    while (SourceLen-- > 0) {
-        BYTE ch;
+    *pLevel = _MSRGetCodec()->Level;
+    return LIBMSR_OK;
+}
 
-        ch = *Source++;
-        switch (BitsPerChar) {
-        case 5:
-            ch = ch - 0x30;
-            break;
-        case 7:
-            ch = ch - 0x20;
-            break;
-        default:
-            return LIBMSR_INVALID_ARGUMENT;
+/*** Public API ***/
+
+LIBMSRSTATUS LIBMSRAPI MSRUnpackData(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    if (BitsPerChar < 1 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    _MSRGetCodec()->Unpack(BitsPerChar, Source, SourceLen, Dest);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPackData(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    if (BitsPerChar < 1 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    _MSRGetCodec()->Pack(BitsPerChar, Source, SourceLen, Dest);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRDecodeTrack(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    const BYTE *Table;
+    BYTE Errors = 0;
+    SIZE_T i;
+
+    if (BitsPerChar < 5 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Table = DecodeTables[BitsPerChar - 5];
+    for (i = 0; i < SourceLen; ++i) {
+        BYTE Entry = Table[Source[i]];
+
+        Errors |= Entry;
+        Dest[i] = Entry & ~MSR_DECODE_PARITY_ERROR;
+    }
+    Dest[SourceLen] = 0x00;
+    return (Errors & MSR_DECODE_PARITY_ERROR) ? LIBMSR_PARITY_ERROR : LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSREncodeTrack(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    const BYTE *Table;
+    SIZE_T i;
+
+    if (BitsPerChar < 5 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Table = EncodeTables[BitsPerChar - 5];
+    for (i = 0; i < SourceLen; ++i) {
+        Dest[i] = Table[Source[i]];
+    }
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSREncodeTrackLrc(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    LIBMSRSTATUS Status;
+    BYTE Base;
+    BYTE Lrc;
+
+    Status = MSREncodeTrack(BitsPerChar, Source, SourceLen, Dest);
+    if (Status < 0) {
+        return Status;
+    }
+    /* Within the character set, x - Base and x ^ Base agree in the data bits,
+     * so the LRC follows from the XOR of the text; only the XOR is wanted here.
+     */
+    Base = MSR_ISO_BASE(BitsPerChar);
+    _MSRGetCodec()->Check(0xFF, Source, SourceLen, &Lrc);
+    if (SourceLen & 1) {
+        Lrc ^= Base;
+    }
+    Lrc &= MSR_DATA_MASK(BitsPerChar);
+    Dest[SourceLen] = EncodeTables[BitsPerChar - 5][(BYTE)(Lrc + Base)];
+    return LIBMSR_OK;
+}
+
+/* Raw characters keep the parity bit in bit 0 and the data bits, reversed, above it.
+ * Bit reversal does not change parity, and the XOR of reversed characters is the
+ * reversed XOR, so the checks work on the raw bytes as they are.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRValidateTrack(UINT BitsPerChar, const BYTE *Source, SIZE_T SourceLen, SIZE_T *pErrorIndex)
+{
+    const MSRCODECKERNELS *Codec;
+    const BYTE *Table;
+    LIBMSRSTATUS Status = LIBMSR_OK;
+    SIZE_T Index = SourceLen;
+    SIZE_T Start, End, Stop, Bad;
+    BYTE CharBits, Base;
+    BYTE Lrc, Ignored;
+
+    if (BitsPerChar < 5 || BitsPerChar > 8) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Codec = _MSRGetCodec();
+    Table = DecodeTables[BitsPerChar - 5];
+    CharBits = (BYTE)((1 << BitsPerChar) - 1);
+    Base = MSR_ISO_BASE(BitsPerChar);
+
+    /* Leading blank characters are not data */
+    for (Start = 0; Start < SourceLen && !(Source[Start] & CharBits); ++Start) {
+    }
+    /* At 5 and 7 BPC the LRC is the character after the end sentinel */
+    End = SourceLen;
+    Stop = SourceLen;
+    if (Base) {
+        for (End = Start; End < SourceLen && (Table[Source[End]] & ~MSR_DECODE_PARITY_ERROR) != '?'; ++End) {
         }
-        *Dest++ = ch;
+        if (End + 1 < SourceLen) {
+            Stop = End + 2;
+        }
+    }
+
+    Bad = Start + Codec->Check(CharBits, Source + Start, Stop - Start, &Lrc);
+    if (Bad == Stop && Stop < SourceLen) {
+        Bad = Stop + Codec->Check(CharBits, Source + Stop, SourceLen - Stop, &Ignored);
+    }
+    if (Bad < SourceLen) {
+        Index = Bad;
+        Status = LIBMSR_PARITY_ERROR;
+    }
+    else if (Base) {
+        if (Start == SourceLen || Table[Source[Start]] != (BitsPerChar == 5 ? ';' : '%')) {
+            Index = Start;
+            Status = LIBMSR_SENTINEL_NOT_FOUND;
+        }
+        else if (End + 1 >= SourceLen) {
+            /* No end sentinel, or nothing after it */
+            Status = LIBMSR_SENTINEL_NOT_FOUND;
+        }
+        else if (Lrc & CharBits & ~1) {
+            Index = End + 1;
+            Status = LIBMSR_LRC_ERROR;
+        }
+    }
+    else if (Lrc & CharBits & ~1) {
+        /* Without sentinels, the last character that is not blank is the LRC */
+        for (Index = SourceLen - 1; !(Source[Index] & CharBits); --Index) {
+        }
+        Status = LIBMSR_LRC_ERROR;
+    }
+
+    if (pErrorIndex) {
+        *pErrorIndex = Index;
+    }
+    return Status;
+}
+
+/* Decode one stored raw track without terminating it, checking parity and,
+ * for the ISO character sets, the sentinels and the LRC.
+ */
+LIBMSRSTATUS LIBMSRDECL _MSRDecodeRecord(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const BYTE *Table = DecodeTables[BitsPerChar - 5];
+    BYTE Base = MSR_ISO_BASE(BitsPerChar);
+    BYTE CharBits = (BYTE)((1 << BitsPerChar) - 1);
+    BYTE Errors = 0;
+    BYTE Lrc = 0;
+    SIZE_T Start;
+    SIZE_T i;
+
+    /* Leading blank characters are not data, as in MSRValidateTrack. Dest may be
+     * Source, so find them before decoding.
+     */
+    for (Start = 0; Start < Length && !(Source[Start] & CharBits); ++Start) {
+    }
+    for (i = 0; i < Length; ++i) {
+        BYTE Entry = Table[Source[i]];
+
+        Errors |= Entry;
+        Dest[i] = Entry & ~MSR_DECODE_PARITY_ERROR;
+    }
+    if (Base) {
+        if (Start == Length || Dest[Start] != (BitsPerChar == 5 ? ';' : '%')) {
+            return LIBMSR_SENTINEL_NOT_FOUND;
+        }
+        /* The LRC character makes the XOR of everything up to and including it zero */
+        for (i = Start; i < Length && Dest[i] != '?'; ++i) {
+            Lrc ^= Dest[i] - Base;
+        }
+        if (i + 1 >= Length) {
+            return LIBMSR_SENTINEL_NOT_FOUND;
+        }
+        Lrc ^= (Dest[i] - Base) ^ (Dest[i + 1] - Base);
+    }
+    if (Errors & MSR_DECODE_PARITY_ERROR) {
+        return LIBMSR_PARITY_ERROR;
+    }
+    return Lrc ? LIBMSR_LRC_ERROR : LIBMSR_OK;
+}
+
+/* Encode one track of text, flagging characters outside the character set. */
+LIBMSRSTATUS LIBMSRDECL _MSREncodeRecord(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const BYTE *Table = EncodeTables[BitsPerChar - 5];
+    BYTE Base = MSR_ISO_BASE(BitsPerChar);
+    BYTE OutOfRange = 0;
+    SIZE_T i;
+
+    for (i = 0; i < Length; ++i) {
+        OutOfRange |= (BYTE)(Source[i] - Base) >> (BitsPerChar - 1);
+        Dest[i] = Table[Source[i]];
+    }
+    return OutOfRange ? LIBMSR_CHARSET_ERROR : LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRIsoBase(UINT BitsPerChar, BYTE *pBase)
+{
+    switch (BitsPerChar) {
+    case 5:
+        *pBase = 0x30;
+        return LIBMSR_OK;
+    case 7:
+        *pBase = 0x20;
+        return LIBMSR_OK;
+    default:
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+}
+
+LIBMSRSTATUS LIBMSRAPI ISO7811ToAscii(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    LIBMSRSTATUS Status;
+    BYTE Base;
+
+    Status = _MSRIsoBase(BitsPerChar, &Base);
+    if (Status < 0) {
+        return Status;
+    }
+    _MSRGetCodec()->ToAscii((1 << (BitsPerChar - 1)) - 1, Base, Source, SourceLen, Dest);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI AsciiToISO7811(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    LIBMSRSTATUS Status;
+    BYTE Base;
+
+    Status = _MSRIsoBase(BitsPerChar, &Base);
+    if (Status < 0) {
+        return Status;
     }
+    _MSRGetCodec()->FromAscii(Base, Source, SourceLen, Dest);
     return LIBMSR_OK;
 }
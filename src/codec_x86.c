@@ -0,0 +1,331 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#ifdef MSR_CODEC_X86
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MSR_TARGET(x)
+#else
+/* Lets the kernels use instructions the rest of the library is not compiled for */
+#define MSR_TARGET(x) __attribute__((target(x)))
+#endif
+
+/*
+ * Bit reversal and parity both work a nibble at a time through pshufb:
+ * each 16-entry table is indexed by the low and the high nibble of every byte.
+ */
+
+/* rev8(n) and rev8(n << 4) for each nibble n */
+#define MSR_REV_LO_NIBBLE 0x00, 0x80, 0x40, (char)0xC0, 0x20, (char)0xA0, 0x60, (char)0xE0, \
+    0x10, (char)0x90, 0x50, (char)0xD0, 0x30, (char)0xB0, 0x70, (char)0xF0
+#define MSR_REV_HI_NIBBLE 0x00, 0x08, 0x04, 0x0C, 0x02, 0x0A, 0x06, 0x0E, \
+    0x01, 0x09, 0x05, 0x0D, 0x03, 0x0B, 0x07, 0x0F
+/* All ones where the nibble has an odd number of bits set */
+#define MSR_ODD_NIBBLE 0, -1, -1, 0, -1, 0, 0, -1, -1, 0, 0, -1, 0, -1, -1, 0
+
+/* Index of the lowest set bit; Mask is not zero */
+static UINT _MSRLowestBit(UINT Mask)
+{
+    UINT Index = 0;
+
+    while (!(Mask & 1)) {
+        Mask >>= 1;
+        Index++;
+    }
+    return Index;
+}
+
+/*** SSSE3 ***/
+
+MSR_TARGET("ssse3")
+static void LIBMSRDECL _MSRUnpackSsse3(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m128i RevLo = _mm_setr_epi8(MSR_REV_LO_NIBBLE);
+    const __m128i RevHi = _mm_setr_epi8(MSR_REV_HI_NIBBLE);
+    const __m128i Nibble = _mm_set1_epi8(0x0F);
+    const __m128i CharMask = _mm_set1_epi8((char)((1 << (BitsPerChar - 1)) - 1));
+    const __m128i Shift = _mm_cvtsi32_si128(8 - BitsPerChar);
+    SIZE_T i;
+
+    for (i = 0; i + 16 <= Length; i += 16) {
+        __m128i Data = _mm_loadu_si128((const __m128i *)(Source + i));
+        __m128i Lo = _mm_and_si128(Data, Nibble);
+        __m128i Hi = _mm_and_si128(_mm_srli_epi16(Data, 4), Nibble);
+        __m128i Rev = _mm_or_si128(_mm_shuffle_epi8(RevLo, Lo), _mm_shuffle_epi8(RevHi, Hi));
+
+        /* Bits shifted in from the neighbouring byte land above the mask */
+        Rev = _mm_and_si128(_mm_srl_epi16(Rev, Shift), CharMask);
+        _mm_storeu_si128((__m128i *)(Dest + i), Rev);
+    }
+    _MSRCodecScalar.Unpack(BitsPerChar, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("ssse3")
+static void LIBMSRDECL _MSRPackSsse3(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m128i ParityBit = _mm_set1_epi8((char)(1 << (BitsPerChar - 1)));
+    const __m128i OddNibble = _mm_and_si128(_mm_setr_epi8(MSR_ODD_NIBBLE), ParityBit);
+    const __m128i Nibble = _mm_set1_epi8(0x0F);
+    SIZE_T i;
+
+    for (i = 0; i + 16 <= Length; i += 16) {
+        __m128i Data = _mm_loadu_si128((const __m128i *)(Source + i));
+        __m128i Lo = _mm_and_si128(Data, Nibble);
+        __m128i Hi = _mm_and_si128(_mm_srli_epi16(Data, 4), Nibble);
+        __m128i Parity = _mm_xor_si128(_mm_shuffle_epi8(OddNibble, Lo), _mm_shuffle_epi8(OddNibble, Hi));
+
+        /* Set the parity bit where the byte has an even number of bits set */
+        Data = _mm_or_si128(Data, _mm_xor_si128(Parity, ParityBit));
+        _mm_storeu_si128((__m128i *)(Dest + i), Data);
+    }
+    _MSRCodecScalar.Pack(BitsPerChar, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("ssse3")
+static void LIBMSRDECL _MSRToAsciiSsse3(BYTE CharMask, BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m128i Mask = _mm_set1_epi8((char)CharMask);
+    const __m128i Offset = _mm_set1_epi8((char)Base);
+    SIZE_T i;
+
+    for (i = 0; i + 16 <= Length; i += 16) {
+        __m128i Data = _mm_loadu_si128((const __m128i *)(Source + i));
+
+        _mm_storeu_si128((__m128i *)(Dest + i), _mm_add_epi8(_mm_and_si128(Data, Mask), Offset));
+    }
+    _MSRCodecScalar.ToAscii(CharMask, Base, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("ssse3")
+static void LIBMSRDECL _MSRFromAsciiSsse3(BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m128i Offset = _mm_set1_epi8((char)Base);
+    SIZE_T i;
+
+    for (i = 0; i + 16 <= Length; i += 16) {
+        __m128i Data = _mm_loadu_si128((const __m128i *)(Source + i));
+
+        _mm_storeu_si128((__m128i *)(Dest + i), _mm_sub_epi8(Data, Offset));
+    }
+    _MSRCodecScalar.FromAscii(Base, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("ssse3")
+static SIZE_T LIBMSRDECL _MSRCheckSsse3(BYTE CharBits, const BYTE *Source, SIZE_T Length, BYTE *pLrc)
+{
+    const __m128i OddNibble = _mm_setr_epi8(MSR_ODD_NIBBLE);
+    const __m128i Nibble = _mm_set1_epi8(0x0F);
+    const __m128i Bits = _mm_set1_epi8((char)CharBits);
+    const __m128i Zero = _mm_setzero_si128();
+    __m128i Lrc = _mm_setzero_si128();
+    SIZE_T Bad = Length;
+    SIZE_T Tail;
+    BYTE TailLrc;
+    UINT Errors;
+    SIZE_T i;
+
+    for (i = 0; i + 16 <= Length; i += 16) {
+        __m128i Data = _mm_and_si128(_mm_loadu_si128((const __m128i *)(Source + i)), Bits);
+        __m128i Lo = _mm_and_si128(Data, Nibble);
+        __m128i Hi = _mm_and_si128(_mm_srli_epi16(Data, 4), Nibble);
+        __m128i Odd = _mm_xor_si128(_mm_shuffle_epi8(OddNibble, Lo), _mm_shuffle_epi8(OddNibble, Hi));
+
+        /* Blank characters and ones with odd parity are fine */
+        Errors = ~(UINT)_mm_movemask_epi8(_mm_or_si128(Odd, _mm_cmpeq_epi8(Data, Zero))) & 0xFFFF;
+        if (Errors && Bad == Length) {
+            Bad = i + _MSRLowestBit(Errors);
+        }
+        Lrc = _mm_xor_si128(Lrc, Data);
+    }
+    Lrc = _mm_xor_si128(Lrc, _mm_srli_si128(Lrc, 8));
+    Lrc = _mm_xor_si128(Lrc, _mm_srli_si128(Lrc, 4));
+    Lrc = _mm_xor_si128(Lrc, _mm_srli_si128(Lrc, 2));
+    Lrc = _mm_xor_si128(Lrc, _mm_srli_si128(Lrc, 1));
+
+    Tail = _MSRCodecScalar.Check(CharBits, Source + i, Length - i, &TailLrc);
+    if (Bad == Length && Tail < Length - i) {
+        Bad = i + Tail;
+    }
+    *pLrc = (BYTE)_mm_cvtsi128_si32(Lrc) ^ TailLrc;
+    return Bad;
+}
+
+const MSRCODECKERNELS _MSRCodecSsse3 = {
+    LIBMSR_CODEC_SSSE3,
+    _MSRUnpackSsse3,
+    _MSRPackSsse3,
+    _MSRToAsciiSsse3,
+    _MSRFromAsciiSsse3,
+    _MSRCheckSsse3,
+};
+
+/*** AVX2 ***/
+
+#ifdef MSR_CODEC_AVX2
+
+/* pshufb works within 128-bit lanes, so the tables are repeated in both */
+
+MSR_TARGET("avx2")
+static void LIBMSRDECL _MSRUnpackAvx2(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m256i RevLo = _mm256_setr_epi8(MSR_REV_LO_NIBBLE, MSR_REV_LO_NIBBLE);
+    const __m256i RevHi = _mm256_setr_epi8(MSR_REV_HI_NIBBLE, MSR_REV_HI_NIBBLE);
+    const __m256i Nibble = _mm256_set1_epi8(0x0F);
+    const __m256i CharMask = _mm256_set1_epi8((char)((1 << (BitsPerChar - 1)) - 1));
+    const __m128i Shift = _mm_cvtsi32_si128(8 - BitsPerChar);
+    SIZE_T i;
+
+    for (i = 0; i + 32 <= Length; i += 32) {
+        __m256i Data = _mm256_loadu_si256((const __m256i *)(Source + i));
+        __m256i Lo = _mm256_and_si256(Data, Nibble);
+        __m256i Hi = _mm256_and_si256(_mm256_srli_epi16(Data, 4), Nibble);
+        __m256i Rev = _mm256_or_si256(_mm256_shuffle_epi8(RevLo, Lo), _mm256_shuffle_epi8(RevHi, Hi));
+
+        Rev = _mm256_and_si256(_mm256_srl_epi16(Rev, Shift), CharMask);
+        _mm256_storeu_si256((__m256i *)(Dest + i), Rev);
+    }
+    _MSRCodecSsse3.Unpack(BitsPerChar, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("avx2")
+static void LIBMSRDECL _MSRPackAvx2(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m256i ParityBit = _mm256_set1_epi8((char)(1 << (BitsPerChar - 1)));
+    const __m256i OddNibble = _mm256_and_si256(_mm256_setr_epi8(MSR_ODD_NIBBLE, MSR_ODD_NIBBLE), ParityBit);
+    const __m256i Nibble = _mm256_set1_epi8(0x0F);
+    SIZE_T i;
+
+    for (i = 0; i + 32 <= Length; i += 32) {
+        __m256i Data = _mm256_loadu_si256((const __m256i *)(Source + i));
+        __m256i Lo = _mm256_and_si256(Data, Nibble);
+        __m256i Hi = _mm256_and_si256(_mm256_srli_epi16(Data, 4), Nibble);
+        __m256i Parity = _mm256_xor_si256(_mm256_shuffle_epi8(OddNibble, Lo), _mm256_shuffle_epi8(OddNibble, Hi));
+
+        Data = _mm256_or_si256(Data, _mm256_xor_si256(Parity, ParityBit));
+        _mm256_storeu_si256((__m256i *)(Dest + i), Data);
+    }
+    _MSRCodecSsse3.Pack(BitsPerChar, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("avx2")
+static void LIBMSRDECL _MSRToAsciiAvx2(BYTE CharMask, BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m256i Mask = _mm256_set1_epi8((char)CharMask);
+    const __m256i Offset = _mm256_set1_epi8((char)Base);
+    SIZE_T i;
+
+    for (i = 0; i + 32 <= Length; i += 32) {
+        __m256i Data = _mm256_loadu_si256((const __m256i *)(Source + i));
+
+        _mm256_storeu_si256((__m256i *)(Dest + i), _mm256_add_epi8(_mm256_and_si256(Data, Mask), Offset));
+    }
+    _MSRCodecSsse3.ToAscii(CharMask, Base, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("avx2")
+static void LIBMSRDECL _MSRFromAsciiAvx2(BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest)
+{
+    const __m256i Offset = _mm256_set1_epi8((char)Base);
+    SIZE_T i;
+
+    for (i = 0; i + 32 <= Length; i += 32) {
+        __m256i Data = _mm256_loadu_si256((const __m256i *)(Source + i));
+
+        _mm256_storeu_si256((__m256i *)(Dest + i), _mm256_sub_epi8(Data, Offset));
+    }
+    _MSRCodecSsse3.FromAscii(Base, Source + i, Length - i, Dest + i);
+}
+
+MSR_TARGET("avx2")
+static SIZE_T LIBMSRDECL _MSRCheckAvx2(BYTE CharBits, const BYTE *Source, SIZE_T Length, BYTE *pLrc)
+{
+    const __m256i OddNibble = _mm256_setr_epi8(MSR_ODD_NIBBLE, MSR_ODD_NIBBLE);
+    const __m256i Nibble = _mm256_set1_epi8(0x0F);
+    const __m256i Bits = _mm256_set1_epi8((char)CharBits);
+    const __m256i Zero = _mm256_setzero_si256();
+    __m256i Lrc = _mm256_setzero_si256();
+    __m128i Fold;
+    SIZE_T Bad = Length;
+    SIZE_T Tail;
+    BYTE TailLrc;
+    UINT Errors;
+    SIZE_T i;
+
+    for (i = 0; i + 32 <= Length; i += 32) {
+        __m256i Data = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(Source + i)), Bits);
+        __m256i Lo = _mm256_and_si256(Data, Nibble);
+        __m256i Hi = _mm256_and_si256(_mm256_srli_epi16(Data, 4), Nibble);
+        __m256i Odd = _mm256_xor_si256(_mm256_shuffle_epi8(OddNibble, Lo), _mm256_shuffle_epi8(OddNibble, Hi));
+
+        Errors = ~(UINT)_mm256_movemask_epi8(_mm256_or_si256(Odd, _mm256_cmpeq_epi8(Data, Zero)));
+        if (Errors && Bad == Length) {
+            Bad = i + _MSRLowestBit(Errors);
+        }
+        Lrc = _mm256_xor_si256(Lrc, Data);
+    }
+    Fold = _mm_xor_si128(_mm256_castsi256_si128(Lrc), _mm256_extracti128_si256(Lrc, 1));
+    Fold = _mm_xor_si128(Fold, _mm_srli_si128(Fold, 8));
+    Fold = _mm_xor_si128(Fold, _mm_srli_si128(Fold, 4));
+    Fold = _mm_xor_si128(Fold, _mm_srli_si128(Fold, 2));
+    Fold = _mm_xor_si128(Fold, _mm_srli_si128(Fold, 1));
+
+    Tail = _MSRCodecSsse3.Check(CharBits, Source + i, Length - i, &TailLrc);
+    if (Bad == Length && Tail < Length - i) {
+        Bad = i + Tail;
+    }
+    *pLrc = (BYTE)_mm_cvtsi128_si32(Fold) ^ TailLrc;
+    return Bad;
+}
+
+const MSRCODECKERNELS _MSRCodecAvx2 = {
+    LIBMSR_CODEC_AVX2,
+    _MSRUnpackAvx2,
+    _MSRPackAvx2,
+    _MSRToAsciiAvx2,
+    _MSRFromAsciiAvx2,
+    _MSRCheckAvx2,
+};
+
+#endif /* MSR_CODEC_AVX2 */
+
+/*** CPU detection ***/
+
+UINT LIBMSRDECL _MSRCodecCpuLevel(void)
+{
+#ifdef _MSC_VER
+    int Info[4];
+    int MaxLeaf;
+    UINT Level = LIBMSR_CODEC_SCALAR;
+
+    __cpuid(Info, 0);
+    MaxLeaf = Info[0];
+    __cpuid(Info, 1);
+    if (Info[2] & (1 << 9)) {
+        Level = LIBMSR_CODEC_SSSE3;
+    }
+#ifdef MSR_CODEC_AVX2
+    /* AVX2 also needs the OS to save the YMM registers (OSXSAVE, AVX, XCR0 bits 1-2) */
+    if (MaxLeaf >= 7 && (Info[2] & (1 << 27)) && (Info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(Info, 7, 0);
+        if (Info[1] & (1 << 5)) {
+            Level = LIBMSR_CODEC_AVX2;
+        }
+    }
+#endif
+    return Level;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return LIBMSR_CODEC_AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return LIBMSR_CODEC_SSSE3;
+    }
+    return LIBMSR_CODEC_SCALAR;
+#endif
+}
+
+#endif /* MSR_CODEC_X86 */
@@ -0,0 +1,328 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define _MSRNameCompare(a, b) lstrcmp((a), (b))
+#define _MSRNameCopy(Dest, Source) lstrcpyn((Dest), (Source), LIBMSR_MAX_PORT_NAME)
+#else
+#define _MSRNameCompare(a, b) strcmp((a), (b))
+#define _MSRNameCopy(Dest, Source) (strncpy((Dest), (Source), LIBMSR_MAX_PORT_NAME - 1), (Dest)[LIBMSR_MAX_PORT_NAME - 1] = 0)
+#endif
+
+#define MSR_PROBE_DEFAULT_TIMEOUT 250
+#define MSR_PROBE_MAX_THREADS 64
+
+/*** Port listing ***/
+
+typedef struct {
+    LIBMSRPORTINFO *Ports;
+    UINT Capacity;
+    /* Ports seen, which may be more than fit */
+    UINT Count;
+} MSRPORTLIST;
+
+static void LIBMSRDECL _MSRPortListAdd(void *Context, LPTSTR PortName)
+{
+    MSRPORTLIST *List = (MSRPORTLIST *)Context;
+
+    if (List->Count < List->Capacity) {
+        memset(&List->Ports[List->Count], 0, sizeof(LIBMSRPORTINFO));
+        _MSRNameCopy(List->Ports[List->Count].PortName, PortName);
+    }
+    List->Count++;
+}
+
+static int _MSRPortCompare(const void *a, const void *b)
+{
+    return _MSRNameCompare(((const LIBMSRPORTINFO *)a)->PortName, ((const LIBMSRPORTINFO *)b)->PortName);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRListPorts(LIBMSRPORTINFO Ports[], UINT Capacity, UINT *pCount)
+{
+    MSRPORTLIST List;
+    LIBMSRSTATUS Status;
+    UINT Listed;
+
+    List.Ports = Ports;
+    List.Capacity = Capacity;
+    List.Count = 0;
+    Status = _MSRSerialEnumerate(_MSRPortListAdd, &List);
+    if (Status < 0) {
+        return Status;
+    }
+    /* Ports is NULL when the caller is only sizing the list */
+    Listed = List.Count < Capacity ? List.Count : Capacity;
+    if (Listed > 1) {
+        qsort(Ports, Listed, sizeof(LIBMSRPORTINFO), _MSRPortCompare);
+    }
+    *pCount = List.Count;
+    return List.Count > Capacity ? LIBMSR_BUFFER_TOO_SMALL : LIBMSR_OK;
+}
+
+/* List every port into a new array; the list may change between counting and listing */
+static LIBMSRSTATUS LIBMSRDECL _MSRListAllPorts(LIBMSRPORTINFO **pPorts, UINT *pCount)
+{
+    LIBMSRPORTINFO *Ports = NULL;
+    LIBMSRSTATUS Status;
+    UINT Capacity = 0;
+    UINT Count;
+
+    for (;;) {
+        Status = MSRListPorts(Ports, Capacity, &Count);
+        if (Status != LIBMSR_BUFFER_TOO_SMALL) {
+            break;
+        }
+        if (Ports) {
+            _MSRFree(Ports);
+        }
+        /* Some room for ports that show up meanwhile */
+        Capacity = Count + 8;
+        Ports = _MSRAlloc(Capacity * sizeof(LIBMSRPORTINFO));
+        if (!Ports) {
+            return LIBMSR_MEM_ALLOC_FAILED;
+        }
+    }
+    if (Status < 0) {
+        if (Ports) {
+            _MSRFree(Ports);
+        }
+        return Status;
+    }
+    *pPorts = Ports;
+    *pCount = Count;
+    return LIBMSR_OK;
+}
+
+/*** Probing ***/
+
+typedef struct {
+    LIBMSRPORTINFO *Ports;
+    UINT Count;
+    /* Index of the next port to probe */
+    UINT Next;
+    MSRLOCK Lock;
+    LIBMSRPROBEOPTIONS Options;
+} MSRPROBE;
+
+static void LIBMSRDECL _MSRProbeOne(LIBMSRPORTINFO *Port, const LIBMSRPROBEOPTIONS *Options)
+{
+    LIBMSRHANDLE Handle;
+    LIBMSRTIMEOUTS Saved;
+    LIBMSRTIMEOUTS Timeouts;
+    MSRTIME Start = _MSRGetTime();
+
+    Port->Model = 0;
+    Port->Handle = NULL;
+    Port->Status = MSROpen(Port->PortName, &Handle);
+    if (Port->Status < 0) {
+        goto done;
+    }
+
+    /* A port with nothing on it must not hold things up for the usual command timeout */
+    MSRGetTimeouts(Handle, &Saved);
+    Timeouts = Saved;
+    Timeouts.CommandMs = Options->TimeoutMs;
+    if (Timeouts.InterByteMs > Options->TimeoutMs) {
+        Timeouts.InterByteMs = Options->TimeoutMs;
+    }
+    MSRSetTimeouts(Handle, &Timeouts);
+
+    Port->Status = MSRReset(Handle);
+    if (Port->Status >= 0) {
+        Port->Status = MSRTestComms(Handle);
+    }
+    if (Port->Status >= 0 && !Options->SkipModel && MSRGetModel(Handle, &Port->Model) < 0) {
+        Port->Model = 0;
+    }
+
+    MSRSetTimeouts(Handle, &Saved);
+    if (Port->Status >= 0 && Options->KeepOpen) {
+        Port->Handle = Handle;
+    }
+    else {
+        MSRClose(Handle);
+    }
+
+done:
+    Port->ProbeTime = (UINT)(_MSRGetTime() - Start);
+}
+
+static void LIBMSRDECL _MSRProbeWorker(void *Arg)
+{
+    MSRPROBE *Probe = (MSRPROBE *)Arg;
+    UINT Index;
+
+    for (;;) {
+        _MSRLock(&Probe->Lock);
+        Index = Probe->Next++;
+        _MSRUnlock(&Probe->Lock);
+        if (Index >= Probe->Count) {
+            break;
+        }
+        _MSRProbeOne(&Probe->Ports[Index], &Probe->Options);
+    }
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRProbePorts(LIBMSRPORTINFO Ports[], UINT Count, const LIBMSRPROBEOPTIONS *pOptions)
+{
+    MSRPROBE Probe;
+    MSRTHREAD Threads[MSR_PROBE_MAX_THREADS];
+    UINT ThreadCount;
+    UINT Started;
+    UINT i;
+
+    memset(&Probe, 0, sizeof(Probe));
+    if (pOptions) {
+        Probe.Options = *pOptions;
+    }
+    if (!Probe.Options.TimeoutMs) {
+        Probe.Options.TimeoutMs = MSR_PROBE_DEFAULT_TIMEOUT;
+    }
+    ThreadCount = Probe.Options.MaxThreads && Probe.Options.MaxThreads < Count ? Probe.Options.MaxThreads : Count;
+    if (ThreadCount > MSR_PROBE_MAX_THREADS) {
+        ThreadCount = MSR_PROBE_MAX_THREADS;
+    }
+    Probe.Ports = Ports;
+    Probe.Count = Count;
+    _MSRLockInit(&Probe.Lock);
+
+    /* The calling thread probes too; if threads cannot be had, it does all the work */
+    Started = 0;
+    for (i = 1; i < ThreadCount; ++i) {
+        if (_MSRThreadCreate(_MSRProbeWorker, &Probe, &Threads[Started]) < 0) {
+            break;
+        }
+        Started++;
+    }
+    _MSRProbeWorker(&Probe);
+    for (i = 0; i < Started; ++i) {
+        _MSRThreadJoin(Threads[i]);
+    }
+
+    _MSRLockDelete(&Probe.Lock);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRDiscover(LIBMSRPORTINFO Ports[], UINT Capacity, UINT *pCount, const LIBMSRPROBEOPTIONS *pOptions)
+{
+    LIBMSRPORTINFO *All;
+    LIBMSRSTATUS Status;
+    UINT Listed;
+    UINT Found = 0;
+    UINT i;
+
+    Status = _MSRListAllPorts(&All, &Listed);
+    if (Status < 0) {
+        return Status;
+    }
+    MSRProbePorts(All, Listed, pOptions);
+
+    for (i = 0; i < Listed; ++i) {
+        if (All[i].Status < 0) {
+            continue;
+        }
+        if (Found < Capacity) {
+            Ports[Found] = All[i];
+        }
+        else if (All[i].Handle) {
+            MSRClose(All[i].Handle);
+        }
+        Found++;
+    }
+    if (All) {
+        _MSRFree(All);
+    }
+
+    *pCount = Found;
+    return Found > Capacity ? LIBMSR_BUFFER_TOO_SMALL : LIBMSR_OK;
+}
+
+/*** Hot-plug polling ***/
+
+typedef struct {
+    /* From _MSRSerialPortsStamp when Ports was listed */
+    ULONGLONG Stamp;
+    BOOL Listed;
+    /* Sorted by name */
+    LIBMSRPORTINFO *Ports;
+    UINT Count;
+} MSRPORTWATCH, *LPMSRPORTWATCH;
+
+LIBMSRSTATUS LIBMSRAPI MSRPortWatchCreate(LIBMSRPORTWATCH *pWatch)
+{
+    LPMSRPORTWATCH Watch;
+
+    Watch = _MSRAlloc(sizeof(*Watch));
+    if (!Watch) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    *pWatch = (LIBMSRPORTWATCH)Watch;
+    return LIBMSR_OK;
+}
+
+void LIBMSRAPI MSRPortWatchDestroy(LIBMSRPORTWATCH WatchHandle)
+{
+    LPMSRPORTWATCH Watch = (LPMSRPORTWATCH)WatchHandle;
+
+    if (Watch->Ports) {
+        _MSRFree(Watch->Ports);
+    }
+    _MSRFree(Watch);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPortWatchPoll(LIBMSRPORTWATCH WatchHandle, LIBMSRPORTCALLBACK Callback, void *Context)
+{
+    LPMSRPORTWATCH Watch = (LPMSRPORTWATCH)WatchHandle;
+    LIBMSRPORTINFO *Ports;
+    LIBMSRSTATUS Status;
+    ULONGLONG Stamp;
+    UINT Count;
+    UINT Old = 0;
+    UINT New = 0;
+    int Order;
+
+    /* Taken before listing, so a change made while listing shows up next time */
+    Stamp = _MSRSerialPortsStamp();
+    if (Watch->Listed && Stamp && Stamp == Watch->Stamp) {
+        return LIBMSR_OK;
+    }
+    Status = _MSRListAllPorts(&Ports, &Count);
+    if (Status < 0) {
+        return Status;
+    }
+
+    /* Both lists are sorted; walk them together */
+    while (Old < Watch->Count || New < Count) {
+        if (Old == Watch->Count) {
+            Order = 1;
+        }
+        else if (New == Count) {
+            Order = -1;
+        }
+        else {
+            Order = _MSRNameCompare(Watch->Ports[Old].PortName, Ports[New].PortName);
+        }
+        if (Order < 0) {
+            Callback(Context, Watch->Ports[Old++].PortName, FALSE);
+        }
+        else if (Order > 0) {
+            Callback(Context, Ports[New++].PortName, TRUE);
+        }
+        else {
+            Old++;
+            New++;
+        }
+    }
+
+    if (Watch->Ports) {
+        _MSRFree(Watch->Ports);
+    }
+    Watch->Ports = Ports;
+    Watch->Count = Count;
+    Watch->Stamp = Stamp;
+    Watch->Listed = TRUE;
+    return LIBMSR_OK;
+}
@@ -0,0 +1,246 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+/* Field limits from ISO/IEC 7813 and the AAMVA DL/ID card design standard */
+#define MSR_PAN_MAX 19
+#define MSR_ISO_NAME_MAX 26
+#define MSR_AAMVA_CITY_MAX 13
+#define MSR_AAMVA_NAME_MAX 35
+#define MSR_AAMVA_ID_MAX 13
+#define MSR_AAMVA_OVERFLOW_MAX 5
+/* AAMVA issuer identification numbers all start with this */
+#define MSR_AAMVA_IIN_PREFIX "636"
+
+/* The data between the sentinels; Pos moves through it as fields are taken */
+typedef struct {
+    const BYTE *Text;
+    UINT Pos;
+    UINT End;
+    LIBMSRFIELD *Fields;
+} MSRFIELDCURSOR;
+
+/* Take up to MaxLength characters, stopping at Separator, then the separator itself.
+ * Returns FALSE if the separator was not there.
+ */
+static BOOL LIBMSRDECL _MSRTakeVariable(MSRFIELDCURSOR *Cursor, UINT Field, BYTE Separator, UINT MaxLength)
+{
+    LIBMSRFIELD *Out = &Cursor->Fields[Field];
+    UINT Pos = Cursor->Pos;
+    UINT Limit = Cursor->End - Pos > MaxLength ? Pos + MaxLength : Cursor->End;
+
+    Out->Offset = Pos;
+    while (Pos < Limit && Cursor->Text[Pos] != Separator) {
+        Pos++;
+    }
+    Out->Length = Pos - Out->Offset;
+    if (Pos == Cursor->End || Cursor->Text[Pos] != Separator) {
+        Cursor->Pos = Pos;
+        return FALSE;
+    }
+    Cursor->Pos = Pos + 1;
+    return TRUE;
+}
+
+/* Take Length characters, or just Separator (if not 0) where the field is left out.
+ * Padding spaces are trimmed; whatever the data is too short for stays empty.
+ */
+static void LIBMSRDECL _MSRTakeFixed(MSRFIELDCURSOR *Cursor, UINT Field, UINT Length, BYTE Separator)
+{
+    LIBMSRFIELD *Out = &Cursor->Fields[Field];
+    UINT Pos = Cursor->Pos;
+
+    Out->Offset = Pos;
+    if (Separator && Pos < Cursor->End && Cursor->Text[Pos] == Separator) {
+        Cursor->Pos = Pos + 1;
+        return;
+    }
+    if (Length > Cursor->End - Pos) {
+        Length = Cursor->End - Pos;
+    }
+    Cursor->Pos = Pos + Length;
+    while (Length > 0 && Cursor->Text[Pos + Length - 1] == ' ') {
+        Length--;
+    }
+    Out->Length = Length;
+}
+
+static void LIBMSRDECL _MSRTakeRest(MSRFIELDCURSOR *Cursor, UINT Field)
+{
+    Cursor->Fields[Field].Offset = Cursor->Pos;
+    Cursor->Fields[Field].Length = Cursor->End - Cursor->Pos;
+    Cursor->Pos = Cursor->End;
+}
+
+/*** ISO/IEC 7813 ***/
+
+/* %B PAN ^ NAME ^ YYMM SSS discretionary ? */
+static LIBMSRSTATUS LIBMSRDECL _MSRParseIsoTrack1(MSRFIELDCURSOR *Cursor)
+{
+    if (Cursor->Pos == Cursor->End || Cursor->Text[Cursor->Pos] != 'B') {
+        return LIBMSR_FORMAT_ERROR;
+    }
+    Cursor->Pos++;
+    if (!_MSRTakeVariable(Cursor, LIBMSR_FIELD_PAN, '^', MSR_PAN_MAX) || !Cursor->Fields[LIBMSR_FIELD_PAN].Length) {
+        return LIBMSR_FORMAT_ERROR;
+    }
+    if (!_MSRTakeVariable(Cursor, LIBMSR_FIELD_NAME, '^', MSR_ISO_NAME_MAX)) {
+        return LIBMSR_FORMAT_ERROR;
+    }
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_EXPIRY, 4, '^');
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_SERVICE_CODE, 3, '^');
+    _MSRTakeRest(Cursor, LIBMSR_FIELD_DISCRETIONARY);
+    return LIBMSR_OK;
+}
+
+/* ; PAN = YYMM SSS discretionary ? */
+static LIBMSRSTATUS LIBMSRDECL _MSRParseIsoTrack2(MSRFIELDCURSOR *Cursor)
+{
+    if (!_MSRTakeVariable(Cursor, LIBMSR_FIELD_PAN, '=', MSR_PAN_MAX) || !Cursor->Fields[LIBMSR_FIELD_PAN].Length) {
+        return LIBMSR_FORMAT_ERROR;
+    }
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_EXPIRY, 4, '=');
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_SERVICE_CODE, 3, '=');
+    _MSRTakeRest(Cursor, LIBMSR_FIELD_DISCRETIONARY);
+    return LIBMSR_OK;
+}
+
+/*** AAMVA ***/
+
+/* % SS CITY ^ NAME ^ ADDRESS ^ ? */
+static LIBMSRSTATUS LIBMSRDECL _MSRParseAamvaTrack1(MSRFIELDCURSOR *Cursor)
+{
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_STATE, 2, 0);
+    _MSRTakeVariable(Cursor, LIBMSR_FIELD_CITY, '^', MSR_AAMVA_CITY_MAX);
+    _MSRTakeVariable(Cursor, LIBMSR_FIELD_NAME, '^', MSR_AAMVA_NAME_MAX);
+    _MSRTakeVariable(Cursor, LIBMSR_FIELD_ADDRESS, '^', Cursor->End - Cursor->Pos);
+    return Cursor->Fields[LIBMSR_FIELD_STATE].Length == 2 ? LIBMSR_OK : LIBMSR_FORMAT_ERROR;
+}
+
+/* ; IIN ID = YYMM CCYYMMDD overflow ? */
+static LIBMSRSTATUS LIBMSRDECL _MSRParseAamvaTrack2(MSRFIELDCURSOR *Cursor)
+{
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_IIN, 6, 0);
+    if (!_MSRTakeVariable(Cursor, LIBMSR_FIELD_ID_NUMBER, '=', MSR_AAMVA_ID_MAX)) {
+        return LIBMSR_FORMAT_ERROR;
+    }
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_EXPIRY, 4, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_BIRTH_DATE, 8, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_ID_OVERFLOW, MSR_AAMVA_OVERFLOW_MAX, 0);
+    return LIBMSR_OK;
+}
+
+/* Fixed positions from the CDS version to the eye color, then the jurisdiction's own data */
+static LIBMSRSTATUS LIBMSRDECL _MSRParseAamvaTrack3(MSRFIELDCURSOR *Cursor)
+{
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_CDS_VERSION, 1, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_JURISDICTION_VERSION, 1, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_POSTAL_CODE, 11, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_CLASS, 2, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_RESTRICTIONS, 10, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_ENDORSEMENTS, 4, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_SEX, 1, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_HEIGHT, 3, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_WEIGHT, 3, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_HAIR_COLOR, 3, 0);
+    _MSRTakeFixed(Cursor, LIBMSR_FIELD_EYE_COLOR, 3, 0);
+    _MSRTakeRest(Cursor, LIBMSR_FIELD_DISCRETIONARY);
+    return Cursor->Fields[LIBMSR_FIELD_CDS_VERSION].Length ? LIBMSR_OK : LIBMSR_FORMAT_ERROR;
+}
+
+/*** Public API ***/
+
+#define _MSRIsDigit(c) ((BYTE)((c) - '0') <= 9)
+#define _MSRIsUpper(c) ((BYTE)((c) - 'A') <= 'Z' - 'A')
+
+/* ISO track 1 has a format code and a digit, AAMVA track 1 a state code */
+static UINT LIBMSRDECL _MSRDetectLayout(BYTE Sentinel, const BYTE *Data, UINT Length)
+{
+    if (Sentinel == ';') {
+        return Length >= 3 && !memcmp(Data, MSR_AAMVA_IIN_PREFIX, 3) ? LIBMSR_LAYOUT_AAMVA_TRACK2 : LIBMSR_LAYOUT_ISO_TRACK2;
+    }
+    if (Length >= 2 && Data[0] == 'B' && _MSRIsDigit(Data[1])) {
+        return LIBMSR_LAYOUT_ISO_TRACK1;
+    }
+    if (Length >= 2 && _MSRIsUpper(Data[0]) && _MSRIsUpper(Data[1])) {
+        return LIBMSR_LAYOUT_AAMVA_TRACK1;
+    }
+    return LIBMSR_LAYOUT_AAMVA_TRACK3;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRParseFields(const BYTE *Text, SIZE_T Length, UINT Layout, LIBMSRFIELDS *pFields)
+{
+    MSRFIELDCURSOR Cursor;
+    const BYTE *End;
+    BYTE Sentinel;
+    SIZE_T Start;
+
+    memset(pFields, 0, sizeof(*pFields));
+
+    /* Blank media decodes to spaces or zeros ahead of the start sentinel */
+    for (Start = 0; Start < Length && Text[Start] != '%' && Text[Start] != ';'; ++Start) {
+    }
+    if (Start == Length) {
+        return LIBMSR_SENTINEL_NOT_FOUND;
+    }
+    Sentinel = Text[Start];
+    End = memchr(Text + Start + 1, '?', Length - Start - 1);
+    if (!End) {
+        return LIBMSR_SENTINEL_NOT_FOUND;
+    }
+    Cursor.Text = Text;
+    Cursor.Pos = (UINT)Start + 1;
+    Cursor.End = (UINT)(End - Text);
+    Cursor.Fields = pFields->Fields;
+
+    if (Layout == LIBMSR_LAYOUT_AUTO) {
+        Layout = _MSRDetectLayout(Sentinel, Text + Cursor.Pos, Cursor.End - Cursor.Pos);
+    }
+    pFields->Layout = Layout;
+    switch (Layout) {
+    case LIBMSR_LAYOUT_ISO_TRACK1:
+        return Sentinel == '%' ? _MSRParseIsoTrack1(&Cursor) : LIBMSR_FORMAT_ERROR;
+    case LIBMSR_LAYOUT_ISO_TRACK2:
+        return Sentinel == ';' ? _MSRParseIsoTrack2(&Cursor) : LIBMSR_FORMAT_ERROR;
+    case LIBMSR_LAYOUT_AAMVA_TRACK1:
+        return Sentinel == '%' ? _MSRParseAamvaTrack1(&Cursor) : LIBMSR_FORMAT_ERROR;
+    case LIBMSR_LAYOUT_AAMVA_TRACK2:
+        return Sentinel == ';' ? _MSRParseAamvaTrack2(&Cursor) : LIBMSR_FORMAT_ERROR;
+    case LIBMSR_LAYOUT_AAMVA_TRACK3:
+        return Sentinel == '%' ? _MSRParseAamvaTrack3(&Cursor) : LIBMSR_FORMAT_ERROR;
+    default:
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+}
+
+/* Doubled digit with the digits of the product added up */
+static const BYTE LuhnDoubled[10] = { 0, 2, 4, 6, 8, 1, 3, 5, 7, 9 };
+
+LIBMSRSTATUS LIBMSRAPI MSRLuhnCheck(const BYTE *Digits, SIZE_T Length)
+{
+    UINT Sum = 0;
+    BYTE Kept, Doubled;
+
+    if (Length == 0) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    /* From the check digit leftwards every second digit is doubled; take them in pairs */
+    while (Length >= 2) {
+        Kept = Digits[Length - 1] - '0';
+        Doubled = Digits[Length - 2] - '0';
+        if (Kept > 9 || Doubled > 9) {
+            return LIBMSR_CHARSET_ERROR;
+        }
+        Sum += Kept + LuhnDoubled[Doubled];
+        Length -= 2;
+    }
+    if (Length) {
+        Kept = Digits[0] - '0';
+        if (Kept > 9) {
+            return LIBMSR_CHARSET_ERROR;
+        }
+        Sum += Kept;
+    }
+    return Sum % 10 ? LIBMSR_CHECK_DIGIT_ERROR : LIBMSR_OK;
+}
@@ -1,11 +1,323 @@
 #ifndef LIBMSR_INTERNALS_H
 #define LIBMSR_INTERNALS_H
 
+#ifdef _WIN32
+#define _MSRAlloc(Size) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (Size))
+#define _MSRFree(Ptr) HeapFree(GetProcessHeap(), 0, (Ptr))
+#else
+#include <stdlib.h>
+#define _MSRAlloc(Size) calloc(1, (Size))
+#define _MSRFree(Ptr) free(Ptr)
+#endif
+
+#ifndef _WIN32
+#define TEXT(s) s
+#endif
+
+#define MSR_RECV_BUFFER_SIZE 256
+
+/* Milliseconds on a monotonic clock */
+typedef unsigned long long MSRTIME;
+
+/* What the library knows about the device settings */
+typedef struct {
+    /* LIBMSR_CONFIG_* fields known to match the device; density is tracked per track */
+    UINT Valid;
+    BYTE BitsPerChar[3];
+    /* 0 if unknown */
+    UINT BitsPerInch[3];
+    BOOL IsHiCo;
+    BYTE LeadingZeros[2];
+} MSRSHADOWCONFIG;
+
+/* Ring of recent wire traffic; written only by the thread driving the handle */
 typedef struct {
-    HANDLE PortHandle;
-    DCB PortSettings;
+    /* Sequence number of the last entry written */
+    ULONGLONG Last;
+    BYTE Opcode;
+    LIBMSRTRACEENTRY Entries[LIBMSR_TRACE_ENTRIES];
+    LIBMSRTRACECALLBACK Callback;
+    void *CallbackContext;
+} MSRTRACE;
+
+typedef struct {
+    const LIBMSRTRANSPORT *Transport;
+    void *Port;
+    /* Read-ahead buffer; bytes in [RecvHead, RecvTail) are not consumed yet */
+    BYTE RecvBuffer[MSR_RECV_BUFFER_SIZE];
+    SIZE_T RecvHead;
+    SIZE_T RecvTail;
+    /* Status of the last failed receive, to tell timeouts from garbage */
+    LIBMSRSTATUS RecvStatus;
+    LIBMSRSTATS Stats;
+    MSRTRACE Trace;
+    LIBMSRTIMEOUTS Timeouts;
+    LIBMSRRETRYPOLICY RetryPolicy;
+    /* One-shot override from MSRSetCallTimeout */
+    UINT CallTimeout;
+    /* Absolute end of the current exchange, 0 if unbounded */
+    MSRTIME Deadline;
+    /* No byte of the response has arrived yet; the inter-byte limit does not apply */
+    BOOL AwaitingResponse;
+    MSRSHADOWCONFIG Config;
+    /* Card reads and writes are recorded here if set */
+    struct _MSRJOURNAL *Journal;
+    UINT JournalDeviceId;
+    /* Set while the handle belongs to a device pool */
+    struct _MSRPOOLDEVICE *PoolDevice;
+    /* Set while the handle has an I/O thread */
+    struct _MSRIOTHREAD *IoThread;
+    /* Set for handles opened with MSROpenRemote */
+    struct _MSRREMOTE *Remote;
 } MSRCONTEXT, *LPMSRCONTEXT;
 
 #define ESC 0x1B
+#define FS 0x1C
+
+/* Run a request on the calling thread, whatever kind it is (libmsr.c) */
+LIBMSRSTATUS LIBMSRDECL _MSRExecute(LPMSRCONTEXT Context, LIBMSRREQUEST *Request);
+/* Same for a card request whose command was already built with _MSRRequestBuild */
+LIBMSRSTATUS LIBMSRDECL _MSRExecuteFrame(LPMSRCONTEXT Context, LIBMSRREQUEST *Request,
+    const BYTE *CommandBuffer, SIZE_T CommandLength);
+
+/* Entry points of the blocking APIs (iothread.c). On a threaded handle these pass
+ * the work to the I/O thread and wait; otherwise they run it right away.
+ */
+typedef LIBMSRSTATUS (LIBMSRDECL *MSRCALLPROC)(LPMSRCONTEXT Context, void *Arg);
+
+LIBMSRSTATUS LIBMSRDECL _MSRRun(LPMSRCONTEXT Context, LIBMSRREQUEST *Request);
+/* For APIs made of several requests, or that look at the shadow configuration */
+LIBMSRSTATUS LIBMSRDECL _MSRCall(LPMSRCONTEXT Context, MSRCALLPROC Proc, void *Arg);
+/* MSRClose from a completion callback: the I/O thread closes the handle once it
+ * leaves its loop. Returns FALSE when not called on the handle's I/O thread.
+ */
+BOOL LIBMSRDECL _MSRIoCloseLater(LPMSRCONTEXT Context);
+
+/* Total timeout for the next command: CommandMs, SwipeMs or a one-shot override (libmsr.c) */
+UINT LIBMSRDECL _MSRTakeCallTimeout(LPMSRCONTEXT Context, BOOL IsSwipe);
+/* Bookkeeping for every completed request, blocking or pooled (libmsr.c) */
+void LIBMSRDECL _MSRRequestCompleted(LPMSRCONTEXT Context, const LIBMSRREQUEST *Request, LIBMSRSTATUS Status);
+/* Keep the shadow configuration in step with a completed request (libmsr.c) */
+void LIBMSRDECL _MSRConfigNote(LPMSRCONTEXT Context, const LIBMSRREQUEST *Request, LIBMSRSTATUS Status);
+/* Record card reads and writes in the attached journal (journal.c) */
+void LIBMSRDECL _MSRJournalNote(LPMSRCONTEXT Context, const LIBMSRREQUEST *Request, LIBMSRSTATUS Status);
+
+/* Performance counters (stats.c) */
+#define _MSRStatsCommand(Context, Command) ((Context)->Stats.Commands[(Command)[1]]++)
+/* Add the time since Start, from _MSRGetTimeUs */
+void LIBMSRDECL _MSRStatsLatency(LIBMSRHISTOGRAM *Histogram, ULONGLONG Start);
+void LIBMSRDECL _MSRStatsError(LPMSRCONTEXT Context, LIBMSRSTATUS Status);
+
+/* Protocol trace ring (trace.c) */
+void LIBMSRDECL _MSRTraceData(LPMSRCONTEXT Context, BYTE Kind, const BYTE *Data, SIZE_T Length);
+void LIBMSRDECL _MSRTraceError(LPMSRCONTEXT Context, LIBMSRSTATUS Status);
+
+/* Platform services (platform_win32.c or platform_posix.c) */
+MSRTIME LIBMSRDECL _MSRGetTime(void);
+/* Microseconds on the same clock */
+ULONGLONG LIBMSRDECL _MSRGetTimeUs(void);
+void LIBMSRDECL _MSRSleep(UINT Milliseconds);
+
+typedef void *MSRTHREAD;
+typedef void (LIBMSRDECL *MSRTHREADPROC)(void *Arg);
+
+LIBMSRSTATUS LIBMSRDECL _MSRThreadCreate(MSRTHREADPROC Proc, void *Arg, MSRTHREAD *pThread);
+/* Wait for the thread to finish and release it */
+void LIBMSRDECL _MSRThreadJoin(MSRTHREAD Thread);
+/* Let the thread release itself when it finishes; only the thread itself calls this */
+void LIBMSRDECL _MSRThreadDetach(MSRTHREAD Thread);
+UINT LIBMSRDECL _MSRCpuCount(void);
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION MSRLOCK;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t MSRLOCK;
+#endif
+
+/* Order plain memory accesses for readers on other threads */
+#ifdef _WIN32
+#define _MSRMemoryBarrier() MemoryBarrier()
+#else
+#define _MSRMemoryBarrier() __sync_synchronize()
+#endif
+
+void LIBMSRDECL _MSRLockInit(MSRLOCK *Lock);
+void LIBMSRDECL _MSRLockDelete(MSRLOCK *Lock);
+void LIBMSRDECL _MSRLock(MSRLOCK *Lock);
+void LIBMSRDECL _MSRUnlock(MSRLOCK *Lock);
+
+/* Pointer-sized atomics; Cas evaluates to nonzero if *Target held Expected and was replaced */
+#ifdef _WIN32
+#define _MSRAtomicCasPointer(Target, Expected, Desired) \
+    (InterlockedCompareExchangePointer((PVOID volatile *)(Target), (Desired), (Expected)) == (PVOID)(Expected))
+#define _MSRAtomicExchangePointer(Target, Value) InterlockedExchangePointer((PVOID volatile *)(Target), (Value))
+#define MSR_THREAD_LOCAL __declspec(thread)
+#else
+#define _MSRAtomicCasPointer(Target, Expected, Desired) __sync_bool_compare_and_swap((Target), (Expected), (Desired))
+#define _MSRAtomicExchangePointer(Target, Value) __atomic_exchange_n((Target), (Value), __ATOMIC_ACQ_REL)
+#define MSR_THREAD_LOCAL __thread
+#endif
+
+#ifdef _WIN32
+typedef CONDITION_VARIABLE MSRCOND;
+typedef HANDLE MSRSEMAPHORE;
+#else
+#include <semaphore.h>
+typedef pthread_cond_t MSRCOND;
+typedef sem_t MSRSEMAPHORE;
+#endif
+
+void LIBMSRDECL _MSRCondInit(MSRCOND *Cond);
+void LIBMSRDECL _MSRCondDelete(MSRCOND *Cond);
+/* Wait with Lock held; returns FALSE if TimeoutMs (LIBMSR_INFINITE for none) ran out */
+BOOL LIBMSRDECL _MSRCondWait(MSRCOND *Cond, MSRLOCK *Lock, UINT TimeoutMs);
+void LIBMSRDECL _MSRCondBroadcast(MSRCOND *Cond);
+
+LIBMSRSTATUS LIBMSRDECL _MSRSemaphoreInit(MSRSEMAPHORE *Semaphore);
+void LIBMSRDECL _MSRSemaphoreDelete(MSRSEMAPHORE *Semaphore);
+void LIBMSRDECL _MSRSemaphorePost(MSRSEMAPHORE *Semaphore);
+void LIBMSRDECL _MSRSemaphoreWait(MSRSEMAPHORE *Semaphore);
+
+/* Milliseconds since 1970-01-01 UTC */
+ULONGLONG LIBMSRDECL _MSRGetWallTime(void);
+
+/* A file mapped read-write in full; View is NULL while the file is empty */
+typedef struct {
+#ifdef _WIN32
+    HANDLE File;
+    HANDLE Mapping;
+#else
+    int Fd;
+#endif
+    BYTE *View;
+    SIZE_T Size;
+} MSRFILEMAP;
+
+/* Open or create the file named Path followed by Suffix and map it */
+LIBMSRSTATUS LIBMSRDECL _MSRMapOpen(LPTSTR Path, LPTSTR Suffix, MSRFILEMAP *Map);
+/* Change the file size and map it again; View moves. On failure the old view is kept. */
+LIBMSRSTATUS LIBMSRDECL _MSRMapResize(MSRFILEMAP *Map, SIZE_T Size);
+/* Write a range back to the file; without Wait this only schedules the writeback */
+LIBMSRSTATUS LIBMSRDECL _MSRMapFlush(MSRFILEMAP *Map, SIZE_T Offset, SIZE_T Length, BOOL Wait);
+/* Unmap and close, cutting the file down to FinalSize */
+void LIBMSRDECL _MSRMapClose(MSRFILEMAP *Map, SIZE_T FinalSize);
+
+/* Low-level I/O shared by the blocking and pooled paths (libmsr.c) */
+LIBMSRSTATUS LIBMSRDECL _MSRSend(LPMSRCONTEXT Context, const BYTE *Buffer, SIZE_T Count);
+LIBMSRSTATUS LIBMSRDECL _MSRRecvSome(LPMSRCONTEXT Context, LPBYTE Buffer, SIZE_T Count, SIZE_T *pBytesRead);
+LIBMSRSTATUS LIBMSRDECL _MSRRecvFill(LPMSRCONTEXT Context);
+void LIBMSRDECL _MSRPurge(LPMSRCONTEXT Context);
+void LIBMSRDECL _MSRDrain(LPMSRCONTEXT Context);
+
+/* Shapes of device responses */
+#define MSR_RESPONSE_NONE 0         /* Nothing is sent back */
+#define MSR_RESPONSE_REPLY 1        /* ESC followed by a fixed number of bytes */
+#define MSR_RESPONSE_TRACKS_RAW 2   /* ESC s, length-prefixed track blocks, ? FS ESC status */
+#define MSR_RESPONSE_TRACKS_ISO 3   /* ESC s, ?-terminated track blocks, ? FS ESC status */
+
+/* The public push parser wired to a request's buffers (parser.c) */
+typedef struct {
+    LIBMSRPARSER Core;
+    LIBMSRREQUEST *Request;
+    UINT Track;             /* Index of the track being stored, 3 if none */
+    LIBMSRSTATUS Status;
+} MSRPARSER;
+
+void LIBMSRDECL _MSRParserInit(MSRPARSER *Parser, LIBMSRREQUEST *Request);
+LIBMSRSTATUS LIBMSRDECL _MSRParserFeed(MSRPARSER *Parser, const BYTE *Data, SIZE_T Length, SIZE_T *pConsumed);
+
+/* Request encoding and reply validation (request.c) */
+#define MSR_MAX_COMMAND_LENGTH (8 + 3 * (3 + 255))
+
+LIBMSRSTATUS LIBMSRDECL _MSRRequestBuild(const LIBMSRREQUEST *Request, BYTE *Buffer, SIZE_T *pLength);
+UINT LIBMSRDECL _MSRRequestResponseKind(UINT Type, UINT *pReplyLength);
+LIBMSRSTATUS LIBMSRDECL _MSRRequestCheckReply(UINT Type, const BYTE *Reply);
+BOOL LIBMSRDECL _MSRRequestWaitsForSwipe(UINT Type);
+
+/* Protocol between a device server and remote handles (server.c, remote.c).
+ * Each message is a fixed header and then Length bytes of data. Both ends share a
+ * host, so values are in host byte order.
+ */
+#define MSR_MSG_OPEN 1          /* Attach to the device named by the data; none names the first */
+#define MSR_MSG_REQUEST 2       /* Run a request; write data follows, reads give capacities in TrackLengths (0: not wanted) */
+#define MSR_MSG_SUBSCRIBE 3     /* Params[0]: LIBMSR_SUBSCRIBE_* flags */
+#define MSR_MSG_CANCEL 4        /* Drop the request with the same Id; it gets no result */
+#define MSR_MSG_RESULT 5        /* From the server: outcome of the message with the same Id; read data follows */
+#define MSR_MSG_SWIPE 6         /* From the server: a card read, for subscribers; track data follows */
+
+/* Track data is 3 tracks of at most LIBMSR_MAX_TRACK_LENGTH bytes */
+#define MSR_MESSAGE_MAX_DATA (3 * LIBMSR_MAX_TRACK_LENGTH)
+
+typedef struct {
+    UINT Length;
+    /* Chosen by the client; results echo it */
+    UINT Id;
+    LIBMSRSTATUS Status;
+    BYTE Type;
+    /* LIBMSR_REQ_* in requests, results and swipes */
+    BYTE RequestType;
+    /* Request parameters; reply bytes in results */
+    BYTE Params[4];
+    unsigned short TrackLengths[3];
+} MSRMESSAGE;
+
+/* Run requests on a remote handle, sending them all before collecting the results (remote.c).
+ * Returns the first failure.
+ */
+LIBMSRSTATUS LIBMSRDECL _MSRRemoteExecute(LPMSRCONTEXT Context, LIBMSRREQUEST Requests[], UINT Count);
+
+/* Open a serial port with the settings all MSRxxx devices use (9600 8N1).
+ * Implemented by the platform backend (serial_win32.c or serial_posix.c).
+ */
+LIBMSRSTATUS LIBMSRDECL _MSRSerialOpen(LPTSTR PortName, const LIBMSRTRANSPORT **pTransport, void **pPort);
+
+/* Call Proc with the name of every serial port on the system, in no particular order */
+typedef void (LIBMSRDECL *MSRPORTPROC)(void *Context, LPTSTR PortName);
+LIBMSRSTATUS LIBMSRDECL _MSRSerialEnumerate(MSRPORTPROC Proc, void *Context);
+/* A value that changes whenever ports may have come or gone; 0 if there is no such indicator */
+ULONGLONG LIBMSRDECL _MSRSerialPortsStamp(void);
+
+/* Codec kernels. All implementations produce identical output and handle Source == Dest.
+ * BitsPerChar has been validated by the caller.
+ */
+typedef struct {
+    UINT Level;
+    void (LIBMSRDECL *Unpack)(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest);
+    void (LIBMSRDECL *Pack)(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest);
+    /* Dest = (Source & CharMask) + Base */
+    void (LIBMSRDECL *ToAscii)(BYTE CharMask, BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest);
+    /* Dest = Source - Base */
+    void (LIBMSRDECL *FromAscii)(BYTE Base, const BYTE *Source, SIZE_T Length, BYTE *Dest);
+    /* Index of the first character (Source & CharBits) that is not blank and has even
+     * parity, or Length if there is none; *pLrc is the XOR of all the characters.
+     */
+    SIZE_T (LIBMSRDECL *Check)(BYTE CharBits, const BYTE *Source, SIZE_T Length, BYTE *pLrc);
+} MSRCODECKERNELS;
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define MSR_CODEC_X86
+/* AVX2 intrinsics need MSVC 2012 or later */
+#if !defined(_MSC_VER) || _MSC_VER >= 1700
+#define MSR_CODEC_AVX2
+#endif
+#endif
+
+/* codec.c */
+extern const MSRCODECKERNELS _MSRCodecScalar;
+BYTE ComputeParity(BYTE x);
+/* Single-record paths of the batch codec; BitsPerChar is 5 to 8 */
+LIBMSRSTATUS LIBMSRDECL _MSRDecodeRecord(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest);
+LIBMSRSTATUS LIBMSRDECL _MSREncodeRecord(UINT BitsPerChar, const BYTE *Source, SIZE_T Length, BYTE *Dest);
+
+/* codec_x86.c */
+#ifdef MSR_CODEC_X86
+extern const MSRCODECKERNELS _MSRCodecSsse3;
+#ifdef MSR_CODEC_AVX2
+extern const MSRCODECKERNELS _MSRCodecAvx2;
+#endif
+/* Highest LIBMSR_CODEC_* level the CPU supports */
+UINT LIBMSRDECL _MSRCodecCpuLevel(void);
+#endif
 
 #endif /* LIBMSR_INTERNALS_H */
@@ -0,0 +1,306 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+/* Internal request types, past the public LIBMSR_REQ_* range */
+#define MSR_REQ_CALL 0x100      /* An MSRCALL: run Proc on the I/O thread */
+#define MSR_REQ_STOP 0x101      /* Leave the I/O thread once the batch is done */
+#define MSR_REQ_CLOSE 0x102     /* As MSR_REQ_STOP, then close the handle */
+
+typedef struct {
+    LIBMSRREQUEST Request;
+    MSRCALLPROC Proc;
+    void *Arg;
+} MSRCALL;
+
+typedef struct _MSRIOTHREAD {
+    LPMSRCONTEXT Context;
+    MSRTHREAD Thread;
+    /* Submitted requests, newest first, linked through Next.
+     * Submitters push with a compare-and-swap; the I/O thread takes the whole list at once.
+     */
+    LIBMSRREQUEST *volatile Incoming;
+    /* Posted once per submission */
+    MSRSEMAPHORE Wakeup;
+    /* Only waiters take the lock; submitting and completing never block on it */
+    MSRLOCK Lock;
+    MSRCOND Completed;
+    /* Queued by _MSRIoCloseLater; nobody waits on it */
+    LIBMSRREQUEST Close;
+} MSRIOTHREAD, *LPMSRIOTHREAD;
+
+/* The handle whose I/O thread this is, if any; calls made from completion
+ * callbacks run directly instead of queueing behind themselves.
+ */
+static MSR_THREAD_LOCAL LPMSRCONTEXT _MSRIoThreadContext;
+
+static void LIBMSRDECL _MSRIoPush(LPMSRIOTHREAD Io, LIBMSRREQUEST *Request)
+{
+    LIBMSRREQUEST *Head;
+
+    Request->Status = LIBMSR_PENDING;
+    do {
+        Head = Io->Incoming;
+        Request->Next = Head;
+    } while (!_MSRAtomicCasPointer(&Io->Incoming, Head, Request));
+    _MSRSemaphorePost(&Io->Wakeup);
+}
+
+/* A request with a callback goes to the callback alone, which may free or resubmit it;
+ * MSRRequestWait refuses such requests, so nobody is waiting on it. Otherwise, once
+ * the status is stored the waiter may reuse the request, so it is not touched again.
+ */
+static void LIBMSRDECL _MSRIoComplete(LPMSRIOTHREAD Io, LIBMSRREQUEST *Request, LIBMSRSTATUS Status)
+{
+    if (Request->Callback) {
+        Request->Status = Status;
+        Request->Callback(Request);
+        return;
+    }
+    _MSRMemoryBarrier();
+    ((volatile LIBMSRREQUEST *)Request)->Status = Status;
+    _MSRLock(&Io->Lock);
+    _MSRCondBroadcast(&Io->Completed);
+    _MSRUnlock(&Io->Lock);
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRIoWait(LPMSRIOTHREAD Io, LIBMSRREQUEST *Request, UINT TimeoutMs)
+{
+    MSRTIME Deadline = TimeoutMs == LIBMSR_INFINITE ? 0 : _MSRGetTime() + TimeoutMs;
+    MSRTIME Now;
+    LIBMSRSTATUS Status;
+
+    _MSRLock(&Io->Lock);
+    while ((Status = ((volatile LIBMSRREQUEST *)Request)->Status) == LIBMSR_PENDING) {
+        if (!Deadline) {
+            _MSRCondWait(&Io->Completed, &Io->Lock, LIBMSR_INFINITE);
+            continue;
+        }
+        Now = _MSRGetTime();
+        if (Now >= Deadline) {
+            break;
+        }
+        _MSRCondWait(&Io->Completed, &Io->Lock, (UINT)(Deadline - Now));
+    }
+    _MSRUnlock(&Io->Lock);
+    _MSRMemoryBarrier();
+    return Status;
+}
+
+/* A later request makes an earlier one pointless if it sets the same thing again.
+ * Single LED commands leave the other LEDs alone, so only the same command or
+ * all on/all off covers an earlier one; the other setters carry the full state.
+ */
+static BOOL LIBMSRDECL _MSRIoSupersedes(const LIBMSRREQUEST *Later, const LIBMSRREQUEST *Earlier)
+{
+    if (Later->Type != Earlier->Type) {
+        return FALSE;
+    }
+    switch (Earlier->Type) {
+    case LIBMSR_REQ_LED:
+        return Later->Params[0] == Earlier->Params[0] || Later->Params[0] == 0x81 || Later->Params[0] == 0x82;
+    case LIBMSR_REQ_SET_COERCIVITY:
+    case LIBMSR_REQ_SET_LEADING_ZEROS:
+    case LIBMSR_REQ_SET_BPC:
+        return TRUE;
+    case LIBMSR_REQ_SET_DENSITY:
+        return Later->Params[0] == Earlier->Params[0];
+    default:
+        return FALSE;
+    }
+}
+
+static void LIBMSRDECL _MSRIoThreadFree(LPMSRIOTHREAD Io)
+{
+    _MSRCondDelete(&Io->Completed);
+    _MSRLockDelete(&Io->Lock);
+    _MSRSemaphoreDelete(&Io->Wakeup);
+    _MSRFree(Io);
+}
+
+static void LIBMSRDECL _MSRIoThreadMain(void *Arg)
+{
+    LPMSRIOTHREAD Io = (LPMSRIOTHREAD)Arg;
+    LIBMSRREQUEST *Batch;
+    LIBMSRREQUEST *Request;
+    LIBMSRREQUEST *Next;
+    LIBMSRREQUEST *Merged;
+    LIBMSRREQUEST *Done;
+    MSRCALL *Call;
+    LIBMSRSTATUS Status;
+    BOOL Stopping = FALSE;
+
+    _MSRIoThreadContext = Io->Context;
+    while (!Stopping) {
+        _MSRSemaphoreWait(&Io->Wakeup);
+
+        /* Take everything submitted so far and put it back in submission order */
+        Request = _MSRAtomicExchangePointer(&Io->Incoming, NULL);
+        Batch = NULL;
+        while (Request) {
+            Next = Request->Next;
+            Request->Next = Batch;
+            Batch = Request;
+            Request = Next;
+        }
+
+        Merged = NULL;
+        for (Request = Batch; Request; Request = Next) {
+            Next = Request->Next;
+            if (Next && _MSRIoSupersedes(Next, Request)) {
+                Request->Next = Merged;
+                Merged = Request;
+                continue;
+            }
+
+            if (Request->Type == MSR_REQ_CALL) {
+                Call = (MSRCALL *)Request;
+                Status = Call->Proc(Io->Context, Call->Arg);
+            }
+            else if (Request->Type == MSR_REQ_STOP || Request->Type == MSR_REQ_CLOSE) {
+                Stopping = TRUE;
+                Status = LIBMSR_OK;
+            }
+            else {
+                Status = _MSRExecute(Io->Context, Request);
+            }
+
+            while (Merged) {
+                Done = Merged;
+                Merged = Merged->Next;
+                _MSRIoComplete(Io, Done, Status);
+            }
+            if (Request != &Io->Close) {
+                _MSRIoComplete(Io, Request, Status);
+            }
+        }
+    }
+    _MSRIoThreadContext = NULL;
+
+    if (Io->Close.Status == LIBMSR_PENDING) {
+        /* Nobody will join this thread; it takes the handle down itself */
+        Io->Context->IoThread = NULL;
+        _MSRThreadDetach(Io->Thread);
+        MSRClose(Io->Context);
+        _MSRIoThreadFree(Io);
+    }
+}
+
+BOOL LIBMSRDECL _MSRIoCloseLater(LPMSRCONTEXT Context)
+{
+    LPMSRIOTHREAD Io = Context->IoThread;
+
+    if (!Io || _MSRIoThreadContext != Context) {
+        return FALSE;
+    }
+    if (Io->Close.Type != MSR_REQ_CLOSE) {
+        Io->Close.Type = MSR_REQ_CLOSE;
+        _MSRIoPush(Io, &Io->Close);
+    }
+    return TRUE;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRRun(LPMSRCONTEXT Context, LIBMSRREQUEST *Request)
+{
+    if (!Context->IoThread || _MSRIoThreadContext == Context) {
+        return _MSRExecute(Context, Request);
+    }
+    Request->Callback = NULL;
+    _MSRIoPush(Context->IoThread, Request);
+    return _MSRIoWait(Context->IoThread, Request, LIBMSR_INFINITE);
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRCall(LPMSRCONTEXT Context, MSRCALLPROC Proc, void *Arg)
+{
+    MSRCALL Call;
+
+    if (!Context->IoThread || _MSRIoThreadContext == Context) {
+        return Proc(Context, Arg);
+    }
+    memset(&Call, 0, sizeof(Call));
+    Call.Request.Type = MSR_REQ_CALL;
+    Call.Proc = Proc;
+    Call.Arg = Arg;
+    _MSRIoPush(Context->IoThread, &Call.Request);
+    return _MSRIoWait(Context->IoThread, &Call.Request, LIBMSR_INFINITE);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRStartIoThread(LIBMSRHANDLE Handle)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    LPMSRIOTHREAD Io;
+    LIBMSRSTATUS Status;
+
+    if (Context->IoThread || Context->PoolDevice) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+
+    Io = _MSRAlloc(sizeof(*Io));
+    if (!Io) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Io->Context = Context;
+    Status = _MSRSemaphoreInit(&Io->Wakeup);
+    if (Status < 0) {
+        goto fail1;
+    }
+    _MSRLockInit(&Io->Lock);
+    _MSRCondInit(&Io->Completed);
+
+    Status = _MSRThreadCreate(_MSRIoThreadMain, Io, &Io->Thread);
+    if (Status < 0) {
+        goto fail2;
+    }
+    Context->IoThread = Io;
+    return LIBMSR_OK;
+
+fail2:
+    _MSRCondDelete(&Io->Completed);
+    _MSRLockDelete(&Io->Lock);
+    _MSRSemaphoreDelete(&Io->Wakeup);
+fail1:
+    _MSRFree(Io);
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRStopIoThread(LIBMSRHANDLE Handle)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    LPMSRIOTHREAD Io = Context->IoThread;
+    LIBMSRREQUEST Stop;
+
+    if (!Io || _MSRIoThreadContext == Context) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+
+    memset(&Stop, 0, sizeof(Stop));
+    Stop.Type = MSR_REQ_STOP;
+    _MSRIoPush(Io, &Stop);
+    _MSRThreadJoin(Io->Thread);
+
+    Context->IoThread = NULL;
+    _MSRIoThreadFree(Io);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRSubmit(LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+
+    if (!Context->IoThread || pRequest->Type < LIBMSR_REQ_RESET || pRequest->Type > LIBMSR_REQ_GET_MODEL) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    _MSRIoPush(Context->IoThread, pRequest);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRRequestWait(LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest, UINT TimeoutMs)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+
+    if (!Context->IoThread || pRequest->Callback) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    return _MSRIoWait(Context->IoThread, pRequest, TimeoutMs);
+}
@@ -0,0 +1,357 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+#define MSR_JOB_DEFAULT_ATTEMPTS 3
+
+/* Packing of one card into the complete write command, run on the worker thread */
+typedef struct {
+    const LIBMSRJOBCARD *Card;
+    const UINT *BitsPerChar;
+    LIBMSRTRACKS Tracks;
+    LIBMSRREQUEST Request;
+    BYTE Frame[MSR_MAX_COMMAND_LENGTH];
+    SIZE_T FrameLength;
+    LIBMSRSTATUS Status;
+    MSRTIME Time;
+} MSRJOBPACK;
+
+/* One worker for the whole job, handed a card at a time; a NULL Pack sends it home */
+typedef struct {
+    MSRSEMAPHORE Start;
+    MSRSEMAPHORE Done;
+    MSRJOBPACK *Pack;
+} MSRJOBWORKER;
+
+static void LIBMSRDECL _MSRJobPack(MSRJOBPACK *Pack)
+{
+    const LIBMSRJOBCARD *Card = Pack->Card;
+    MSRTIME Start = _MSRGetTime();
+    const BYTE *Raw;
+    SIZE_T Length;
+    UINT Track;
+
+    MSRTracksClear(Pack->Tracks);
+    Pack->Status = LIBMSR_OK;
+    for (Track = 0; Track < 3 && Pack->Status >= 0; ++Track) {
+        if (!Card->Text[Track]) {
+            continue;
+        }
+        Pack->Status = MSRTracksSetText(Pack->Tracks, Track + 1, Card->Text[Track], Card->TextLength[Track]);
+        if (Pack->Status >= 0) {
+            Pack->Status = MSRTracksEncode(Pack->Tracks, Track + 1, Pack->BitsPerChar[Track]);
+        }
+    }
+    if (Pack->Status >= 0) {
+        memset(&Pack->Request, 0, sizeof(Pack->Request));
+        Pack->Request.Type = LIBMSR_REQ_WRITE_RAW;
+        for (Track = 0; Track < 3; ++Track) {
+            MSRTracksGetRaw(Pack->Tracks, Track + 1, &Raw, &Length);
+            Pack->Request.TrackBuffers[Track] = Length ? (BYTE *)Raw : NULL;
+            Pack->Request.TrackLengths[Track] = Length;
+        }
+        Pack->Status = _MSRRequestBuild(&Pack->Request, Pack->Frame, &Pack->FrameLength);
+    }
+    Pack->Time = _MSRGetTime() - Start;
+}
+
+static void LIBMSRDECL _MSRJobWorker(void *Arg)
+{
+    MSRJOBWORKER *Worker = (MSRJOBWORKER *)Arg;
+
+    for (;;) {
+        _MSRSemaphoreWait(&Worker->Start);
+        if (!Worker->Pack) {
+            break;
+        }
+        _MSRJobPack(Worker->Pack);
+        _MSRSemaphorePost(&Worker->Done);
+    }
+}
+
+/* Send the packed command; on a threaded handle this runs on its I/O thread */
+static LIBMSRSTATUS LIBMSRDECL _MSRJobWrite(LPMSRCONTEXT Context, void *Arg)
+{
+    MSRJOBPACK *Pack = (MSRJOBPACK *)Arg;
+
+    return _MSRExecuteFrame(Context, &Pack->Request, Pack->Frame, Pack->FrameLength);
+}
+
+/* Raw reads come back with the first bit of each character in its top bit, while raw writes take it in bit 0 */
+static BYTE LIBMSRDECL _MSRJobWriteForm(BYTE Raw, UINT BitsPerChar)
+{
+    BYTE Value = 0;
+    UINT i;
+
+    for (i = 0; i < BitsPerChar; ++i) {
+        Value |= ((Raw >> (BitsPerChar - 1 - i)) & 1) << i;
+    }
+    return Value;
+}
+
+/* Skip the blank characters in front of the data, as MSRValidateTrack does */
+static SIZE_T LIBMSRDECL _MSRJobSkipBlanks(const BYTE **ppData, SIZE_T Length, UINT BitsPerChar)
+{
+    BYTE CharBits = (BYTE)((1 << BitsPerChar) - 1);
+
+    while (Length && !(**ppData & CharBits)) {
+        ++*ppData;
+        --Length;
+    }
+    return Length;
+}
+
+/* Compare what was read back with what was written, byte for byte in the form written.
+ * The device reads blank characters on either side of the data; those are not compared,
+ * but what follows the data must be blank.
+ */
+static BOOL LIBMSRDECL _MSRJobVerified(LIBMSRTRACKS Written, LIBMSRTRACKS ReadBack, const UINT *BitsPerChar)
+{
+    const BYTE *Expected, *Actual;
+    SIZE_T ExpectedLength, ActualLength;
+    SIZE_T i;
+    UINT Track;
+
+    for (Track = 1; Track <= 3; ++Track) {
+        MSRTracksGetRaw(Written, Track, &Expected, &ExpectedLength);
+        if (!ExpectedLength) {
+            continue;
+        }
+        ExpectedLength = _MSRJobSkipBlanks(&Expected, ExpectedLength, BitsPerChar[Track - 1]);
+        MSRTracksGetRaw(ReadBack, Track, &Actual, &ActualLength);
+        ActualLength = _MSRJobSkipBlanks(&Actual, ActualLength, BitsPerChar[Track - 1]);
+        if (ActualLength < ExpectedLength) {
+            return FALSE;
+        }
+        for (i = 0; i < ActualLength; ++i) {
+            if (_MSRJobWriteForm(Actual[i], BitsPerChar[Track - 1]) != (i < ExpectedLength ? Expected[i] : 0)) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/* Failures a fresh swipe may fix; anything else stops the job */
+static BOOL LIBMSRDECL _MSRJobRetryable(LIBMSRSTATUS Status)
+{
+    switch (Status) {
+    case LIBMSR_TIMEOUT:
+    case LIBMSR_BUFFER_TOO_SMALL:
+    case LIBMSR_DEVICE_UNEXPECTED_RESPONSE:
+    case LIBMSR_DEVICE_COMMAND_FAILED:
+    case LIBMSR_DEVICE_VERIFY_FAILED:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* Write and verify one packed card; returns a status that stops the job, if any */
+static LIBMSRSTATUS LIBMSRDECL _MSRJobCard(LIBMSRHANDLE Handle, LIBMSRJOBCARD *Card, SIZE_T Index, MSRJOBPACK *Pack,
+    LIBMSRTRACKS ReadBack, const LIBMSRJOBOPTIONS *Options, LIBMSRJOBSTATS *Stats, UINT *pVerifyReads)
+{
+    LIBMSRSTATUS Status;
+    MSRTIME Start;
+
+    for (;;) {
+        Card->Attempts++;
+        Stats->Attempts++;
+
+        if (Options->Callback) {
+            Options->Callback(Options->Context, Index, Card, LIBMSR_JOB_WRITE);
+        }
+        Start = _MSRGetTime();
+        Status = _MSRCall((LPMSRCONTEXT)Handle, _MSRJobWrite, Pack);
+        Stats->WriteTime += _MSRGetTime() - Start;
+
+        if (Status >= 0) {
+            if (Options->Callback) {
+                Options->Callback(Options->Context, Index, Card, LIBMSR_JOB_VERIFY);
+            }
+            Start = _MSRGetTime();
+            Status = MSRCardReadRawTracks(Handle, ReadBack);
+            Stats->VerifyTime += _MSRGetTime() - Start;
+            (*pVerifyReads)++;
+            if (Status >= 0 && !_MSRJobVerified(Pack->Tracks, ReadBack, Options->BitsPerChar)) {
+                Status = LIBMSR_DEVICE_VERIFY_FAILED;
+                Stats->VerifyFailures++;
+            }
+        }
+
+        Card->Status = Status;
+        if (Status >= 0) {
+            return LIBMSR_OK;
+        }
+        if (!_MSRJobRetryable(Status)) {
+            return Status;
+        }
+        if (Card->Attempts >= Options->MaxAttempts) {
+            return LIBMSR_OK;
+        }
+        if (Options->Callback) {
+            Options->Callback(Options->Context, Index, Card, LIBMSR_JOB_RETRY);
+        }
+    }
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJobRun(LIBMSRHANDLE Handle, LIBMSRJOBCARD Cards[], SIZE_T Count,
+    const LIBMSRJOBOPTIONS *pOptions, LIBMSRJOBSTATS *pStats)
+{
+    static const UINT DefaultBitsPerChar[3] = { 7, 5, 5 };
+    LIBMSRJOBOPTIONS Options;
+    LIBMSRJOBSTATS Stats;
+    LIBMSRCONFIG Config;
+    MSRJOBPACK Packs[2];
+    MSRJOBPACK *Pack, *NextPack;
+    LIBMSRTRACKS ReadBack;
+    MSRJOBWORKER Worker;
+    MSRTHREAD WorkerThread;
+    BOOL WorkerStarted = FALSE;
+    LIBMSRSTATUS Status;
+    MSRTIME Start;
+    UINT VerifyReads = 0;
+    UINT Track;
+    SIZE_T i;
+
+    memset(&Options, 0, sizeof(Options));
+    if (pOptions) {
+        Options = *pOptions;
+    }
+    for (Track = 0; Track < 3; ++Track) {
+        if (!Options.BitsPerChar[Track]) {
+            Options.BitsPerChar[Track] = DefaultBitsPerChar[Track];
+        }
+    }
+    if (!Options.MaxAttempts) {
+        Options.MaxAttempts = MSR_JOB_DEFAULT_ATTEMPTS;
+    }
+    memset(&Stats, 0, sizeof(Stats));
+    Start = _MSRGetTime();
+
+    /* The device must pack characters the way the job does; nothing is sent if it already does */
+    memset(&Config, 0, sizeof(Config));
+    Config.Fields = LIBMSR_CONFIG_BPC;
+    for (Track = 0; Track < 3; ++Track) {
+        Config.BitsPerChar[Track] = (BYTE)Options.BitsPerChar[Track];
+    }
+    Status = MSRApplyConfig(Handle, &Config);
+    if (Status < 0) {
+        for (i = 0; i < Count; ++i) {
+            Cards[i].Status = LIBMSR_CANCELLED;
+            Cards[i].Attempts = 0;
+        }
+        goto fail0;
+    }
+
+    memset(Packs, 0, sizeof(Packs));
+    Status = MSRTracksCreate(0, &Packs[0].Tracks);
+    if (Status < 0) {
+        goto fail0;
+    }
+    Status = MSRTracksCreate(0, &Packs[1].Tracks);
+    if (Status < 0) {
+        goto fail1;
+    }
+    Status = MSRTracksCreate(0, &ReadBack);
+    if (Status < 0) {
+        goto fail2;
+    }
+    Packs[0].BitsPerChar = Options.BitsPerChar;
+    Packs[1].BitsPerChar = Options.BitsPerChar;
+
+    /* Without a worker, each card is packed in turn on this thread */
+    if (Count > 1 && _MSRSemaphoreInit(&Worker.Start) >= 0) {
+        if (_MSRSemaphoreInit(&Worker.Done) >= 0) {
+            WorkerStarted = _MSRThreadCreate(_MSRJobWorker, &Worker, &WorkerThread) >= 0;
+            if (!WorkerStarted) {
+                _MSRSemaphoreDelete(&Worker.Done);
+            }
+        }
+        if (!WorkerStarted) {
+            _MSRSemaphoreDelete(&Worker.Start);
+        }
+    }
+
+    if (Count) {
+        Packs[0].Card = &Cards[0];
+        _MSRJobPack(&Packs[0]);
+        Stats.EncodeTime += Packs[0].Time;
+    }
+    for (i = 0; i < Count; ++i) {
+        Pack = &Packs[i & 1];
+        NextPack = &Packs[(i + 1) & 1];
+
+        /* Pack the next card while this one is being swiped */
+        if (i + 1 < Count) {
+            NextPack->Card = &Cards[i + 1];
+            if (WorkerStarted) {
+                Worker.Pack = NextPack;
+                _MSRSemaphorePost(&Worker.Start);
+            }
+        }
+
+        Cards[i].Attempts = 0;
+        if (Pack->Status < 0) {
+            /* Text that cannot be encoded will not get better by retrying */
+            Cards[i].Status = Pack->Status;
+        }
+        else {
+            Status = _MSRJobCard(Handle, &Cards[i], i, Pack, ReadBack, &Options, &Stats, &VerifyReads);
+        }
+        if (Cards[i].Status >= 0) {
+            Stats.Cards++;
+        }
+        else {
+            Stats.Failed++;
+        }
+        if (Options.Callback) {
+            Options.Callback(Options.Context, i, &Cards[i], LIBMSR_JOB_DONE);
+        }
+
+        if (i + 1 < Count) {
+            if (WorkerStarted) {
+                _MSRSemaphoreWait(&Worker.Done);
+            }
+            else {
+                _MSRJobPack(NextPack);
+            }
+            Stats.EncodeTime += NextPack->Time;
+        }
+        if (Status < 0) {
+            /* The rest of the queue was never attempted */
+            for (++i; i < Count; ++i) {
+                Cards[i].Status = LIBMSR_CANCELLED;
+                Cards[i].Attempts = 0;
+            }
+            break;
+        }
+    }
+
+    Stats.ElapsedTime = _MSRGetTime() - Start;
+    if (Stats.ElapsedTime) {
+        Stats.CardsPerMinute = Stats.Cards * 60000.0 / Stats.ElapsedTime;
+    }
+    if (VerifyReads) {
+        Stats.VerifyFailureRate = (double)Stats.VerifyFailures / VerifyReads;
+    }
+    if (pStats) {
+        *pStats = Stats;
+    }
+
+    if (WorkerStarted) {
+        Worker.Pack = NULL;
+        _MSRSemaphorePost(&Worker.Start);
+        _MSRThreadJoin(WorkerThread);
+        _MSRSemaphoreDelete(&Worker.Done);
+        _MSRSemaphoreDelete(&Worker.Start);
+    }
+    MSRTracksDestroy(ReadBack);
+fail2:
+    MSRTracksDestroy(Packs[1].Tracks);
+fail1:
+    MSRTracksDestroy(Packs[0].Tracks);
+fail0:
+    return Status;
+}
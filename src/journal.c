@@ -0,0 +1,608 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+/*
+ * The journal file is a header followed by records back to back; the index file
+ * is a header followed by one fixed-size entry per record, in the same order.
+ * Both headers hold the committed extent: anything past it is an append that was
+ * never committed and gets overwritten. Files grow in large steps and are cut
+ * back to the committed size on close.
+ */
+
+#define MSR_JOURNAL_MAGIC 0x4A52534D        /* "MSRJ" */
+#define MSR_JOURNAL_INDEX_MAGIC 0x4952534D  /* "MSRI" */
+#define MSR_JOURNAL_VERSION 1
+#define MSR_JOURNAL_MIN_GROWTH (1 << 20)
+#define MSR_JOURNAL_INDEX_MIN_GROWTH (64 << 10)
+
+typedef struct {
+    UINT Magic;
+    UINT Version;
+    /* Data: end of the committed records; index: committed entry count */
+    ULONGLONG Committed;
+    ULONGLONG Reserved[6];
+} MSRJOURNALHEADER;
+
+typedef struct {
+    /* Whole record, padded to 8 bytes */
+    UINT Size;
+    UINT Type;
+    ULONGLONG Time;
+    UINT DeviceId;
+    LIBMSRSTATUS Status;
+    UINT TrackLengths[3];
+    UINT Reserved;
+} MSRJOURNALRECORD;
+
+typedef struct {
+    ULONGLONG Time;
+    ULONGLONG Offset;
+    UINT DeviceId;
+    UINT Size;
+} MSRJOURNALENTRY;
+
+/* Positions of one device's records, kept in memory */
+typedef struct {
+    UINT DeviceId;
+    SIZE_T Count;
+    SIZE_T Capacity;
+    SIZE_T *Positions;
+} MSRJOURNALDEVICE;
+
+typedef struct _MSRJOURNAL {
+    MSRLOCK Lock;
+    MSRFILEMAP Data;
+    MSRFILEMAP Index;
+    /* Appended and committed extents */
+    SIZE_T End;
+    SIZE_T CommittedEnd;
+    SIZE_T Count;
+    SIZE_T CommittedCount;
+    ULONGLONG LastTime;
+    /* When the oldest pending record was appended */
+    MSRTIME GroupStart;
+    /* Sorted by DeviceId */
+    MSRJOURNALDEVICE *Devices;
+    SIZE_T DeviceCount;
+    SIZE_T DeviceCapacity;
+} MSRJOURNAL, *LPMSRJOURNAL;
+
+#define MSR_JOURNAL_ENTRIES(Journal) ((MSRJOURNALENTRY *)((Journal)->Index.View + sizeof(MSRJOURNALHEADER)))
+
+/* Make room for Needed elements, doubling the capacity */
+static BOOL _MSRGrowArray(void **pArray, SIZE_T *pCapacity, SIZE_T Needed, SIZE_T ElementSize)
+{
+    SIZE_T Capacity = *pCapacity ? *pCapacity : 16;
+    void *Array;
+
+    if (Needed <= *pCapacity) {
+        return TRUE;
+    }
+    while (Capacity < Needed) {
+        Capacity *= 2;
+    }
+    Array = _MSRAlloc(Capacity * ElementSize);
+    if (!Array) {
+        return FALSE;
+    }
+    if (*pArray) {
+        memcpy(Array, *pArray, *pCapacity * ElementSize);
+        _MSRFree(*pArray);
+    }
+    *pArray = Array;
+    *pCapacity = Capacity;
+    return TRUE;
+}
+
+static MSRJOURNALDEVICE *_MSRJournalFindDevice(LPMSRJOURNAL Journal, UINT DeviceId, SIZE_T *pSlot)
+{
+    SIZE_T Low = 0, High = Journal->DeviceCount;
+
+    while (Low < High) {
+        SIZE_T Mid = (Low + High) / 2;
+
+        if (Journal->Devices[Mid].DeviceId < DeviceId) {
+            Low = Mid + 1;
+        }
+        else {
+            High = Mid;
+        }
+    }
+    *pSlot = Low;
+    if (Low < Journal->DeviceCount && Journal->Devices[Low].DeviceId == DeviceId) {
+        return &Journal->Devices[Low];
+    }
+    return NULL;
+}
+
+static LIBMSRSTATUS _MSRJournalIndexDevice(LPMSRJOURNAL Journal, UINT DeviceId, SIZE_T Position)
+{
+    MSRJOURNALDEVICE *Device;
+    SIZE_T Slot;
+
+    Device = _MSRJournalFindDevice(Journal, DeviceId, &Slot);
+    if (!Device) {
+        if (!_MSRGrowArray((void **)&Journal->Devices, &Journal->DeviceCapacity, Journal->DeviceCount + 1, sizeof(MSRJOURNALDEVICE))) {
+            return LIBMSR_MEM_ALLOC_FAILED;
+        }
+        Device = &Journal->Devices[Slot];
+        memmove(Device + 1, Device, (Journal->DeviceCount - Slot) * sizeof(MSRJOURNALDEVICE));
+        memset(Device, 0, sizeof(*Device));
+        Device->DeviceId = DeviceId;
+        Journal->DeviceCount++;
+    }
+    if (!_MSRGrowArray((void **)&Device->Positions, &Device->Capacity, Device->Count + 1, sizeof(SIZE_T))) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Device->Positions[Device->Count++] = Position;
+    return LIBMSR_OK;
+}
+
+/* Grow a file so it holds at least Needed bytes */
+static LIBMSRSTATUS _MSRJournalReserve(MSRFILEMAP *Map, SIZE_T Needed, SIZE_T MinGrowth)
+{
+    SIZE_T Size;
+
+    if (Needed <= Map->Size) {
+        return LIBMSR_OK;
+    }
+    Size = Map->Size + (Map->Size / 2 > MinGrowth ? Map->Size / 2 : MinGrowth);
+    if (Size < Needed) {
+        Size = Needed;
+    }
+    return _MSRMapResize(Map, Size);
+}
+
+static LIBMSRSTATUS _MSRJournalAddEntry(LPMSRJOURNAL Journal, const MSRJOURNALRECORD *Record, SIZE_T Offset)
+{
+    MSRJOURNALENTRY *Entry;
+    LIBMSRSTATUS Status;
+
+    Status = _MSRJournalReserve(&Journal->Index,
+        sizeof(MSRJOURNALHEADER) + (Journal->Count + 1) * sizeof(MSRJOURNALENTRY), MSR_JOURNAL_INDEX_MIN_GROWTH);
+    if (Status < 0) {
+        return Status;
+    }
+    Status = _MSRJournalIndexDevice(Journal, Record->DeviceId, Journal->Count);
+    if (Status < 0) {
+        return Status;
+    }
+    Entry = &MSR_JOURNAL_ENTRIES(Journal)[Journal->Count++];
+    Entry->Time = Record->Time;
+    Entry->Offset = Offset;
+    Entry->DeviceId = Record->DeviceId;
+    Entry->Size = Record->Size;
+    Journal->LastTime = Record->Time;
+    return LIBMSR_OK;
+}
+
+/* Publish pending records: data and entries first, then the headers that cover them */
+static LIBMSRSTATUS _MSRJournalCommit(LPMSRJOURNAL Journal, BOOL Wait)
+{
+    MSRJOURNALHEADER *Header;
+    SIZE_T EntryStart = sizeof(MSRJOURNALHEADER) + Journal->CommittedCount * sizeof(MSRJOURNALENTRY);
+    LIBMSRSTATUS Status;
+
+    Status = _MSRMapFlush(&Journal->Data, Journal->CommittedEnd, Journal->End - Journal->CommittedEnd, Wait);
+    if (Status >= 0) {
+        Status = _MSRMapFlush(&Journal->Index, EntryStart,
+            (Journal->Count - Journal->CommittedCount) * sizeof(MSRJOURNALENTRY), Wait);
+    }
+    if (Status < 0) {
+        return Status;
+    }
+    Header = (MSRJOURNALHEADER *)Journal->Data.View;
+    Header->Committed = Journal->End;
+    Header = (MSRJOURNALHEADER *)Journal->Index.View;
+    Header->Committed = Journal->Count;
+    Status = _MSRMapFlush(&Journal->Data, 0, sizeof(MSRJOURNALHEADER), Wait);
+    if (Status >= 0) {
+        Status = _MSRMapFlush(&Journal->Index, 0, sizeof(MSRJOURNALHEADER), Wait);
+    }
+    Journal->CommittedEnd = Journal->End;
+    Journal->CommittedCount = Journal->Count;
+    return Status;
+}
+
+static LIBMSRSTATUS _MSRJournalInitHeader(MSRFILEMAP *Map, UINT Magic, ULONGLONG Committed, SIZE_T MinGrowth)
+{
+    MSRJOURNALHEADER *Header;
+    LIBMSRSTATUS Status;
+
+    Status = _MSRJournalReserve(Map, MinGrowth, MinGrowth);
+    if (Status < 0) {
+        return Status;
+    }
+    Header = (MSRJOURNALHEADER *)Map->View;
+    memset(Header, 0, sizeof(*Header));
+    Header->Magic = Magic;
+    Header->Version = MSR_JOURNAL_VERSION;
+    Header->Committed = Committed;
+    return LIBMSR_OK;
+}
+
+/* Bring the index in line with the committed records, scanning whatever it misses */
+static LIBMSRSTATUS _MSRJournalLoadIndex(LPMSRJOURNAL Journal)
+{
+    const MSRJOURNALHEADER *Header = (const MSRJOURNALHEADER *)Journal->Index.View;
+    const MSRJOURNALENTRY *Entries;
+    const MSRJOURNALRECORD *Record;
+    SIZE_T Count = 0;
+    SIZE_T Position;
+    SIZE_T i;
+    LIBMSRSTATUS Status;
+
+    if (Journal->Index.Size >= sizeof(MSRJOURNALHEADER) &&
+        Header->Magic == MSR_JOURNAL_INDEX_MAGIC && Header->Version == MSR_JOURNAL_VERSION) {
+        Count = (SIZE_T)Header->Committed;
+        if (Count > (Journal->Index.Size - sizeof(MSRJOURNALHEADER)) / sizeof(MSRJOURNALENTRY)) {
+            Count = 0;
+        }
+    }
+    else {
+        Status = _MSRJournalInitHeader(&Journal->Index, MSR_JOURNAL_INDEX_MAGIC, 0, MSR_JOURNAL_INDEX_MIN_GROWTH);
+        if (Status < 0) {
+            return Status;
+        }
+    }
+
+    /* Entries for records that were never committed are dropped */
+    Entries = MSR_JOURNAL_ENTRIES(Journal);
+    while (Count > 0 && Entries[Count - 1].Offset + Entries[Count - 1].Size > Journal->End) {
+        Count--;
+    }
+    for (i = 0; i < Count; ++i) {
+        Status = _MSRJournalIndexDevice(Journal, Entries[i].DeviceId, i);
+        if (Status < 0) {
+            return Status;
+        }
+    }
+    Journal->Count = Count;
+    Journal->LastTime = Count ? Entries[Count - 1].Time : 0;
+
+    Position = Count ? (SIZE_T)(Entries[Count - 1].Offset + Entries[Count - 1].Size) : sizeof(MSRJOURNALHEADER);
+    while (Position < Journal->End) {
+        Record = (const MSRJOURNALRECORD *)(Journal->Data.View + Position);
+        if (Journal->End - Position < sizeof(MSRJOURNALRECORD) || Record->Size < sizeof(MSRJOURNALRECORD) ||
+            Record->Size > Journal->End - Position) {
+            return LIBMSR_FILE_CORRUPT;
+        }
+        Status = _MSRJournalAddEntry(Journal, Record, Position);
+        if (Status < 0) {
+            return Status;
+        }
+        Position += Record->Size;
+    }
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalOpen(LPTSTR Path, LIBMSRJOURNAL *pJournal)
+{
+    LPMSRJOURNAL Journal;
+    const MSRJOURNALHEADER *Header;
+    LIBMSRSTATUS Status;
+    UINT i;
+
+    Journal = _MSRAlloc(sizeof(*Journal));
+    if (!Journal) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Status = _MSRMapOpen(Path, TEXT(""), &Journal->Data);
+    if (Status < 0) {
+        goto fail1;
+    }
+    Status = _MSRMapOpen(Path, TEXT(".idx"), &Journal->Index);
+    if (Status < 0) {
+        goto fail2;
+    }
+
+    if (Journal->Data.Size == 0) {
+        Status = _MSRJournalInitHeader(&Journal->Data, MSR_JOURNAL_MAGIC, sizeof(MSRJOURNALHEADER), MSR_JOURNAL_MIN_GROWTH);
+        if (Status < 0) {
+            goto fail3;
+        }
+    }
+    Header = (const MSRJOURNALHEADER *)Journal->Data.View;
+    if (Journal->Data.Size < sizeof(MSRJOURNALHEADER) || Header->Magic != MSR_JOURNAL_MAGIC ||
+        Header->Version != MSR_JOURNAL_VERSION || Header->Committed < sizeof(MSRJOURNALHEADER) ||
+        Header->Committed > Journal->Data.Size) {
+        Status = LIBMSR_FILE_CORRUPT;
+        goto fail3;
+    }
+    Journal->End = (SIZE_T)Header->Committed;
+
+    Status = _MSRJournalLoadIndex(Journal);
+    if (Status < 0) {
+        goto fail4;
+    }
+    Status = _MSRJournalCommit(Journal, TRUE);
+    if (Status < 0) {
+        goto fail4;
+    }
+    _MSRLockInit(&Journal->Lock);
+    *pJournal = Journal;
+    return LIBMSR_OK;
+
+fail4:
+    for (i = 0; i < Journal->DeviceCount; ++i) {
+        _MSRFree(Journal->Devices[i].Positions);
+    }
+    _MSRFree(Journal->Devices);
+fail3:
+    /* Leave the files as they were found */
+    _MSRMapClose(&Journal->Index, Journal->Index.Size);
+fail2:
+    _MSRMapClose(&Journal->Data, Journal->Data.Size);
+fail1:
+    _MSRFree(Journal);
+    return Status;
+}
+
+void LIBMSRAPI MSRJournalClose(LIBMSRJOURNAL Handle)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+    SIZE_T i;
+
+    _MSRJournalCommit(Journal, TRUE);
+    _MSRMapClose(&Journal->Index, sizeof(MSRJOURNALHEADER) + Journal->Count * sizeof(MSRJOURNALENTRY));
+    _MSRMapClose(&Journal->Data, Journal->End);
+    for (i = 0; i < Journal->DeviceCount; ++i) {
+        _MSRFree(Journal->Devices[i].Positions);
+    }
+    _MSRFree(Journal->Devices);
+    _MSRLockDelete(&Journal->Lock);
+    _MSRFree(Journal);
+}
+
+static LIBMSRSTATUS _MSRJournalAppend(LPMSRJOURNAL Journal, UINT DeviceId, UINT Type, LIBMSRSTATUS Status,
+    const BYTE *const Tracks[3], const SIZE_T TrackLengths[3])
+{
+    MSRJOURNALRECORD *Record;
+    SIZE_T Size = sizeof(MSRJOURNALRECORD);
+    SIZE_T Position;
+    ULONGLONG Now;
+    BYTE *Ptr;
+    UINT i;
+    LIBMSRSTATUS Result;
+
+    for (i = 0; i < 3; ++i) {
+        if (TrackLengths[i] > 0xFFFF || (TrackLengths[i] && !Tracks[i])) {
+            return LIBMSR_INVALID_ARGUMENT;
+        }
+        Size += TrackLengths[i];
+    }
+    Size = (Size + 7) & ~(SIZE_T)7;
+
+    _MSRLock(&Journal->Lock);
+    Result = _MSRJournalReserve(&Journal->Data, Journal->End + Size, MSR_JOURNAL_MIN_GROWTH);
+    if (Result < 0) {
+        goto done;
+    }
+    Position = Journal->End;
+    Record = (MSRJOURNALRECORD *)(Journal->Data.View + Position);
+    Now = _MSRGetWallTime();
+    Record->Size = (UINT)Size;
+    Record->Type = Type;
+    Record->Time = Now > Journal->LastTime ? Now : Journal->LastTime;
+    Record->DeviceId = DeviceId;
+    Record->Status = Status;
+    Record->Reserved = 0;
+    Ptr = (BYTE *)(Record + 1);
+    for (i = 0; i < 3; ++i) {
+        Record->TrackLengths[i] = (UINT)TrackLengths[i];
+        if (TrackLengths[i]) {
+            memcpy(Ptr, Tracks[i], TrackLengths[i]);
+            Ptr += TrackLengths[i];
+        }
+    }
+    memset(Ptr, 0, (BYTE *)Record + Size - Ptr);
+
+    Result = _MSRJournalAddEntry(Journal, Record, Position);
+    if (Result < 0) {
+        goto done;
+    }
+    Journal->End += Size;
+
+    if (Journal->Count - Journal->CommittedCount == 1) {
+        Journal->GroupStart = _MSRGetTime();
+    }
+    if (Journal->Count - Journal->CommittedCount >= LIBMSR_JOURNAL_GROUP_RECORDS ||
+        _MSRGetTime() - Journal->GroupStart >= LIBMSR_JOURNAL_GROUP_MS) {
+        Result = _MSRJournalCommit(Journal, FALSE);
+    }
+
+done:
+    _MSRUnlock(&Journal->Lock);
+    return Result;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalAppend(LIBMSRJOURNAL Journal, const LIBMSRJOURNALRECORD *pRecord)
+{
+    return _MSRJournalAppend((LPMSRJOURNAL)Journal, pRecord->DeviceId, pRecord->Type, pRecord->Status,
+        pRecord->Tracks, pRecord->TrackLengths);
+}
+
+void LIBMSRDECL _MSRJournalNote(LPMSRCONTEXT Context, const LIBMSRREQUEST *Request, LIBMSRSTATUS Status)
+{
+    const BYTE *Tracks[3];
+    UINT i;
+
+    if (Request->Type != LIBMSR_REQ_READ_RAW && Request->Type != LIBMSR_REQ_WRITE_RAW) {
+        return;
+    }
+    for (i = 0; i < 3; ++i) {
+        Tracks[i] = Request->TrackBuffers[i];
+    }
+    /* The card operation has already happened; a journal failure cannot undo it */
+    _MSRJournalAppend(Context->Journal, Context->JournalDeviceId, Request->Type, Status, Tracks, Request->TrackLengths);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRSetJournal(LIBMSRHANDLE Handle, LIBMSRJOURNAL Journal, UINT DeviceId)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+
+    Context->Journal = (LPMSRJOURNAL)Journal;
+    Context->JournalDeviceId = DeviceId;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalCommit(LIBMSRJOURNAL Handle)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+    LIBMSRSTATUS Status;
+
+    _MSRLock(&Journal->Lock);
+    Status = _MSRJournalCommit(Journal, FALSE);
+    _MSRUnlock(&Journal->Lock);
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalSync(LIBMSRJOURNAL Handle)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+    LIBMSRSTATUS Status;
+
+    _MSRLock(&Journal->Lock);
+    Status = _MSRJournalCommit(Journal, TRUE);
+    _MSRUnlock(&Journal->Lock);
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalGetCount(LIBMSRJOURNAL Handle, SIZE_T *pCount)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+
+    _MSRLock(&Journal->Lock);
+    *pCount = Journal->Count;
+    _MSRUnlock(&Journal->Lock);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalGetRecord(LIBMSRJOURNAL Handle, SIZE_T Index, LIBMSRJOURNALRECORD *pRecord,
+    BYTE *Buffer, SIZE_T Capacity)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+    const MSRJOURNALRECORD *Record;
+    const BYTE *Ptr;
+    SIZE_T Length = 0;
+    UINT i;
+
+    /* The view moves when an append grows the file, so the data is copied out under the lock */
+    _MSRLock(&Journal->Lock);
+    if (Index >= Journal->Count) {
+        _MSRUnlock(&Journal->Lock);
+        return LIBMSR_NOT_FOUND;
+    }
+    Record = (const MSRJOURNALRECORD *)(Journal->Data.View + MSR_JOURNAL_ENTRIES(Journal)[Index].Offset);
+    pRecord->Time = Record->Time;
+    pRecord->DeviceId = Record->DeviceId;
+    pRecord->Type = Record->Type;
+    pRecord->Status = Record->Status;
+    for (i = 0; i < 3; ++i) {
+        pRecord->TrackLengths[i] = Record->TrackLengths[i];
+        Length += Record->TrackLengths[i];
+    }
+    if (Buffer && Length <= Capacity) {
+        memcpy(Buffer, Record + 1, Length);
+    }
+    _MSRUnlock(&Journal->Lock);
+
+    Ptr = Buffer;
+    for (i = 0; i < 3; ++i) {
+        pRecord->Tracks[i] = Buffer && Length <= Capacity && pRecord->TrackLengths[i] ? Ptr : NULL;
+        Ptr += pRecord->TrackLengths[i];
+    }
+    return Buffer && Length > Capacity ? LIBMSR_BUFFER_TOO_SMALL : LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalFindTime(LIBMSRJOURNAL Handle, ULONGLONG Time, SIZE_T *pIndex)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+    const MSRJOURNALENTRY *Entries;
+    LIBMSRSTATUS Status;
+    SIZE_T Low = 0, High;
+
+    _MSRLock(&Journal->Lock);
+    Entries = MSR_JOURNAL_ENTRIES(Journal);
+    High = Journal->Count;
+    while (Low < High) {
+        SIZE_T Mid = (Low + High) / 2;
+
+        if (Entries[Mid].Time < Time) {
+            Low = Mid + 1;
+        }
+        else {
+            High = Mid;
+        }
+    }
+    *pIndex = Low;
+    Status = Low < Journal->Count ? LIBMSR_OK : LIBMSR_NOT_FOUND;
+    _MSRUnlock(&Journal->Lock);
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalFindDevice(LIBMSRJOURNAL Handle, UINT DeviceId, ULONGLONG Time, SIZE_T *pIndex)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+    const MSRJOURNALENTRY *Entries;
+    const MSRJOURNALDEVICE *Device;
+    LIBMSRSTATUS Status = LIBMSR_NOT_FOUND;
+    SIZE_T Low = 0, High;
+    SIZE_T Slot;
+
+    _MSRLock(&Journal->Lock);
+    Device = _MSRJournalFindDevice(Journal, DeviceId, &Slot);
+    if (Device) {
+        Entries = MSR_JOURNAL_ENTRIES(Journal);
+        High = Device->Count;
+        while (Low < High) {
+            SIZE_T Mid = (Low + High) / 2;
+
+            if (Entries[Device->Positions[Mid]].Time < Time) {
+                Low = Mid + 1;
+            }
+            else {
+                High = Mid;
+            }
+        }
+        if (Low < Device->Count) {
+            *pIndex = Device->Positions[Low];
+            Status = LIBMSR_OK;
+        }
+    }
+    _MSRUnlock(&Journal->Lock);
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRJournalNextForDevice(LIBMSRJOURNAL Handle, SIZE_T Index, SIZE_T *pNext)
+{
+    LPMSRJOURNAL Journal = (LPMSRJOURNAL)Handle;
+    const MSRJOURNALDEVICE *Device;
+    LIBMSRSTATUS Status = LIBMSR_NOT_FOUND;
+    SIZE_T Low = 0, High;
+    SIZE_T Slot;
+
+    _MSRLock(&Journal->Lock);
+    if (Index < Journal->Count) {
+        Device = _MSRJournalFindDevice(Journal, MSR_JOURNAL_ENTRIES(Journal)[Index].DeviceId, &Slot);
+        High = Device->Count;
+        while (Low < High) {
+            SIZE_T Mid = (Low + High) / 2;
+
+            if (Device->Positions[Mid] <= Index) {
+                Low = Mid + 1;
+            }
+            else {
+                High = Mid;
+            }
+        }
+        if (Low < Device->Count) {
+            *pNext = Device->Positions[Low];
+            Status = LIBMSR_OK;
+        }
+    }
+    _MSRUnlock(&Journal->Lock);
+    return Status;
+}
@@ -1,623 +1,959 @@
 #include "libmsr.h"
 #include "internals.h"
 
-LIBMSRSTATUS LIBMSRAPI MSROpen(LPTSTR PortName, LIBMSRHANDLE *pHandle)
+#include <string.h>
+
+LIBMSRSTATUS LIBMSRAPI MSROpenTransport(const LIBMSRTRANSPORT *Transport, void *Port, LIBMSRHANDLE *pHandle)
 {
-    LIBMSRSTATUS Status;
     LPMSRCONTEXT Context;
-    COMMTIMEOUTS Timeouts;
 
-    Context = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*Context));
+    Context = _MSRAlloc(sizeof(*Context));
     if (!Context) {
-        Status = LIBMSR_MEM_ALLOC_FAILED;
-        goto fail0;
+        return LIBMSR_MEM_ALLOC_FAILED;
     }
 
-    Context->PortHandle = CreateFile(
-        PortName,
-        GENERIC_READ | GENERIC_WRITE,
-		0,
-        NULL,
-        OPEN_EXISTING,
-        0,
-        NULL);
-    if (Context->PortHandle == INVALID_HANDLE_VALUE) {
-        Status = LIBMSR_PORT_OPEN_FAILED;
-        goto fail1;
-    }
+    Context->Transport = Transport;
+    Context->Port = Port;
+    Context->Timeouts.InterByteMs = 100;
+    Context->Timeouts.CommandMs = 1000;
+    Context->Timeouts.SwipeMs = 0;
+    Context->RetryPolicy.MaxAttempts = 1;
 
-    Context->PortSettings.DCBlength = sizeof(DCB);
-    if (!GetCommState(Context->PortHandle, &Context->PortSettings)) {
-        Status = LIBMSR_PORT_SETUP_FAILED;
-        goto fail1;
+    *pHandle = (LIBMSRHANDLE)Context;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSROpen(LPTSTR PortName, LIBMSRHANDLE *pHandle)
+{
+    LIBMSRSTATUS Status;
+    const LIBMSRTRANSPORT *Transport;
+    void *Port;
+
+    Status = _MSRSerialOpen(PortName, &Transport, &Port);
+    if (Status < 0) {
+        return Status;
     }
 
-    /* NOTE: All MSRxxx devices seem to use 9600, 8N1*/
-    Context->PortSettings.BaudRate = CBR_9600;
-    Context->PortSettings.fParity = FALSE;
-    Context->PortSettings.ByteSize = 8;
-    Context->PortSettings.Parity = NOPARITY;
-    Context->PortSettings.StopBits = ONESTOPBIT;
-    if (!SetCommState(Context->PortHandle, &Context->PortSettings)) {
-        Status = LIBMSR_PORT_SETUP_FAILED;
-        goto fail1;
+    Status = MSROpenTransport(Transport, Port, pHandle);
+    if (Status < 0) {
+        Transport->Close(Port);
     }
+    return Status;
+}
+
+void LIBMSRAPI MSRClose(LIBMSRHANDLE Handle)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
 
-    if (!SetupComm(Context->PortHandle, 1024, 1024)) {
-        Status = LIBMSR_PORT_SETUP_FAILED;
-        goto fail1;
+    if (_MSRIoCloseLater(Context)) {
+        return;
     }
+    if (Context->IoThread) {
+        MSRStopIoThread(Handle);
+    }
+    Context->Transport->Close(Context->Port);
 
-    /* TODO: Set timeouts */
+    _MSRFree(Context);
+}
 
-    *pHandle = (LIBMSRHANDLE)Context;
+
+LIBMSRSTATUS LIBMSRAPI MSRGetIoCounters(LIBMSRHANDLE Handle, LIBMSRIOCOUNTERS *pCounters)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+
+    *pCounters = Context->Stats.Io;
     return LIBMSR_OK;
+}
 
-fail1:
-    HeapFree(GetProcessHeap(), 0, Context);
+/* The settings below are used by the I/O thread, so on a threaded handle they are
+ * changed there, in line with the commands queued around them.
+ */
+static LIBMSRSTATUS LIBMSRDECL _MSRSetTimeouts(LPMSRCONTEXT Context, void *Arg)
+{
+    Context->Timeouts = *(const LIBMSRTIMEOUTS *)Arg;
+    return LIBMSR_OK;
+}
 
-fail0:
-    return Status;
+LIBMSRSTATUS LIBMSRAPI MSRSetTimeouts(LIBMSRHANDLE Handle, const LIBMSRTIMEOUTS *pTimeouts)
+{
+    return _MSRCall((LPMSRCONTEXT)Handle, _MSRSetTimeouts, (void *)pTimeouts);
 }
 
-void LIBMSRAPI MSRClose(LIBMSRHANDLE Handle)
+LIBMSRSTATUS LIBMSRAPI MSRGetTimeouts(LIBMSRHANDLE Handle, LIBMSRTIMEOUTS *pTimeouts)
 {
     LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
 
-    CloseHandle(Context->PortHandle);
+    *pTimeouts = Context->Timeouts;
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRSetCallTimeout(LPMSRCONTEXT Context, void *Arg)
+{
+    Context->CallTimeout = *(const UINT *)Arg;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRSetCallTimeout(LIBMSRHANDLE Handle, UINT TotalMs)
+{
+    return _MSRCall((LPMSRCONTEXT)Handle, _MSRSetCallTimeout, &TotalMs);
+}
 
-    HeapFree(GetProcessHeap(), 0, Context);
+static LIBMSRSTATUS LIBMSRDECL _MSRSetRetryPolicy(LPMSRCONTEXT Context, void *Arg)
+{
+    Context->RetryPolicy = *(const LIBMSRRETRYPOLICY *)Arg;
+    return LIBMSR_OK;
 }
 
+LIBMSRSTATUS LIBMSRAPI MSRSetRetryPolicy(LIBMSRHANDLE Handle, const LIBMSRRETRYPOLICY *pPolicy)
+{
+    if (pPolicy->MaxAttempts < 1) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    return _MSRCall((LPMSRCONTEXT)Handle, _MSRSetRetryPolicy, (void *)pPolicy);
+}
 
-static LIBMSRSTATUS LIBMSRDECL _MSRSend(LPMSRCONTEXT Context, LPBYTE Buffer, SIZE_T Count)
+/* Pick the total timeout for the call being made, consuming any one-shot override. */
+UINT LIBMSRDECL _MSRTakeCallTimeout(LPMSRCONTEXT Context, BOOL IsSwipe)
 {
-    DWORD BytesWritten;
+    UINT TotalMs;
+
+    if (Context->CallTimeout) {
+        TotalMs = Context->CallTimeout;
+        Context->CallTimeout = 0;
+    }
+    else {
+        TotalMs = IsSwipe ? Context->Timeouts.SwipeMs : Context->Timeouts.CommandMs;
+    }
+    return TotalMs;
+}
+
+static void LIBMSRDECL _MSRSetDeadline(LPMSRCONTEXT Context, UINT TotalMs)
+{
+    Context->Deadline = TotalMs ? _MSRGetTime() + TotalMs : 0;
+}
+
+/* How long the next transport read may block. */
+static UINT LIBMSRDECL _MSRRecvTimeout(LPMSRCONTEXT Context)
+{
+    UINT Timeout = LIBMSR_INFINITE;
+    MSRTIME Now;
+
+    if (Context->Deadline) {
+        Now = _MSRGetTime();
+        Timeout = Now < Context->Deadline ? (UINT)(Context->Deadline - Now) : 0;
+    }
+    if (!Context->AwaitingResponse && Context->Timeouts.InterByteMs && Context->Timeouts.InterByteMs < Timeout) {
+        Timeout = Context->Timeouts.InterByteMs;
+    }
+    return Timeout;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRSend(LPMSRCONTEXT Context, const BYTE *Buffer, SIZE_T Count)
+{
+    LIBMSRSTATUS Status;
+    SIZE_T BytesWritten;
 
     while (Count > 0) {
-        if (!WriteFile(Context->PortHandle, Buffer, Count, &BytesWritten, NULL)) {
-            return LIBMSR_PORT_WRITE_FAILED;
+        Context->Stats.Io.WriteCalls++;
+        Status = Context->Transport->Write(Context->Port, Buffer, Count, &BytesWritten);
+        if (Status < 0) {
+            return Status;
         }
         if (BytesWritten == 0) {
             return LIBMSR_PORT_WRITE_FAILED;
         }
+        Context->Stats.Io.BytesWritten += BytesWritten;
+        _MSRTraceData(Context, LIBMSR_CAPTURE_WRITE, Buffer, BytesWritten);
         Count -= BytesWritten;
         Buffer += BytesWritten;
     }
     return LIBMSR_OK;
 }
 
+/* Issue one transport read of whatever is available, up to Count bytes. */
+LIBMSRSTATUS LIBMSRDECL _MSRRecvSome(LPMSRCONTEXT Context, LPBYTE Buffer, SIZE_T Count, SIZE_T *pBytesRead)
+{
+    LIBMSRSTATUS Status;
+
+    Context->Stats.Io.ReadCalls++;
+    Status = Context->Transport->Read(Context->Port, Buffer, Count, _MSRRecvTimeout(Context), pBytesRead);
+    if (Status >= 0 && *pBytesRead == 0) {
+        Status = LIBMSR_PORT_READ_FAILED;
+    }
+    if (Status < 0) {
+        Context->RecvStatus = Status;
+        return Status;
+    }
+    Context->AwaitingResponse = FALSE;
+    Context->Stats.Io.BytesRead += *pBytesRead;
+    _MSRTraceData(Context, LIBMSR_CAPTURE_READ, Buffer, *pBytesRead);
+    return LIBMSR_OK;
+}
+
+/* Refill the read-ahead buffer; only called when it is empty. */
+LIBMSRSTATUS LIBMSRDECL _MSRRecvFill(LPMSRCONTEXT Context)
+{
+    LIBMSRSTATUS Status;
+    SIZE_T BytesRead;
+
+    Status = _MSRRecvSome(Context, Context->RecvBuffer, sizeof(Context->RecvBuffer), &BytesRead);
+    if (Status < 0) {
+        return Status;
+    }
+    Context->RecvHead = 0;
+    Context->RecvTail = BytesRead;
+    return LIBMSR_OK;
+}
+
 static LIBMSRSTATUS LIBMSRDECL _MSRRecv(LPMSRCONTEXT Context, LPBYTE Buffer, SIZE_T Count)
 {
-    DWORD BytesRead;
+    LIBMSRSTATUS Status;
+    SIZE_T Available;
+    SIZE_T BytesRead;
 
     while (Count > 0) {
-        if (!ReadFile(Context->PortHandle, Buffer, Count, &BytesRead, NULL)) {
-            return LIBMSR_PORT_READ_FAILED;
+        Available = Context->RecvTail - Context->RecvHead;
+        if (Available > 0) {
+            if (Available > Count) {
+                Available = Count;
+            }
+            memcpy(Buffer, Context->RecvBuffer + Context->RecvHead, Available);
+            Context->RecvHead += Available;
+            Count -= Available;
+            Buffer += Available;
+            continue;
         }
-        if (BytesRead == 0) {
-            return LIBMSR_PORT_READ_FAILED;
+        /* Large requests bypass the buffer to avoid a second copy */
+        if (Count >= sizeof(Context->RecvBuffer)) {
+            Status = _MSRRecvSome(Context, Buffer, Count, &BytesRead);
+            if (Status < 0) {
+                return Status;
+            }
+            Count -= BytesRead;
+            Buffer += BytesRead;
+            continue;
+        }
+        Status = _MSRRecvFill(Context);
+        if (Status < 0) {
+            return Status;
         }
-        Count -= BytesRead;
-        Buffer += BytesRead;
     }
     return LIBMSR_OK;
 }
 
 static int LIBMSRDECL _MSRRecvChar(LPMSRCONTEXT Context)
 {
-    BYTE Buffer;
-    DWORD BytesRead;
+    if (Context->RecvHead == Context->RecvTail) {
+        if (_MSRRecvFill(Context) < 0) {
+            return -1;
+        }
+    }
+    return Context->RecvBuffer[Context->RecvHead++];
+}
+
+/* Drop anything received but not consumed yet, both buffered and in the driver. */
+void LIBMSRDECL _MSRPurge(LPMSRCONTEXT Context)
+{
+    Context->RecvHead = 0;
+    Context->RecvTail = 0;
+    Context->RecvStatus = LIBMSR_OK;
+    Context->Transport->Purge(Context->Port);
+}
 
-    if (!ReadFile(Context->PortHandle, &Buffer, 1, &BytesRead, NULL)) {
-        return -1;
+/* Drop what a device sends after a reset: whatever it had already started on keeps
+ * arriving for a moment, so read until the line has been quiet for InterByteMs.
+ * A line that never goes quiet is given up on after a few gaps' worth of time.
+ */
+void LIBMSRDECL _MSRDrain(LPMSRCONTEXT Context)
+{
+    BYTE Buffer[256];
+    SIZE_T BytesRead;
+    MSRTIME Deadline;
+    UINT Gap = Context->Timeouts.InterByteMs;
+
+    _MSRPurge(Context);
+    if (!Gap) {
+        return;
+    }
+    Deadline = _MSRGetTime() + Gap * 8;
+    do {
+        Context->Stats.Io.ReadCalls++;
+        if (Context->Transport->Read(Context->Port, Buffer, sizeof(Buffer), Gap, &BytesRead) < 0 || BytesRead == 0) {
+            break;
+        }
+        Context->Stats.Io.BytesRead += BytesRead;
+        _MSRTraceData(Context, LIBMSR_CAPTURE_READ, Buffer, BytesRead);
+    } while (_MSRGetTime() < Deadline);
+    _MSRPurge(Context);
+}
+
+/* Send a command that gets no answer */
+static LIBMSRSTATUS LIBMSRDECL _MSRDoSendOnly(LPMSRCONTEXT Context, LIBMSRREQUEST *Request)
+{
+    BYTE CommandBuffer[MSR_MAX_COMMAND_LENGTH];
+    SIZE_T CommandLength;
+    LIBMSRSTATUS Status;
+
+    Status = _MSRRequestBuild(Request, CommandBuffer, &CommandLength);
+    if (Status < 0) {
+        return Status;
+    }
+    _MSRStatsCommand(Context, CommandBuffer);
+    Status = _MSRSend(Context, CommandBuffer, CommandLength);
+    if (Status >= 0 && Request->Type == LIBMSR_REQ_RESET) {
+        _MSRDrain(Context);
     }
-    return Buffer;
+    _MSRRequestCompleted(Context, Request, Status);
+    return Status;
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRReset(LIBMSRHANDLE Handle)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
+    LIBMSRREQUEST Request;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x61;
-    /* No answer expected */
-    return _MSRSend(Context, CommandBuffer, 2);
+    /* The device is back to its defaults, whatever they are; the shadow configuration is dropped on completion */
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_RESET;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRLedAllOff(LIBMSRHANDLE Handle)
+static LIBMSRSTATUS LIBMSRDECL _MSRLed(LIBMSRHANDLE Handle, BYTE Command)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
+    LIBMSRREQUEST Request;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x81;
-    /* No answer expected */
-    return _MSRSend(Context, CommandBuffer, 2);
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_LED;
+    Request.Params[0] = Command;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRLedAllOn(LIBMSRHANDLE Handle)
+LIBMSRSTATUS LIBMSRAPI MSRLedAllOff(LIBMSRHANDLE Handle)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
+    return _MSRLed(Handle, 0x81);
+}
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x82;
-    /* No answer expected */
-    return _MSRSend(Context, CommandBuffer, 2);
+LIBMSRSTATUS LIBMSRAPI MSRLedAllOn(LIBMSRHANDLE Handle)
+{
+    return _MSRLed(Handle, 0x82);
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRLedGreenOn(LIBMSRHANDLE Handle)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
-
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x82;
-    /* No answer expected */
-    return _MSRSend(Context, CommandBuffer, 2);
+    return _MSRLed(Handle, 0x83);
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRLedYellowOn(LIBMSRHANDLE Handle)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
-
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x82;
-    /* No answer expected */
-    return _MSRSend(Context, CommandBuffer, 2);
+    return _MSRLed(Handle, 0x84);
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRLedRedOn(LIBMSRHANDLE Handle)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
+    return _MSRLed(Handle, 0x85);
+}
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x82;
-    /* No answer expected */
-    return _MSRSend(Context, CommandBuffer, 2);
+/* Tell a malformed response from one that stopped arriving. */
+static LIBMSRSTATUS LIBMSRDECL _MSRResponseError(LPMSRCONTEXT Context)
+{
+    if (Context->RecvStatus < 0) {
+        return Context->RecvStatus;
+    }
+    return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
 }
 
+/* The caller sets the deadline for the exchange beforehand. */
 static LIBMSRSTATUS LIBMSRDECL _MSRDoSendRecvWithCheck(LPMSRCONTEXT Context, BYTE CommandBuffer[], UINT CommandLength)
 {
     LIBMSRSTATUS Status;
+    ULONGLONG Start;
     int Esc;
 
-    PurgeComm(Context->PortHandle, PURGE_RXCLEAR | PURGE_TXCLEAR);
+    _MSRPurge(Context);
+    _MSRStatsCommand(Context, CommandBuffer);
+    Start = _MSRGetTimeUs();
     Status = _MSRSend(Context, CommandBuffer, CommandLength);
     if (Status < 0) {
         return Status;
     }
+    Context->AwaitingResponse = TRUE;
     Esc = _MSRRecvChar(Context);
     if (Esc != ESC) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
+        return _MSRResponseError(Context);
     }
+    _MSRStatsLatency(&Context->Stats.RoundTrip, Start);
     return LIBMSR_OK;
 }
 
-/* For commands that return 1B 30 or 1B 41 */
-static LIBMSRSTATUS LIBMSRDECL _MSRDoCommandNoData(LPMSRCONTEXT Context, BYTE CommandBuffer[], UINT CommandLength)
+/* Decide whether a failed exchange is worth another attempt, and wait before it. */
+static BOOL LIBMSRDECL _MSRRetryWait(LPMSRCONTEXT Context, LIBMSRSTATUS Status, UINT Attempt, UINT *pBackoff)
+{
+    if (Attempt >= Context->RetryPolicy.MaxAttempts) {
+        return FALSE;
+    }
+    if (Status != LIBMSR_TIMEOUT && Status != LIBMSR_DEVICE_UNEXPECTED_RESPONSE) {
+        return FALSE;
+    }
+    _MSRSleep(*pBackoff);
+    *pBackoff *= 2;
+    /* A zero cap means no cap */
+    if (Context->RetryPolicy.MaxBackoffMs && *pBackoff > Context->RetryPolicy.MaxBackoffMs) {
+        *pBackoff = Context->RetryPolicy.MaxBackoffMs;
+    }
+    return TRUE;
+}
+
+/* Send a command that answers at once and collect the ReplyLength bytes after the ESC.
+ * Only used for idempotent commands, so failed exchanges are retried per the handle's policy.
+ */
+static LIBMSRSTATUS LIBMSRDECL _MSRTransact(LPMSRCONTEXT Context, BYTE CommandBuffer[], UINT CommandLength, BYTE Reply[], UINT ReplyLength)
 {
     LIBMSRSTATUS Status;
-    int ReportedStatus;
+    UINT TotalMs;
+    UINT Attempt;
+    UINT Backoff;
+
+    TotalMs = _MSRTakeCallTimeout(Context, FALSE);
+    Backoff = Context->RetryPolicy.InitialBackoffMs;
+    for (Attempt = 1;; ++Attempt) {
+        _MSRSetDeadline(Context, TotalMs);
+        Status = _MSRDoSendRecvWithCheck(Context, CommandBuffer, CommandLength);
+        if (Status >= 0) {
+            Status = _MSRRecv(Context, Reply, ReplyLength);
+        }
+        if (Status >= 0 || !_MSRRetryWait(Context, Status, Attempt, &Backoff)) {
+            break;
+        }
+    }
+    return Status;
+}
 
-    Status = _MSRDoSendRecvWithCheck(Context, CommandBuffer, CommandLength);
+/* Run a configuration request synchronously and keep the shadow configuration up to date */
+static LIBMSRSTATUS LIBMSRDECL _MSRDoRequest(LPMSRCONTEXT Context, LIBMSRREQUEST *Request)
+{
+    BYTE CommandBuffer[MSR_MAX_COMMAND_LENGTH];
+    SIZE_T CommandLength;
+    UINT ReplyLength;
+    LIBMSRSTATUS Status;
+
+    if (Context->Remote) {
+        return _MSRRemoteExecute(Context, Request, 1);
+    }
+    Status = _MSRRequestBuild(Request, CommandBuffer, &CommandLength);
     if (Status < 0) {
         return Status;
     }
-    ReportedStatus = _MSRRecvChar(Context);
-    if (ReportedStatus != 0x30) {
-        return LIBMSR_DEVICE_COMMAND_FAILED;
+    _MSRRequestResponseKind(Request->Type, &ReplyLength);
+    Status = _MSRTransact(Context, CommandBuffer, (UINT)CommandLength, Request->Reply, ReplyLength);
+    if (Status >= 0) {
+        Status = _MSRRequestCheckReply(Request->Type, Request->Reply);
+    }
+    _MSRRequestCompleted(Context, Request, Status);
+    return Status;
+}
+
+void LIBMSRDECL _MSRRequestCompleted(LPMSRCONTEXT Context, const LIBMSRREQUEST *Request, LIBMSRSTATUS Status)
+{
+    _MSRConfigNote(Context, Request, Status);
+    if (Status < 0) {
+        _MSRStatsError(Context, Status);
+        _MSRTraceError(Context, Status);
+    }
+    if (Context->Journal) {
+        _MSRJournalNote(Context, Request, Status);
+    }
+}
+
+void LIBMSRDECL _MSRConfigNote(LPMSRCONTEXT Context, const LIBMSRREQUEST *Request, LIBMSRSTATUS Status)
+{
+    MSRSHADOWCONFIG *Config = &Context->Config;
+    UINT Track;
+
+    switch (Request->Type) {
+    case LIBMSR_REQ_RESET:
+        memset(Config, 0, sizeof(*Config));
+        break;
+    case LIBMSR_REQ_SET_BPC:
+        Config->Valid &= ~LIBMSR_CONFIG_BPC;
+        if (Status >= 0) {
+            memcpy(Config->BitsPerChar, Request->Params, 3);
+            Config->Valid |= LIBMSR_CONFIG_BPC;
+        }
+        break;
+    case LIBMSR_REQ_SET_DENSITY:
+        Track = Request->Params[0] - 1;
+        if (Track < 3) {
+            Config->BitsPerInch[Track] = Status >= 0 ? (Request->Params[1] ? 210 : 75) : 0;
+        }
+        break;
+    case LIBMSR_REQ_SET_COERCIVITY:
+    case LIBMSR_REQ_GET_COERCIVITY:
+        if (Status >= 0) {
+            Config->IsHiCo = Request->Type == LIBMSR_REQ_SET_COERCIVITY ? !!Request->Params[0] : Request->Reply[0] == 'H';
+            Config->Valid |= LIBMSR_CONFIG_COERCIVITY;
+        }
+        else if (Request->Type == LIBMSR_REQ_SET_COERCIVITY) {
+            Config->Valid &= ~LIBMSR_CONFIG_COERCIVITY;
+        }
+        break;
+    case LIBMSR_REQ_SET_LEADING_ZEROS:
+    case LIBMSR_REQ_GET_LEADING_ZEROS:
+        if (Status >= 0) {
+            if (Request->Type == LIBMSR_REQ_SET_LEADING_ZEROS) {
+                memcpy(Config->LeadingZeros, Request->Params, 2);
+            }
+            else {
+                memcpy(Config->LeadingZeros, Request->Reply, 2);
+            }
+            Config->Valid |= LIBMSR_CONFIG_LEADING_ZEROS;
+        }
+        else if (Request->Type == LIBMSR_REQ_SET_LEADING_ZEROS) {
+            Config->Valid &= ~LIBMSR_CONFIG_LEADING_ZEROS;
+        }
+        break;
     }
-    return LIBMSR_OK;
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRTestComms(LIBMSRHANDLE Handle)
 {
-    BYTE CommandBuffer[2];
+    LIBMSRREQUEST Request;
+
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_TEST_COMMS;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRGetModel(LIBMSRHANDLE Handle, BYTE *pModel)
+{
+    LIBMSRREQUEST Request;
     LIBMSRSTATUS Status;
-    int ReportedStatus;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x65;
-    Status = _MSRDoSendRecvWithCheck((LPMSRCONTEXT)Handle, CommandBuffer, 2);
-    if (Status < 0) {
-        return Status;
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_GET_MODEL;
+    Status = _MSRRun((LPMSRCONTEXT)Handle, &Request);
+    if (Status >= 0) {
+        *pModel = Request.Reply[0];
     }
-    ReportedStatus = _MSRRecvChar((LPMSRCONTEXT)Handle);
-    if (ReportedStatus != 0x79) {
-        return LIBMSR_DEVICE_COMMAND_FAILED;
-    }
-    return LIBMSR_OK;
+    return Status;
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRCardErase(LIBMSRHANDLE Handle, BOOL EraseTrack1, BOOL EraseTrack2, BOOL EraseTrack3)
 {
+    LIBMSRREQUEST Request;
     BYTE TrackMask;
-    BYTE CommandBuffer[3];
 
     TrackMask = !!EraseTrack1 | (!!EraseTrack2 << 1) | (!!EraseTrack3 << 2);
     if (!TrackMask) {
         return LIBMSR_INVALID_ARGUMENT;
     }
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x63;
-    CommandBuffer[2] = TrackMask;
-    return _MSRDoCommandNoData((LPMSRCONTEXT)Handle, CommandBuffer, 3);
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_ERASE;
+    Request.Params[0] = TrackMask;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRSetCoercivity(LIBMSRHANDLE Handle, BOOL IsHiCo)
 {
-    BYTE CommandBuffer[2];
+    LIBMSRREQUEST Request;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = IsHiCo ? 0x78 : 0x79;
-    return _MSRDoCommandNoData((LPMSRCONTEXT)Handle, CommandBuffer, 2);
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_SET_COERCIVITY;
+    Request.Params[0] = IsHiCo ? 1 : 0;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRGetCoercivity(LIBMSRHANDLE Handle, BOOL *pIsHiCo)
+static LIBMSRSTATUS LIBMSRDECL _MSRGetCoercivity(LPMSRCONTEXT Context, void *Arg)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
+    LIBMSRREQUEST Request;
     LIBMSRSTATUS Status;
-    int Value;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x64;
-    Status = _MSRDoSendRecvWithCheck(Context, CommandBuffer, 2);
-    if (Status < 0) {
-        return Status;
-    }
-    Value = _MSRRecvChar(Context);
-    if (Value == 'H') {
-        *pIsHiCo = TRUE;
-    }
-    else if (Value == 'L') {
-        *pIsHiCo = FALSE;
-    }
-    else {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
+    if (!(Context->Config.Valid & LIBMSR_CONFIG_COERCIVITY)) {
+        memset(&Request, 0, sizeof(Request));
+        Request.Type = LIBMSR_REQ_GET_COERCIVITY;
+        Status = _MSRDoRequest(Context, &Request);
+        if (Status < 0) {
+            return Status;
+        }
     }
+    *(BOOL *)Arg = Context->Config.IsHiCo;
     return LIBMSR_OK;
 }
 
+LIBMSRSTATUS LIBMSRAPI MSRGetCoercivity(LIBMSRHANDLE Handle, BOOL *pIsHiCo)
+{
+    return _MSRCall((LPMSRCONTEXT)Handle, _MSRGetCoercivity, pIsHiCo);
+}
+
 LIBMSRSTATUS LIBMSRAPI MSRSetLeadingZeroCount(LIBMSRHANDLE Handle, BYTE Tracks13Count, BYTE Track2Count)
 {
-    BYTE CommandBuffer[4];
+    LIBMSRREQUEST Request;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x7A;
-    CommandBuffer[2] = Tracks13Count;
-    CommandBuffer[3] = Track2Count;
-    return _MSRDoCommandNoData((LPMSRCONTEXT)Handle, CommandBuffer, 4);
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_SET_LEADING_ZEROS;
+    Request.Params[0] = Tracks13Count;
+    Request.Params[1] = Track2Count;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRGetLeadingZeroCount(LIBMSRHANDLE Handle, BYTE *pTracks13Count, BYTE *pTrack2Count)
+static LIBMSRSTATUS LIBMSRDECL _MSRGetLeadingZeroCount(LPMSRCONTEXT Context, void *Arg)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[2];
+    LIBMSRREQUEST Request;
     LIBMSRSTATUS Status;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x6C;
-    Status = _MSRDoSendRecvWithCheck(Context, CommandBuffer, 2);
-    if (Status < 0) {
-        return Status;
+    if (!(Context->Config.Valid & LIBMSR_CONFIG_LEADING_ZEROS)) {
+        memset(&Request, 0, sizeof(Request));
+        Request.Type = LIBMSR_REQ_GET_LEADING_ZEROS;
+        Status = _MSRDoRequest(Context, &Request);
+        if (Status < 0) {
+            return Status;
+        }
     }
-    *pTracks13Count = _MSRRecvChar(Context);
-    *pTrack2Count = _MSRRecvChar(Context);
+    memcpy(Arg, Context->Config.LeadingZeros, 2);
     return LIBMSR_OK;
 }
 
+LIBMSRSTATUS LIBMSRAPI MSRGetLeadingZeroCount(LIBMSRHANDLE Handle, BYTE *pTracks13Count, BYTE *pTrack2Count)
+{
+    BYTE Counts[2];
+    LIBMSRSTATUS Status;
+
+    Status = _MSRCall((LPMSRCONTEXT)Handle, _MSRGetLeadingZeroCount, Counts);
+    if (Status >= 0) {
+        *pTracks13Count = Counts[0];
+        *pTrack2Count = Counts[1];
+    }
+    return Status;
+}
+
 LIBMSRSTATUS LIBMSRAPI MSRSetDensity(LIBMSRHANDLE Handle, UINT Track, UINT BitsPerInch)
 {
-    BYTE CommandBuffer[3];
-    static const BYTE BpiSetting[] = { 0xA0, 0xA1, 0x4B, 0xD2, 0xC0, 0xC1 };
+    LIBMSRREQUEST Request;
 
-    if (Track > 3) {
+    if (Track < 1 || Track > 3) {
         return LIBMSR_INVALID_ARGUMENT;
     }
     if (BitsPerInch != 210 && BitsPerInch != 75) {
         return LIBMSR_INVALID_ARGUMENT;
     }
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x62;
-    CommandBuffer[2] = BpiSetting[((Track - 1) << 1) + (BitsPerInch == 210)];
-    return _MSRDoCommandNoData((LPMSRCONTEXT)Handle, CommandBuffer, 3);
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_SET_DENSITY;
+    Request.Params[0] = (BYTE)Track;
+    Request.Params[1] = BitsPerInch == 210;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
 }
 
 LIBMSRSTATUS LIBMSRAPI MSRSetBitsPerChar(LIBMSRHANDLE Handle, BYTE Track1BPC, BYTE Track2BPC, BYTE Track3BPC)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[5];
-    LIBMSRSTATUS Status;
+    LIBMSRREQUEST Request;
+
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_SET_BPC;
+    Request.Params[0] = Track1BPC;
+    Request.Params[1] = Track2BPC;
+    Request.Params[2] = Track3BPC;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
+}
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x6F;
-    CommandBuffer[2] = Track1BPC;
-    CommandBuffer[3] = Track2BPC;
-    CommandBuffer[4] = Track3BPC;
-    Status = _MSRDoSendRecvWithCheck(Context, CommandBuffer, 5);
-    _MSRRecvChar(Context); // 30
-    _MSRRecvChar(Context); // b1
-    _MSRRecvChar(Context); // b2
-    _MSRRecvChar(Context); // b3
-    return Status;
+#define MSR_MAX_CONFIG_REQUESTS 6
+
+/* List the requests needed to move from the shadow configuration to the desired one. */
+static UINT LIBMSRDECL _MSRConfigDiff(LPMSRCONTEXT Context, const LIBMSRCONFIG *pConfig, LIBMSRREQUEST Requests[])
+{
+    const MSRSHADOWCONFIG *Config = &Context->Config;
+    LIBMSRREQUEST *Request = Requests;
+    UINT Track;
+
+    memset(Requests, 0, MSR_MAX_CONFIG_REQUESTS * sizeof(LIBMSRREQUEST));
+    if ((pConfig->Fields & LIBMSR_CONFIG_BPC) &&
+        (!(Config->Valid & LIBMSR_CONFIG_BPC) || memcmp(Config->BitsPerChar, pConfig->BitsPerChar, 3))) {
+        Request->Type = LIBMSR_REQ_SET_BPC;
+        memcpy(Request->Params, pConfig->BitsPerChar, 3);
+        Request++;
+    }
+    if (pConfig->Fields & LIBMSR_CONFIG_DENSITY) {
+        for (Track = 0; Track < 3; ++Track) {
+            if (pConfig->BitsPerInch[Track] && pConfig->BitsPerInch[Track] != Config->BitsPerInch[Track]) {
+                Request->Type = LIBMSR_REQ_SET_DENSITY;
+                Request->Params[0] = (BYTE)(Track + 1);
+                Request->Params[1] = pConfig->BitsPerInch[Track] == 210;
+                Request++;
+            }
+        }
+    }
+    if ((pConfig->Fields & LIBMSR_CONFIG_COERCIVITY) &&
+        (!(Config->Valid & LIBMSR_CONFIG_COERCIVITY) || Config->IsHiCo != !!pConfig->IsHiCo)) {
+        Request->Type = LIBMSR_REQ_SET_COERCIVITY;
+        Request->Params[0] = pConfig->IsHiCo ? 1 : 0;
+        Request++;
+    }
+    if ((pConfig->Fields & LIBMSR_CONFIG_LEADING_ZEROS) &&
+        (!(Config->Valid & LIBMSR_CONFIG_LEADING_ZEROS) ||
+            Config->LeadingZeros[0] != pConfig->Tracks13LeadingZeros ||
+            Config->LeadingZeros[1] != pConfig->Track2LeadingZeros)) {
+        Request->Type = LIBMSR_REQ_SET_LEADING_ZEROS;
+        Request->Params[0] = pConfig->Tracks13LeadingZeros;
+        Request->Params[1] = pConfig->Track2LeadingZeros;
+        Request++;
+    }
+    return (UINT)(Request - Requests);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRCardReadISO(LIBMSRHANDLE Handle, BYTE *pTrack1Buffer, BYTE *pTrack2Buffer, BYTE *pTrack3Buffer)
+/* Send all the requests in one write, then collect the replies in order.
+ * Requests after the first failure are treated as failed too, since the device state is unknown.
+ */
+static LIBMSRSTATUS LIBMSRDECL _MSRDoPipelined(LPMSRCONTEXT Context, LIBMSRREQUEST Requests[], UINT Count, UINT TotalMs)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    BYTE CommandBuffer[MSR_MAX_CONFIG_REQUESTS * 8];
+    SIZE_T CommandLength = 0;
+    SIZE_T Length;
+    UINT ReplyLength;
     LIBMSRSTATUS Status;
-    BYTE CommandBuffer[2];
-    BYTE *Ptr;
-    BYTE ch;
+    ULONGLONG Start;
+    UINT i;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x72;
-    Status = _MSRDoSendRecvWithCheck(Context, CommandBuffer, 2);
-    if (Status < 0) {
-        return Status;
+    if (Context->Remote) {
+        return _MSRRemoteExecute(Context, Requests, Count);
     }
-    if (_MSRRecvChar(Context) != 0x73) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
+    for (i = 0; i < Count; ++i) {
+        Status = _MSRRequestBuild(&Requests[i], CommandBuffer + CommandLength, &Length);
+        if (Status < 0) {
+            return Status;
+        }
+        _MSRStatsCommand(Context, CommandBuffer + CommandLength);
+        CommandLength += Length;
     }
 
-    for (;;) {
-        ch = _MSRRecvChar(Context);
-        if (ch != ESC) {
-            break;
+    _MSRSetDeadline(Context, TotalMs * Count);
+    _MSRPurge(Context);
+    Start = _MSRGetTimeUs();
+    Status = _MSRSend(Context, CommandBuffer, CommandLength);
+    for (i = 0; i < Count; ++i) {
+        if (Status >= 0) {
+            Context->AwaitingResponse = TRUE;
+            if (_MSRRecvChar(Context) != ESC) {
+                Status = _MSRResponseError(Context);
+            }
+            else if (i == 0) {
+                /* Later replies were queued behind the first; only it shows the round trip */
+                _MSRStatsLatency(&Context->Stats.RoundTrip, Start);
+            }
         }
-        switch (_MSRRecvChar(Context)) {
-        case 1:
-            Ptr = pTrack1Buffer;
-            break;
-        case 2:
-            Ptr = pTrack2Buffer;
-            break;
-        case 3:
-            Ptr = pTrack3Buffer;
-            break;
-        default:
-            Ptr = NULL;
-            break;
+        if (Status >= 0) {
+            _MSRRequestResponseKind(Requests[i].Type, &ReplyLength);
+            Status = _MSRRecv(Context, Requests[i].Reply, ReplyLength);
         }
-
-        do {
-            ch = _MSRRecvChar(Context);
-            /* MSR605: If no data on the track, 1B 2B is sent as content */
-            if (ch == ESC) {
-                ch = _MSRRecvChar(Context);
-                break;
-            }
-            *Ptr++ = ch;
-        } while (ch != 0x3F);
-        *Ptr = 0x00;
+        if (Status >= 0) {
+            Status = _MSRRequestCheckReply(Requests[i].Type, Requests[i].Reply);
+        }
+        _MSRRequestCompleted(Context, &Requests[i], Status);
     }
+    return Status;
+}
 
-    if (ch != 0x3F) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
-    }
-    if (_MSRRecvChar(Context) != 0x1C) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
+static LIBMSRSTATUS LIBMSRDECL _MSRApplyConfig(LPMSRCONTEXT Context, void *Arg)
+{
+    const LIBMSRCONFIG *pConfig = (const LIBMSRCONFIG *)Arg;
+    LIBMSRREQUEST Requests[MSR_MAX_CONFIG_REQUESTS];
+    LIBMSRSTATUS Status;
+    UINT TotalMs;
+    UINT Count;
+    UINT Attempt;
+    UINT Backoff;
+
+    TotalMs = _MSRTakeCallTimeout(Context, FALSE);
+    Backoff = Context->RetryPolicy.InitialBackoffMs;
+    for (Attempt = 1;; ++Attempt) {
+        /* Settings confirmed by an earlier attempt are not sent again */
+        Count = _MSRConfigDiff(Context, pConfig, Requests);
+        if (Count == 0) {
+            return LIBMSR_OK;
+        }
+        Status = _MSRDoPipelined(Context, Requests, Count, TotalMs);
+        if (Status >= 0 || !_MSRRetryWait(Context, Status, Attempt, &Backoff)) {
+            break;
+        }
     }
+    return Status;
+}
 
-    if (_MSRRecvChar(Context) != ESC) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
-    }
-    ch = _MSRRecvChar(Context);
-    if (ch != 0x30) {
-        return LIBMSR_DEVICE_COMMAND_FAILED;
+LIBMSRSTATUS LIBMSRAPI MSRApplyConfig(LIBMSRHANDLE Handle, const LIBMSRCONFIG *pConfig)
+{
+    UINT Track;
+
+    if (pConfig->Fields & LIBMSR_CONFIG_DENSITY) {
+        for (Track = 0; Track < 3; ++Track) {
+            if (pConfig->BitsPerInch[Track] && pConfig->BitsPerInch[Track] != 75 && pConfig->BitsPerInch[Track] != 210) {
+                return LIBMSR_INVALID_ARGUMENT;
+            }
+        }
     }
+    return _MSRCall((LPMSRCONTEXT)Handle, _MSRApplyConfig, (void *)pConfig);
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRInvalidateConfig(LPMSRCONTEXT Context, void *Arg)
+{
+    (void)Arg;
+    memset(&Context->Config, 0, sizeof(Context->Config));
     return LIBMSR_OK;
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRCardReadRaw(LIBMSRHANDLE Handle, 
-    BYTE *pTrack1Buffer, SIZE_T *pTrack1Length,
-    BYTE *pTrack2Buffer, SIZE_T *pTrack2Length,
-    BYTE *pTrack3Buffer, SIZE_T *pTrack3Length)
+LIBMSRSTATUS LIBMSRAPI MSRInvalidateConfig(LIBMSRHANDLE Handle)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    return _MSRCall((LPMSRCONTEXT)Handle, _MSRInvalidateConfig, NULL);
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRDoCardFrame(LPMSRCONTEXT Context, LIBMSRREQUEST *Request,
+    const BYTE *CommandBuffer, SIZE_T CommandLength)
+{
+    SIZE_T Consumed;
+    MSRPARSER Parser;
     LIBMSRSTATUS Status;
-    BYTE CommandBuffer[2];
-    BYTE ch;
+    ULONGLONG Start;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x6D;
-    Status = _MSRDoSendRecvWithCheck(Context, CommandBuffer, 2);
+    _MSRSetDeadline(Context, _MSRTakeCallTimeout(Context, TRUE));
+    _MSRPurge(Context);
+    _MSRStatsCommand(Context, CommandBuffer);
+    Start = _MSRGetTimeUs();
+    Status = _MSRSend(Context, CommandBuffer, CommandLength);
     if (Status < 0) {
         return Status;
     }
-    if (_MSRRecvChar(Context) != 0x73) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
-    }
+    Context->AwaitingResponse = TRUE;
 
+    _MSRParserInit(&Parser, Request);
     for (;;) {
-        BYTE *TrackBuffer;
-        SIZE_T TrackLength;
-        SIZE_T *pTrackLength;
-
-        ch = _MSRRecvChar(Context);
-        if (ch != ESC) {
-            //for(;;) { ch = _MSRRecvChar(Context); }
-            break;
-        }
-        switch (_MSRRecvChar(Context)) {
-        case 1:
-            TrackBuffer = pTrack1Buffer;
-            pTrackLength = pTrack1Length;
-            break;
-        case 2:
-            TrackBuffer = pTrack2Buffer;
-            pTrackLength = pTrack2Length;
-            break;
-        case 3:
-            TrackBuffer = pTrack3Buffer;
-            pTrackLength = pTrack3Length;
-            break;
-        default:
-            TrackBuffer = NULL;
-            break;
+        if (Context->RecvHead == Context->RecvTail) {
+            Status = _MSRRecvFill(Context);
+            if (Status < 0) {
+                return Status;
+            }
+            if (Start) {
+                _MSRStatsLatency(&Context->Stats.SwipeWait, Start);
+                Start = 0;
+            }
         }
-
-        TrackLength = _MSRRecvChar(Context);
-        Status = _MSRRecv(Context, TrackBuffer, TrackLength);
-        if (Status < 0) {
+        Status = _MSRParserFeed(&Parser, Context->RecvBuffer + Context->RecvHead,
+            Context->RecvTail - Context->RecvHead, &Consumed);
+        Context->RecvHead += Consumed;
+        if (Status != LIBMSR_PENDING) {
             return Status;
         }
-        *pTrackLength = TrackLength;
-    }
-
-    if (ch != 0x3F) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
-    }
-    if (_MSRRecvChar(Context) != 0x1C) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
-    }
-
-    if (_MSRRecvChar(Context) != ESC) {
-        return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
-    }
-    ch = _MSRRecvChar(Context);
-    if (ch != 0x30) {
-        return LIBMSR_DEVICE_COMMAND_FAILED;
     }
-    return LIBMSR_OK;
 }
 
-static LIBMSRSTATUS LIBMSRDECL _MSRCardXmitTrack(LPMSRCONTEXT Context, BYTE TrackId, BYTE *Buffer, SIZE_T Length)
+/* Run a card command that waits for a swipe, parsing the response as it arrives;
+ * read data goes straight into the request's track buffers.
+ */
+static LIBMSRSTATUS LIBMSRDECL _MSRDoCardRequest(LPMSRCONTEXT Context, LIBMSRREQUEST *Request)
 {
-    BYTE CommandBuffer[3];
+    BYTE CommandBuffer[MSR_MAX_COMMAND_LENGTH];
+    SIZE_T CommandLength;
     LIBMSRSTATUS Status;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = TrackId;
-    CommandBuffer[2] = (BYTE)Length;
-    Status = _MSRSend(Context, CommandBuffer, 3);
-    if (Status < 0) {
-        return Status;
-    }
-    if (Length > 0) {
-        Status = _MSRSend(Context, Buffer, Length);
+    Status = _MSRRequestBuild(Request, CommandBuffer, &CommandLength);
+    if (Status >= 0) {
+        Status = _MSRDoCardFrame(Context, Request, CommandBuffer, CommandLength);
     }
+    _MSRRequestCompleted(Context, Request, Status);
     return Status;
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRCardWriteRaw(LIBMSRHANDLE Handle, 
-    BYTE *pTrack1Buffer, SIZE_T Track1Length,
-    BYTE *pTrack2Buffer, SIZE_T Track2Length,
-    BYTE *pTrack3Buffer, SIZE_T Track3Length)
+LIBMSRSTATUS LIBMSRDECL _MSRExecuteFrame(LPMSRCONTEXT Context, LIBMSRREQUEST *Request,
+    const BYTE *CommandBuffer, SIZE_T CommandLength)
 {
-    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
-    BYTE CommandBuffer[3];
     LIBMSRSTATUS Status;
 
-    CommandBuffer[0] = ESC;
-    CommandBuffer[1] = 0x6E;
-    Status = _MSRSend(Context, CommandBuffer, 2);
-    if (Status < 0) {
-        return Status;
-    }
-
-    CommandBuffer[1] = 0x73;
-    Status = _MSRSend(Context, CommandBuffer, 2);
-    if (Status < 0) {
-        return Status;
-    }
-
-    Status = _MSRCardXmitTrack(Context, 1, pTrack1Buffer, Track1Length);
-    if (Status < 0) {
-        return Status;
+    /* The server builds its own command from the request */
+    if (Context->Remote) {
+        return _MSRRemoteExecute(Context, Request, 1);
     }
-    Status = _MSRCardXmitTrack(Context, 2, pTrack2Buffer, Track2Length);
-    if (Status < 0) {
-        return Status;
-    }
-    Status = _MSRCardXmitTrack(Context, 3, pTrack3Buffer, Track3Length);
-    if (Status < 0) {
-        return Status;
-    }
-
-    CommandBuffer[0] = 0x3F;
-    CommandBuffer[1] = 0x1C;
-    return _MSRDoCommandNoData(Context, CommandBuffer, 2);
+    Status = _MSRDoCardFrame(Context, Request, CommandBuffer, CommandLength);
+    _MSRRequestCompleted(Context, Request, Status);
+    return Status;
 }
 
-static const BYTE BitReverseTable[256] = {
-    0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
-    0x08, 0x88, 0x48, 0xC8, 0x28, 0xA8, 0x68, 0xE8, 0x18, 0x98, 0x58, 0xD8, 0x38, 0xB8, 0x78, 0xF8,
-    0x04, 0x84, 0x44, 0xC4, 0x24, 0xA4, 0x64, 0xE4, 0x14, 0x94, 0x54, 0xD4, 0x34, 0xB4, 0x74, 0xF4,
-    0x0C, 0x8C, 0x4C, 0xCC, 0x2C, 0xAC, 0x6C, 0xEC, 0x1C, 0x9C, 0x5C, 0xDC, 0x3C, 0xBC, 0x7C, 0xFC,
-    0x02, 0x82, 0x42, 0xC2, 0x22, 0xA2, 0x62, 0xE2, 0x12, 0x92, 0x52, 0xD2, 0x32, 0xB2, 0x72, 0xF2,
-    0x0A, 0x8A, 0x4A, 0xCA, 0x2A, 0xAA, 0x6A, 0xEA, 0x1A, 0x9A, 0x5A, 0xDA, 0x3A, 0xBA, 0x7A, 0xFA,
-    0x06, 0x86, 0x46, 0xC6, 0x26, 0xA6, 0x66, 0xE6, 0x16, 0x96, 0x56, 0xD6, 0x36, 0xB6, 0x76, 0xF6,
-    0x0E, 0x8E, 0x4E, 0xCE, 0x2E, 0xAE, 0x6E, 0xEE, 0x1E, 0x9E, 0x5E, 0xDE, 0x3E, 0xBE, 0x7E, 0xFE,
-    0x01, 0x81, 0x41, 0xC1, 0x21, 0xA1, 0x61, 0xE1, 0x11, 0x91, 0x51, 0xD1, 0x31, 0xB1, 0x71, 0xF1,
-    0x09, 0x89, 0x49, 0xC9, 0x29, 0xA9, 0x69, 0xE9, 0x19, 0x99, 0x59, 0xD9, 0x39, 0xB9, 0x79, 0xF9,
-    0x05, 0x85, 0x45, 0xC5, 0x25, 0xA5, 0x65, 0xE5, 0x15, 0x95, 0x55, 0xD5, 0x35, 0xB5, 0x75, 0xF5,
-    0x0D, 0x8D, 0x4D, 0xCD, 0x2D, 0xAD, 0x6D, 0xED, 0x1D, 0x9D, 0x5D, 0xDD, 0x3D, 0xBD, 0x7D, 0xFD,
-    0x03, 0x83, 0x43, 0xC3, 0x23, 0xA3, 0x63, 0xE3, 0x13, 0x93, 0x53, 0xD3, 0x33, 0xB3, 0x73, 0xF3,
-    0x0B, 0x8B, 0x4B, 0xCB, 0x2B, 0xAB, 0x6B, 0xEB, 0x1B, 0x9B, 0x5B, 0xDB, 0x3B, 0xBB, 0x7B, 0xFB,
-    0x07, 0x87, 0x47, 0xC7, 0x27, 0xA7, 0x67, 0xE7, 0x17, 0x97, 0x57, 0xD7, 0x37, 0xB7, 0x77, 0xF7,
-    0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF,
-};
-
-BYTE ComputeParity(BYTE x)
+LIBMSRSTATUS LIBMSRDECL _MSRExecute(LPMSRCONTEXT Context, LIBMSRREQUEST *Request)
 {
-    int PopCount;
+    UINT ReplyLength;
 
-    PopCount = 0;
-    while (x) {
-        PopCount += x & 1;
-        x >>= 1;
+    if (Context->Remote) {
+        return _MSRRemoteExecute(Context, Request, 1);
+    }
+    if (_MSRRequestWaitsForSwipe(Request->Type)) {
+        return _MSRDoCardRequest(Context, Request);
     }
-    return (PopCount & 1) == 0;
+    if (_MSRRequestResponseKind(Request->Type, &ReplyLength) == MSR_RESPONSE_NONE) {
+        return _MSRDoSendOnly(Context, Request);
+    }
+    return _MSRDoRequest(Context, Request);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRUnpackData(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+/* The pointer-based read APIs assume each buffer holds LIBMSR_MAX_TRACK_LENGTH bytes */
+static LIBMSRSTATUS LIBMSRDECL _MSRCardRead(LPMSRCONTEXT Context, UINT Type, BYTE *Buffers[3], SIZE_T *pLengths[3])
 {
-    BYTE ParityMask = 1 << (BitsPerChar - 1);
-
-    while (SourceLen-- > 0) {
-        BYTE ch;
-        BYTE Parity;
-
-        ch = BitReverseTable[*Source++] >> (8 - BitsPerChar);
-        Parity = !!(ch & ParityMask);
-        ch &= ~ParityMask;
-        *Dest++ = ch;
+    LIBMSRREQUEST Request;
+    LIBMSRSTATUS Status;
+    UINT Track;
+
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = Type;
+    for (Track = 0; Track < 3; ++Track) {
+        Request.TrackBuffers[Track] = Buffers[Track];
+        Request.TrackCapacities[Track] = Buffers[Track] ? LIBMSR_MAX_TRACK_LENGTH : 0;
+    }
+    Status = _MSRRun(Context, &Request);
+    for (Track = 0; Track < 3; ++Track) {
+        if (pLengths[Track]) {
+            *pLengths[Track] = Request.TrackLengths[Track];
+        }
     }
-    return LIBMSR_OK;
+    return Status;
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRPackData(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+LIBMSRSTATUS LIBMSRAPI MSRCardReadISO(LIBMSRHANDLE Handle, BYTE *pTrack1Buffer, BYTE *pTrack2Buffer, BYTE *pTrack3Buffer)
 {
-    while (SourceLen-- > 0) {
-        BYTE ch;
+    BYTE *Buffers[3];
+    SIZE_T *pLengths[3] = { NULL, NULL, NULL };
 
-        ch = *Source++;
-        ch |= ComputeParity(ch) << (BitsPerChar - 1);
-        *Dest++ = ch;
-    }
-    return LIBMSR_OK;
+    Buffers[0] = pTrack1Buffer;
+    Buffers[1] = pTrack2Buffer;
+    Buffers[2] = pTrack3Buffer;
+    return _MSRCardRead((LPMSRCONTEXT)Handle, LIBMSR_REQ_READ_ISO, Buffers, pLengths);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSRDecodeTrack(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+LIBMSRSTATUS LIBMSRAPI MSRCardReadRaw(LIBMSRHANDLE Handle, 
+    BYTE *pTrack1Buffer, SIZE_T *pTrack1Length,
+    BYTE *pTrack2Buffer, SIZE_T *pTrack2Length,
+    BYTE *pTrack3Buffer, SIZE_T *pTrack3Length)
 {
-    MSRUnpackData(BitsPerChar, Source, SourceLen, Dest);
-    ISO7811ToAscii(BitsPerChar, Dest, SourceLen, Dest);
-    Dest[SourceLen] = 0x00;
-    return LIBMSR_OK;
+    BYTE *Buffers[3];
+    SIZE_T *pLengths[3];
+
+    Buffers[0] = pTrack1Buffer;
+    Buffers[1] = pTrack2Buffer;
+    Buffers[2] = pTrack3Buffer;
+    pLengths[0] = pTrack1Length;
+    pLengths[1] = pTrack2Length;
+    pLengths[2] = pTrack3Length;
+    return _MSRCardRead((LPMSRCONTEXT)Handle, LIBMSR_REQ_READ_RAW, Buffers, pLengths);
 }
 
-LIBMSRSTATUS LIBMSRAPI MSREncodeTrack(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+LIBMSRSTATUS LIBMSRAPI MSRCardWriteRaw(LIBMSRHANDLE Handle, 
+    BYTE *pTrack1Buffer, SIZE_T Track1Length,
+    BYTE *pTrack2Buffer, SIZE_T Track2Length,
+    BYTE *pTrack3Buffer, SIZE_T Track3Length)
 {
-    AsciiToISO7811(BitsPerChar, Source, SourceLen, Dest);
-    MSRPackData(BitsPerChar, Dest, SourceLen, Dest);
-    return LIBMSR_OK;
+    LIBMSRREQUEST Request;
+
+    /* The whole command goes out in one piece; purging halfway could drop unsent track data */
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = LIBMSR_REQ_WRITE_RAW;
+    Request.TrackBuffers[0] = pTrack1Buffer;
+    Request.TrackBuffers[1] = pTrack2Buffer;
+    Request.TrackBuffers[2] = pTrack3Buffer;
+    Request.TrackLengths[0] = Track1Length;
+    Request.TrackLengths[1] = Track2Length;
+    Request.TrackLengths[2] = Track3Length;
+    return _MSRRun((LPMSRCONTEXT)Handle, &Request);
 }
@@ -5,6 +5,8 @@
 #ifndef LIBMSR_H
 #define LIBMSR_H
 
+#ifdef _WIN32
+
 #include <Windows.h>
 
 #define LIBMSRDECL __stdcall
@@ -15,40 +17,296 @@
 #define LIBMSRAPI __declspec(dllimport) LIBMSRDECL
 #endif
 
+#else /* !_WIN32 */
+
+#include <stddef.h>
+
+/* Provide the handful of Win32 types the API is expressed in. */
+typedef unsigned char BYTE, *LPBYTE;
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef unsigned int DWORD;
+typedef size_t SIZE_T;
+typedef unsigned long long ULONGLONG;
+typedef char TCHAR, *LPTSTR;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define LIBMSRDECL
+#define LIBMSRAPI __attribute__((visibility("default")))
+
+#endif /* _WIN32 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _WIN32
 typedef long LIBMSRSTATUS;
+#else
+/* Status codes are 32-bit values with the top bit marking an error. */
+typedef int LIBMSRSTATUS;
+#endif
 typedef void* LIBMSRHANDLE;
 
 /*** Status codes returned by all APIs ***/
 
 #define LIBMSR_OK 0L
-#define LIBMSR_ERROR 0xC0000000L
+#define LIBMSR_PENDING 1L
+#define LIBMSR_ERROR ((LIBMSRSTATUS)0xC0000000L)
 #define LIBMSR_MEM_ALLOC_FAILED (LIBMSR_ERROR | 0x00000001)
 #define LIBMSR_INVALID_ARGUMENT (LIBMSR_ERROR | 0x00000002)
+#define LIBMSR_NOT_SUPPORTED (LIBMSR_ERROR | 0x00000003)
+#define LIBMSR_BUFFER_TOO_SMALL (LIBMSR_ERROR | 0x00000004)
+#define LIBMSR_CANCELLED (LIBMSR_ERROR | 0x00000005)
+#define LIBMSR_NOT_FOUND (LIBMSR_ERROR | 0x00000006)
 
 #define LIBMSR_DEVICE_ERROR (LIBMSR_ERROR | 0x00010000L)
 #define LIBMSR_DEVICE_UNEXPECTED_RESPONSE (LIBMSR_DEVICE_ERROR | 0x00000001)
 #define LIBMSR_DEVICE_COMMAND_FAILED (LIBMSR_DEVICE_ERROR | 0x00000002)
+#define LIBMSR_DEVICE_VERIFY_FAILED (LIBMSR_DEVICE_ERROR | 0x00000003)
 
 #define LIBMSR_COMM_PORT_ERROR (LIBMSR_ERROR | 0x00020000L)
 #define LIBMSR_PORT_OPEN_FAILED (LIBMSR_COMM_PORT_ERROR | 0x00000002)
 #define LIBMSR_PORT_SETUP_FAILED (LIBMSR_COMM_PORT_ERROR | 0x00000003)
 #define LIBMSR_PORT_WRITE_FAILED (LIBMSR_COMM_PORT_ERROR | 0x00000004)
 #define LIBMSR_PORT_READ_FAILED (LIBMSR_COMM_PORT_ERROR | 0x00000005)
+#define LIBMSR_TIMEOUT (LIBMSR_COMM_PORT_ERROR | 0x00000006)
+#define LIBMSR_REPLAY_MISMATCH (LIBMSR_COMM_PORT_ERROR | 0x00000007)
 
 #define LIBMSR_CODEC_ERROR (LIBMSR_ERROR | 0x00040000L)
 #define LIBMSR_PARITY_ERROR (LIBMSR_CODEC_ERROR | 0x00000001)
+#define LIBMSR_LRC_ERROR (LIBMSR_CODEC_ERROR | 0x00000002)
+#define LIBMSR_SENTINEL_NOT_FOUND (LIBMSR_CODEC_ERROR | 0x00000003)
+#define LIBMSR_CHARSET_ERROR (LIBMSR_CODEC_ERROR | 0x00000004)
+#define LIBMSR_FORMAT_ERROR (LIBMSR_CODEC_ERROR | 0x00000005)
+#define LIBMSR_CHECK_DIGIT_ERROR (LIBMSR_CODEC_ERROR | 0x00000006)
+
+#define LIBMSR_FILE_ERROR (LIBMSR_ERROR | 0x00080000L)
+#define LIBMSR_FILE_IO_FAILED (LIBMSR_FILE_ERROR | 0x00000001)
+#define LIBMSR_FILE_CORRUPT (LIBMSR_FILE_ERROR | 0x00000002)
+
+#define LIBMSR_INFINITE 0xFFFFFFFF
+
+/*** Transport API ***/
+
+/* A transport moves bytes between the library and the device.
+ * The serial port backends used by MSROpen are transports too; supply your own
+ * to run the library over anything else.
+ */
+typedef struct _LIBMSRTRANSPORT {
+    /* Read at least one and up to Count bytes, blocking until some are available.
+     * Return LIBMSR_TIMEOUT if nothing arrives within TimeoutMs (LIBMSR_INFINITE waits forever).
+     */
+    LIBMSRSTATUS (LIBMSRDECL *Read)(void *Port, BYTE *Buffer, SIZE_T Count, UINT TimeoutMs, SIZE_T *pBytesRead);
+    /* Write up to Count bytes; report how many were actually written. */
+    LIBMSRSTATUS (LIBMSRDECL *Write)(void *Port, const BYTE *Buffer, SIZE_T Count, SIZE_T *pBytesWritten);
+    /* Discard any data pending in either direction. */
+    LIBMSRSTATUS (LIBMSRDECL *Purge)(void *Port);
+    /* Release the port; called once from MSRClose. */
+    void (LIBMSRDECL *Close)(void *Port);
+    /* Optional: a file descriptor that polls readable when Read would not block.
+     * Required to use the handle with a device pool.
+     */
+    int (LIBMSRDECL *GetFd)(void *Port);
+} LIBMSRTRANSPORT;
+
+/*** Capture and replay ***/
+
+/* A capture records the traffic of one handle: a header, then one event per
+ * transport call, each followed by its Length bytes of data. Writes and reads
+ * hold the bytes actually moved; errors hold the LIBMSRSTATUS returned.
+ * Values are stored in host byte order.
+ */
+#define LIBMSR_CAPTURE_MAGIC 0x4352534D     /* "MSRC" */
+#define LIBMSR_CAPTURE_VERSION 1
+
+#define LIBMSR_CAPTURE_WRITE 'W'
+#define LIBMSR_CAPTURE_READ 'R'
+#define LIBMSR_CAPTURE_ERROR 'E'
+
+typedef struct _LIBMSRCAPTUREHEADER {
+    UINT Magic;
+    UINT Version;
+} LIBMSRCAPTUREHEADER;
+
+typedef struct _LIBMSRCAPTUREEVENT {
+    /* Since the capture started */
+    UINT TimeMs;
+    BYTE Kind;
+    BYTE Reserved[3];
+    UINT Length;
+} LIBMSRCAPTUREEVENT;
+
+/* Wrap a transport so everything passing through it is written to a capture file.
+ * On success the new port owns InnerPort; pass the results to MSROpenTransport.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRCaptureWrap(LPTSTR CapturePath, const LIBMSRTRANSPORT *Inner, void *InnerPort,
+    const LIBMSRTRANSPORT **pTransport, void **pPort);
+
+/* MSROpen with the serial port wrapped in a recorder. */
+LIBMSRSTATUS LIBMSRAPI MSROpenRecorded(LPTSTR PortName, LPTSTR CapturePath, LIBMSRHANDLE *pHandle);
+
+/* Open a handle that plays a capture back instead of talking to a device.
+ * Reads return the recorded data in the recorded chunks, without delay, and
+ * LIBMSR_TIMEOUT where the device sent nothing more. Writes must match the
+ * recorded ones or fail with LIBMSR_REPLAY_MISMATCH. Recorded errors are
+ * returned where they happened. Replay handles cannot join a device pool.
+ * MSROpenReplayBuffer uses the caller's copy, which must outlive the handle.
+ */
+LIBMSRSTATUS LIBMSRAPI MSROpenReplay(LPTSTR CapturePath, LIBMSRHANDLE *pHandle);
+LIBMSRSTATUS LIBMSRAPI MSROpenReplayBuffer(const BYTE *Capture, SIZE_T Length, LIBMSRHANDLE *pHandle);
 
 /*** General device API */
 
 /* Open the port and allocate a handle.
+ * On Windows, PortName is a device name like "COM3" or "\\\\.\\COM12".
+ * On POSIX systems, it is a tty device path like "/dev/ttyUSB0".
  */
 LIBMSRSTATUS LIBMSRAPI MSROpen(LPTSTR PortName, LIBMSRHANDLE *pHandle);
 
+/* Allocate a handle talking to the device via the given transport.
+ * The handle takes ownership of Port and releases it via Transport->Close.
+ */
+LIBMSRSTATUS LIBMSRAPI MSROpenTransport(const LIBMSRTRANSPORT *Transport, void *Port, LIBMSRHANDLE *pHandle);
+
 /* Close the port; handle is not usable after that.
+ * Called from a completion callback, the close happens once the I/O thread has run
+ * the commands already queued.
  */
 void LIBMSRAPI MSRClose(LIBMSRHANDLE Handle);
 
+/* Transport activity since the handle was opened or MSRResetStats was called.
+ * ReadCalls/WriteCalls count transport calls, i.e. syscalls for the serial backends.
+ */
+typedef struct _LIBMSRIOCOUNTERS {
+    SIZE_T ReadCalls;
+    SIZE_T WriteCalls;
+    SIZE_T BytesRead;
+    SIZE_T BytesWritten;
+} LIBMSRIOCOUNTERS;
+
+LIBMSRSTATUS LIBMSRAPI MSRGetIoCounters(LIBMSRHANDLE Handle, LIBMSRIOCOUNTERS *pCounters);
+
+/* Performance counters kept for each handle since it was opened or last reset.
+ * They are updated by the thread using the handle without any locking, so a
+ * snapshot taken from another thread may be slightly out of step.
+ */
+#define LIBMSR_STATS_BUCKETS 32
+#define LIBMSR_STATS_ERROR_SLOTS 16
+
+/* Latencies in microseconds. Bucket 0 counts values below 2 us;
+ * bucket i counts values from 2^i up to 2^(i+1) us, the last one everything above.
+ */
+typedef struct _LIBMSRHISTOGRAM {
+    ULONGLONG Count;
+    ULONGLONG TotalUs;
+    ULONGLONG MaxUs;
+    ULONGLONG Buckets[LIBMSR_STATS_BUCKETS];
+} LIBMSRHISTOGRAM;
+
+typedef struct _LIBMSRERRORCOUNT {
+    LIBMSRSTATUS Status;
+    UINT Count;
+} LIBMSRERRORCOUNT;
+
+typedef struct _LIBMSRSTATS {
+    /* Same as MSRGetIoCounters */
+    LIBMSRIOCOUNTERS Io;
+    /* Commands sent, indexed by the byte after ESC */
+    UINT Commands[256];
+    /* From sending a command to the ESC that starts its response */
+    LIBMSRHISTOGRAM RoundTrip;
+    /* From sending a card read, write or erase to the first byte of the response */
+    LIBMSRHISTOGRAM SwipeWait;
+    /* Failed commands by status, in order of first occurrence; unused slots have Status 0 */
+    LIBMSRERRORCOUNT Errors[LIBMSR_STATS_ERROR_SLOTS];
+    /* Failures with a status that found no free slot */
+    UINT OtherErrors;
+} LIBMSRSTATS;
+
+LIBMSRSTATUS LIBMSRAPI MSRGetStats(LIBMSRHANDLE Handle, LIBMSRSTATS *pStats);
+/* Start counting from zero, I/O counters included. */
+LIBMSRSTATUS LIBMSRAPI MSRResetStats(LIBMSRHANDLE Handle);
+
+/* Each handle also keeps its most recent wire traffic in a fixed-size ring, so the
+ * bytes behind an error can be looked at after the fact. Transfers longer than
+ * LIBMSR_TRACE_DATA bytes take several consecutive entries.
+ */
+#define LIBMSR_TRACE_ENTRIES 128
+#define LIBMSR_TRACE_DATA 48
+
+typedef struct _LIBMSRTRACEENTRY {
+    /* Counts entries since the handle was opened, starting at 1 */
+    ULONGLONG Sequence;
+    /* Microseconds on a monotonic clock */
+    ULONGLONG TimeUs;
+    /* LIBMSR_CAPTURE_WRITE, _READ, or _ERROR for a failed command */
+    BYTE Kind;
+    /* Byte after ESC of the last command sent, 0 if none */
+    BYTE Opcode;
+    BYTE Length;
+    LIBMSRSTATUS Status;
+    BYTE Data[LIBMSR_TRACE_DATA];
+} LIBMSRTRACEENTRY;
+
+/* Copy up to Count of the most recent entries, oldest first.
+ * Safe to call from any thread; entries overwritten while being copied are skipped.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRTraceRead(LIBMSRHANDLE Handle, LIBMSRTRACEENTRY Entries[], UINT Count, UINT *pCount);
+
+/* Called on the thread driving the handle whenever a command fails, after the
+ * error has been added to the trace. The callback may use MSRTraceRead and
+ * MSRGetStats, but no other API on the same handle. NULL turns it off.
+ */
+typedef void (LIBMSRDECL *LIBMSRTRACECALLBACK)(void *Context, LIBMSRHANDLE Handle, LIBMSRSTATUS Status);
+
+LIBMSRSTATUS LIBMSRAPI MSRSetTraceCallback(LIBMSRHANDLE Handle, LIBMSRTRACECALLBACK Callback, void *Context);
+
+/* Timeouts, in milliseconds; zero means no limit.
+ * InterByteMs bounds the gap between bytes once a response has started.
+ * CommandMs bounds the whole exchange for commands that answer at once.
+ * SwipeMs bounds card reads, writes and erases, which wait for a swipe.
+ * Commands that time out fail with LIBMSR_TIMEOUT.
+ * Defaults: 100 ms inter-byte, 1000 ms per command, no limit on swipes.
+ */
+typedef struct _LIBMSRTIMEOUTS {
+    UINT InterByteMs;
+    UINT CommandMs;
+    UINT SwipeMs;
+} LIBMSRTIMEOUTS;
+
+LIBMSRSTATUS LIBMSRAPI MSRSetTimeouts(LIBMSRHANDLE Handle, const LIBMSRTIMEOUTS *pTimeouts);
+LIBMSRSTATUS LIBMSRAPI MSRGetTimeouts(LIBMSRHANDLE Handle, LIBMSRTIMEOUTS *pTimeouts);
+
+/* Override the total timeout (CommandMs or SwipeMs) for the next call only.
+ * On a threaded handle that is the next command queued after this call, from
+ * whichever thread; threads sharing a handle should agree on who uses it.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRSetCallTimeout(LIBMSRHANDLE Handle, UINT TotalMs);
+
+/* Retry policy for idempotent commands: MSRTestComms and the getters/setters.
+ * An exchange that times out or gets garbled is retried up to MaxAttempts times
+ * in total, sleeping InitialBackoffMs before the first retry and doubling that
+ * up to MaxBackoffMs (0 for no limit). Each attempt gets the full command timeout.
+ * Default: a single attempt.
+ */
+typedef struct _LIBMSRRETRYPOLICY {
+    UINT MaxAttempts;
+    UINT InitialBackoffMs;
+    UINT MaxBackoffMs;
+} LIBMSRRETRYPOLICY;
+
+LIBMSRSTATUS LIBMSRAPI MSRSetRetryPolicy(LIBMSRHANDLE Handle, const LIBMSRRETRYPOLICY *pPolicy);
+
 /* Soft-reset the device.
+ * Returns once the line has been quiet for InterByteMs, so any response the device
+ * was in the middle of sending is gone.
  */
 LIBMSRSTATUS LIBMSRAPI MSRReset(LIBMSRHANDLE Handle);
 
@@ -63,6 +321,11 @@ LIBMSRSTATUS LIBMSRAPI MSRLedRedOn(LIBMSRHANDLE Handle);
  */
 LIBMSRSTATUS LIBMSRAPI MSRTestComms(LIBMSRHANDLE Handle);
 
+/* Ask the device for its model. MSR605-family devices answer with a character
+ * such as '3' for a three-track unit; others may not answer at all.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRGetModel(LIBMSRHANDLE Handle, BYTE *pModel);
+
 /* Set whether to use LoCo or HiCo settings when writing a card.
  * This does not affect reading a card in any way.
  */
@@ -88,14 +351,48 @@ LIBMSRSTATUS LIBMSRAPI MSRSetDensity(LIBMSRHANDLE Handle, UINT Track, UINT BitsP
  */
 LIBMSRSTATUS LIBMSRAPI MSRSetBitsPerChar(LIBMSRHANDLE Handle, BYTE Track1BPC, BYTE Track2BPC, BYTE Track3BPC);
 
+/* Fields of LIBMSRCONFIG to apply */
+#define LIBMSR_CONFIG_BPC 0x01
+#define LIBMSR_CONFIG_DENSITY 0x02
+#define LIBMSR_CONFIG_COERCIVITY 0x04
+#define LIBMSR_CONFIG_LEADING_ZEROS 0x08
+
+typedef struct _LIBMSRCONFIG {
+    UINT Fields;
+    BYTE BitsPerChar[3];
+    /* 75 or 210; 0 leaves the track alone */
+    UINT BitsPerInch[3];
+    BOOL IsHiCo;
+    BYTE Tracks13LeadingZeros;
+    BYTE Track2LeadingZeros;
+} LIBMSRCONFIG;
+
+/* Bring the device to the given configuration in one go.
+ * The library remembers what it last set on each handle and only sends the
+ * settings that differ, back to back, collecting the replies afterwards.
+ * Each setting sent gets the full command timeout.
+ * The remembered state also answers MSRGetCoercivity and MSRGetLeadingZeroCount.
+ * It is dropped by MSRReset; call MSRInvalidateConfig if the device may have
+ * been reconfigured behind the library's back (e.g. power cycled).
+ */
+LIBMSRSTATUS LIBMSRAPI MSRApplyConfig(LIBMSRHANDLE Handle, const LIBMSRCONFIG *pConfig);
+LIBMSRSTATUS LIBMSRAPI MSRInvalidateConfig(LIBMSRHANDLE Handle);
+
 /*** Card access API ***/
 
 /* Erase a card being swiped.
  */
 LIBMSRSTATUS LIBMSRAPI MSRCardErase(LIBMSRHANDLE Handle, BOOL EraseTrack1, BOOL EraseTrack2, BOOL EraseTrack3);
 
+/* Space a track buffer needs to take any read: a raw track is at most 255 bytes,
+ * and ISO text gets the same room including its terminating NUL.
+ */
+#define LIBMSR_MAX_TRACK_LENGTH 256
+
 /* Read data from an ISO-compliant card.
  * Outputs track data, fully decoded (7-5-5 BPC, 210-75-210 BPI).
+ * Each buffer must hold LIBMSR_MAX_TRACK_LENGTH bytes; longer text is cut short and
+ * LIBMSR_BUFFER_TOO_SMALL returned. Tracks with a NULL buffer are skipped.
  * NOTE: This may be removed in favor of the raw API.
  */
 LIBMSRSTATUS LIBMSRAPI MSRCardReadISO(LIBMSRHANDLE Handle, BYTE *pTrack1Buffer, BYTE *pTrack2Buffer, BYTE *pTrack3Buffer);
@@ -103,6 +400,8 @@ LIBMSRSTATUS LIBMSRAPI MSRCardReadISO(LIBMSRHANDLE Handle, BYTE *pTrack1Buffer,
 /* Read raw data from a card.
  * NOTE: Data is returned LSB first (bit-swapped) and right-aligned within a byte.
  * NOTE: The LRC character AND trailing zero bits are also returned.
+ * Each buffer must hold LIBMSR_MAX_TRACK_LENGTH bytes. Tracks with a NULL buffer are
+ * skipped; lengths of tracks the device did not send are set to 0.
  */
 LIBMSRSTATUS LIBMSRAPI MSRCardReadRaw(LIBMSRHANDLE Handle, 
     BYTE *pTrack1Buffer, SIZE_T *pTrack1Length,
@@ -117,6 +416,109 @@ LIBMSRSTATUS LIBMSRAPI MSRCardWriteRaw(LIBMSRHANDLE Handle,
     BYTE *pTrack2Buffer, SIZE_T Track2Length,
     BYTE *pTrack3Buffer, SIZE_T Track3Length);
 
+/*** Track set API ***/
+
+/* A track set owns the buffers for one card: raw data and text for all three tracks,
+ * carved out of a single allocation. Reads land in it directly and decoding works
+ * within it, so a set reused from swipe to swipe costs no allocations or extra copies.
+ * Tracks are numbered 1 to 3.
+ */
+typedef void* LIBMSRTRACKS;
+
+/* Capacity is the raw size of each track; 0 picks LIBMSR_MAX_TRACK_LENGTH.
+ * Text gets one more byte for its NUL.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRTracksCreate(SIZE_T Capacity, LIBMSRTRACKS *pTracks);
+void LIBMSRAPI MSRTracksDestroy(LIBMSRTRACKS Tracks);
+
+/* Empty all tracks. Reads do this themselves. */
+LIBMSRSTATUS LIBMSRAPI MSRTracksClear(LIBMSRTRACKS Tracks);
+
+/* Read a card into the raw data (MSRCardReadRaw) or the text (MSRCardReadISO) of the set.
+ * Data over capacity is dropped and LIBMSR_BUFFER_TOO_SMALL returned.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRCardReadRawTracks(LIBMSRHANDLE Handle, LIBMSRTRACKS Tracks);
+LIBMSRSTATUS LIBMSRAPI MSRCardReadISOTracks(LIBMSRHANDLE Handle, LIBMSRTRACKS Tracks);
+
+/* Write the raw data of every track that has some. */
+LIBMSRSTATUS LIBMSRAPI MSRCardWriteRawTracks(LIBMSRHANDLE Handle, LIBMSRTRACKS Tracks);
+
+/* Convert a track between raw data and text with MSRDecodeTrack or MSREncodeTrack. */
+LIBMSRSTATUS LIBMSRAPI MSRTracksDecode(LIBMSRTRACKS Tracks, UINT Track, UINT BitsPerChar);
+LIBMSRSTATUS LIBMSRAPI MSRTracksEncode(LIBMSRTRACKS Tracks, UINT Track, UINT BitsPerChar);
+
+/* Views into the set, valid until the next call that changes the track.
+ * Text is NUL-terminated.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRTracksGetRaw(LIBMSRTRACKS Tracks, UINT Track, const BYTE **ppData, SIZE_T *pLength);
+LIBMSRSTATUS LIBMSRAPI MSRTracksGetText(LIBMSRTRACKS Tracks, UINT Track, const BYTE **ppText, SIZE_T *pLength);
+
+/* Replace the text of a track, e.g. before MSRTracksEncode. */
+LIBMSRSTATUS LIBMSRAPI MSRTracksSetText(LIBMSRTRACKS Tracks, UINT Track, const BYTE *Text, SIZE_T Length);
+
+/*** Encoding job API ***/
+
+/* A job writes a queue of cards on one device and reads each one back to verify it.
+ * While the operator swipes a card, the raw data for the next one is packed on a
+ * worker thread. A card that fails to write or verify is tried again, up to
+ * MaxAttempts times, before the job moves on to the next one.
+ */
+
+/* One card to write. Tracks with NULL text are left alone.
+ * Text is encoded as it is, without adding an LRC: at 5 and 7 BPC it should run from
+ * the start sentinel through the LRC, as MSRTracksGetText gives it for a decoded read.
+ */
+typedef struct _LIBMSRJOBCARD {
+    const BYTE *Text[3];
+    SIZE_T TextLength[3];
+    /* Filled in by the job */
+    LIBMSRSTATUS Status;
+    UINT Attempts;
+} LIBMSRJOBCARD;
+
+/* Stages reported to the progress callback */
+#define LIBMSR_JOB_WRITE 1      /* About to wait for the card to be swiped for writing */
+#define LIBMSR_JOB_VERIFY 2     /* About to wait for it to be swiped again to read it back */
+#define LIBMSR_JOB_RETRY 3      /* The attempt failed; Status tells why */
+#define LIBMSR_JOB_DONE 4       /* Status is final */
+
+typedef void (LIBMSRDECL *LIBMSRJOBCALLBACK)(void *Context, SIZE_T Index, const LIBMSRJOBCARD *pCard, UINT Stage);
+
+typedef struct _LIBMSRJOBOPTIONS {
+    /* 0 picks 7, 5 and 5; the job sets the device to these before the first card */
+    UINT BitsPerChar[3];
+    /* 0 picks 3 */
+    UINT MaxAttempts;
+    /* Optional, e.g. to prompt the operator */
+    LIBMSRJOBCALLBACK Callback;
+    void *Context;
+} LIBMSRJOBOPTIONS;
+
+typedef struct _LIBMSRJOBSTATS {
+    UINT Cards;             /* Written and verified */
+    UINT Failed;            /* Given up on */
+    UINT Attempts;
+    UINT VerifyFailures;    /* Read back without error but not matching */
+    /* Total time per stage, in milliseconds; packing overlaps the swipes */
+    ULONGLONG EncodeTime;
+    ULONGLONG WriteTime;
+    ULONGLONG VerifyTime;
+    ULONGLONG ElapsedTime;
+    double CardsPerMinute;
+    /* Verify failures per verify read */
+    double VerifyFailureRate;
+} LIBMSRJOBSTATS;
+
+/* Write and verify Count cards in order. A card verifies when the raw data read back
+ * matches the raw data written, with nothing but blank characters on either side.
+ * Each card's Status and Attempts are filled in; the return value is LIBMSR_OK
+ * unless the job had to stop early on an error that retrying cannot fix, such as
+ * a lost port, or could not set the device's bits per character. pOptions and
+ * pStats may be NULL.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRJobRun(LIBMSRHANDLE Handle, LIBMSRJOBCARD Cards[], SIZE_T Count,
+    const LIBMSRJOBOPTIONS *pOptions, LIBMSRJOBSTATS *pStats);
+
 /*** Data conversion API ***/
 
 /* Unpack raw data from the reader.
@@ -131,10 +533,32 @@ LIBMSRSTATUS LIBMSRAPI MSRUnpackData(UINT BitsPerChar, BYTE *Source, SIZE_T Sour
  */
 LIBMSRSTATUS LIBMSRAPI MSRPackData(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest);
 
-/* Convenience functions -- unpack/decode and encode/pack. */
+/* Convenience functions -- unpack/decode and encode/pack, in a single pass.
+ * BitsPerChar may be 5 to 8; only 5 and 7 have an ISO character set, so 6 and 8
+ * just strip or add the parity bit.
+ * MSRDecodeTrack NUL-terminates Dest, so it needs SourceLen + 1 bytes.
+ * It converts the whole track even if some characters fail the parity check,
+ * then returns LIBMSR_PARITY_ERROR. All-zero characters (blank media) are not checked.
+ */
 LIBMSRSTATUS LIBMSRAPI MSRDecodeTrack(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest);
 LIBMSRSTATUS LIBMSRAPI MSREncodeTrack(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest);
 
+/* MSREncodeTrack, then add the LRC character after the data, for MSRCardWriteRaw.
+ * At 5 and 7 BPC the text should run from the start sentinel to the end sentinel.
+ * Dest needs SourceLen + 1 bytes.
+ */
+LIBMSRSTATUS LIBMSRAPI MSREncodeTrackLrc(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest);
+
+/* Check a raw track as read by MSRCardReadRaw without decoding it.
+ * Every character must have odd parity; blank (all-zero) ones are skipped. At 5 and 7 BPC
+ * the data must start with the start sentinel after any blank characters and be followed
+ * by the end sentinel and the LRC; at 6 and 8 BPC the last character that is not blank
+ * is taken as the LRC. Returns LIBMSR_PARITY_ERROR, LIBMSR_SENTINEL_NOT_FOUND or
+ * LIBMSR_LRC_ERROR, in that order of precedence, with *pErrorIndex set to the character
+ * at fault, or to SourceLen if a character is missing. pErrorIndex may be NULL.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRValidateTrack(UINT BitsPerChar, const BYTE *Source, SIZE_T SourceLen, SIZE_T *pErrorIndex);
+
 /* Convert data from ISO/IEC 7811-2/-6 defined encoding to ASCII.
  * Source and Dest should be the same size.
  */
@@ -145,4 +569,534 @@ LIBMSRSTATUS LIBMSRAPI ISO7811ToAscii(UINT BitsPerChar, BYTE *Source, SIZE_T Sou
  */
 LIBMSRSTATUS LIBMSRAPI AsciiToISO7811(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest);
 
+/* Implementations of the data conversion functions */
+#define LIBMSR_CODEC_AUTO 0
+#define LIBMSR_CODEC_SCALAR 1
+#define LIBMSR_CODEC_SSSE3 2
+#define LIBMSR_CODEC_AVX2 3
+
+/* Choose the implementation used by the data conversion functions.
+ * By default the fastest one the CPU supports is used; all of them produce
+ * identical output. Returns LIBMSR_NOT_SUPPORTED if the CPU cannot run it.
+ * Do not call this while other threads are converting data.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRSetCodecLevel(UINT Level);
+LIBMSRSTATUS LIBMSRAPI MSRGetCodecLevel(UINT *pLevel);
+
+/*** Batch codec API ***/
+
+/* A set of tracks stored back to back, described by parallel arrays.
+ * Record i occupies Lengths[i] bytes at Input + Offsets[i]; its result goes to the
+ * same place in Output (which may be Input) and its status to Statuses[i].
+ */
+typedef struct _LIBMSRTRACKSET {
+    SIZE_T Count;
+    const SIZE_T *Offsets;
+    const SIZE_T *Lengths;
+    const BYTE *Input;
+    BYTE *Output;
+    LIBMSRSTATUS *Statuses;
+} LIBMSRTRACKSET;
+
+/* Decode raw tracks or encode text for a whole set, split across ThreadCount
+ * threads (0 uses one per CPU). BitsPerChar may be 5 to 8 and applies to every record.
+ * Output is not NUL-terminated.
+ * Decoding reports LIBMSR_PARITY_ERROR, and at 5 and 7 BPC also LIBMSR_SENTINEL_NOT_FOUND
+ * and LIBMSR_LRC_ERROR; leading blank characters before the start sentinel are
+ * skipped, as MSRValidateTrack does, and decode as the zero character.
+ * Encoding reports LIBMSR_CHARSET_ERROR for text outside the character set.
+ * The return value only reflects the set as a whole.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRBatchDecode(const LIBMSRTRACKSET *pSet, UINT BitsPerChar, UINT ThreadCount);
+LIBMSRSTATUS LIBMSRAPI MSRBatchEncode(const LIBMSRTRACKSET *pSet, UINT BitsPerChar, UINT ThreadCount);
+
+/*** Bitstream API ***/
+
+/* Reading raw at 8 BPC returns the track bits exactly as they passed the head.
+ * These functions keep such a track as a packed bitstream (first bit in the MSB
+ * of the first byte) and do the framing in software, so a card can be tried at
+ * any BPC, bit offset and swipe direction without swiping it again.
+ */
+
+/* Pack raw data read at BitsPerChar into a bitstream; Bits needs (SourceLen * BitsPerChar + 7) / 8 bytes.
+ * At 8 BPC this is a plain copy.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRBitsFromRaw(UINT BitsPerChar, const BYTE *Source, SIZE_T SourceLen, BYTE *Bits, SIZE_T *pBitCount);
+
+/* Reverse the order of the bits, as if the card were swiped the other way. Dest must not overlap Bits. */
+LIBMSRSTATUS LIBMSRAPI MSRBitsReverse(const BYTE *Bits, SIZE_T BitCount, BYTE *Dest);
+
+/* Find the first character with the given data value (parity is added) at or after StartBit.
+ * With Reverse set, the stream is scanned from its end and offsets count from there.
+ * Returns LIBMSR_SENTINEL_NOT_FOUND if there is none.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRBitsFindChar(const BYTE *Bits, SIZE_T BitCount, SIZE_T StartBit,
+    UINT BitsPerChar, BYTE Value, BOOL Reverse, SIZE_T *pOffset);
+
+/* Cut the stream into characters from Offset on, in the format MSRCardWriteRaw takes:
+ * right-aligned, first bit in bit 0, parity in the top bit.
+ * Dest needs (BitCount - Offset) / BitsPerChar bytes.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRBitsFrame(const BYTE *Bits, SIZE_T BitCount, SIZE_T Offset,
+    UINT BitsPerChar, BOOL Reverse, BYTE *Dest, SIZE_T *pCount);
+
+/* Swipe directions */
+#define LIBMSR_BITS_FORWARD 1
+#define LIBMSR_BITS_REVERSE 2
+
+/* Find and decode the data on a track.
+ * At 5 and 7 BPC the data runs from the ISO start sentinel to the end sentinel and
+ * is returned as ASCII. At 6 and 8 BPC there are no sentinels: the data starts at
+ * the first one bit, ends at the first all-zero character, and the values are
+ * returned with parity stripped. Either way the LRC character is checked and dropped.
+ * Directions is a mask of LIBMSR_BITS_*; each is tried in turn until one decodes
+ * cleanly, and *pDirection tells which one was used.
+ * Dest is NUL-terminated; returns LIBMSR_PARITY_ERROR or LIBMSR_LRC_ERROR with the
+ * data still decoded, or LIBMSR_SENTINEL_NOT_FOUND if no data was found.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRBitsDecodeTrack(const BYTE *Bits, SIZE_T BitCount, UINT BitsPerChar, UINT Directions,
+    BYTE *Dest, SIZE_T DestSize, SIZE_T *pLength, UINT *pDirection);
+
+/*** Journal API ***/
+
+/* A journal keeps an audit trail of card reads and writes in an append-only,
+ * memory-mapped file, with a side index (the same path plus ".idx") for looking
+ * records up by time and device. Handles attached with MSRSetJournal record every
+ * raw read and write, blocking or pooled, whether it succeeded or not.
+ * Appends are copies into the mapping; they are committed in groups, every
+ * LIBMSR_JOURNAL_GROUP_RECORDS records or LIBMSR_JOURNAL_GROUP_MS of appending, by
+ * scheduling the writeback without waiting for it. Records that were not committed
+ * when the process died are dropped on reopen; MSRJournalSync waits for the disk.
+ * A journal may be shared by handles used from different threads.
+ */
+typedef void* LIBMSRJOURNAL;
+
+#define LIBMSR_JOURNAL_GROUP_RECORDS 64
+#define LIBMSR_JOURNAL_GROUP_MS 100
+
+typedef struct _LIBMSRJOURNALRECORD {
+    /* Milliseconds since 1970-01-01 UTC; never decreases within a journal */
+    ULONGLONG Time;
+    UINT DeviceId;
+    /* LIBMSR_REQ_READ_RAW or LIBMSR_REQ_WRITE_RAW */
+    UINT Type;
+    LIBMSRSTATUS Status;
+    const BYTE *Tracks[3];
+    SIZE_T TrackLengths[3];
+} LIBMSRJOURNALRECORD;
+
+/* Open a journal, creating it if needed. A missing or stale index is rebuilt. */
+LIBMSRSTATUS LIBMSRAPI MSRJournalOpen(LPTSTR Path, LIBMSRJOURNAL *pJournal);
+/* Commit, sync and close. Detach it from all handles first. */
+void LIBMSRAPI MSRJournalClose(LIBMSRJOURNAL Journal);
+
+/* Record reads and writes done through the handle under the given device id; NULL detaches. */
+LIBMSRSTATUS LIBMSRAPI MSRSetJournal(LIBMSRHANDLE Handle, LIBMSRJOURNAL Journal, UINT DeviceId);
+
+/* Append a record; Time is filled in by the journal. */
+LIBMSRSTATUS LIBMSRAPI MSRJournalAppend(LIBMSRJOURNAL Journal, const LIBMSRJOURNALRECORD *pRecord);
+/* Commit pending records now (MSRJournalCommit) or also wait for them to reach the disk (MSRJournalSync). */
+LIBMSRSTATUS LIBMSRAPI MSRJournalCommit(LIBMSRJOURNAL Journal);
+LIBMSRSTATUS LIBMSRAPI MSRJournalSync(LIBMSRJOURNAL Journal);
+
+/* Records are numbered from 0 in the order they were appended.
+ * MSRJournalGetRecord copies the track data back to back into Buffer and points the
+ * record's Tracks into it. With a NULL Buffer only the other fields and the lengths
+ * are filled in. If the data does not fit, LIBMSR_BUFFER_TOO_SMALL is returned with
+ * the lengths set; at most 3 * 0xFFFF bytes are ever needed.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRJournalGetCount(LIBMSRJOURNAL Journal, SIZE_T *pCount);
+LIBMSRSTATUS LIBMSRAPI MSRJournalGetRecord(LIBMSRJOURNAL Journal, SIZE_T Index, LIBMSRJOURNALRECORD *pRecord,
+    BYTE *Buffer, SIZE_T Capacity);
+
+/* Lookups, O(log n): the first record at or after Time, overall or for one device,
+ * and the next record of the same device. Return LIBMSR_NOT_FOUND past the end.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRJournalFindTime(LIBMSRJOURNAL Journal, ULONGLONG Time, SIZE_T *pIndex);
+LIBMSRSTATUS LIBMSRAPI MSRJournalFindDevice(LIBMSRJOURNAL Journal, UINT DeviceId, ULONGLONG Time, SIZE_T *pIndex);
+LIBMSRSTATUS LIBMSRAPI MSRJournalNextForDevice(LIBMSRJOURNAL Journal, SIZE_T Index, SIZE_T *pNext);
+
+/*** Response parser API ***/
+
+/* A push parser for device responses, for callers that do their own I/O.
+ * Feed it bytes as they arrive, in chunks of any size; it reports what it
+ * recognises through a callback and never allocates or blocks. The parser
+ * state lives in a caller-provided LIBMSRPARSER, one per response.
+ */
+
+/* Event types */
+#define LIBMSR_PARSE_REPLY 1        /* Data/Length: the fixed-size reply after the ESC */
+#define LIBMSR_PARSE_TRACK_BEGIN 2  /* Track: id as sent (1 to 3); Length: raw length, 0 for ISO */
+#define LIBMSR_PARSE_TRACK_DATA 3   /* Track; Data/Length: a chunk of the track, pointing into the fed buffer */
+#define LIBMSR_PARSE_TRACK_END 4    /* Track */
+#define LIBMSR_PARSE_STATUS 5       /* Byte: the status byte closing a card read */
+#define LIBMSR_PARSE_COMPLETE 6     /* Status: result of the command, from the reply or status byte */
+#define LIBMSR_PARSE_ERROR 7        /* Status: LIBMSR_DEVICE_UNEXPECTED_RESPONSE; Byte: the offending byte */
+
+typedef struct _LIBMSRPARSEEVENT {
+    UINT Type;
+    UINT Track;
+    const BYTE *Data;
+    SIZE_T Length;
+    BYTE Byte;
+    LIBMSRSTATUS Status;
+} LIBMSRPARSEEVENT;
+
+typedef void (LIBMSRDECL *LIBMSRPARSECALLBACK)(void *Context, const LIBMSRPARSEEVENT *pEvent);
+
+typedef struct _LIBMSRPARSER {
+    /* Private to the library */
+    UINT Type;
+    UINT Kind;
+    UINT State;
+    UINT Track;
+    SIZE_T Remaining;
+    UINT ReplyLength;
+    UINT ReplyCount;
+    BYTE Reply[4];
+    LIBMSRSTATUS Status;
+    LIBMSRPARSECALLBACK Callback;
+    void *Context;
+} LIBMSRPARSER;
+
+/* Prepare to parse the response to a command of the given LIBMSR_REQ_* type.
+ * Commands without a response complete at once.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRParserInit(LIBMSRPARSER *pParser, UINT RequestType, LIBMSRPARSECALLBACK Callback, void *Context);
+
+/* Consume response bytes. Returns LIBMSR_PENDING while more are needed, then the
+ * same status as the final COMPLETE or ERROR event. *pConsumed tells how many bytes
+ * were used; anything past the end of the response is left alone.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRParserFeed(LIBMSRPARSER *pParser, const BYTE *Data, SIZE_T Length, SIZE_T *pConsumed);
+
+/*** Device pool API ***/
+
+/* A pool drives any number of devices from a single thread.
+ * Commands are submitted as requests and complete asynchronously; the thread
+ * calling MSRPoolWait does all the I/O. Currently available on POSIX systems only;
+ * elsewhere these APIs return LIBMSR_NOT_SUPPORTED.
+ */
+typedef void* LIBMSRPOOL;
+
+/* Request types and their parameters */
+#define LIBMSR_REQ_RESET 1              /* No parameters */
+#define LIBMSR_REQ_TEST_COMMS 2         /* No parameters */
+#define LIBMSR_REQ_LED 3                /* Params[0]: LED command, 0x81..0x85 */
+#define LIBMSR_REQ_SET_COERCIVITY 4     /* Params[0]: nonzero for HiCo */
+#define LIBMSR_REQ_GET_COERCIVITY 5     /* Reply[0]: 'H' or 'L' */
+#define LIBMSR_REQ_SET_LEADING_ZEROS 6  /* Params[0]: tracks 1 and 3; Params[1]: track 2 */
+#define LIBMSR_REQ_GET_LEADING_ZEROS 7  /* Reply[0]: tracks 1 and 3; Reply[1]: track 2 */
+#define LIBMSR_REQ_SET_DENSITY 8        /* Params[0]: track; Params[1]: nonzero for 210 bpi */
+#define LIBMSR_REQ_SET_BPC 9            /* Params[0..2]: bits per char for tracks 1-3 */
+#define LIBMSR_REQ_ERASE 10             /* Params[0]: track mask, bit 0 is track 1 */
+#define LIBMSR_REQ_READ_ISO 11          /* Track buffers receive NUL-terminated text */
+#define LIBMSR_REQ_READ_RAW 12          /* Track buffers receive raw data */
+#define LIBMSR_REQ_WRITE_RAW 13         /* Track buffers/lengths supply raw data */
+#define LIBMSR_REQ_GET_MODEL 14         /* Reply[0]: model character */
+
+struct _LIBMSRREQUEST;
+
+/* Called from MSRPoolWait, or on the I/O thread of a threaded handle, when a request with a callback completes. */
+typedef void (LIBMSRDECL *LIBMSRCOMPLETION)(struct _LIBMSRREQUEST *pRequest);
+
+typedef struct _LIBMSRREQUEST {
+    /* Filled by the caller */
+    UINT Type;
+    BYTE Params[3];
+    BYTE *TrackBuffers[3];
+    SIZE_T TrackCapacities[3];
+    /* In for writes, out for reads */
+    SIZE_T TrackLengths[3];
+    /* Optional; if set, the request is handed to the callback instead of MSRPoolWait's caller */
+    LIBMSRCOMPLETION Callback;
+    void *UserData;
+
+    /* Filled on completion */
+    LIBMSRSTATUS Status;
+    BYTE Reply[4];
+
+    /* Private to the library */
+    struct _LIBMSRREQUEST *Next;
+    void *Owner;
+} LIBMSRREQUEST;
+
+/* Create and destroy a pool.
+ * Destroying a pool does not close the handles added to it.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRPoolCreate(LIBMSRPOOL *pPool);
+void LIBMSRAPI MSRPoolDestroy(LIBMSRPOOL Pool);
+
+/* Add an open handle to the pool. The transport must provide GetFd.
+ * Once added, the handle must only be used through the pool until it is removed.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRPoolAdd(LIBMSRPOOL Pool, LIBMSRHANDLE Handle);
+
+/* Convenience: MSROpen followed by MSRPoolAdd. */
+LIBMSRSTATUS LIBMSRAPI MSRPoolOpen(LIBMSRPOOL Pool, LPTSTR PortName, LIBMSRHANDLE *pHandle);
+
+/* Remove a handle from the pool; it must have no requests outstanding. */
+LIBMSRSTATUS LIBMSRAPI MSRPoolRemove(LIBMSRPOOL Pool, LIBMSRHANDLE Handle);
+
+/* Queue a request for the device. Requests to one device run in order.
+ * The request memory must stay valid until it is returned by MSRPoolWait.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRPoolSubmit(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest);
+
+/* Run I/O until a request completes or TimeoutMs passes (-1 waits forever).
+ * Completed requests that have a callback are passed to it and waiting goes on;
+ * others are returned. On timeout, LIBMSR_OK is returned with *ppRequest set to NULL.
+ * LIBMSR_PORT_WRITE_FAILED or LIBMSR_PORT_READ_FAILED means the descriptor from
+ * MSRPoolGetFd could not be signalled or cleared; no request is lost, and later
+ * calls go on returning them.
+ * A request is bounded by its handle's CommandMs or SwipeMs from when it is sent;
+ * past that it completes with LIBMSR_TIMEOUT and the device is reset.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRPoolWait(LIBMSRPOOL Pool, int TimeoutMs, LIBMSRREQUEST **ppRequest);
+
+/* Get a descriptor that polls readable whenever MSRPoolWait has work to do,
+ * so a pool can be plugged into another event loop. Call MSRPoolWait with a
+ * zero timeout when it fires. Request timeouts do not make it readable, so also
+ * call MSRPoolWait at least as often as the shortest timeout in use.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRPoolGetFd(LIBMSRPOOL Pool, int *pFd);
+
+/* Cancel a submitted request; it completes with LIBMSR_CANCELLED.
+ * If the device is already working on it (e.g. waiting for a swipe), the device
+ * is reset and the line is drained until it has been quiet for InterByteMs.
+ * Returns LIBMSR_INVALID_ARGUMENT if the request is not outstanding.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRPoolCancel(LIBMSRPOOL Pool, LIBMSRREQUEST *pRequest);
+
+/*** Asynchronous card access API ***/
+
+/* Non-blocking counterparts of MSRCardReadRaw, MSRCardReadISO and MSRCardWriteRaw.
+ * These fill in *pRequest, submit it to the pool and return at once; the result
+ * is reported via Callback, or by MSRPoolWait if Callback is NULL.
+ * Read buffers are bounded by the given capacities; NULL buffers discard the track.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRCardReadRawAsync(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest,
+    BYTE *pTrack1Buffer, SIZE_T Track1Capacity,
+    BYTE *pTrack2Buffer, SIZE_T Track2Capacity,
+    BYTE *pTrack3Buffer, SIZE_T Track3Capacity,
+    LIBMSRCOMPLETION Callback, void *UserData);
+
+LIBMSRSTATUS LIBMSRAPI MSRCardReadISOAsync(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest,
+    BYTE *pTrack1Buffer, SIZE_T Track1Capacity,
+    BYTE *pTrack2Buffer, SIZE_T Track2Capacity,
+    BYTE *pTrack3Buffer, SIZE_T Track3Capacity,
+    LIBMSRCOMPLETION Callback, void *UserData);
+
+LIBMSRSTATUS LIBMSRAPI MSRCardWriteRawAsync(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest,
+    BYTE *pTrack1Buffer, SIZE_T Track1Length,
+    BYTE *pTrack2Buffer, SIZE_T Track2Length,
+    BYTE *pTrack3Buffer, SIZE_T Track3Length,
+    LIBMSRCOMPLETION Callback, void *UserData);
+
+/*** Threaded handle API ***/
+
+/* A handle can own an I/O thread that does all its device traffic. Any number of
+ * threads may then use the handle at once: the blocking APIs hand their command to
+ * the I/O thread and wait for it, and MSRSubmit queues a request without waiting.
+ * Commands run in submission order. An LED or device setting command is dropped when
+ * the next one sets the same thing again: the same LED command or all on/all off after
+ * any LED command, or the same setting (per track for the density). The dropped
+ * requests complete with the status of the one sent and get no reply data.
+ * A threaded handle cannot be added to a pool.
+ */
+
+/* Start the I/O thread for the handle. */
+LIBMSRSTATUS LIBMSRAPI MSRStartIoThread(LIBMSRHANDLE Handle);
+
+/* Run the commands already queued, then stop the I/O thread.
+ * No other thread may be using the handle. MSRClose does this as well.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRStopIoThread(LIBMSRHANDLE Handle);
+
+/* Queue a request on a threaded handle and return at once.
+ * On completion the request's Callback, if any, is run on the I/O thread and the
+ * request is the callback's from then on. Otherwise wait for it with MSRRequestWait.
+ * The request memory must stay valid until it has completed.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRSubmit(LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest);
+
+/* Wait up to TimeoutMs (LIBMSR_INFINITE waits forever) for a submitted request.
+ * Returns the request's status, or LIBMSR_PENDING if it has not completed yet.
+ * Requests with a Callback cannot be waited for (LIBMSR_INVALID_ARGUMENT).
+ */
+LIBMSRSTATUS LIBMSRAPI MSRRequestWait(LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest, UINT TimeoutMs);
+
+/*** Device discovery API ***/
+
+#define LIBMSR_MAX_PORT_NAME 64
+
+typedef struct {
+    TCHAR PortName[LIBMSR_MAX_PORT_NAME];
+    /* Filled by MSRProbePorts: LIBMSR_OK if a device answered */
+    LIBMSRSTATUS Status;
+    /* From MSRGetModel, 0 if the device did not say */
+    BYTE Model;
+    /* Milliseconds the probe took */
+    UINT ProbeTime;
+    /* Open handle to the device if asked for; the caller closes it */
+    LIBMSRHANDLE Handle;
+} LIBMSRPORTINFO;
+
+typedef struct {
+    /* Deadline for each step of the probe, default 250 ms */
+    UINT TimeoutMs;
+    /* Ports probed at once, default all of them */
+    UINT MaxThreads;
+    /* Leave handles open for the devices found */
+    BOOL KeepOpen;
+    /* Skip the model query for devices known not to answer it */
+    BOOL SkipModel;
+} LIBMSRPROBEOPTIONS;
+
+/* List the serial ports a device could be on, sorted by name.
+ * If there are more than Capacity, *pCount gets the full count and
+ * LIBMSR_BUFFER_TOO_SMALL is returned.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRListPorts(LIBMSRPORTINFO Ports[], UINT Capacity, UINT *pCount);
+
+/* Probe the given ports in parallel: open each one, reset the device, test
+ * communications and ask for the model, all with short deadlines.
+ * Each port gets its own result in Status. pOptions may be NULL.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRProbePorts(LIBMSRPORTINFO Ports[], UINT Count, const LIBMSRPROBEOPTIONS *pOptions);
+
+/* MSRListPorts then MSRProbePorts; only the ports with a device are returned. */
+LIBMSRSTATUS LIBMSRAPI MSRDiscover(LIBMSRPORTINFO Ports[], UINT Capacity, UINT *pCount, const LIBMSRPROBEOPTIONS *pOptions);
+
+/* Hot-plug notification by polling the port list. Each call to MSRPortWatchPoll
+ * compares the ports with those seen by the previous call and reports the
+ * differences; the first call reports every port as arrived. Where the system
+ * allows (POSIX), an unchanged device directory is detected without listing it.
+ */
+typedef void* LIBMSRPORTWATCH;
+typedef void (LIBMSRDECL *LIBMSRPORTCALLBACK)(void *Context, LPTSTR PortName, BOOL Arrived);
+
+LIBMSRSTATUS LIBMSRAPI MSRPortWatchCreate(LIBMSRPORTWATCH *pWatch);
+void LIBMSRAPI MSRPortWatchDestroy(LIBMSRPORTWATCH Watch);
+LIBMSRSTATUS LIBMSRAPI MSRPortWatchPoll(LIBMSRPORTWATCH Watch, LIBMSRPORTCALLBACK Callback, void *Context);
+
+/*** Card data API ***/
+
+/* A field of a decoded track: Length characters at Offset into the text that was parsed.
+ * Absent fields have Length 0. Fixed-width fields have their padding spaces trimmed.
+ */
+typedef struct _LIBMSRFIELD {
+    UINT Offset;
+    UINT Length;
+} LIBMSRFIELD;
+
+/* Track layouts */
+#define LIBMSR_LAYOUT_AUTO 0
+#define LIBMSR_LAYOUT_ISO_TRACK1 1      /* ISO/IEC 7813 track 1, format code B */
+#define LIBMSR_LAYOUT_ISO_TRACK2 2      /* ISO/IEC 7813 track 2 */
+#define LIBMSR_LAYOUT_AAMVA_TRACK1 3    /* AAMVA driver license/ID card tracks */
+#define LIBMSR_LAYOUT_AAMVA_TRACK2 4
+#define LIBMSR_LAYOUT_AAMVA_TRACK3 5
+
+/* Field indices, and the layouts that have them */
+#define LIBMSR_FIELD_PAN 0                  /* ISO: primary account number */
+#define LIBMSR_FIELD_NAME 1                 /* ISO track 1, AAMVA track 1 */
+#define LIBMSR_FIELD_EXPIRY 2               /* ISO, AAMVA track 2: YYMM */
+#define LIBMSR_FIELD_SERVICE_CODE 3         /* ISO */
+#define LIBMSR_FIELD_DISCRETIONARY 4        /* ISO; AAMVA track 3: ID number and the rest */
+#define LIBMSR_FIELD_STATE 5                /* AAMVA track 1 */
+#define LIBMSR_FIELD_CITY 6                 /* AAMVA track 1 */
+#define LIBMSR_FIELD_ADDRESS 7              /* AAMVA track 1 */
+#define LIBMSR_FIELD_IIN 8                  /* AAMVA track 2: issuer identification number */
+#define LIBMSR_FIELD_ID_NUMBER 9            /* AAMVA track 2 */
+#define LIBMSR_FIELD_BIRTH_DATE 10          /* AAMVA track 2: CCYYMMDD */
+#define LIBMSR_FIELD_ID_OVERFLOW 11         /* AAMVA track 2 */
+#define LIBMSR_FIELD_CDS_VERSION 12         /* AAMVA track 3 from here on */
+#define LIBMSR_FIELD_JURISDICTION_VERSION 13
+#define LIBMSR_FIELD_POSTAL_CODE 14
+#define LIBMSR_FIELD_CLASS 15
+#define LIBMSR_FIELD_RESTRICTIONS 16
+#define LIBMSR_FIELD_ENDORSEMENTS 17
+#define LIBMSR_FIELD_SEX 18
+#define LIBMSR_FIELD_HEIGHT 19
+#define LIBMSR_FIELD_WEIGHT 20
+#define LIBMSR_FIELD_HAIR_COLOR 21
+#define LIBMSR_FIELD_EYE_COLOR 22
+#define LIBMSR_FIELD_COUNT 23
+
+typedef struct _LIBMSRFIELDS {
+    /* The LIBMSR_LAYOUT_* the track was parsed as */
+    UINT Layout;
+    LIBMSRFIELD Fields[LIBMSR_FIELD_COUNT];
+} LIBMSRFIELDS;
+
+/* Split decoded track text, e.g. from MSRDecodeTrack or MSRCardReadISO, into fields.
+ * Anything before the start sentinel (blank media) and after the end sentinel (the LRC)
+ * is skipped. With LIBMSR_LAYOUT_AUTO the layout is told from the start of the data;
+ * AAMVA track 2 is told from ISO track 2 by the 636 issuer prefix.
+ * Returns LIBMSR_SENTINEL_NOT_FOUND or LIBMSR_FORMAT_ERROR if the text does not fit.
+ * The text is not copied and nothing is allocated.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRParseFields(const BYTE *Text, SIZE_T Length, UINT Layout, LIBMSRFIELDS *pFields);
+
+/* Check the Luhn (mod 10) check digit that ends a PAN.
+ * Returns LIBMSR_CHECK_DIGIT_ERROR if it is wrong and LIBMSR_CHARSET_ERROR if
+ * there is anything but digits.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRLuhnCheck(const BYTE *Digits, SIZE_T Length);
+
+/*** Device server API ***/
+
+/* A server owns devices and shares them with other processes over a local socket;
+ * src/msrd.c runs one. Requests from all clients of a device run in the order they
+ * arrive. Identical reads and queries waiting at the same time go to the device once
+ * and are answered together, so clients waiting for a swipe all get the same card.
+ * Currently available on POSIX systems only; elsewhere these APIs return LIBMSR_NOT_SUPPORTED.
+ */
+typedef void* LIBMSRSERVER;
+
+/* Create a server listening on the Unix socket at SocketPath.
+ * A stale socket file is replaced; one another server is listening on is not.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRServerCreate(LPTSTR SocketPath, LIBMSRSERVER *pServer);
+
+/* Close the devices and every client connection, and remove the socket. */
+void LIBMSRAPI MSRServerDestroy(LIBMSRSERVER Server);
+
+/* Open a port and serve the device on it; clients name it as given here. */
+LIBMSRSTATUS LIBMSRAPI MSRServerOpen(LIBMSRSERVER Server, LPTSTR PortName);
+
+/* Wait up to TimeoutMs (-1 waits forever) for client messages or device responses
+ * and handle everything that is ready. Returns early, with LIBMSR_OK, if a signal
+ * arrives. Call it in a loop.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRServerRun(LIBMSRSERVER Server, int TimeoutMs);
+
+/* Open a device on the server listening at SocketPath; NULL PortName takes its first device.
+ * The handle works with the blocking APIs and an I/O thread, but not with a pool.
+ * Device settings are not cached, as other clients may change them. Of the timeouts
+ * only SwipeMs applies; the server answers everything else as soon as the device has.
+ */
+LIBMSRSTATUS LIBMSRAPI MSROpenRemote(LPTSTR SocketPath, LPTSTR PortName, LIBMSRHANDLE *pHandle);
+
+/* Subscription flags */
+#define LIBMSR_SUBSCRIBE_SWIPES 1   /* Every card read on the device, whichever client asked for it */
+#define LIBMSR_SUBSCRIBE_LISTEN 3   /* As above; also keep a raw read waiting while the device is idle.
+                                     * A request from any client cancels that read, which resets the device. */
+
+/* Ask for swipe events on a remote handle; 0 stops them.
+ * Events are queued on the handle until collected with MSRRemoteWaitSwipe.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRRemoteSubscribe(LIBMSRHANDLE Handle, UINT Flags);
+
+/* Wait up to TimeoutMs (LIBMSR_INFINITE waits forever) for a swipe event.
+ * Set TrackBuffers and TrackCapacities in *pEvent first; Type (the read request type),
+ * TrackLengths and Status are filled in. Returns LIBMSR_TIMEOUT if no event came.
+ */
+LIBMSRSTATUS LIBMSRAPI MSRRemoteWaitSwipe(LIBMSRHANDLE Handle, LIBMSRREQUEST *pEvent, UINT TimeoutMs);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* LIBMSR_H */
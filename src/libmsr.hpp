@@ -0,0 +1,608 @@
+/*
+ * libmsr.hpp: C++20 interface to libmsr
+ *
+ * Header-only; link against the C library as usual.
+ * Failed calls throw msr::Error, a std::system_error whose code() is in msr::Category().
+ *
+ * Devices opened through an msr::Pool can be driven from coroutines: the *Async
+ * operations return awaitables, and one thread calling Pool::Run resumes every
+ * coroutine as its request completes. The same operations work on a handle with
+ * an I/O thread, resuming the coroutine on that thread instead.
+ */
+
+#ifndef LIBMSR_HPP
+#define LIBMSR_HPP
+
+#include "libmsr.h"
+
+#include <array>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace msr {
+
+/*** Errors ***/
+
+class ErrorCategory : public std::error_category {
+public:
+    const char *name() const noexcept override { return "libmsr"; }
+
+    std::string message(int Value) const override
+    {
+        switch ((LIBMSRSTATUS)Value) {
+        case LIBMSR_OK: return "success";
+        case LIBMSR_PENDING: return "pending";
+        case LIBMSR_MEM_ALLOC_FAILED: return "memory allocation failed";
+        case LIBMSR_INVALID_ARGUMENT: return "invalid argument";
+        case LIBMSR_NOT_SUPPORTED: return "not supported";
+        case LIBMSR_BUFFER_TOO_SMALL: return "buffer too small";
+        case LIBMSR_CANCELLED: return "cancelled";
+        case LIBMSR_NOT_FOUND: return "not found";
+        case LIBMSR_DEVICE_UNEXPECTED_RESPONSE: return "unexpected response from device";
+        case LIBMSR_DEVICE_COMMAND_FAILED: return "device command failed";
+        case LIBMSR_DEVICE_VERIFY_FAILED: return "device verify failed";
+        case LIBMSR_PORT_OPEN_FAILED: return "cannot open port";
+        case LIBMSR_PORT_SETUP_FAILED: return "cannot set up port";
+        case LIBMSR_PORT_WRITE_FAILED: return "port write failed";
+        case LIBMSR_PORT_READ_FAILED: return "port read failed";
+        case LIBMSR_TIMEOUT: return "timed out";
+        case LIBMSR_REPLAY_MISMATCH: return "replay does not match capture";
+        case LIBMSR_PARITY_ERROR: return "parity error";
+        case LIBMSR_LRC_ERROR: return "LRC error";
+        case LIBMSR_SENTINEL_NOT_FOUND: return "sentinel not found";
+        case LIBMSR_CHARSET_ERROR: return "character not in track character set";
+        case LIBMSR_FORMAT_ERROR: return "track format error";
+        case LIBMSR_CHECK_DIGIT_ERROR: return "check digit error";
+        case LIBMSR_FILE_IO_FAILED: return "file I/O failed";
+        case LIBMSR_FILE_CORRUPT: return "file corrupt";
+        default: return "libmsr error";
+        }
+    }
+};
+
+inline const std::error_category &Category() noexcept
+{
+    static const ErrorCategory Instance;
+    return Instance;
+}
+
+inline std::error_code MakeErrorCode(LIBMSRSTATUS Status) noexcept
+{
+    return std::error_code((int)Status, Category());
+}
+
+class Error : public std::system_error {
+public:
+    explicit Error(LIBMSRSTATUS Status) : std::system_error(MakeErrorCode(Status)), Status_(Status) {}
+
+    LIBMSRSTATUS Status() const noexcept { return Status_; }
+
+private:
+    LIBMSRSTATUS Status_;
+};
+
+/* Throw for an error status; pass anything else through */
+inline LIBMSRSTATUS Check(LIBMSRSTATUS Status)
+{
+    if (Status < 0) {
+        throw Error(Status);
+    }
+    return Status;
+}
+
+/*** Track data ***/
+
+/* Views of the three tracks in the caller's buffers, cut to what was read.
+ * Tracks given no buffer, or not sent by the device, are empty.
+ */
+using Tracks = std::array<std::span<BYTE>, 3>;
+
+enum class Led : BYTE {
+    AllOff = 0x81,
+    AllOn = 0x82,
+    Green = 0x83,
+    Yellow = 0x84,
+    Red = 0x85,
+};
+
+class Device;
+class Pool;
+
+namespace detail {
+
+inline BYTE *BufferOf(std::span<BYTE> Buffer) noexcept
+{
+    return Buffer.empty() ? nullptr : Buffer.data();
+}
+
+/* The C API takes write data through non-const pointers but does not modify it */
+inline BYTE *BufferOf(std::span<const BYTE> Buffer) noexcept
+{
+    return Buffer.empty() ? nullptr : const_cast<BYTE *>(Buffer.data());
+}
+
+/* The blocking reads need full-size buffers; see MSRCardReadRaw */
+inline void CheckReadBuffers(std::span<BYTE> T1, std::span<BYTE> T2, std::span<BYTE> T3)
+{
+    for (std::span<BYTE> Buffer : { T1, T2, T3 }) {
+        if (!Buffer.empty() && Buffer.size() < LIBMSR_MAX_TRACK_LENGTH) {
+            throw Error(LIBMSR_BUFFER_TOO_SMALL);
+        }
+    }
+}
+
+inline Tracks TracksOf(const LIBMSRREQUEST &Request) noexcept
+{
+    Tracks Result;
+
+    for (int i = 0; i < 3; ++i) {
+        if (Request.TrackBuffers[i]) {
+            Result[i] = std::span<BYTE>(Request.TrackBuffers[i], Request.TrackLengths[i]);
+        }
+    }
+    return Result;
+}
+
+inline LIBMSRREQUEST MakeRequest(UINT Type, BYTE Param0 = 0, BYTE Param1 = 0, BYTE Param2 = 0) noexcept
+{
+    LIBMSRREQUEST Request;
+
+    std::memset(&Request, 0, sizeof(Request));
+    Request.Type = Type;
+    Request.Params[0] = Param0;
+    Request.Params[1] = Param1;
+    Request.Params[2] = Param2;
+    return Request;
+}
+
+/* The part of an operation that does not depend on its result type */
+class OperationBase {
+public:
+    OperationBase(LIBMSRHANDLE Handle, Pool *Owner, const LIBMSRREQUEST &Request) noexcept
+        : Handle(Handle), Owner(Owner), Request(Request) {}
+
+    OperationBase(const OperationBase &) = delete;
+    OperationBase &operator=(const OperationBase &) = delete;
+
+    bool await_ready() const noexcept { return false; }
+    inline bool await_suspend(std::coroutine_handle<> Caller) noexcept;
+
+protected:
+    /* Threaded handles complete requests through this, on their I/O thread */
+    static void LIBMSRDECL Complete(LIBMSRREQUEST *pRequest)
+    {
+        std::coroutine_handle<>::from_address(pRequest->UserData).resume();
+    }
+
+    LIBMSRHANDLE Handle;
+    Pool *Owner;
+    /* The library holds on to this until completion, so the operation must not move */
+    LIBMSRREQUEST Request;
+};
+
+} /* namespace detail */
+
+/* An awaitable device request. Awaiting it submits the request, suspends the
+ * coroutine until the request completes and then yields Result, or throws.
+ */
+template <class Result>
+class Operation : public detail::OperationBase {
+public:
+    using detail::OperationBase::OperationBase;
+
+    Result await_resume()
+    {
+        Check(Request.Status);
+        if constexpr (std::is_same_v<Result, Tracks>) {
+            return detail::TracksOf(Request);
+        }
+        else if constexpr (std::is_same_v<Result, BYTE>) {
+            return Request.Reply[0];
+        }
+    }
+};
+
+/*** Pool ***/
+
+/* A device pool run from one thread; see MSRPoolCreate.
+ * Every request on the pool must come from an Operation, as Run resumes the
+ * coroutine that submitted it. The pool cannot move, as its devices refer to it.
+ */
+class Pool {
+public:
+    Pool() { Check(MSRPoolCreate(&Handle)); }
+    ~Pool() { MSRPoolDestroy(Handle); }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    LIBMSRPOOL Get() const noexcept { return Handle; }
+
+    /* Requests submitted and not yet completed */
+    SIZE_T Outstanding() const noexcept { return Outstanding_; }
+
+    /* Open a device straight into the pool */
+    inline Device Open(const TCHAR *PortName);
+
+    /* Take an open device into the pool */
+    inline void Add(Device &Dev);
+
+    /* Complete at most one request, resuming its coroutine there and then.
+     * Returns false if nothing completed within TimeoutMs (-1 waits forever).
+     */
+    bool RunOnce(int TimeoutMs = -1)
+    {
+        LIBMSRREQUEST *Completed;
+
+        Check(MSRPoolWait(Handle, TimeoutMs, &Completed));
+        if (!Completed) {
+            return false;
+        }
+        Outstanding_--;
+        std::coroutine_handle<>::from_address(Completed->UserData).resume();
+        return true;
+    }
+
+    /* Run until no request is outstanding, i.e. every coroutine using the pool
+     * has finished or is waiting on something else.
+     */
+    void Run()
+    {
+        while (Outstanding_) {
+            RunOnce(-1);
+        }
+    }
+
+    /* Descriptor for another event loop; call RunOnce(0) when it is readable */
+    int GetFd() const
+    {
+        int Fd;
+
+        Check(MSRPoolGetFd(Handle, &Fd));
+        return Fd;
+    }
+
+private:
+    friend class detail::OperationBase;
+
+    LIBMSRPOOL Handle = nullptr;
+    SIZE_T Outstanding_ = 0;
+};
+
+inline bool detail::OperationBase::await_suspend(std::coroutine_handle<> Caller) noexcept
+{
+    LIBMSRSTATUS Status;
+
+    Request.UserData = Caller.address();
+    if (!Handle) {
+        Status = LIBMSR_INVALID_ARGUMENT;
+    }
+    else if (Owner) {
+        Request.Callback = nullptr;
+        Status = MSRPoolSubmit(Owner->Get(), Handle, &Request);
+        if (Status >= 0) {
+            Owner->Outstanding_++;
+        }
+    }
+    else {
+        /* Once submitted, the request may complete and resume the caller on the
+         * I/O thread at any moment; the operation must not be touched after that.
+         */
+        Request.Callback = Complete;
+        Status = MSRSubmit(Handle, &Request);
+    }
+    if (Status < 0) {
+        Request.Status = Status;
+        return false;
+    }
+    return true;
+}
+
+/*** Device ***/
+
+/* Owns an open device handle and closes it on destruction.
+ * A device in a pool is removed from it first; it must not have requests outstanding,
+ * and must be closed before the pool is destroyed.
+ * The blocking calls cannot be used on a device in a pool.
+ */
+class Device {
+public:
+    Device() noexcept = default;
+    explicit Device(LIBMSRHANDLE Handle, Pool *Owner = nullptr) noexcept : Handle(Handle), Owner(Owner) {}
+
+    Device(Device &&Other) noexcept
+        : Handle(std::exchange(Other.Handle, nullptr)), Owner(std::exchange(Other.Owner, nullptr)) {}
+
+    Device &operator=(Device &&Other) noexcept
+    {
+        if (this != &Other) {
+            Close();
+            Handle = std::exchange(Other.Handle, nullptr);
+            Owner = std::exchange(Other.Owner, nullptr);
+        }
+        return *this;
+    }
+
+    Device(const Device &) = delete;
+    Device &operator=(const Device &) = delete;
+
+    ~Device() { Close(); }
+
+    static Device Open(const TCHAR *PortName)
+    {
+        LIBMSRHANDLE Handle;
+
+        Check(MSROpen(const_cast<LPTSTR>(PortName), &Handle));
+        return Device(Handle);
+    }
+
+    void Close() noexcept
+    {
+        if (!Handle) {
+            return;
+        }
+        if (Owner) {
+            MSRPoolRemove(Owner->Get(), Handle);
+        }
+        MSRClose(Handle);
+        Handle = nullptr;
+        Owner = nullptr;
+    }
+
+    /* Give up ownership without closing; the handle stays in its pool, if any */
+    LIBMSRHANDLE Release() noexcept
+    {
+        Owner = nullptr;
+        return std::exchange(Handle, nullptr);
+    }
+
+    LIBMSRHANDLE Get() const noexcept { return Handle; }
+    Pool *GetPool() const noexcept { return Owner; }
+    explicit operator bool() const noexcept { return Handle != nullptr; }
+
+    /* Give the handle an I/O thread, making it safe to share and able to run Operations */
+    void StartIoThread() { Check(MSRStartIoThread(Handle)); }
+
+    /* Blocking calls */
+
+    void Reset() { Check(MSRReset(Handle)); }
+    void TestComms() { Check(MSRTestComms(Handle)); }
+
+    void SetLed(Led Which)
+    {
+        switch (Which) {
+        case Led::AllOff: Check(MSRLedAllOff(Handle)); break;
+        case Led::AllOn: Check(MSRLedAllOn(Handle)); break;
+        case Led::Green: Check(MSRLedGreenOn(Handle)); break;
+        case Led::Yellow: Check(MSRLedYellowOn(Handle)); break;
+        case Led::Red: Check(MSRLedRedOn(Handle)); break;
+        }
+    }
+
+    BYTE GetModel()
+    {
+        BYTE Model;
+
+        Check(MSRGetModel(Handle, &Model));
+        return Model;
+    }
+
+    void SetCoercivity(bool IsHiCo) { Check(MSRSetCoercivity(Handle, IsHiCo)); }
+
+    bool GetCoercivity()
+    {
+        BOOL IsHiCo;
+
+        Check(MSRGetCoercivity(Handle, &IsHiCo));
+        return IsHiCo != FALSE;
+    }
+
+    void SetBitsPerChar(BYTE Track1BPC, BYTE Track2BPC, BYTE Track3BPC)
+    {
+        Check(MSRSetBitsPerChar(Handle, Track1BPC, Track2BPC, Track3BPC));
+    }
+
+    void SetDensity(UINT Track, UINT BitsPerInch) { Check(MSRSetDensity(Handle, Track, BitsPerInch)); }
+
+    void ApplyConfig(const LIBMSRCONFIG &Config) { Check(MSRApplyConfig(Handle, &Config)); }
+
+    void Erase(bool Track1, bool Track2, bool Track3) { Check(MSRCardErase(Handle, Track1, Track2, Track3)); }
+
+    /* Non-empty buffers must hold LIBMSR_MAX_TRACK_LENGTH bytes; empty ones skip the track */
+    Tracks ReadRaw(std::span<BYTE> T1, std::span<BYTE> T2, std::span<BYTE> T3)
+    {
+        SIZE_T Lengths[3] = { 0, 0, 0 };
+
+        detail::CheckReadBuffers(T1, T2, T3);
+        Check(MSRCardReadRaw(Handle,
+            detail::BufferOf(T1), &Lengths[0], detail::BufferOf(T2), &Lengths[1], detail::BufferOf(T3), &Lengths[2]));
+        return Tracks{ T1.first(T1.empty() ? 0 : Lengths[0]), T2.first(T2.empty() ? 0 : Lengths[1]),
+            T3.first(T3.empty() ? 0 : Lengths[2]) };
+    }
+
+    /* As ReadRaw; the text is NUL-terminated in the buffers, and the views stop short of it */
+    Tracks ReadISO(std::span<BYTE> T1, std::span<BYTE> T2, std::span<BYTE> T3)
+    {
+        Tracks Result{ T1, T2, T3 };
+
+        detail::CheckReadBuffers(T1, T2, T3);
+        Check(MSRCardReadISO(Handle, detail::BufferOf(T1), detail::BufferOf(T2), detail::BufferOf(T3)));
+        for (std::span<BYTE> &Text : Result) {
+            if (!Text.empty()) {
+                Text = Text.first(std::strlen((const char *)Text.data()));
+            }
+        }
+        return Result;
+    }
+
+    void WriteRaw(std::span<const BYTE> T1, std::span<const BYTE> T2, std::span<const BYTE> T3)
+    {
+        Check(MSRCardWriteRaw(Handle,
+            detail::BufferOf(T1), T1.size(), detail::BufferOf(T2), T2.size(), detail::BufferOf(T3), T3.size()));
+    }
+
+    /* Awaitable calls, for a device in a pool or with an I/O thread.
+     * Buffers must stay valid until the operation completes; reads take buffers of any size.
+     */
+
+    Operation<void> ResetAsync() { return MakeOperation<void>(detail::MakeRequest(LIBMSR_REQ_RESET)); }
+    Operation<void> TestCommsAsync() { return MakeOperation<void>(detail::MakeRequest(LIBMSR_REQ_TEST_COMMS)); }
+    Operation<void> SetLedAsync(Led Which) { return MakeOperation<void>(detail::MakeRequest(LIBMSR_REQ_LED, (BYTE)Which)); }
+    Operation<BYTE> GetModelAsync() { return MakeOperation<BYTE>(detail::MakeRequest(LIBMSR_REQ_GET_MODEL)); }
+
+    Operation<void> SetCoercivityAsync(bool IsHiCo)
+    {
+        return MakeOperation<void>(detail::MakeRequest(LIBMSR_REQ_SET_COERCIVITY, IsHiCo));
+    }
+
+    Operation<void> EraseAsync(bool Track1, bool Track2, bool Track3)
+    {
+        return MakeOperation<void>(detail::MakeRequest(LIBMSR_REQ_ERASE, (BYTE)(Track1 | Track2 << 1 | Track3 << 2)));
+    }
+
+    Operation<Tracks> ReadRawAsync(std::span<BYTE> T1, std::span<BYTE> T2, std::span<BYTE> T3)
+    {
+        return MakeOperation<Tracks>(MakeTrackRequest(LIBMSR_REQ_READ_RAW, T1, T2, T3));
+    }
+
+    /* The text is NUL-terminated when it fits; the views leave the NUL out */
+    Operation<Tracks> ReadISOAsync(std::span<BYTE> T1, std::span<BYTE> T2, std::span<BYTE> T3)
+    {
+        return MakeOperation<Tracks>(MakeTrackRequest(LIBMSR_REQ_READ_ISO, T1, T2, T3));
+    }
+
+    Operation<void> WriteRawAsync(std::span<const BYTE> T1, std::span<const BYTE> T2, std::span<const BYTE> T3)
+    {
+        LIBMSRREQUEST Request = detail::MakeRequest(LIBMSR_REQ_WRITE_RAW);
+        std::span<const BYTE> Buffers[3] = { T1, T2, T3 };
+
+        for (int i = 0; i < 3; ++i) {
+            Request.TrackBuffers[i] = detail::BufferOf(Buffers[i]);
+            Request.TrackLengths[i] = Buffers[i].size();
+        }
+        return MakeOperation<void>(Request);
+    }
+
+private:
+    friend class Pool;
+
+    template <class Result>
+    Operation<Result> MakeOperation(const LIBMSRREQUEST &Request) noexcept
+    {
+        return Operation<Result>(Handle, Owner, Request);
+    }
+
+    static LIBMSRREQUEST MakeTrackRequest(UINT Type, std::span<BYTE> T1, std::span<BYTE> T2, std::span<BYTE> T3) noexcept
+    {
+        LIBMSRREQUEST Request = detail::MakeRequest(Type);
+        std::span<BYTE> Buffers[3] = { T1, T2, T3 };
+
+        for (int i = 0; i < 3; ++i) {
+            Request.TrackBuffers[i] = detail::BufferOf(Buffers[i]);
+            Request.TrackCapacities[i] = Buffers[i].size();
+        }
+        return Request;
+    }
+
+    LIBMSRHANDLE Handle = nullptr;
+    Pool *Owner = nullptr;
+};
+
+inline Device Pool::Open(const TCHAR *PortName)
+{
+    LIBMSRHANDLE DeviceHandle;
+
+    Check(MSRPoolOpen(Handle, const_cast<LPTSTR>(PortName), &DeviceHandle));
+    return Device(DeviceHandle, this);
+}
+
+inline void Pool::Add(Device &Dev)
+{
+    Check(MSRPoolAdd(Handle, Dev.Handle));
+    Dev.Owner = this;
+}
+
+/*** Task ***/
+
+/* A coroutine for a card workflow. It starts at once and runs up to its first
+ * suspension; awaiting a Task waits for it to finish and rethrows its exception.
+ * Destroying a Task destroys the coroutine, so it must not be waiting on a device then.
+ */
+class Task {
+public:
+    struct promise_type {
+        std::exception_ptr Exception;
+        std::coroutine_handle<> Continuation;
+
+        Task get_return_object() noexcept { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> Self) noexcept
+            {
+                std::coroutine_handle<> Next = Self.promise().Continuation;
+
+                return Next ? Next : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { Exception = std::current_exception(); }
+    };
+
+    Task() noexcept = default;
+    Task(Task &&Other) noexcept : Coroutine(std::exchange(Other.Coroutine, nullptr)) {}
+
+    Task &operator=(Task &&Other) noexcept
+    {
+        if (this != &Other) {
+            if (Coroutine) {
+                Coroutine.destroy();
+            }
+            Coroutine = std::exchange(Other.Coroutine, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if (Coroutine) {
+            Coroutine.destroy();
+        }
+    }
+
+    bool Done() const noexcept { return !Coroutine || Coroutine.done(); }
+
+    /* Rethrow what ended the task, if anything; it must be done */
+    void Get() const
+    {
+        if (Coroutine && Coroutine.promise().Exception) {
+            std::rethrow_exception(Coroutine.promise().Exception);
+        }
+    }
+
+    bool await_ready() const noexcept { return Done(); }
+    void await_suspend(std::coroutine_handle<> Caller) noexcept { Coroutine.promise().Continuation = Caller; }
+    void await_resume() const { Get(); }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> Coroutine) noexcept : Coroutine(Coroutine) {}
+
+    std::coroutine_handle<promise_type> Coroutine;
+};
+
+} /* namespace msr */
+
+#endif /* LIBMSR_HPP */
@@ -1,25 +1,134 @@
 #include "libmsr.h"
 #include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
 #include <tchar.h>
+#else
+#define _tmain main
+typedef char _TCHAR;
+#endif
+
+/* Show how many transport calls and bytes the last operation took. */
+static void PrintIoCounters(LIBMSRHANDLE Handle, LIBMSRIOCOUNTERS *Last)
+{
+    LIBMSRIOCOUNTERS Now;
+
+    MSRGetIoCounters(Handle, &Now);
+    printf("I/O: %u reads for %u bytes, %u writes for %u bytes\n",
+        (unsigned)(Now.ReadCalls - Last->ReadCalls), (unsigned)(Now.BytesRead - Last->BytesRead),
+        (unsigned)(Now.WriteCalls - Last->WriteCalls), (unsigned)(Now.BytesWritten - Last->BytesWritten));
+    *Last = Now;
+}
+
+/* Decode all three tracks of a raw read at 7-5-5 BPC and print them. */
+static void PrintTracks(LIBMSRTRACKS Tracks)
+{
+    static const UINT BitsPerChar[3] = { 7, 5, 5 };
+    const BYTE *Text;
+    SIZE_T Length;
+    UINT Track;
+
+    for (Track = 1; Track <= 3; ++Track) {
+        MSRTracksDecode(Tracks, Track, BitsPerChar[Track - 1]);
+        MSRTracksGetText(Tracks, Track, &Text, &Length);
+        printf("Track%u: '%s'\n", Track, (const char *)Text);
+    }
+}
+
+/* Show the wire traffic leading up to a failed command. */
+static void LIBMSRDECL DumpTrace(void *Context, LIBMSRHANDLE Handle, LIBMSRSTATUS Status)
+{
+    LIBMSRTRACEENTRY Entries[16];
+    UINT Count;
+    UINT i, j;
+
+    (void)Context;
+    MSRTraceRead(Handle, Entries, 16, &Count);
+    printf("Command failed with status %08X after:\n", Status);
+    for (i = 0; i < Count; ++i) {
+        printf("  %c %02X:", Entries[i].Kind, Entries[i].Opcode);
+        if (Entries[i].Kind == LIBMSR_CAPTURE_ERROR) {
+            printf(" %08X", Entries[i].Status);
+        }
+        for (j = 0; j < Entries[i].Length; ++j) {
+            printf(" %02X", Entries[i].Data[j]);
+        }
+        printf("\n");
+    }
+}
+
+/* Prompt the operator as the write job goes along. */
+static void LIBMSRDECL JobProgress(void *Context, SIZE_T Index, const LIBMSRJOBCARD *pCard, UINT Stage)
+{
+    (void)Context;
+    (void)Index;
+    switch (Stage) {
+    case LIBMSR_JOB_WRITE:
+        printf("Swipe blank card to be written.\n");
+        break;
+    case LIBMSR_JOB_VERIFY:
+        printf("Swipe written card to verify.\n");
+        break;
+    case LIBMSR_JOB_RETRY:
+        printf("Attempt %u failed with status %08X, trying again.\n", pCard->Attempts, pCard->Status);
+        break;
+    case LIBMSR_JOB_DONE:
+        if (pCard->Status < 0) {
+            printf("Card failed with status %08X\n", pCard->Status);
+        }
+        else {
+            printf("Card written and verified.\n");
+        }
+        break;
+    }
+}
 
 int _tmain(int argc, _TCHAR *argv[])
 {
     LIBMSRHANDLE Handle;
     LIBMSRSTATUS Status;
-    BYTE Track1[512];
-    BYTE Track2[512];
-    BYTE Track3[512];
-    SIZE_T Track1Len, Track2Len, Track3Len;
-    BYTE Track1Text[512];
-    BYTE Track2Text[512];
-    BYTE Track3Text[512];
-
-    Status = MSROpen(argv[1], &Handle);
+    LIBMSRTRACKS Tracks;
+    LIBMSRIOCOUNTERS IoCounters;
+    LIBMSRJOBCARD Card;
+    LIBMSRJOBOPTIONS Options;
+    LIBMSRJOBSTATS Stats;
+    LIBMSRPORTINFO Port;
+    LIBMSRPROBEOPTIONS ProbeOptions;
+    UINT Count;
+    UINT Track;
+
+    Status = MSRTracksCreate(0, &Tracks);
     if (Status < 0) {
         printf("Failed with status %08X\n", Status);
         return 1;
     }
 
+    if (argc >= 2) {
+        Status = MSROpen(argv[1], &Handle);
+        if (Status < 0) {
+            printf("Failed with status %08X\n", Status);
+            return 1;
+        }
+    }
+    else {
+        /* No port given: use the first device that answers */
+        memset(&ProbeOptions, 0, sizeof(ProbeOptions));
+        ProbeOptions.KeepOpen = TRUE;
+        Status = MSRDiscover(&Port, 1, &Count, &ProbeOptions);
+        if (Status < 0 && Status != LIBMSR_BUFFER_TOO_SMALL) {
+            printf("Failed with status %08X\n", Status);
+            return 1;
+        }
+        if (!Count) {
+            printf("No device found.\n");
+            return 1;
+        }
+        printf("Found a device, model %c.\n", Port.Model ? Port.Model : '?');
+        Handle = Port.Handle;
+    }
+
+    MSRSetTraceCallback(Handle, DumpTrace, NULL);
+
     Status = MSRReset(Handle);
     if (Status < 0) {
         printf("Failed with status %08X\n", Status);
@@ -36,13 +145,6 @@ int _tmain(int argc, _TCHAR *argv[])
         return 1;
     }
 
-#if 0
-    Status = MSRCardReadISO(Handle, Track1, Track2, Track3);
-    printf("Track1: '%s'\n", Track1);
-    printf("Track2: '%s'\n", Track2);
-    printf("Track3: '%s'\n", Track3);
-#endif
-
     Status = MSRSetBitsPerChar(Handle, 7, 5, 5);
     if (Status < 0) {
         printf("Failed with status %08X\n", Status);
@@ -50,40 +152,29 @@ int _tmain(int argc, _TCHAR *argv[])
     }
 
     printf("Swipe source card.\n");
-    Status = MSRCardReadRaw(Handle, Track1, &Track1Len, Track2, &Track2Len, Track3, &Track3Len);
-    if (Status < 0) {
-        printf("Failed with status %08X\n", Status);
-        return 1;
-    }
-    MSRDecodeTrack(7, Track1, Track1Len, Track1Text);
-    MSRDecodeTrack(5, Track2, Track2Len, Track2Text);
-    MSRDecodeTrack(5, Track3, Track3Len, Track3Text);
-    printf("Track1: '%s'\n", Track1Text);
-    printf("Track2: '%s'\n", Track2Text);
-    printf("Track3: '%s'\n", Track3Text);
-
-    printf("Swipe blank card to be written.\n");
-    MSREncodeTrack(7, Track1Text, Track1Len, Track1);
-    MSREncodeTrack(5, Track2Text, Track2Len, Track2);
-    Status = MSRCardWriteRaw(Handle, Track1, Track1Len, Track2, Track2Len, NULL, 0);
+    MSRGetIoCounters(Handle, &IoCounters);
+    Status = MSRCardReadRawTracks(Handle, Tracks);
     if (Status < 0) {
         printf("Failed with status %08X\n", Status);
         return 1;
     }
+    PrintIoCounters(Handle, &IoCounters);
+    PrintTracks(Tracks);
 
-    printf("Swipe written card to verify.\n");
-    Status = MSRCardReadRaw(Handle, Track1, &Track1Len, Track2, &Track2Len, Track3, &Track3Len);
+    for (Track = 0; Track < 3; ++Track) {
+        MSRTracksGetText(Tracks, Track + 1, &Card.Text[Track], &Card.TextLength[Track]);
+    }
+    memset(&Options, 0, sizeof(Options));
+    Options.Callback = JobProgress;
+    Status = MSRJobRun(Handle, &Card, 1, &Options, &Stats);
     if (Status < 0) {
         printf("Failed with status %08X\n", Status);
         return 1;
     }
-    MSRDecodeTrack(7, Track1, Track1Len, Track1Text);
-    MSRDecodeTrack(5, Track2, Track2Len, Track2Text);
-    MSRDecodeTrack(5, Track3, Track3Len, Track3Text);
-    printf("Track1: '%s'\n", Track1Text);
-    printf("Track2: '%s'\n", Track2Text);
-    printf("Track3: '%s'\n", Track3Text);
+    printf("%u written, %u failed, %u attempts; write %u ms, verify %u ms\n",
+        Stats.Cards, Stats.Failed, Stats.Attempts, (unsigned)Stats.WriteTime, (unsigned)Stats.VerifyTime);
 
     MSRClose(Handle);
+    MSRTracksDestroy(Tracks);
     return 0;
 }
@@ -0,0 +1,1921 @@
+/*
+ * msrbench: performance measurements for libmsr.
+ *
+ * Usage: msrbench <mode> [arguments]
+ *
+ *   pool <rounds> <port>...
+ *       Drive every port from one thread through a device pool, keeping one
+ *       command in flight per device, and report throughput and latency.
+ *       Run against msrsim to see how the pool scales with the device count.
+ *
+ *   codec [megabytes]
+ *       Check that every codec implementation the CPU supports gives the same
+ *       output as the scalar one, then report the throughput of each.
+ *
+ *   batch [records] [threads]
+ *       Decode a set of synthetic track 2 raw reads with MSRBatchDecode at
+ *       1, 2, 4... threads up to the given count (default: CPU count x 2)
+ *       and report records per second.
+ *
+ *   kernels [rounds]
+ *       Run each data conversion function over a generated corpus of track 1,
+ *       2 and 3 reads at their maximum lengths with every codec implementation
+ *       the CPU supports and report ns/byte and cycles/byte. MSRValidateTrack
+ *       runs over a copy of the reads with bits flipped here and there. Every output is
+ *       hashed and checked against the golden values in this file, so any
+ *       change to what the kernels produce makes the run fail.
+ *
+ *   fields [rounds]
+ *       Split the kernel corpus and a few AAMVA samples into fields with
+ *       MSRParseFields, checking the results, and report millions of tracks
+ *       parsed per second with and without a Luhn check of the PAN.
+ *
+ *   journal <path> [records] [devices]
+ *       Append synthetic swipe records spread over the given number of devices
+ *       to a new journal, reopen it, and report append rate, open time and
+ *       lookup time by time and by device.
+ *
+ *   record <capture> <port> [swipes]
+ *       Record a session of card reads from a device (or msrsim) to a capture.
+ *
+ *   replay <capture> [rounds]
+ *       Play a capture back through the library the given number of times,
+ *       making the API call that matches each recorded command, and report
+ *       sessions per second.
+ *
+ *   parser [iterations]
+ *       Generate random card read responses, some of them corrupted, and check
+ *       that the push parser gives the same events fed whole and in random
+ *       chunks, and the same result as the blocking read API replaying the
+ *       response. Then report the parser's throughput.
+ *
+ *   jobs <port> [cards]
+ *       Write and verify synthetic cards with MSRJobRun and report cards per
+ *       minute, verify failures and the time spent in each stage.
+ *
+ *   threads <port> [threads] [commands]
+ *       Give the handle an I/O thread and have several threads use it at once,
+ *       each making blocking calls and then queueing a burst of LED commands
+ *       with MSRSubmit. Reports throughput, latency and how many of the LED
+ *       commands were merged away.
+ *
+ *   discover [port...]
+ *       Probe the given ports, or every serial port on the system, in parallel
+ *       and show what answered, the model and how long each probe took next to
+ *       the total time.
+ *
+ *   watch <seconds>
+ *       Poll the port list for the given time and print ports as they come and
+ *       go, with the average cost of a poll.
+ *
+ *   remote <socket> [clients] [commands]
+ *       Connect several clients to a running msrd, have each make blocking
+ *       calls at once and report throughput and latency. Then have every client
+ *       read a card at the same time while another client subscribes to swipes,
+ *       which should see the single swipe they all shared.
+ *
+ *   serial [rounds]
+ *       Open a pseudo-terminal through the termios backend and play the device
+ *       on the master side. Checks the raw port settings, the given number of
+ *       communications tests, that stale input is purged, the command and
+ *       inter-byte timeouts, and that closing restores the settings. Reports
+ *       the round-trip latency and fails if any check does.
+ */
+
+#ifndef _WIN32
+/* posix_openpt and friends */
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "libmsr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+static double BenchNow(void)
+{
+    LARGE_INTEGER Counter, Frequency;
+
+    QueryPerformanceCounter(&Counter);
+    QueryPerformanceFrequency(&Frequency);
+    return (double)Counter.QuadPart / Frequency.QuadPart;
+}
+
+/* Arguments are narrow but the library takes TCHAR names; a few calls' worth are kept */
+static LPTSTR BenchName(const char *Name)
+{
+    static TCHAR Names[4][MAX_PATH];
+    static unsigned Next;
+    TCHAR *Buffer = Names[Next++ % 4];
+
+#ifdef UNICODE
+    MultiByteToWideChar(CP_ACP, 0, Name, -1, Buffer, MAX_PATH);
+    Buffer[MAX_PATH - 1] = 0;
+#else
+    lstrcpynA(Buffer, Name, MAX_PATH);
+#endif
+    return Buffer;
+}
+
+#define BenchCopyName(Dest, Name, Size) lstrcpyn((Dest), BenchName(Name), (Size))
+
+/* printf conversion for a TCHAR string */
+#ifdef UNICODE
+#define BENCH_TS "ls"
+#else
+#define BENCH_TS "s"
+#endif
+
+#else
+
+#include <time.h>
+#include <unistd.h>
+
+static double BenchNow(void)
+{
+    struct timespec Ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return Ts.tv_sec + Ts.tv_nsec / 1e9;
+}
+
+#define BenchName(Name) (Name)
+#define BenchCopyName(Dest, Name, Size) strncpy((Dest), (Name), (Size) - 1)
+#define BENCH_TS "s"
+
+#endif
+
+/*** Codec ***/
+
+static const char *CodecNames[] = { "auto", "scalar", "ssse3", "avx2" };
+
+/* The conversions under test; the ISO ones only take 5 or 7 bits per char */
+typedef struct {
+    const char *Name;
+    LIBMSRSTATUS (LIBMSRDECL *Convert)(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest);
+    BOOL IsoOnly;
+} CODECOP;
+
+static const CODECOP CodecOps[] = {
+    { "unpack", MSRUnpackData, FALSE },
+    { "pack", MSRPackData, FALSE },
+    { "to-ascii", ISO7811ToAscii, TRUE },
+    { "from-ascii", AsciiToISO7811, TRUE },
+};
+
+#define CODEC_OP_COUNT (sizeof(CodecOps) / sizeof(CodecOps[0]))
+
+static BOOL CodecBitsPerCharValid(const CODECOP *Op, UINT BitsPerChar)
+{
+    return Op->IsoOnly ? BitsPerChar == 5 || BitsPerChar == 7 : TRUE;
+}
+
+/* Compare every level against scalar over all byte values, lengths and alignments */
+static unsigned CodecVerify(UINT Level, const BYTE *Input, BYTE *Expected, BYTE *Actual)
+{
+    unsigned Mismatches = 0;
+    unsigned i;
+    UINT BitsPerChar;
+    SIZE_T Offset, Length;
+
+    for (i = 0; i < CODEC_OP_COUNT; ++i) {
+        for (BitsPerChar = 1; BitsPerChar <= 8; ++BitsPerChar) {
+            if (!CodecBitsPerCharValid(&CodecOps[i], BitsPerChar)) {
+                continue;
+            }
+            for (Offset = 0; Offset < 32; ++Offset) {
+                for (Length = 0; Length <= 300; Length += Length < 70 ? 1 : 23) {
+                    MSRSetCodecLevel(LIBMSR_CODEC_SCALAR);
+                    CodecOps[i].Convert(BitsPerChar, (BYTE *)Input + Offset, Length, Expected);
+                    MSRSetCodecLevel(Level);
+                    CodecOps[i].Convert(BitsPerChar, (BYTE *)Input + Offset, Length, Actual);
+                    if (memcmp(Expected, Actual, Length)) {
+                        fprintf(stderr, "%s: %s mismatch, bpc %u, offset %u, length %u\n",
+                            CodecNames[Level], CodecOps[i].Name, BitsPerChar, (unsigned)Offset, (unsigned)Length);
+                        Mismatches++;
+                    }
+                    /* In place, as MSRDecodeTrack and MSREncodeTrack do it */
+                    memcpy(Actual, Input + Offset, Length);
+                    CodecOps[i].Convert(BitsPerChar, Actual, Length, Actual);
+                    if (memcmp(Expected, Actual, Length)) {
+                        fprintf(stderr, "%s: %s in-place mismatch, bpc %u, length %u\n",
+                            CodecNames[Level], CodecOps[i].Name, BitsPerChar, (unsigned)Length);
+                        Mismatches++;
+                    }
+                }
+            }
+        }
+    }
+    return Mismatches;
+}
+
+static int BenchCodec(int argc, char *argv[])
+{
+    SIZE_T Size = (argc >= 1 ? (SIZE_T)atoi(argv[0]) : 64) << 20;
+    BYTE *Input, *Output, *Expected;
+    unsigned Mismatches = 0;
+    UINT Best, Level;
+    unsigned i;
+    SIZE_T j;
+
+    Input = malloc(Size + 32);
+    Output = malloc(Size + 32);
+    Expected = malloc(Size + 32);
+    srand(1);
+    for (j = 0; j < Size + 32; ++j) {
+        Input[j] = (BYTE)(j < 256 ? j : rand());
+    }
+
+    MSRSetCodecLevel(LIBMSR_CODEC_AUTO);
+    MSRGetCodecLevel(&Best);
+    for (Level = LIBMSR_CODEC_SCALAR; Level <= Best; ++Level) {
+        Mismatches += CodecVerify(Level, Input, Expected, Output);
+    }
+    printf("verified %u implementations: %u mismatches\n", Best, Mismatches);
+
+    for (Level = LIBMSR_CODEC_SCALAR; Level <= Best; ++Level) {
+        MSRSetCodecLevel(Level);
+        printf("%-8s", CodecNames[Level]);
+        for (i = 0; i < CODEC_OP_COUNT; ++i) {
+            double Start = BenchNow();
+
+            CodecOps[i].Convert(CodecOps[i].IsoOnly ? 7 : 8, Input, Size, Output);
+            printf(" %s %.0f MB/s", CodecOps[i].Name, Size / (BenchNow() - Start) / 1e6);
+        }
+        printf("\n");
+    }
+
+    free(Input);
+    free(Output);
+    free(Expected);
+    return Mismatches ? 1 : 0;
+}
+
+/*** Batch codec ***/
+
+static BYTE Reverse8(BYTE x)
+{
+    BYTE r = 0;
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+        r |= ((x >> i) & 1) << (7 - i);
+    }
+    return r;
+}
+
+/* A track 2 raw read: ;PAN=YYMMSSS? plus LRC and trailing zeros, framed at 5 BPC */
+static SIZE_T BatchMakeRecord(BYTE *Out, unsigned Seed)
+{
+    char Text[40];
+    BYTE Lrc = 0;
+    SIZE_T Length, i;
+
+    Length = sprintf(Text, ";%016u%03u=%07u?", Seed * 2654435761u, Seed % 1000, Seed % 10000000);
+    for (i = 0; i < Length; ++i) {
+        Lrc ^= (BYTE)(Text[i] - 0x30) & 0x0F;
+    }
+    Text[Length] = (char)(Lrc + 0x30);
+    MSREncodeTrack(5, (BYTE *)Text, Length + 1, Out);
+    for (i = 0; i < Length + 1; ++i) {
+        Out[i] = Reverse8((BYTE)(Out[i] << 3));
+    }
+    Out[Length + 1] = 0;
+    Out[Length + 2] = 0;
+    return Length + 3;
+}
+
+static int BenchBatch(int argc, char *argv[])
+{
+    LIBMSRTRACKSET Set;
+    SIZE_T Count = argc >= 1 ? (SIZE_T)atol(argv[0]) : 2000000;
+    UINT MaxThreads = argc >= 2 ? (UINT)atoi(argv[1]) : 0;
+    BYTE *Input, *Output;
+    SIZE_T *Offsets, *Lengths;
+    LIBMSRSTATUS *Statuses;
+    SIZE_T Size = 0, Failed, i;
+    double Base = 0;
+    UINT Threads;
+
+    if (MaxThreads == 0) {
+#ifdef _WIN32
+        SYSTEM_INFO Info;
+
+        GetSystemInfo(&Info);
+        MaxThreads = Info.dwNumberOfProcessors * 2;
+#else
+        MaxThreads = (UINT)sysconf(_SC_NPROCESSORS_ONLN) * 2;
+#endif
+    }
+    Input = malloc(Count * 48);
+    Output = malloc(Count * 48);
+    Offsets = malloc(Count * sizeof(SIZE_T));
+    Lengths = malloc(Count * sizeof(SIZE_T));
+    Statuses = malloc(Count * sizeof(LIBMSRSTATUS));
+    for (i = 0; i < Count; ++i) {
+        Offsets[i] = Size;
+        Lengths[i] = BatchMakeRecord(Input + Size, (unsigned)i);
+        Size += Lengths[i];
+    }
+    Set.Count = Count;
+    Set.Offsets = Offsets;
+    Set.Lengths = Lengths;
+    Set.Input = Input;
+    Set.Output = Output;
+    Set.Statuses = Statuses;
+
+    printf("%u records, %u bytes\n", (unsigned)Count, (unsigned)Size);
+    for (Threads = 1; Threads <= MaxThreads; Threads *= 2) {
+        double Start = BenchNow(), Rate;
+
+        MSRBatchDecode(&Set, 5, Threads);
+        Rate = Count / (BenchNow() - Start);
+        if (Threads == 1) {
+            Base = Rate;
+        }
+        for (Failed = 0, i = 0; i < Count; ++i) {
+            Failed += Statuses[i] != LIBMSR_OK;
+        }
+        printf("threads %2u: %10.0f records/s, speedup %.2f, failed %u\n", Threads, Rate, Rate / Base, (unsigned)Failed);
+    }
+
+    free(Input);
+    free(Output);
+    free(Offsets);
+    free(Lengths);
+    free(Statuses);
+    return 0;
+}
+
+/*** Codec kernels ***/
+
+/* Cycle counts come from the time stamp counter, which ticks at the nominal
+ * clock; with turbo or power saving they are only roughly core cycles.
+ */
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#define KernelCycles() __rdtsc()
+#define KERNEL_HAVE_CYCLES
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define KernelCycles() __rdtsc()
+#define KERNEL_HAVE_CYCLES
+#else
+#define KernelCycles() 0
+#endif
+
+#define KERNEL_RECORDS 1024
+
+/* Where an operation takes its input from */
+#define KERNEL_TEXT 0
+#define KERNEL_ISO 1
+#define KERNEL_RAW 2
+#define KERNEL_DAMAGED 3        /* Raw reads, some with a bit flipped */
+#define KERNEL_INPUTS 4
+
+/* What an operation takes and gives */
+#define KERNEL_CONVERT 0        /* A track in, a track out */
+#define KERNEL_ADD_LRC 1        /* A track without its LRC in, the whole track out */
+#define KERNEL_CHECK 2          /* A track in, an error index out */
+
+/* Tracks at the ISO 7811 maximum lengths, sentinels and LRC included */
+typedef struct {
+    UINT Track;
+    UINT BitsPerChar;
+    UINT Length;
+} KERNELTRACK;
+
+static const KERNELTRACK KernelTracks[] = {
+    { 1, 7, 79 },
+    { 2, 5, 40 },
+    { 3, 5, 107 },
+};
+
+#define KERNEL_TRACK_COUNT (sizeof(KernelTracks) / sizeof(KernelTracks[0]))
+
+/* Golden is the hash of every output and status over the corpus. It must not
+ * change when a kernel is optimized; if the corpus itself is changed on
+ * purpose, take the new values from a run with a known good build.
+ */
+typedef struct {
+    const char *Name;
+    LIBMSRSTATUS (LIBMSRDECL *Convert)(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest);
+    int Input;
+    int Shape;
+    ULONGLONG Golden;
+} KERNELOP;
+
+/* The error index stands in for converted data */
+static LIBMSRSTATUS LIBMSRDECL KernelValidate(UINT BitsPerChar, BYTE *Source, SIZE_T SourceLen, BYTE *Dest)
+{
+    LIBMSRSTATUS Status;
+    SIZE_T Index;
+
+    Status = MSRValidateTrack(BitsPerChar, Source, SourceLen, &Index);
+    Dest[0] = (BYTE)Index;
+    Dest[1] = (BYTE)(Index >> 8);
+    return Status;
+}
+
+static const KERNELOP KernelOps[] = {
+    { "unpack", MSRUnpackData, KERNEL_RAW, KERNEL_CONVERT, 0xCE2C7F496665263BULL },
+    { "pack", MSRPackData, KERNEL_ISO, KERNEL_CONVERT, 0xA130821278466A1BULL },
+    { "to-ascii", ISO7811ToAscii, KERNEL_ISO, KERNEL_CONVERT, 0xF251B0252781B39BULL },
+    { "from-ascii", AsciiToISO7811, KERNEL_TEXT, KERNEL_CONVERT, 0xCE2C7F496665263BULL },
+    { "decode", MSRDecodeTrack, KERNEL_RAW, KERNEL_CONVERT, 0xF251B0252781B39BULL },
+    { "encode", MSREncodeTrack, KERNEL_TEXT, KERNEL_CONVERT, 0xA130821278466A1BULL },
+    { "encode-lrc", MSREncodeTrackLrc, KERNEL_TEXT, KERNEL_ADD_LRC, 0xA130821278466A1BULL },
+    { "validate", KernelValidate, KERNEL_DAMAGED, KERNEL_CHECK, 0xAA714B2279ABAA28ULL },
+};
+
+#define KERNEL_OP_COUNT (sizeof(KernelOps) / sizeof(KernelOps[0]))
+
+/* Every input for every track, KERNEL_RECORDS records of each back to back */
+static BYTE *KernelCorpus[KERNEL_TRACK_COUNT][KERNEL_INPUTS];
+
+/* Our own generator, so the corpus is the same with every C library */
+static unsigned KernelSeed = 1;
+
+static unsigned KernelRandom(void)
+{
+    KernelSeed = KernelSeed * 1103515245u + 12345u;
+    return (KernelSeed >> 16) & 0x7FFF;
+}
+
+static void KernelDigits(BYTE *Out, UINT Count)
+{
+    while (Count--) {
+        *Out++ = (BYTE)('0' + KernelRandom() % 10);
+    }
+}
+
+/* Start sentinel, card-like fields, digits up to the end sentinel, then LRC */
+static void KernelMakeText(const KERNELTRACK *Track, BYTE *Out)
+{
+    static const char NameChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ /";
+    BYTE Base = Track->BitsPerChar == 7 ? 0x20 : 0x30;
+    BYTE Mask = Track->BitsPerChar == 7 ? 0x3F : 0x0F;
+    BYTE Lrc = 0;
+    UINT i = 0, j;
+
+    if (Track->Track == 1) {
+        Out[i++] = '%';
+        Out[i++] = 'B';
+        KernelDigits(Out + i, 16);
+        i += 16;
+        Out[i++] = '^';
+        for (j = 0; j < 26; ++j) {
+            Out[i++] = NameChars[KernelRandom() % (sizeof(NameChars) - 1)];
+        }
+        Out[i++] = '^';
+    }
+    else {
+        Out[i++] = ';';
+        KernelDigits(Out + i, 16);
+        i += 16;
+        Out[i++] = '=';
+    }
+    KernelDigits(Out + i, Track->Length - 2 - i);
+    i = Track->Length - 2;
+    Out[i++] = '?';
+    for (j = 0; j < i; ++j) {
+        Lrc ^= (BYTE)(Out[j] - Base) & Mask;
+    }
+    Out[i] = (BYTE)(Lrc + Base);
+}
+
+static void KernelMakeCorpus(void)
+{
+    const KERNELTRACK *Track;
+    BYTE *Text, *Iso, *Raw, *Damaged;
+    UINT t, r, i;
+
+    MSRSetCodecLevel(LIBMSR_CODEC_SCALAR);
+    for (t = 0; t < KERNEL_TRACK_COUNT; ++t) {
+        Track = &KernelTracks[t];
+        for (i = 0; i < KERNEL_INPUTS; ++i) {
+            KernelCorpus[t][i] = malloc(KERNEL_RECORDS * Track->Length);
+        }
+        for (r = 0; r < KERNEL_RECORDS; ++r) {
+            Text = KernelCorpus[t][KERNEL_TEXT] + r * Track->Length;
+            Iso = KernelCorpus[t][KERNEL_ISO] + r * Track->Length;
+            Raw = KernelCorpus[t][KERNEL_RAW] + r * Track->Length;
+            KernelMakeText(Track, Text);
+            AsciiToISO7811(Track->BitsPerChar, Text, Track->Length, Iso);
+            /* As the reader returns it: parity added, bits reversed */
+            MSREncodeTrack(Track->BitsPerChar, Text, Track->Length, Raw);
+            for (i = 0; i < Track->Length; ++i) {
+                Raw[i] = Reverse8((BYTE)(Raw[i] << (8 - Track->BitsPerChar)));
+            }
+        }
+    }
+    /* Damaged last, so the rest of the corpus does not depend on it */
+    for (t = 0; t < KERNEL_TRACK_COUNT; ++t) {
+        Track = &KernelTracks[t];
+        memcpy(KernelCorpus[t][KERNEL_DAMAGED], KernelCorpus[t][KERNEL_RAW], KERNEL_RECORDS * Track->Length);
+        for (r = 0; r < KERNEL_RECORDS; r += 1 + KernelRandom() % 4) {
+            Damaged = KernelCorpus[t][KERNEL_DAMAGED] + r * Track->Length;
+            Damaged[KernelRandom() % Track->Length] ^= (BYTE)(1 << (KernelRandom() % Track->BitsPerChar));
+        }
+    }
+}
+
+static void KernelFreeCorpus(void)
+{
+    UINT t, i;
+
+    for (t = 0; t < KERNEL_TRACK_COUNT; ++t) {
+        for (i = 0; i < KERNEL_INPUTS; ++i) {
+            free(KernelCorpus[t][i]);
+        }
+    }
+}
+
+static ULONGLONG KernelHash(ULONGLONG Hash, const BYTE *Data, SIZE_T Length)
+{
+    while (Length--) {
+        Hash = (Hash ^ *Data++) * 0x100000001B3ULL;
+    }
+    return Hash;
+}
+
+/* Run an operation once over the whole corpus; Bytes is how many characters it converted */
+static ULONGLONG KernelPass(const KERNELOP *Op, BYTE *Output, BOOL Hash, SIZE_T *pBytes)
+{
+    ULONGLONG Result = 0xCBF29CE484222325ULL;
+    const KERNELTRACK *Track;
+    LIBMSRSTATUS Status;
+    BYTE *Input;
+    SIZE_T InLength, OutLength;
+    SIZE_T Bytes = 0;
+    UINT t, r;
+
+    for (t = 0; t < KERNEL_TRACK_COUNT; ++t) {
+        Track = &KernelTracks[t];
+        Input = KernelCorpus[t][Op->Input];
+        InLength = Op->Shape == KERNEL_ADD_LRC ? Track->Length - 1 : Track->Length;
+        OutLength = Op->Shape == KERNEL_CHECK ? 2 : Track->Length;
+        for (r = 0; r < KERNEL_RECORDS; ++r) {
+            Status = Op->Convert(Track->BitsPerChar, Input + r * Track->Length, InLength, Output);
+            if (Hash) {
+                Result = KernelHash(Result, (const BYTE *)&Status, sizeof(Status));
+                Result = KernelHash(Result, Output, OutLength);
+            }
+        }
+        Bytes += KERNEL_RECORDS * Track->Length;
+    }
+    *pBytes = Bytes;
+    return Result;
+}
+
+static int BenchKernels(int argc, char *argv[])
+{
+    int Rounds = argc >= 1 ? atoi(argv[0]) : 200;
+    BYTE Output[256];
+    ULONGLONG Hash, Cycles;
+    double Start, Elapsed;
+    unsigned Mismatches = 0;
+    SIZE_T Bytes;
+    UINT Best, Level;
+    unsigned i, t;
+    int Round;
+
+    KernelMakeCorpus();
+    MSRSetCodecLevel(LIBMSR_CODEC_AUTO);
+    MSRGetCodecLevel(&Best);
+    printf("corpus: %u records each of", KERNEL_RECORDS);
+    for (t = 0; t < KERNEL_TRACK_COUNT; ++t) {
+        printf(" track %u (%u chars, %u BPC)", KernelTracks[t].Track, KernelTracks[t].Length, KernelTracks[t].BitsPerChar);
+    }
+    printf("\n");
+
+    for (Level = LIBMSR_CODEC_SCALAR; Level <= Best; ++Level) {
+        MSRSetCodecLevel(Level);
+        for (i = 0; i < KERNEL_OP_COUNT; ++i) {
+            Hash = KernelPass(&KernelOps[i], Output, TRUE, &Bytes);
+            Start = BenchNow();
+            Cycles = KernelCycles();
+            for (Round = 0; Round < Rounds; ++Round) {
+                KernelPass(&KernelOps[i], Output, FALSE, &Bytes);
+            }
+            Cycles = KernelCycles() - Cycles;
+            Elapsed = BenchNow() - Start;
+            Bytes *= Rounds;
+
+            printf("%-8s %-10s %7.3f ns/byte", CodecNames[Level], KernelOps[i].Name, Elapsed * 1e9 / Bytes);
+#ifdef KERNEL_HAVE_CYCLES
+            printf(" %7.3f cycles/byte", (double)Cycles / Bytes);
+#else
+            printf("     n/a cycles/byte");
+#endif
+            if (Hash != KernelOps[i].Golden) {
+                printf("  MISMATCH %016llX", Hash);
+                Mismatches++;
+            }
+            printf("\n");
+        }
+    }
+    printf("golden corpus: %u mismatches\n", Mismatches);
+
+    KernelFreeCorpus();
+    return Mismatches ? 1 : 0;
+}
+
+/*** Card data ***/
+
+typedef struct {
+    const char *Text;
+    UINT Layout;
+    UINT Field;
+    const char *Value;
+} FIELDSSAMPLE;
+
+static const FIELDSSAMPLE FieldsSamples[] = {
+    { "%B4111111111111111^DOE/JOHN^2512101?", LIBMSR_LAYOUT_ISO_TRACK1, LIBMSR_FIELD_NAME, "DOE/JOHN" },
+    { ";4111111111111111=2512101?", LIBMSR_LAYOUT_ISO_TRACK2, LIBMSR_FIELD_SERVICE_CODE, "101" },
+    { "%CAOAKLAND^DOE$JOHN$Q^1234 MAIN ST^?", LIBMSR_LAYOUT_AAMVA_TRACK1, LIBMSR_FIELD_ADDRESS, "1234 MAIN ST" },
+    { ";6360141234567890=251219900101?", LIBMSR_LAYOUT_AAMVA_TRACK2, LIBMSR_FIELD_BIRTH_DATE, "19900101" },
+    { "%0194607      C A         NONEM509160BRNBLU1234567890?", LIBMSR_LAYOUT_AAMVA_TRACK3, LIBMSR_FIELD_EYE_COLOR, "BLU" },
+};
+
+#define FIELDS_SAMPLE_COUNT (sizeof(FieldsSamples) / sizeof(FieldsSamples[0]))
+
+static BOOL FieldsCheckSample(const FIELDSSAMPLE *Sample)
+{
+    LIBMSRFIELDS Fields;
+    const LIBMSRFIELD *Field = &Fields.Fields[Sample->Field];
+
+    if (MSRParseFields((const BYTE *)Sample->Text, strlen(Sample->Text), LIBMSR_LAYOUT_AUTO, &Fields) < 0) {
+        return FALSE;
+    }
+    return Fields.Layout == Sample->Layout && Field->Length == strlen(Sample->Value)
+        && !memcmp(Sample->Text + Field->Offset, Sample->Value, Field->Length);
+}
+
+/* Parse every track of the kernel corpus, then the samples, Rounds times; Luhn-check PANs if asked */
+static double FieldsRun(int Rounds, BOOL Luhn, unsigned *pTracks, unsigned *pLuhnValid)
+{
+    LIBMSRFIELDS Fields;
+    const LIBMSRFIELD *Pan = &Fields.Fields[LIBMSR_FIELD_PAN];
+    const BYTE *Text;
+    unsigned Tracks = 0, LuhnValid = 0;
+    double Start = BenchNow();
+    UINT t, r;
+    int Round;
+
+    for (Round = 0; Round < Rounds; ++Round) {
+        for (t = 0; t < KERNEL_TRACK_COUNT; ++t) {
+            for (r = 0; r < KERNEL_RECORDS; ++r) {
+                Text = KernelCorpus[t][KERNEL_TEXT] + r * KernelTracks[t].Length;
+                MSRParseFields(Text, KernelTracks[t].Length, LIBMSR_LAYOUT_AUTO, &Fields);
+                if (Luhn) {
+                    LuhnValid += MSRLuhnCheck(Text + Pan->Offset, Pan->Length) == LIBMSR_OK;
+                }
+            }
+            Tracks += KERNEL_RECORDS;
+        }
+        for (r = 0; r < FIELDS_SAMPLE_COUNT; ++r) {
+            MSRParseFields((const BYTE *)FieldsSamples[r].Text, strlen(FieldsSamples[r].Text), LIBMSR_LAYOUT_AUTO, &Fields);
+        }
+        Tracks += FIELDS_SAMPLE_COUNT;
+    }
+    *pTracks = Tracks;
+    *pLuhnValid = LuhnValid;
+    return BenchNow() - Start;
+}
+
+static int BenchFields(int argc, char *argv[])
+{
+    int Rounds = argc >= 1 ? atoi(argv[0]) : 200;
+    LIBMSRFIELDS Fields;
+    const LIBMSRFIELD *Pan = &Fields.Fields[LIBMSR_FIELD_PAN];
+    unsigned Failed = 0, Tracks, LuhnValid;
+    double Elapsed;
+    UINT t, r;
+
+    KernelMakeCorpus();
+    /* Corpus tracks 2 and 3 both have the ISO track 2 layout; it is given, as a random
+     * PAN may start with the AAMVA prefix
+     */
+    for (t = 0; t < KERNEL_TRACK_COUNT; ++t) {
+        for (r = 0; r < KERNEL_RECORDS; ++r) {
+            if (MSRParseFields(KernelCorpus[t][KERNEL_TEXT] + r * KernelTracks[t].Length, KernelTracks[t].Length,
+                    t == 0 ? LIBMSR_LAYOUT_ISO_TRACK1 : LIBMSR_LAYOUT_ISO_TRACK2, &Fields) < 0
+                || Pan->Offset != (t == 0 ? 2 : 1) || Pan->Length != 16) {
+                Failed++;
+            }
+        }
+    }
+    for (r = 0; r < FIELDS_SAMPLE_COUNT; ++r) {
+        if (!FieldsCheckSample(&FieldsSamples[r])) {
+            fprintf(stderr, "fields: wrong result for %s\n", FieldsSamples[r].Text);
+            Failed++;
+        }
+    }
+    if (MSRLuhnCheck((const BYTE *)"4111111111111111", 16) != LIBMSR_OK
+        || MSRLuhnCheck((const BYTE *)"79927398713", 11) != LIBMSR_OK
+        || MSRLuhnCheck((const BYTE *)"79927398710", 11) != LIBMSR_CHECK_DIGIT_ERROR) {
+        fprintf(stderr, "fields: Luhn check is wrong\n");
+        Failed++;
+    }
+    printf("checked: %u failures\n", Failed);
+
+    Elapsed = FieldsRun(Rounds, FALSE, &Tracks, &LuhnValid);
+    printf("parse:        %6.2f M tracks/s, %.1f ns/track\n", Tracks / Elapsed / 1e6, Elapsed * 1e9 / Tracks);
+    Elapsed = FieldsRun(Rounds, TRUE, &Tracks, &LuhnValid);
+    printf("parse + Luhn: %6.2f M tracks/s, %.1f ns/track, %u PANs pass\n",
+        Tracks / Elapsed / 1e6, Elapsed * 1e9 / Tracks, LuhnValid / Rounds);
+
+    KernelFreeCorpus();
+    return Failed ? 1 : 0;
+}
+
+/*** Journal ***/
+
+static int BenchJournal(int argc, char *argv[])
+{
+    LIBMSRJOURNAL Journal;
+    LIBMSRJOURNALRECORD Record;
+    LIBMSRSTATUS Status;
+    SIZE_T Count = argc >= 2 ? (SIZE_T)atol(argv[1]) : 100000;
+    UINT Devices = argc >= 3 ? (UINT)atoi(argv[2]) : 16;
+    SIZE_T Found, Index, i;
+    ULONGLONG FirstTime, LastTime;
+    BYTE Track[256];
+    BYTE Data[3 * 256];
+    char IndexPath[1024];
+    double Start, Elapsed;
+
+    if (argc < 1 || Devices == 0) {
+        fprintf(stderr, "journal: path required\n");
+        return 2;
+    }
+    remove(argv[0]);
+    sprintf(IndexPath, "%.1000s.idx", argv[0]);
+    remove(IndexPath);
+    for (i = 0; i < sizeof(Track); ++i) {
+        Track[i] = (BYTE)i;
+    }
+
+    Status = MSRJournalOpen(BenchName(argv[0]), &Journal);
+    if (Status < 0) {
+        fprintf(stderr, "MSRJournalOpen: %08X\n", (unsigned)Status);
+        return 1;
+    }
+    memset(&Record, 0, sizeof(Record));
+    Record.Type = LIBMSR_REQ_READ_RAW;
+    Record.Tracks[0] = Track;
+    Record.Tracks[1] = Track;
+    Record.Tracks[2] = Track;
+    Record.TrackLengths[0] = 79;
+    Record.TrackLengths[1] = 40;
+    Record.TrackLengths[2] = 107;
+    Start = BenchNow();
+    for (i = 0; i < Count; ++i) {
+        Record.DeviceId = (UINT)(i % Devices);
+        Status = MSRJournalAppend(Journal, &Record);
+        if (Status < 0) {
+            fprintf(stderr, "MSRJournalAppend: %08X\n", (unsigned)Status);
+            return 1;
+        }
+    }
+    Elapsed = BenchNow() - Start;
+    printf("append: %u records in %.3f s, %.0f records/s\n", (unsigned)Count, Elapsed, Count / Elapsed);
+    Start = BenchNow();
+    MSRJournalClose(Journal);
+    printf("close:  %.3f ms\n", (BenchNow() - Start) * 1000);
+
+    Start = BenchNow();
+    Status = MSRJournalOpen(BenchName(argv[0]), &Journal);
+    if (Status < 0) {
+        fprintf(stderr, "MSRJournalOpen: %08X\n", (unsigned)Status);
+        return 1;
+    }
+    printf("open:   %.3f ms\n", (BenchNow() - Start) * 1000);
+    MSRJournalGetCount(Journal, &Found);
+    if (Found != Count) {
+        fprintf(stderr, "reopened journal has %u records\n", (unsigned)Found);
+        return 1;
+    }
+    MSRJournalGetRecord(Journal, 0, &Record, NULL, 0);
+    FirstTime = Record.Time;
+    Status = MSRJournalGetRecord(Journal, Count - 1, &Record, Data, sizeof(Data));
+    LastTime = Record.Time;
+    if (Status < 0 || Record.TrackLengths[2] != 107 || memcmp(Record.Tracks[2], Track, 107)) {
+        fprintf(stderr, "reopened journal has the wrong data\n");
+        return 1;
+    }
+
+    Start = BenchNow();
+    for (Found = 0, i = 0; i < Count; ++i) {
+        Found += MSRJournalFindTime(Journal, FirstTime + (LastTime - FirstTime) * i / Count, &Index) >= 0;
+    }
+    Elapsed = BenchNow() - Start;
+    printf("find by time:   %.0f ns per lookup, %u found\n", Elapsed * 1e9 / Count, (unsigned)Found);
+    Start = BenchNow();
+    for (Found = 0, i = 0; i < Count; ++i) {
+        Found += MSRJournalFindDevice(Journal, (UINT)(i % Devices), FirstTime + (LastTime - FirstTime) * i / Count, &Index) >= 0;
+    }
+    Elapsed = BenchNow() - Start;
+    printf("find by device: %.0f ns per lookup, %u found\n", Elapsed * 1e9 / Count, (unsigned)Found);
+
+    MSRJournalClose(Journal);
+    return 0;
+}
+
+/*** Capture and replay ***/
+
+static int BenchRecord(int argc, char *argv[])
+{
+    LIBMSRHANDLE Handle;
+    LIBMSRTRACKS Tracks;
+    LIBMSRSTATUS Status;
+    int Swipes = argc >= 3 ? atoi(argv[2]) : 10;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: msrbench record <capture> <port> [swipes]\n");
+        return 2;
+    }
+    Status = MSROpenRecorded(BenchName(argv[1]), BenchName(argv[0]), &Handle);
+    if (Status < 0) {
+        fprintf(stderr, "MSROpenRecorded: %08X\n", (unsigned)Status);
+        return 1;
+    }
+    MSRTracksCreate(0, &Tracks);
+    MSRReset(Handle);
+    MSRTestComms(Handle);
+    MSRSetBitsPerChar(Handle, 7, 5, 5);
+    for (i = 0; i < Swipes; ++i) {
+        Status = MSRCardReadRawTracks(Handle, Tracks);
+        if (Status >= 0) {
+            Status = MSRCardReadISOTracks(Handle, Tracks);
+        }
+        if (Status < 0) {
+            fprintf(stderr, "swipe %d: %08X\n", i, (unsigned)Status);
+        }
+    }
+    MSRTracksDestroy(Tracks);
+    MSRClose(Handle);
+    return 0;
+}
+
+/* Make the API calls the capture was recorded with; returns how many failed */
+static int ReplaySession(const BYTE *Capture, SIZE_T Length, LIBMSRTRACKS Tracks, int *pCalls)
+{
+    LIBMSRHANDLE Handle;
+    LIBMSRSTATUS Status;
+    LIBMSRCAPTUREEVENT Event;
+    const BYTE *Data;
+    SIZE_T Position = sizeof(LIBMSRCAPTUREHEADER);
+    int Failed = 0;
+
+    if (MSROpenReplayBuffer(Capture, Length, &Handle) < 0) {
+        return 1;
+    }
+    while (Position + sizeof(LIBMSRCAPTUREEVENT) <= Length) {
+        /* Events are packed, so copy each header out rather than read it in place */
+        memcpy(&Event, Capture + Position, sizeof(Event));
+        Data = Capture + Position + sizeof(Event);
+        Position += sizeof(Event) + Event.Length;
+        if (Event.Kind != LIBMSR_CAPTURE_WRITE || Event.Length < 2 || Data[0] != 0x1B) {
+            continue;
+        }
+        switch (Data[1]) {
+        case 0x61:
+            Status = MSRReset(Handle);
+            break;
+        case 0x65:
+            Status = MSRTestComms(Handle);
+            break;
+        case 0x6F:
+            Status = Event.Length >= 5 ? MSRSetBitsPerChar(Handle, Data[2], Data[3], Data[4]) : LIBMSR_INVALID_ARGUMENT;
+            break;
+        case 0x6D:
+            Status = MSRCardReadRawTracks(Handle, Tracks);
+            break;
+        case 0x72:
+            Status = MSRCardReadISOTracks(Handle, Tracks);
+            break;
+        default:
+            fprintf(stderr, "replay: no API call for command %02X\n", Data[1]);
+            Status = LIBMSR_NOT_SUPPORTED;
+            break;
+        }
+        (*pCalls)++;
+        Failed += Status < 0;
+    }
+    MSRClose(Handle);
+    return Failed;
+}
+
+static int BenchReplay(int argc, char *argv[])
+{
+    FILE *File;
+    BYTE *Capture;
+    long Length;
+    LIBMSRTRACKS Tracks;
+    int Rounds = argc >= 2 ? atoi(argv[1]) : 10000;
+    int Calls = 0, Failed = 0;
+    int i;
+    double Start, Elapsed;
+
+    if (argc < 1) {
+        fprintf(stderr, "Usage: msrbench replay <capture> [rounds]\n");
+        return 2;
+    }
+    File = fopen(argv[0], "rb");
+    if (!File) {
+        perror(argv[0]);
+        return 1;
+    }
+    fseek(File, 0, SEEK_END);
+    Length = ftell(File);
+    fseek(File, 0, SEEK_SET);
+    Capture = malloc(Length);
+    if (fread(Capture, 1, Length, File) != (size_t)Length) {
+        perror(argv[0]);
+        return 1;
+    }
+    fclose(File);
+
+    MSRTracksCreate(0, &Tracks);
+    Start = BenchNow();
+    for (i = 0; i < Rounds; ++i) {
+        Failed += ReplaySession(Capture, Length, Tracks, &Calls);
+    }
+    Elapsed = BenchNow() - Start;
+    printf("%d sessions, %d calls, %d failed: %.0f sessions/s, %.0f calls/s\n",
+        Rounds, Calls, Failed, Rounds / Elapsed, Calls / Elapsed);
+    MSRTracksDestroy(Tracks);
+    free(Capture);
+    return Failed ? 1 : 0;
+}
+
+/*** Encoding jobs ***/
+
+static void PrintHistogram(const char *Name, const LIBMSRHISTOGRAM *Histogram)
+{
+    UINT i;
+
+    if (!Histogram->Count) {
+        return;
+    }
+    printf("%s: %llu, mean %llu us, max %llu us\n", Name, Histogram->Count,
+        Histogram->TotalUs / Histogram->Count, Histogram->MaxUs);
+    for (i = 0; i < LIBMSR_STATS_BUCKETS; ++i) {
+        if (Histogram->Buckets[i]) {
+            printf("  < %8llu us: %llu\n", 2ULL << i, Histogram->Buckets[i]);
+        }
+    }
+}
+
+static void PrintStats(LIBMSRHANDLE Handle)
+{
+    LIBMSRSTATS Stats;
+    UINT i;
+
+    MSRGetStats(Handle, &Stats);
+    printf("I/O: %u reads for %u bytes, %u writes for %u bytes\n",
+        (unsigned)Stats.Io.ReadCalls, (unsigned)Stats.Io.BytesRead,
+        (unsigned)Stats.Io.WriteCalls, (unsigned)Stats.Io.BytesWritten);
+    printf("commands:");
+    for (i = 0; i < 256; ++i) {
+        if (Stats.Commands[i]) {
+            printf(" %02X x%u", i, Stats.Commands[i]);
+        }
+    }
+    printf("\n");
+    PrintHistogram("round trips", &Stats.RoundTrip);
+    PrintHistogram("swipe waits", &Stats.SwipeWait);
+    for (i = 0; i < LIBMSR_STATS_ERROR_SLOTS && Stats.Errors[i].Status; ++i) {
+        printf("error %08X x%u\n", (unsigned)Stats.Errors[i].Status, Stats.Errors[i].Count);
+    }
+}
+
+static int BenchJobs(int argc, char *argv[])
+{
+    LIBMSRHANDLE Handle;
+    LIBMSRSTATUS Status;
+    LIBMSRJOBCARD *Cards;
+    LIBMSRJOBSTATS Stats;
+    char (*Text)[2][48];
+    int Count = argc >= 2 ? atoi(argv[1]) : 100;
+    int i;
+
+    if (argc < 1) {
+        fprintf(stderr, "Usage: msrbench jobs <port> [cards]\n");
+        return 2;
+    }
+    Status = MSROpen(BenchName(argv[0]), &Handle);
+    if (Status < 0) {
+        fprintf(stderr, "MSROpen: %08X\n", (unsigned)Status);
+        return 1;
+    }
+    MSRSetBitsPerChar(Handle, 7, 5, 5);
+
+    Cards = calloc(Count, sizeof(*Cards));
+    Text = calloc(Count, sizeof(*Text));
+    for (i = 0; i < Count; ++i) {
+        sprintf(Text[i][0], "%%B41111111%08d^DOE/JOHN^2512101?", i);
+        sprintf(Text[i][1], ";41111111%08d=2512101?", i);
+        Cards[i].Text[0] = (const BYTE *)Text[i][0];
+        Cards[i].TextLength[0] = strlen(Text[i][0]);
+        Cards[i].Text[1] = (const BYTE *)Text[i][1];
+        Cards[i].TextLength[1] = strlen(Text[i][1]);
+    }
+
+    Status = MSRJobRun(Handle, Cards, Count, NULL, &Stats);
+    printf("status %08X: %u cards, %u failed, %u attempts, %u verify failures (%.1f%%)\n",
+        (unsigned)Status, Stats.Cards, Stats.Failed, Stats.Attempts, Stats.VerifyFailures, Stats.VerifyFailureRate * 100);
+    printf("%.1f cards/min; encode %u ms, write %u ms, verify %u ms of %u ms\n", Stats.CardsPerMinute,
+        (unsigned)Stats.EncodeTime, (unsigned)Stats.WriteTime, (unsigned)Stats.VerifyTime, (unsigned)Stats.ElapsedTime);
+    PrintStats(Handle);
+
+    free(Text);
+    free(Cards);
+    MSRClose(Handle);
+    return Status < 0 || Stats.Failed ? 1 : 0;
+}
+
+/*** Discovery ***/
+
+static int BenchDiscover(int argc, char *argv[])
+{
+    LIBMSRPORTINFO *Ports;
+    LIBMSRSTATUS Status;
+    UINT Count;
+    UINT Found = 0;
+    double Start, Elapsed, ProbeSum = 0;
+    UINT i;
+
+    if (argc > 0) {
+        Count = argc;
+        Ports = calloc(Count, sizeof(*Ports));
+        for (i = 0; i < Count; ++i) {
+            BenchCopyName(Ports[i].PortName, argv[i], LIBMSR_MAX_PORT_NAME);
+        }
+    }
+    else {
+        MSRListPorts(NULL, 0, &Count);
+        Ports = calloc(Count + 1, sizeof(*Ports));
+        Status = MSRListPorts(Ports, Count + 1, &Count);
+        if (Status < 0) {
+            fprintf(stderr, "MSRListPorts: %08X\n", (unsigned)Status);
+            return 1;
+        }
+    }
+
+    Start = BenchNow();
+    MSRProbePorts(Ports, Count, NULL);
+    Elapsed = BenchNow() - Start;
+
+    for (i = 0; i < Count; ++i) {
+        printf("%-24" BENCH_TS " %08X  model %c  %u ms\n", Ports[i].PortName, (unsigned)Ports[i].Status,
+            Ports[i].Model ? Ports[i].Model : '-', Ports[i].ProbeTime);
+        ProbeSum += Ports[i].ProbeTime;
+        if (Ports[i].Status >= 0) {
+            Found++;
+        }
+    }
+    printf("%u ports, %u devices: %.0f ms in total, %.0f ms one by one\n", Count, Found, Elapsed * 1e3, ProbeSum);
+    free(Ports);
+    return 0;
+}
+
+static void LIBMSRDECL WatchReport(void *Context, LPTSTR PortName, BOOL Arrived)
+{
+    printf("%s %" BENCH_TS "\n", Arrived ? "+" : "-", PortName);
+    fflush(stdout);
+}
+
+static int BenchWatch(int argc, char *argv[])
+{
+    LIBMSRPORTWATCH Watch;
+    double End, Start, PollTime = 0;
+    unsigned Polls = 0;
+
+    if (argc < 1) {
+        fprintf(stderr, "Usage: msrbench watch <seconds>\n");
+        return 2;
+    }
+    if (MSRPortWatchCreate(&Watch) < 0) {
+        return 1;
+    }
+    End = BenchNow() + atof(argv[0]);
+    while (BenchNow() < End) {
+        Start = BenchNow();
+        MSRPortWatchPoll(Watch, WatchReport, NULL);
+        PollTime += BenchNow() - Start;
+        Polls++;
+#ifdef _WIN32
+        Sleep(100);
+#else
+        usleep(100000);
+#endif
+    }
+    printf("%u polls, %.1f us each\n", Polls, PollTime / Polls * 1e6);
+    MSRPortWatchDestroy(Watch);
+    return 0;
+}
+
+/*** Response parser ***/
+
+#define FUZZ_MAX_RESPONSE 1024
+
+/* What a parser made of one response, independent of how it was chunked */
+typedef struct {
+    LIBMSRSTATUS Status;
+    SIZE_T Consumed;
+    BYTE Data[3][FUZZ_MAX_RESPONSE];
+    SIZE_T Length[3];
+    /* Non-data events in order, as a running hash */
+    unsigned Trace;
+    int Track;
+} FUZZRESULT;
+
+static unsigned FuzzSeed = 1;
+
+static unsigned FuzzRandom(void)
+{
+    FuzzSeed ^= FuzzSeed << 13;
+    FuzzSeed ^= FuzzSeed >> 17;
+    FuzzSeed ^= FuzzSeed << 5;
+    return FuzzSeed;
+}
+
+static void LIBMSRDECL FuzzCollect(void *Context, const LIBMSRPARSEEVENT *pEvent)
+{
+    FUZZRESULT *Result = (FUZZRESULT *)Context;
+
+    if (pEvent->Type == LIBMSR_PARSE_TRACK_BEGIN) {
+        Result->Track = pEvent->Track >= 1 && pEvent->Track <= 3 ? (int)pEvent->Track - 1 : -1;
+        if (Result->Track >= 0) {
+            Result->Length[Result->Track] = 0;
+        }
+    }
+    if (pEvent->Type == LIBMSR_PARSE_TRACK_DATA) {
+        if (Result->Track >= 0) {
+            memcpy(Result->Data[Result->Track] + Result->Length[Result->Track], pEvent->Data, pEvent->Length);
+            Result->Length[Result->Track] += pEvent->Length;
+        }
+        return;
+    }
+    Result->Trace = Result->Trace * 31 + pEvent->Type * 257 + pEvent->Track * 7 + pEvent->Byte + (unsigned)pEvent->Length;
+}
+
+/* Feed a response in chunks of 1..MaxChunk bytes; MaxChunk of 0 feeds it whole */
+static void FuzzParse(UINT Type, const BYTE *Response, SIZE_T Length, SIZE_T MaxChunk, FUZZRESULT *Result)
+{
+    LIBMSRPARSER Parser;
+    SIZE_T Position = 0;
+    SIZE_T Chunk;
+    SIZE_T Consumed;
+
+    memset(Result, 0, sizeof(*Result));
+    MSRParserInit(&Parser, Type, FuzzCollect, Result);
+    Result->Status = LIBMSR_PENDING;
+    while (Position < Length && Result->Status == LIBMSR_PENDING) {
+        Chunk = MaxChunk ? 1 + FuzzRandom() % MaxChunk : Length;
+        if (Chunk > Length - Position) {
+            Chunk = Length - Position;
+        }
+        Result->Status = MSRParserFeed(&Parser, Response + Position, Chunk, &Consumed);
+        Position += Consumed;
+    }
+    Result->Consumed = Position;
+}
+
+/* A card read response, with tracks that are sometimes empty and bytes that are sometimes wrong */
+static SIZE_T FuzzMakeResponse(BOOL IsIso, BYTE *Response)
+{
+    static const BYTE StatusBytes[] = { 0x30, 0x30, 0x30, 0x31, 0x32, 0x34 };
+    SIZE_T Length = 0;
+    UINT Track, Count, i;
+
+    Response[Length++] = 0x1B;
+    Response[Length++] = 0x73;
+    for (Track = 1; Track <= 3; ++Track) {
+        Response[Length++] = 0x1B;
+        Response[Length++] = (BYTE)Track;
+        Count = FuzzRandom() % 5 ? FuzzRandom() % 120 : 0;
+        if (IsIso) {
+            if (!Count) {
+                /* No data on the track */
+                Response[Length++] = 0x1B;
+                Response[Length++] = 0x2B;
+                continue;
+            }
+            for (i = 0; i < Count; ++i) {
+                BYTE Char = (BYTE)(0x20 + FuzzRandom() % 0x40);
+                Response[Length++] = Char == 0x3F ? 0x30 : Char;
+            }
+            Response[Length++] = 0x3F;
+        }
+        else {
+            Response[Length++] = (BYTE)Count;
+            for (i = 0; i < Count; ++i) {
+                Response[Length++] = (BYTE)FuzzRandom();
+            }
+        }
+    }
+    Response[Length++] = 0x3F;
+    Response[Length++] = 0x1C;
+    Response[Length++] = 0x1B;
+    Response[Length++] = StatusBytes[FuzzRandom() % sizeof(StatusBytes)];
+
+    if (FuzzRandom() % 4 == 0) {
+        Response[FuzzRandom() % Length] = (BYTE)FuzzRandom();
+    }
+    return Length;
+}
+
+static void FuzzPutEvent(BYTE *Capture, SIZE_T *pLength, BYTE Kind, const BYTE *Data, SIZE_T Length)
+{
+    LIBMSRCAPTUREEVENT Event;
+
+    memset(&Event, 0, sizeof(Event));
+    Event.Kind = Kind;
+    Event.Length = (UINT)Length;
+    memcpy(Capture + *pLength, &Event, sizeof(Event));
+    memcpy(Capture + *pLength + sizeof(Event), Data, Length);
+    *pLength += sizeof(Event) + Length;
+}
+
+/* Run the same response through the blocking API, as read from a device in random pieces */
+static LIBMSRSTATUS FuzzBlocking(BOOL IsIso, const BYTE *Response, SIZE_T Length, LIBMSRTRACKS Tracks, BYTE *Capture)
+{
+    LIBMSRCAPTUREHEADER Header;
+    LIBMSRHANDLE Handle;
+    LIBMSRSTATUS Status;
+    BYTE Command[2];
+    SIZE_T CaptureLength = 0;
+    SIZE_T Position = 0;
+    SIZE_T Chunk;
+
+    Header.Magic = LIBMSR_CAPTURE_MAGIC;
+    Header.Version = LIBMSR_CAPTURE_VERSION;
+    memcpy(Capture, &Header, sizeof(Header));
+    CaptureLength = sizeof(Header);
+    Command[0] = 0x1B;
+    Command[1] = IsIso ? 0x72 : 0x6D;
+    FuzzPutEvent(Capture, &CaptureLength, LIBMSR_CAPTURE_WRITE, Command, 2);
+    while (Position < Length) {
+        Chunk = 1 + FuzzRandom() % 64;
+        if (Chunk > Length - Position) {
+            Chunk = Length - Position;
+        }
+        FuzzPutEvent(Capture, &CaptureLength, LIBMSR_CAPTURE_READ, Response + Position, Chunk);
+        Position += Chunk;
+    }
+
+    Status = MSROpenReplayBuffer(Capture, CaptureLength, &Handle);
+    if (Status < 0) {
+        return Status;
+    }
+    Status = IsIso ? MSRCardReadISOTracks(Handle, Tracks) : MSRCardReadRawTracks(Handle, Tracks);
+    MSRClose(Handle);
+    return Status;
+}
+
+static BOOL FuzzSame(const FUZZRESULT *a, const FUZZRESULT *b)
+{
+    UINT Track;
+
+    if (a->Status != b->Status || a->Consumed != b->Consumed || a->Trace != b->Trace) {
+        return FALSE;
+    }
+    for (Track = 0; Track < 3; ++Track) {
+        if (a->Length[Track] != b->Length[Track] || memcmp(a->Data[Track], b->Data[Track], a->Length[Track])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static BOOL FuzzSameAsBlocking(BOOL IsIso, const FUZZRESULT *Result, LIBMSRSTATUS Status, LIBMSRTRACKS Tracks)
+{
+    const BYTE *Data;
+    SIZE_T Length;
+    UINT Track;
+
+    /* The blocking API runs out of time where the push parser asks for more */
+    if (Status != (Result->Status == LIBMSR_PENDING ? LIBMSR_TIMEOUT : Result->Status)) {
+        return FALSE;
+    }
+    if (Status < 0) {
+        return TRUE;
+    }
+    for (Track = 0; Track < 3; ++Track) {
+        if (IsIso) {
+            MSRTracksGetText(Tracks, Track + 1, &Data, &Length);
+        }
+        else {
+            MSRTracksGetRaw(Tracks, Track + 1, &Data, &Length);
+        }
+        if (Length != Result->Length[Track] || memcmp(Data, Result->Data[Track], Length)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int BenchParser(int argc, char *argv[])
+{
+    static FUZZRESULT Whole, Chunked;
+    BYTE Response[FUZZ_MAX_RESPONSE];
+    BYTE *Capture;
+    LIBMSRTRACKS Tracks;
+    LIBMSRSTATUS Status;
+    SIZE_T Length;
+    SIZE_T TotalBytes = 0;
+    UINT Type;
+    BOOL IsIso;
+    int Iterations = argc >= 1 ? atoi(argv[0]) : 100000;
+    int Mismatches = 0, Failed = 0;
+    int i;
+    double Start, Elapsed;
+
+    Capture = malloc(sizeof(LIBMSRCAPTUREHEADER) + FUZZ_MAX_RESPONSE * (sizeof(LIBMSRCAPTUREEVENT) + 1) + 64);
+    MSRTracksCreate(0, &Tracks);
+    for (i = 0; i < Iterations; ++i) {
+        IsIso = FuzzRandom() & 1;
+        Type = IsIso ? LIBMSR_REQ_READ_ISO : LIBMSR_REQ_READ_RAW;
+        Length = FuzzMakeResponse(IsIso, Response);
+
+        FuzzParse(Type, Response, Length, 0, &Whole);
+        FuzzParse(Type, Response, Length, 1 + FuzzRandom() % 16, &Chunked);
+        if (!FuzzSame(&Whole, &Chunked)) {
+            fprintf(stderr, "iteration %d: chunked parse differs (%08X vs %08X)\n", i, (unsigned)Chunked.Status, (unsigned)Whole.Status);
+            Mismatches++;
+        }
+        Status = FuzzBlocking(IsIso, Response, Length, Tracks, Capture);
+        if (!FuzzSameAsBlocking(IsIso, &Whole, Status, Tracks)) {
+            fprintf(stderr, "iteration %d: blocking read differs (%08X vs %08X)\n", i, (unsigned)Status, (unsigned)Whole.Status);
+            Mismatches++;
+        }
+        Failed += Whole.Status != LIBMSR_OK;
+    }
+    printf("%d responses (%d not OK), %d mismatches\n", Iterations, Failed, Mismatches);
+
+    /* Throughput of the push parser alone, fed whole */
+    Length = FuzzMakeResponse(FALSE, Response);
+    Start = BenchNow();
+    for (i = 0; i < Iterations; ++i) {
+        FuzzParse(LIBMSR_REQ_READ_RAW, Response, Length, 0, &Whole);
+        TotalBytes += Length;
+    }
+    Elapsed = BenchNow() - Start;
+    printf("parse: %.0f responses/s, %.1f MB/s\n", Iterations / Elapsed, TotalBytes / Elapsed / 1e6);
+
+    MSRTracksDestroy(Tracks);
+    free(Capture);
+    return Mismatches ? 1 : 0;
+}
+
+#ifndef _WIN32
+
+/*** Device pool ***/
+
+typedef struct {
+    LIBMSRHANDLE Handle;
+    LIBMSRREQUEST Request;
+    unsigned Remaining;
+    double SubmittedAt;
+} POOLBENCHDEVICE;
+
+static int BenchPool(int argc, char *argv[])
+{
+    LIBMSRPOOL Pool;
+    LIBMSRSTATUS Status;
+    LIBMSRREQUEST *Completed;
+    POOLBENCHDEVICE *Devices;
+    unsigned DeviceCount;
+    unsigned Rounds;
+    unsigned Outstanding;
+    unsigned Errors = 0;
+    double Start, Elapsed, LatencySum = 0, LatencyMax = 0;
+    unsigned i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: msrbench pool <rounds> <port>...\n");
+        return 1;
+    }
+    Rounds = (unsigned)atoi(argv[0]);
+    DeviceCount = argc - 1;
+
+    Status = MSRPoolCreate(&Pool);
+    if (Status < 0) {
+        fprintf(stderr, "MSRPoolCreate failed with status %08X\n", Status);
+        return 1;
+    }
+    Devices = calloc(DeviceCount, sizeof(*Devices));
+    for (i = 0; i < DeviceCount; ++i) {
+        Status = MSRPoolOpen(Pool, BenchName(argv[i + 1]), &Devices[i].Handle);
+        if (Status < 0) {
+            fprintf(stderr, "%s: open failed with status %08X\n", argv[i + 1], Status);
+            return 1;
+        }
+        Devices[i].Request.Type = LIBMSR_REQ_TEST_COMMS;
+        Devices[i].Request.UserData = &Devices[i];
+        Devices[i].Remaining = Rounds;
+    }
+
+    Start = BenchNow();
+    Outstanding = 0;
+    for (i = 0; i < DeviceCount; ++i) {
+        if (Devices[i].Remaining > 0) {
+            Devices[i].SubmittedAt = BenchNow();
+            MSRPoolSubmit(Pool, Devices[i].Handle, &Devices[i].Request);
+            Outstanding++;
+        }
+    }
+    while (Outstanding > 0) {
+        POOLBENCHDEVICE *Device;
+        double Latency;
+
+        Status = MSRPoolWait(Pool, 5000, &Completed);
+        if (Status < 0 || !Completed) {
+            fprintf(stderr, "Timed out with %u requests outstanding\n", Outstanding);
+            return 1;
+        }
+        Device = (POOLBENCHDEVICE *)Completed->UserData;
+        Latency = BenchNow() - Device->SubmittedAt;
+        LatencySum += Latency;
+        if (Latency > LatencyMax) {
+            LatencyMax = Latency;
+        }
+        if (Completed->Status < 0) {
+            Errors++;
+        }
+        Outstanding--;
+        if (--Device->Remaining > 0) {
+            Device->SubmittedAt = BenchNow();
+            MSRPoolSubmit(Pool, Device->Handle, &Device->Request);
+            Outstanding++;
+        }
+    }
+    Elapsed = BenchNow() - Start;
+
+    printf("devices: %u, commands: %u, errors: %u\n", DeviceCount, DeviceCount * Rounds, Errors);
+    printf("throughput: %.0f commands/s, latency: mean %.3f ms, max %.3f ms\n",
+        DeviceCount * Rounds / Elapsed, LatencySum / (DeviceCount * Rounds) * 1e3, LatencyMax * 1e3);
+
+    for (i = 0; i < DeviceCount; ++i) {
+        MSRPoolRemove(Pool, Devices[i].Handle);
+        MSRClose(Devices[i].Handle);
+    }
+    MSRPoolDestroy(Pool);
+    free(Devices);
+    return Errors ? 1 : 0;
+}
+
+/*** Threaded handle ***/
+
+#include <pthread.h>
+
+#define THREADS_BURST 16
+
+typedef struct {
+    LIBMSRHANDLE Handle;
+    unsigned Commands;
+    unsigned Errors;
+    double LatencySum;
+    double LatencyMax;
+} THREADBENCH;
+
+static void *ThreadsWorker(void *Arg)
+{
+    THREADBENCH *Bench = (THREADBENCH *)Arg;
+    LIBMSRREQUEST Burst[THREADS_BURST];
+    BOOL IsHiCo;
+    double Start, Latency;
+    unsigned i;
+
+    for (i = 0; i < Bench->Commands; ++i) {
+        Start = BenchNow();
+        if ((i % 4 == 3 ? MSRGetCoercivity(Bench->Handle, &IsHiCo) : MSRTestComms(Bench->Handle)) < 0) {
+            Bench->Errors++;
+        }
+        Latency = BenchNow() - Start;
+        Bench->LatencySum += Latency;
+        if (Latency > Bench->LatencyMax) {
+            Bench->LatencyMax = Latency;
+        }
+    }
+
+    memset(Burst, 0, sizeof(Burst));
+    for (i = 0; i < THREADS_BURST; ++i) {
+        Burst[i].Type = LIBMSR_REQ_LED;
+        /* Blink: each all on or all off covers the one before */
+        Burst[i].Params[0] = 0x81 + i % 2;
+        MSRSubmit(Bench->Handle, &Burst[i]);
+    }
+    for (i = 0; i < THREADS_BURST; ++i) {
+        if (MSRRequestWait(Bench->Handle, &Burst[i], 5000) != LIBMSR_OK) {
+            Bench->Errors++;
+        }
+    }
+    return NULL;
+}
+
+static int BenchThreads(int argc, char *argv[])
+{
+    LIBMSRHANDLE Handle;
+    LIBMSRSTATUS Status;
+    LIBMSRSTATS Stats;
+    THREADBENCH *Benches;
+    pthread_t *Threads;
+    unsigned ThreadCount = argc >= 2 ? (unsigned)atoi(argv[1]) : 4;
+    unsigned Commands = argc >= 3 ? (unsigned)atoi(argv[2]) : 1000;
+    unsigned Errors = 0, LedsSent = 0;
+    double Start, Elapsed, LatencySum = 0, LatencyMax = 0;
+    unsigned i;
+
+    if (argc < 1) {
+        fprintf(stderr, "Usage: msrbench threads <port> [threads] [commands]\n");
+        return 2;
+    }
+    Status = MSROpen(BenchName(argv[0]), &Handle);
+    if (Status >= 0) {
+        Status = MSRStartIoThread(Handle);
+    }
+    if (Status < 0) {
+        fprintf(stderr, "%s: open failed with status %08X\n", argv[0], (unsigned)Status);
+        return 1;
+    }
+
+    Benches = calloc(ThreadCount, sizeof(*Benches));
+    Threads = calloc(ThreadCount, sizeof(*Threads));
+    Start = BenchNow();
+    for (i = 0; i < ThreadCount; ++i) {
+        Benches[i].Handle = Handle;
+        Benches[i].Commands = Commands;
+        pthread_create(&Threads[i], NULL, ThreadsWorker, &Benches[i]);
+    }
+    for (i = 0; i < ThreadCount; ++i) {
+        pthread_join(Threads[i], NULL);
+        Errors += Benches[i].Errors;
+        LatencySum += Benches[i].LatencySum;
+        if (Benches[i].LatencyMax > LatencyMax) {
+            LatencyMax = Benches[i].LatencyMax;
+        }
+    }
+    Elapsed = BenchNow() - Start;
+
+    MSRGetStats(Handle, &Stats);
+    for (i = 0x81; i <= 0x85; ++i) {
+        LedsSent += Stats.Commands[i];
+    }
+    printf("threads: %u, blocking calls: %u, errors: %u\n", ThreadCount, ThreadCount * Commands, Errors);
+    printf("throughput: %.0f calls/s, latency: mean %.3f ms, max %.3f ms\n",
+        ThreadCount * Commands / Elapsed, LatencySum / (ThreadCount * Commands) * 1e3, LatencyMax * 1e3);
+    printf("LED commands: %u submitted, %u sent\n", ThreadCount * THREADS_BURST, LedsSent);
+    PrintStats(Handle);
+
+    MSRClose(Handle);
+    free(Threads);
+    free(Benches);
+    return Errors ? 1 : 0;
+}
+
+/*** Device server ***/
+
+typedef struct {
+    LIBMSRHANDLE Handle;
+    unsigned Commands;
+    unsigned Errors;
+    double LatencySum;
+    double LatencyMax;
+    /* Shared read */
+    SIZE_T Length;
+} REMOTEBENCH;
+
+static void *RemoteWorker(void *Arg)
+{
+    REMOTEBENCH *Bench = (REMOTEBENCH *)Arg;
+    double Start, Latency;
+    unsigned i;
+
+    for (i = 0; i < Bench->Commands; ++i) {
+        Start = BenchNow();
+        if (MSRTestComms(Bench->Handle) < 0) {
+            Bench->Errors++;
+        }
+        Latency = BenchNow() - Start;
+        Bench->LatencySum += Latency;
+        if (Latency > Bench->LatencyMax) {
+            Bench->LatencyMax = Latency;
+        }
+    }
+    return NULL;
+}
+
+static void *RemoteReader(void *Arg)
+{
+    REMOTEBENCH *Bench = (REMOTEBENCH *)Arg;
+    BYTE Tracks[3][LIBMSR_MAX_TRACK_LENGTH];
+    SIZE_T Lengths[3];
+
+    if (MSRCardReadRaw(Bench->Handle, Tracks[0], &Lengths[0], Tracks[1], &Lengths[1], Tracks[2], &Lengths[2]) < 0) {
+        Bench->Errors++;
+    }
+    else {
+        Bench->Length = Lengths[0] + Lengths[1] + Lengths[2];
+    }
+    return NULL;
+}
+
+static int BenchRemote(int argc, char *argv[])
+{
+    LIBMSRHANDLE Subscriber;
+    LIBMSRSTATUS Status;
+    LIBMSRTIMEOUTS Timeouts;
+    LIBMSRREQUEST Event;
+    BYTE Tracks[3][LIBMSR_MAX_TRACK_LENGTH];
+    REMOTEBENCH *Benches;
+    pthread_t *Threads;
+    unsigned ClientCount = argc >= 2 ? (unsigned)atoi(argv[1]) : 8;
+    unsigned Commands = argc >= 3 ? (unsigned)atoi(argv[2]) : 1000;
+    unsigned Errors = 0, ReadErrors = 0, Swipes = 0;
+    double Start, Elapsed, LatencySum = 0, LatencyMax = 0;
+    unsigned i;
+
+    if (argc < 1 || ClientCount < 1) {
+        fprintf(stderr, "Usage: msrbench remote <socket> [clients] [commands]\n");
+        return 2;
+    }
+    Benches = calloc(ClientCount, sizeof(*Benches));
+    Threads = calloc(ClientCount, sizeof(*Threads));
+    Status = MSROpenRemote(argv[0], NULL, &Subscriber);
+    for (i = 0; i < ClientCount && Status >= 0; ++i) {
+        Status = MSROpenRemote(argv[0], NULL, &Benches[i].Handle);
+    }
+    if (Status < 0) {
+        fprintf(stderr, "%s: connect failed with status %08X\n", argv[0], (unsigned)Status);
+        return 1;
+    }
+
+    Start = BenchNow();
+    for (i = 0; i < ClientCount; ++i) {
+        Benches[i].Commands = Commands;
+        pthread_create(&Threads[i], NULL, RemoteWorker, &Benches[i]);
+    }
+    for (i = 0; i < ClientCount; ++i) {
+        pthread_join(Threads[i], NULL);
+        Errors += Benches[i].Errors;
+        LatencySum += Benches[i].LatencySum;
+        if (Benches[i].LatencyMax > LatencyMax) {
+            LatencyMax = Benches[i].LatencyMax;
+        }
+    }
+    Elapsed = BenchNow() - Start;
+    printf("clients: %u, blocking calls: %u, errors: %u\n", ClientCount, ClientCount * Commands, Errors);
+    printf("throughput: %.0f calls/s, latency: mean %.3f ms, max %.3f ms\n",
+        ClientCount * Commands / Elapsed, LatencySum / (ClientCount * Commands) * 1e3, LatencyMax * 1e3);
+
+    /* Every client waits for the same swipe */
+    MSRRemoteSubscribe(Subscriber, LIBMSR_SUBSCRIBE_SWIPES);
+    Start = BenchNow();
+    for (i = 0; i < ClientCount; ++i) {
+        MSRGetTimeouts(Benches[i].Handle, &Timeouts);
+        Timeouts.SwipeMs = 10000;
+        MSRSetTimeouts(Benches[i].Handle, &Timeouts);
+        Benches[i].Errors = 0;
+        pthread_create(&Threads[i], NULL, RemoteReader, &Benches[i]);
+    }
+    for (i = 0; i < ClientCount; ++i) {
+        pthread_join(Threads[i], NULL);
+        ReadErrors += Benches[i].Errors;
+        if (Benches[i].Length != Benches[0].Length) {
+            ReadErrors++;
+        }
+    }
+    Elapsed = BenchNow() - Start;
+
+    memset(&Event, 0, sizeof(Event));
+    for (i = 0; i < 3; ++i) {
+        Event.TrackBuffers[i] = Tracks[i];
+        Event.TrackCapacities[i] = sizeof(Tracks[i]);
+    }
+    while (MSRRemoteWaitSwipe(Subscriber, &Event, 200) == LIBMSR_OK) {
+        Swipes++;
+    }
+    printf("shared read: %u clients in %.0f ms, %u errors, %u swipe event(s) seen by the subscriber\n",
+        ClientCount, Elapsed * 1e3, ReadErrors, Swipes);
+
+    for (i = 0; i < ClientCount; ++i) {
+        MSRClose(Benches[i].Handle);
+    }
+    MSRClose(Subscriber);
+    free(Threads);
+    free(Benches);
+    return Errors || ReadErrors || Swipes != 1 ? 1 : 0;
+}
+
+/*** Termios backend ***/
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+
+/* What the device on the pty master does with a communications test */
+#define SERIAL_ANSWER 0
+#define SERIAL_SILENT 1
+/* ESC and then nothing, to run into the inter-byte timeout */
+#define SERIAL_PARTIAL 2
+
+typedef struct {
+    int Master;
+    volatile int Behaviour;
+    volatile int Stopping;
+    unsigned Commands;
+    unsigned Unexpected;
+} SERIALBENCH;
+
+static void *SerialDevice(void *Arg)
+{
+    SERIALBENCH *Bench = (SERIALBENCH *)Arg;
+    static const BYTE Answer[2] = { 0x1B, 0x79 };
+    BYTE Buffer[64];
+    BYTE Previous = 0;
+    struct pollfd PollFd;
+    ssize_t Count;
+    ssize_t i;
+
+    PollFd.fd = Bench->Master;
+    PollFd.events = POLLIN;
+    while (!Bench->Stopping) {
+        if (poll(&PollFd, 1, 20) <= 0) {
+            continue;
+        }
+        Count = read(Bench->Master, Buffer, sizeof(Buffer));
+        if (Count <= 0) {
+            /* EIO while nobody has the slave open */
+            usleep(20000);
+            continue;
+        }
+        for (i = 0; i < Count; ++i) {
+            if (Previous != 0x1B) {
+                Previous = Buffer[i];
+                continue;
+            }
+            Previous = 0;
+            if (Buffer[i] != 0x65) {
+                Bench->Unexpected++;
+                continue;
+            }
+            Bench->Commands++;
+            if (Bench->Behaviour == SERIAL_ANSWER) {
+                write(Bench->Master, Answer, sizeof(Answer));
+            }
+            else if (Bench->Behaviour == SERIAL_PARTIAL) {
+                write(Bench->Master, Answer, 1);
+            }
+        }
+    }
+    return NULL;
+}
+
+static unsigned SerialCheck(const char *What, int Passed)
+{
+    printf("%-44s %s\n", What, Passed ? "ok" : "FAILED");
+    return !Passed;
+}
+
+static int BenchSerial(int argc, char *argv[])
+{
+    unsigned Rounds = argc > 0 ? (unsigned)atoi(argv[0]) : 1000;
+    SERIALBENCH Bench;
+    LIBMSRHANDLE Handle;
+    LIBMSRSTATUS Status;
+    LIBMSRTIMEOUTS Timeouts;
+    struct termios Settings;
+    pthread_t Thread;
+    unsigned Failures = 0;
+    unsigned Errors = 0;
+    unsigned i;
+    double Start, Elapsed;
+    char *SlaveName;
+
+    memset(&Bench, 0, sizeof(Bench));
+    Bench.Master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (Bench.Master < 0 || grantpt(Bench.Master) < 0 || unlockpt(Bench.Master) < 0 || !(SlaveName = ptsname(Bench.Master))) {
+        fprintf(stderr, "Cannot create a pseudo-terminal\n");
+        return 1;
+    }
+
+    Status = MSROpen(BenchName(SlaveName), &Handle);
+    if (Status < 0) {
+        fprintf(stderr, "MSROpen(%s) failed with status %08X\n", SlaveName, (unsigned)Status);
+        close(Bench.Master);
+        return 1;
+    }
+    /* Terminal settings made through the slave are read back through the master */
+    tcgetattr(Bench.Master, &Settings);
+    Failures += SerialCheck("raw mode, 8 data bits",
+        !(Settings.c_lflag & (ICANON | ECHO | ISIG)) && !(Settings.c_oflag & OPOST) && (Settings.c_cflag & CSIZE) == CS8);
+    Failures += SerialCheck("VMIN 1, VTIME 0", Settings.c_cc[VMIN] == 1 && Settings.c_cc[VTIME] == 0);
+    Failures += SerialCheck("9600 baud", cfgetospeed(&Settings) == B9600 && cfgetispeed(&Settings) == B9600);
+
+    pthread_create(&Thread, NULL, SerialDevice, &Bench);
+
+    Start = BenchNow();
+    for (i = 0; i < Rounds; ++i) {
+        if (MSRTestComms(Handle) != LIBMSR_OK) {
+            Errors++;
+        }
+    }
+    Elapsed = BenchNow() - Start;
+    Failures += SerialCheck("communications test round trips", !Errors && Bench.Commands == Rounds && !Bench.Unexpected);
+    printf("  %u round trips, %u errors, mean %.3f ms\n", Rounds, Errors, Rounds ? Elapsed * 1e3 / Rounds : 0.0);
+
+    /* Bytes already waiting would be taken for the answer unless the port is purged */
+    write(Bench.Master, "junk", 4);
+    usleep(20000);
+    Failures += SerialCheck("stale input purged", MSRTestComms(Handle) == LIBMSR_OK);
+
+    MSRGetTimeouts(Handle, &Timeouts);
+    Timeouts.InterByteMs = 100;
+    Timeouts.CommandMs = 200;
+    MSRSetTimeouts(Handle, &Timeouts);
+    Bench.Behaviour = SERIAL_SILENT;
+    Start = BenchNow();
+    Status = MSRTestComms(Handle);
+    Elapsed = BenchNow() - Start;
+    Failures += SerialCheck("command timeout", Status == LIBMSR_TIMEOUT && Elapsed >= 0.19 && Elapsed < 0.5);
+    printf("  status %08X after %.0f ms, expected %08X after 200 ms\n", (unsigned)Status, Elapsed * 1e3, (unsigned)LIBMSR_TIMEOUT);
+
+    Timeouts.CommandMs = 2000;
+    MSRSetTimeouts(Handle, &Timeouts);
+    Bench.Behaviour = SERIAL_PARTIAL;
+    Start = BenchNow();
+    Status = MSRTestComms(Handle);
+    Elapsed = BenchNow() - Start;
+    Failures += SerialCheck("inter-byte timeout", Status == LIBMSR_TIMEOUT && Elapsed >= 0.09 && Elapsed < 0.5);
+    printf("  status %08X after %.0f ms, expected %08X after 100 ms\n", (unsigned)Status, Elapsed * 1e3, (unsigned)LIBMSR_TIMEOUT);
+
+    Bench.Behaviour = SERIAL_ANSWER;
+    Failures += SerialCheck("round trip after timeouts", MSRTestComms(Handle) == LIBMSR_OK);
+
+    Bench.Stopping = 1;
+    pthread_join(Thread, NULL);
+    MSRClose(Handle);
+    tcgetattr(Bench.Master, &Settings);
+    Failures += SerialCheck("settings restored on close", (Settings.c_lflag & ICANON) != 0);
+
+    close(Bench.Master);
+    return Failures ? 1 : 0;
+}
+
+#endif /* !_WIN32 */
+
+typedef struct {
+    const char *Name;
+    int (*Run)(int argc, char *argv[]);
+} BENCHMODE;
+
+static const BENCHMODE Modes[] = {
+    { "codec", BenchCodec },
+    { "batch", BenchBatch },
+    { "kernels", BenchKernels },
+    { "fields", BenchFields },
+    { "journal", BenchJournal },
+    { "record", BenchRecord },
+    { "replay", BenchReplay },
+    { "parser", BenchParser },
+    { "jobs", BenchJobs },
+    { "discover", BenchDiscover },
+    { "watch", BenchWatch },
+#ifndef _WIN32
+    { "pool", BenchPool },
+    { "threads", BenchThreads },
+    { "remote", BenchRemote },
+    { "serial", BenchSerial },
+#endif
+    { NULL, NULL },
+};
+
+int main(int argc, char *argv[])
+{
+    const BENCHMODE *Mode;
+
+    if (argc >= 2) {
+        for (Mode = Modes; Mode->Name; ++Mode) {
+            if (!strcmp(argv[1], Mode->Name)) {
+                return Mode->Run(argc - 2, argv + 2);
+            }
+        }
+    }
+    fprintf(stderr, "Usage: msrbench <mode> [arguments]\nModes:");
+    for (Mode = Modes; Mode->Name; ++Mode) {
+        fprintf(stderr, " %s", Mode->Name);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+}
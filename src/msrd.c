@@ -0,0 +1,127 @@
+/*
+ * msrd: device server sharing MSRxxx readers between processes.
+ *
+ * Opens the given ports, or every device MSRDiscover finds, and serves them
+ * on a Unix socket for MSROpenRemote. Runs until SIGINT or SIGTERM.
+ */
+
+#ifndef _WIN32
+
+#include "libmsr.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_SOCKET "/tmp/msrd.sock"
+#define MAX_DISCOVERED 64
+
+static volatile sig_atomic_t Stopping;
+
+static void OnSignal(int Signal)
+{
+    (void)Signal;
+    Stopping = 1;
+}
+
+static void Usage(const char *Name)
+{
+    fprintf(stderr,
+        "Usage: %s [-s socket] [port...]\n"
+        "  -s  socket to listen on (default " DEFAULT_SOCKET ")\n"
+        "  with no ports, every device found on the system is served\n",
+        Name);
+}
+
+static int OpenPort(LIBMSRSERVER Server, LPTSTR PortName)
+{
+    LIBMSRSTATUS Status = MSRServerOpen(Server, PortName);
+
+    if (Status < 0) {
+        fprintf(stderr, "Cannot open %s: status %08X\n", PortName, (unsigned)Status);
+        return -1;
+    }
+    fprintf(stderr, "Serving %s\n", PortName);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static LIBMSRPORTINFO Ports[MAX_DISCOVERED];
+    LIBMSRSERVER Server;
+    LIBMSRSTATUS Status;
+    struct sigaction Action;
+    char *SocketPath = DEFAULT_SOCKET;
+    UINT Count = 0;
+    UINT i;
+    int Served = 0;
+    int Option;
+
+    while ((Option = getopt(argc, argv, "s:")) != -1) {
+        switch (Option) {
+        case 's':
+            SocketPath = optarg;
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    Status = MSRServerCreate(SocketPath, &Server);
+    if (Status < 0) {
+        fprintf(stderr, "Cannot listen on %s: status %08X\n", SocketPath, (unsigned)Status);
+        return 1;
+    }
+
+    if (optind < argc) {
+        for (i = optind; i < (UINT)argc; ++i) {
+            Served += OpenPort(Server, argv[i]) == 0;
+        }
+    }
+    else {
+        Status = MSRDiscover(Ports, MAX_DISCOVERED, &Count, NULL);
+        if (Status < 0 && Status != LIBMSR_BUFFER_TOO_SMALL) {
+            fprintf(stderr, "Discovery failed with status %08X\n", (unsigned)Status);
+        }
+        for (i = 0; i < Count && i < MAX_DISCOVERED; ++i) {
+            Served += OpenPort(Server, Ports[i].PortName) == 0;
+        }
+    }
+    if (!Served) {
+        fprintf(stderr, "No devices to serve\n");
+        MSRServerDestroy(Server);
+        return 1;
+    }
+
+    /* No SA_RESTART, so a signal gets the server out of its wait */
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = OnSignal;
+    sigemptyset(&Action.sa_mask);
+    sigaction(SIGINT, &Action, NULL);
+    sigaction(SIGTERM, &Action, NULL);
+
+    while (!Stopping) {
+        Status = MSRServerRun(Server, -1);
+        if (Status < 0) {
+            fprintf(stderr, "Server failed with status %08X\n", (unsigned)Status);
+            break;
+        }
+    }
+
+    MSRServerDestroy(Server);
+    return Status < 0 ? 1 : 0;
+}
+
+#else /* _WIN32 */
+
+#include <stdio.h>
+
+int main(void)
+{
+    fprintf(stderr, "msrd needs POSIX Unix sockets\n");
+    return 1;
+}
+
+#endif /* _WIN32 */
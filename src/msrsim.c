@@ -0,0 +1,696 @@
+/*
+ * msrsim: MSR605 protocol simulator serving the device command set on ptys.
+ *
+ * Each simulated device gets its own pseudo-terminal; the slave names are
+ * printed on stdout, one per line, and can be passed straight to MSROpen.
+ *
+ * Card images are text files with up to three lines, one per track, holding
+ * the track contents in ASCII including sentinels (e.g. "%B123^X/Y^2512?").
+ * An empty line leaves the track blank. Each read swipe takes the next image,
+ * cycling through the list; a written card stays in place for the next swipe.
+ */
+
+#ifndef _WIN32
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef unsigned char BYTE;
+typedef unsigned long long SIMTIME;
+
+#define ESC 0x1B
+#define FS 0x1C
+
+#define MAX_DEVICES 256
+#define MAX_CARDS 64
+#define MAX_TRACK_BITS 4096
+#define IO_BUFFER_SIZE 2048
+
+/* Time to send one byte at 9600 8N1, in microseconds */
+#define BYTE_TIME_US 1042
+/* How often to check whether a client has opened an idle pty */
+#define IDLE_POLL_US 20000
+
+typedef struct {
+    /* Track contents in time order, one bit per byte */
+    BYTE Bits[MAX_TRACK_BITS];
+    unsigned BitCount;
+} SIMTRACK;
+
+typedef struct {
+    SIMTRACK Tracks[3];
+} SIMCARD;
+
+typedef enum {
+    SWIPE_NONE,
+    SWIPE_READ_RAW,
+    SWIPE_READ_ISO,
+    SWIPE_WRITE,
+    SWIPE_ERASE,
+} SIMSWIPE;
+
+typedef struct {
+    int Master;
+    char SlaveName[64];
+
+    BYTE In[IO_BUFFER_SIZE];
+    size_t InLength;
+    BYTE Out[IO_BUFFER_SIZE];
+    size_t OutLength;
+    /* Earliest time the next byte of Out may leave */
+    SIMTIME OutReadyAt;
+    /* Nobody has the slave open; do not poll until then */
+    SIMTIME IdleUntil;
+
+    /* Device settings */
+    BYTE BitsPerChar[3];
+    int IsHiCo;
+    BYTE LeadingZeros13;
+    BYTE LeadingZeros2;
+
+    /* Pending swipe */
+    SIMSWIPE Swipe;
+    SIMTIME SwipeAt;
+    BYTE EraseMask;
+    SIMCARD WriteData;
+
+    SIMCARD Card;
+    int CardWritten;
+    unsigned NextCard;
+} SIMDEVICE;
+
+static SIMCARD Cards[MAX_CARDS];
+static unsigned CardCount;
+static SIMTIME SwipeDelayUs = 500000;
+static SIMTIME LatencyUs;
+static int PaceOutput;
+static int Verbose;
+
+static SIMTIME Now(void)
+{
+    struct timespec Ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return (SIMTIME)Ts.tv_sec * 1000000 + Ts.tv_nsec / 1000;
+}
+
+/*** Track encoding ***/
+
+static void TrackAppendChar(SIMTRACK *Track, unsigned Value, unsigned BitsPerChar)
+{
+    unsigned i;
+
+    for (i = 0; i < BitsPerChar && Track->BitCount < MAX_TRACK_BITS; ++i) {
+        Track->Bits[Track->BitCount++] = (Value >> i) & 1;
+    }
+}
+
+static unsigned OddParity(unsigned Value)
+{
+    unsigned Parity = 1;
+
+    while (Value) {
+        Parity ^= Value & 1;
+        Value >>= 1;
+    }
+    return Parity;
+}
+
+/* Encode ASCII track text with parity and a trailing LRC character. */
+static void TrackEncodeText(SIMTRACK *Track, const char *Text, unsigned BitsPerChar)
+{
+    unsigned Base = BitsPerChar == 7 ? 0x20 : 0x30;
+    unsigned DataBits = BitsPerChar - 1;
+    unsigned Lrc = 0;
+
+    Track->BitCount = 0;
+    if (!*Text) {
+        return;
+    }
+    for (; *Text; ++Text) {
+        unsigned Value = ((unsigned char)*Text - Base) & ((1 << DataBits) - 1);
+        Lrc ^= Value;
+        TrackAppendChar(Track, Value | (OddParity(Value) << DataBits), BitsPerChar);
+    }
+    TrackAppendChar(Track, Lrc | (OddParity(Lrc) << DataBits), BitsPerChar);
+}
+
+/* Store bytes written with the 0x6E command: right-aligned, first bit in bit 0. */
+static void TrackStoreWritten(SIMTRACK *Track, const BYTE *Data, unsigned Length, unsigned BitsPerChar)
+{
+    unsigned i;
+
+    Track->BitCount = 0;
+    for (i = 0; i < Length; ++i) {
+        TrackAppendChar(Track, Data[i], BitsPerChar);
+    }
+}
+
+/* The head syncs on the first one bit; leading zeros are not reported. */
+static unsigned TrackFirstBit(const SIMTRACK *Track)
+{
+    unsigned i;
+
+    for (i = 0; i < Track->BitCount; ++i) {
+        if (Track->Bits[i]) {
+            return i;
+        }
+    }
+    return Track->BitCount;
+}
+
+/* Raw read: frame the bitstream into BitsPerChar chunks, first bit in the MSB.
+ * One extra all-zero character stands in for the trailing clocking zeros.
+ */
+static unsigned TrackReadRaw(const SIMTRACK *Track, unsigned BitsPerChar, BYTE *Out, unsigned OutSize)
+{
+    unsigned Bit = TrackFirstBit(Track);
+    unsigned Length = 0;
+
+    if (Bit == Track->BitCount) {
+        return 0;
+    }
+    while (Bit < Track->BitCount && Length < OutSize) {
+        BYTE Value = 0;
+        unsigned i;
+
+        for (i = 0; i < BitsPerChar; ++i, ++Bit) {
+            if (Bit < Track->BitCount && Track->Bits[Bit]) {
+                Value |= 1 << (BitsPerChar - 1 - i);
+            }
+        }
+        Out[Length++] = Value;
+    }
+    if (Length < OutSize) {
+        Out[Length++] = 0;
+    }
+    return Length;
+}
+
+/* ISO read: decode start sentinel through end sentinel as ASCII. */
+static unsigned TrackReadIso(const SIMTRACK *Track, unsigned BitsPerChar, BYTE *Out, unsigned OutSize)
+{
+    unsigned Base = BitsPerChar == 7 ? 0x20 : 0x30;
+    unsigned Bit = TrackFirstBit(Track);
+    unsigned Length = 0;
+
+    while (Bit + BitsPerChar <= Track->BitCount && Length < OutSize) {
+        BYTE Value = 0;
+        unsigned i;
+
+        for (i = 0; i < BitsPerChar - 1; ++i) {
+            Value |= Track->Bits[Bit + i] << i;
+        }
+        Bit += BitsPerChar;
+        Out[Length++] = (BYTE)(Value + Base);
+        if (Value + Base == '?') {
+            break;
+        }
+    }
+    return Length;
+}
+
+static int LoadCard(const char *Path, SIMCARD *Card)
+{
+    static const unsigned IsoBitsPerChar[3] = { 7, 5, 5 };
+    char Line[1024];
+    FILE *File;
+    unsigned Track;
+
+    File = fopen(Path, "r");
+    if (!File) {
+        return -1;
+    }
+    memset(Card, 0, sizeof(*Card));
+    for (Track = 0; Track < 3 && fgets(Line, sizeof(Line), File); ++Track) {
+        Line[strcspn(Line, "\r\n")] = '\0';
+        TrackEncodeText(&Card->Tracks[Track], Line, IsoBitsPerChar[Track]);
+    }
+    fclose(File);
+    return 0;
+}
+
+/*** Device I/O ***/
+
+static void DeviceReply(SIMDEVICE *Device, const BYTE *Data, size_t Length)
+{
+    if (Device->OutLength + Length > sizeof(Device->Out)) {
+        fprintf(stderr, "%s: output overflow\n", Device->SlaveName);
+        return;
+    }
+    if (Device->OutLength == 0) {
+        Device->OutReadyAt = Now() + LatencyUs;
+    }
+    memcpy(Device->Out + Device->OutLength, Data, Length);
+    Device->OutLength += Length;
+}
+
+static void DeviceReply2(SIMDEVICE *Device, BYTE First, BYTE Second)
+{
+    BYTE Reply[2];
+
+    Reply[0] = First;
+    Reply[1] = Second;
+    DeviceReply(Device, Reply, 2);
+}
+
+static void DeviceFlush(SIMDEVICE *Device, SIMTIME Time)
+{
+    size_t Count = Device->OutLength;
+    ssize_t Written;
+
+    if (Count == 0 || Time < Device->OutReadyAt) {
+        return;
+    }
+    if (PaceOutput) {
+        size_t Allowed = (size_t)((Time - Device->OutReadyAt) / BYTE_TIME_US) + 1;
+        if (Allowed < Count) {
+            Count = Allowed;
+        }
+    }
+    Written = write(Device->Master, Device->Out, Count);
+    if (Written <= 0) {
+        return;
+    }
+    memmove(Device->Out, Device->Out + Written, Device->OutLength - Written);
+    Device->OutLength -= Written;
+    if (PaceOutput) {
+        Device->OutReadyAt += (SIMTIME)Written * BYTE_TIME_US;
+    }
+}
+
+static void DeviceReset(SIMDEVICE *Device)
+{
+    Device->Swipe = SWIPE_NONE;
+    Device->BitsPerChar[0] = 7;
+    Device->BitsPerChar[1] = 5;
+    Device->BitsPerChar[2] = 5;
+}
+
+static void DeviceStartSwipe(SIMDEVICE *Device, SIMSWIPE Swipe)
+{
+    Device->Swipe = Swipe;
+    Device->SwipeAt = Now() + SwipeDelayUs;
+}
+
+static void DeviceCompleteSwipe(SIMDEVICE *Device)
+{
+    static const unsigned IsoBitsPerChar[3] = { 7, 5, 5 };
+    BYTE Data[512];
+    unsigned Track;
+    unsigned Length;
+
+    if (Device->Swipe == SWIPE_READ_RAW || Device->Swipe == SWIPE_READ_ISO) {
+        if (!Device->CardWritten && CardCount > 0) {
+            Device->Card = Cards[Device->NextCard];
+            Device->NextCard = (Device->NextCard + 1) % CardCount;
+        }
+        Device->CardWritten = 0;
+    }
+
+    switch (Device->Swipe) {
+    case SWIPE_READ_RAW:
+        DeviceReply2(Device, ESC, 's');
+        for (Track = 0; Track < 3; ++Track) {
+            BYTE Header[3];
+
+            Length = TrackReadRaw(&Device->Card.Tracks[Track], Device->BitsPerChar[Track], Data, 255);
+            Header[0] = ESC;
+            Header[1] = Track + 1;
+            Header[2] = (BYTE)Length;
+            DeviceReply(Device, Header, 3);
+            DeviceReply(Device, Data, Length);
+        }
+        DeviceReply2(Device, '?', FS);
+        DeviceReply2(Device, ESC, '0');
+        break;
+
+    case SWIPE_READ_ISO:
+        DeviceReply2(Device, ESC, 's');
+        for (Track = 0; Track < 3; ++Track) {
+            DeviceReply2(Device, ESC, Track + 1);
+            Length = TrackReadIso(&Device->Card.Tracks[Track], IsoBitsPerChar[Track], Data, sizeof(Data));
+            if (Length == 0 || Data[Length - 1] != '?') {
+                DeviceReply2(Device, ESC, '+');
+            }
+            else {
+                DeviceReply(Device, Data, Length);
+            }
+        }
+        DeviceReply2(Device, '?', FS);
+        DeviceReply2(Device, ESC, '0');
+        break;
+
+    case SWIPE_WRITE:
+        Device->Card = Device->WriteData;
+        Device->CardWritten = 1;
+        DeviceReply2(Device, ESC, '0');
+        break;
+
+    case SWIPE_ERASE:
+        for (Track = 0; Track < 3; ++Track) {
+            if (Device->EraseMask & (1 << Track)) {
+                Device->Card.Tracks[Track].BitCount = 0;
+            }
+        }
+        Device->CardWritten = 1;
+        DeviceReply2(Device, ESC, '0');
+        break;
+
+    default:
+        break;
+    }
+    Device->Swipe = SWIPE_NONE;
+}
+
+/* Length of the write command at the start of In, 0 if incomplete. */
+static size_t WriteCommandLength(const BYTE *In, size_t Length)
+{
+    size_t Pos = 2;
+
+    if (Length < Pos + 2) {
+        return 0;
+    }
+    if (In[Pos] != ESC || In[Pos + 1] != 's') {
+        return Pos;
+    }
+    Pos += 2;
+    for (;;) {
+        if (Pos + 2 > Length) {
+            return 0;
+        }
+        if (In[Pos] == '?' && In[Pos + 1] == FS) {
+            return Pos + 2;
+        }
+        if (In[Pos] != ESC) {
+            return Pos;
+        }
+        if (Pos + 3 > Length) {
+            return 0;
+        }
+        Pos += 3 + In[Pos + 2];
+    }
+}
+
+static void DeviceParseWrite(SIMDEVICE *Device, const BYTE *In, size_t Length)
+{
+    size_t Pos = 4;
+
+    memset(&Device->WriteData, 0, sizeof(Device->WriteData));
+    while (Pos + 3 <= Length && In[Pos] == ESC) {
+        unsigned Track = In[Pos + 1];
+        unsigned DataLength = In[Pos + 2];
+
+        if (Track >= 1 && Track <= 3) {
+            TrackStoreWritten(&Device->WriteData.Tracks[Track - 1], In + Pos + 3, DataLength,
+                Device->BitsPerChar[Track - 1]);
+        }
+        Pos += 3 + DataLength;
+    }
+}
+
+/* Execute one command from the input buffer; returns bytes consumed, 0 if incomplete. */
+static size_t DeviceCommand(SIMDEVICE *Device)
+{
+    const BYTE *In = Device->In;
+    size_t Length = Device->InLength;
+    BYTE Reply[8];
+
+    if (In[0] != ESC) {
+        return 1;
+    }
+    if (Length < 2) {
+        return 0;
+    }
+    if (Verbose) {
+        fprintf(stderr, "%s: command %02X\n", Device->SlaveName, In[1]);
+    }
+
+    switch (In[1]) {
+    case 0x61: /* Reset */
+        DeviceReset(Device);
+        return 2;
+    case 0x65: /* Communications test */
+        DeviceReply2(Device, ESC, 'y');
+        return 2;
+    case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: /* LEDs */
+        return 2;
+    case 0x6D: /* Read raw */
+        DeviceStartSwipe(Device, SWIPE_READ_RAW);
+        return 2;
+    case 0x72: /* Read ISO */
+        DeviceStartSwipe(Device, SWIPE_READ_ISO);
+        return 2;
+    case 0x6E: /* Write raw */
+        Length = WriteCommandLength(In, Length);
+        if (Length > 4) {
+            DeviceParseWrite(Device, In, Length);
+            DeviceStartSwipe(Device, SWIPE_WRITE);
+        }
+        return Length;
+    case 0x63: /* Erase */
+        if (Length < 3) {
+            return 0;
+        }
+        Device->EraseMask = In[2];
+        DeviceStartSwipe(Device, SWIPE_ERASE);
+        return 3;
+    case 0x6F: /* Set BPC */
+        if (Length < 5) {
+            return 0;
+        }
+        memcpy(Device->BitsPerChar, In + 2, 3);
+        Reply[0] = ESC;
+        Reply[1] = '0';
+        memcpy(Reply + 2, In + 2, 3);
+        DeviceReply(Device, Reply, 5);
+        return 5;
+    case 0x62: /* Set density */
+        if (Length < 3) {
+            return 0;
+        }
+        DeviceReply2(Device, ESC, '0');
+        return 3;
+    case 0x78: /* Set HiCo */
+    case 0x79: /* Set LoCo */
+        Device->IsHiCo = In[1] == 0x78;
+        DeviceReply2(Device, ESC, '0');
+        return 2;
+    case 0x64: /* Get coercivity */
+        DeviceReply2(Device, ESC, Device->IsHiCo ? 'H' : 'L');
+        return 2;
+    case 0x7A: /* Set leading zeros */
+        if (Length < 4) {
+            return 0;
+        }
+        Device->LeadingZeros13 = In[2];
+        Device->LeadingZeros2 = In[3];
+        DeviceReply2(Device, ESC, '0');
+        return 4;
+    case 0x74: /* Get model: three tracks */
+        Reply[0] = ESC;
+        Reply[1] = '3';
+        Reply[2] = 'S';
+        DeviceReply(Device, Reply, 3);
+        return 2;
+    case 0x6C: /* Get leading zeros */
+        Reply[0] = ESC;
+        Reply[1] = Device->LeadingZeros13;
+        Reply[2] = Device->LeadingZeros2;
+        DeviceReply(Device, Reply, 3);
+        return 2;
+    default:
+        DeviceReply2(Device, ESC, '1');
+        return 2;
+    }
+}
+
+static void DeviceReceive(SIMDEVICE *Device)
+{
+    ssize_t BytesRead;
+    size_t Consumed;
+
+    BytesRead = read(Device->Master, Device->In + Device->InLength, sizeof(Device->In) - Device->InLength);
+    if (BytesRead <= 0) {
+        return;
+    }
+    Device->InLength += BytesRead;
+
+    while (Device->InLength > 0) {
+        Consumed = DeviceCommand(Device);
+        if (Consumed == 0) {
+            if (Device->InLength == sizeof(Device->In)) {
+                /* Garbage filled the buffer; start over */
+                Device->InLength = 0;
+            }
+            break;
+        }
+        memmove(Device->In, Device->In + Consumed, Device->InLength - Consumed);
+        Device->InLength -= Consumed;
+    }
+}
+
+static int DeviceOpen(SIMDEVICE *Device)
+{
+    struct termios Settings;
+
+    memset(Device, 0, sizeof(*Device));
+    Device->Master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (Device->Master < 0) {
+        return -1;
+    }
+    if (grantpt(Device->Master) < 0 || unlockpt(Device->Master) < 0) {
+        close(Device->Master);
+        return -1;
+    }
+    snprintf(Device->SlaveName, sizeof(Device->SlaveName), "%s", ptsname(Device->Master));
+    if (tcgetattr(Device->Master, &Settings) == 0) {
+        cfmakeraw(&Settings);
+        tcsetattr(Device->Master, TCSANOW, &Settings);
+    }
+    fcntl(Device->Master, F_SETFL, fcntl(Device->Master, F_GETFL) | O_NONBLOCK);
+
+    Device->IsHiCo = 1;
+    Device->LeadingZeros13 = 61;
+    Device->LeadingZeros2 = 22;
+    DeviceReset(Device);
+    return 0;
+}
+
+static void Usage(const char *Name)
+{
+    fprintf(stderr,
+        "Usage: %s [-n devices] [-s swipe_ms] [-l latency_us] [-p] [-v] [-c card_file]...\n"
+        "  -n  number of simulated devices (default 1)\n"
+        "  -s  delay between a card command and the simulated swipe (default 500 ms)\n"
+        "  -l  latency added before each response (default 0 us)\n"
+        "  -p  pace responses at 9600 baud\n"
+        "  -c  card image to present on read swipes; may be repeated\n"
+        "  -v  log commands to stderr\n",
+        Name);
+}
+
+int main(int argc, char *argv[])
+{
+    static SIMDEVICE Devices[MAX_DEVICES];
+    static struct pollfd PollFds[MAX_DEVICES];
+    unsigned DeviceCount = 1;
+    unsigned i;
+    int Option;
+
+    while ((Option = getopt(argc, argv, "n:s:l:pc:v")) != -1) {
+        switch (Option) {
+        case 'n':
+            DeviceCount = (unsigned)atoi(optarg);
+            if (DeviceCount < 1 || DeviceCount > MAX_DEVICES) {
+                fprintf(stderr, "Device count must be 1..%u\n", MAX_DEVICES);
+                return 1;
+            }
+            break;
+        case 's':
+            SwipeDelayUs = (SIMTIME)atol(optarg) * 1000;
+            break;
+        case 'l':
+            LatencyUs = (SIMTIME)atol(optarg);
+            break;
+        case 'p':
+            PaceOutput = 1;
+            break;
+        case 'c':
+            if (CardCount == MAX_CARDS || LoadCard(optarg, &Cards[CardCount]) < 0) {
+                fprintf(stderr, "Cannot load card image %s\n", optarg);
+                return 1;
+            }
+            CardCount++;
+            break;
+        case 'v':
+            Verbose = 1;
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < DeviceCount; ++i) {
+        if (DeviceOpen(&Devices[i]) < 0) {
+            perror("posix_openpt");
+            return 1;
+        }
+        printf("%s\n", Devices[i].SlaveName);
+    }
+    fflush(stdout);
+
+    for (;;) {
+        SIMTIME Time = Now();
+        SIMTIME NextEvent = Time + 1000000;
+        int Timeout;
+
+        for (i = 0; i < DeviceCount; ++i) {
+            SIMDEVICE *Device = &Devices[i];
+
+            if (Device->Swipe != SWIPE_NONE && Device->SwipeAt <= NextEvent) {
+                NextEvent = Device->SwipeAt;
+            }
+            if (Device->OutLength > 0 && Device->OutReadyAt <= NextEvent) {
+                NextEvent = Device->OutReadyAt;
+            }
+            if (Device->IdleUntil > Time) {
+                if (Device->IdleUntil < NextEvent) {
+                    NextEvent = Device->IdleUntil;
+                }
+                PollFds[i].fd = -1;
+            }
+            else {
+                PollFds[i].fd = Device->Master;
+            }
+            PollFds[i].events = POLLIN;
+            PollFds[i].revents = 0;
+        }
+        Timeout = NextEvent > Time ? (int)((NextEvent - Time + 999) / 1000) : 0;
+
+        if (poll(PollFds, DeviceCount, Timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+
+        Time = Now();
+        for (i = 0; i < DeviceCount; ++i) {
+            SIMDEVICE *Device = &Devices[i];
+
+            if (PollFds[i].revents & POLLIN) {
+                DeviceReceive(Device);
+            }
+            else if (PollFds[i].revents & POLLHUP) {
+                /* Nobody has the slave open right now */
+                Device->IdleUntil = Time + IDLE_POLL_US;
+            }
+            if (Device->Swipe != SWIPE_NONE && Device->SwipeAt <= Time) {
+                DeviceCompleteSwipe(Device);
+            }
+            DeviceFlush(Device, Time);
+        }
+    }
+}
+
+#else /* _WIN32 */
+
+#include <stdio.h>
+
+int main(void)
+{
+    fprintf(stderr, "msrsim needs POSIX pseudo-terminals\n");
+    return 1;
+}
+
+#endif /* _WIN32 */
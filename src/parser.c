@@ -0,0 +1,296 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+/* Parser states */
+#define MSR_PARSE_ESC 0         /* Leading ESC of the response */
+#define MSR_PARSE_REPLY 1       /* Fixed-size reply bytes */
+#define MSR_PARSE_START 2       /* 's' opening the track blocks */
+#define MSR_PARSE_BLOCK 3       /* ESC opening a block, or '?' closing the list */
+#define MSR_PARSE_TRACK_ID 4
+#define MSR_PARSE_RAW_LENGTH 5
+#define MSR_PARSE_RAW_DATA 6
+#define MSR_PARSE_ISO_DATA 7
+#define MSR_PARSE_ISO_EMPTY 8   /* Byte after ESC in ISO data, as in 1B 2B */
+#define MSR_PARSE_FS 9
+#define MSR_PARSE_END_ESC 10
+#define MSR_PARSE_END_STATUS 11
+#define MSR_PARSE_DONE 12
+
+static void _MSRParserEmit(LIBMSRPARSER *Parser, UINT Type, const BYTE *Data, SIZE_T Length, BYTE Byte)
+{
+    LIBMSRPARSEEVENT Event;
+
+    if (!Parser->Callback) {
+        return;
+    }
+    Event.Type = Type;
+    Event.Track = Parser->Track;
+    Event.Data = Data;
+    Event.Length = Length;
+    Event.Byte = Byte;
+    Event.Status = Parser->Status;
+    Parser->Callback(Parser->Context, &Event);
+}
+
+static void _MSRParserComplete(LIBMSRPARSER *Parser)
+{
+    Parser->State = MSR_PARSE_DONE;
+    Parser->Status = _MSRRequestCheckReply(Parser->Type, Parser->Reply);
+    _MSRParserEmit(Parser, LIBMSR_PARSE_COMPLETE, NULL, 0, 0);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRParserInit(LIBMSRPARSER *pParser, UINT RequestType, LIBMSRPARSECALLBACK Callback, void *Context)
+{
+    memset(pParser, 0, sizeof(*pParser));
+    pParser->Type = RequestType;
+    pParser->Kind = _MSRRequestResponseKind(RequestType, &pParser->ReplyLength);
+    pParser->State = MSR_PARSE_ESC;
+    pParser->Status = LIBMSR_PENDING;
+    pParser->Callback = Callback;
+    pParser->Context = Context;
+
+    if (pParser->Kind == MSR_RESPONSE_NONE) {
+        pParser->State = MSR_PARSE_DONE;
+        pParser->Status = LIBMSR_OK;
+        _MSRParserEmit(pParser, LIBMSR_PARSE_COMPLETE, NULL, 0, 0);
+    }
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRParserFeed(LIBMSRPARSER *pParser, const BYTE *Data, SIZE_T Length, SIZE_T *pConsumed)
+{
+    SIZE_T Pos = 0;
+    SIZE_T Start;
+    SIZE_T Chunk;
+    BYTE Byte = 0;
+
+    while (Pos < Length && pParser->State != MSR_PARSE_DONE) {
+        /* Track data is handed out in runs pointing into the caller's buffer */
+        if (pParser->State == MSR_PARSE_RAW_DATA) {
+            Chunk = Length - Pos < pParser->Remaining ? Length - Pos : pParser->Remaining;
+            _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_DATA, Data + Pos, Chunk, 0);
+            Pos += Chunk;
+            pParser->Remaining -= Chunk;
+            if (pParser->Remaining == 0) {
+                _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_END, NULL, 0, 0);
+                pParser->State = MSR_PARSE_BLOCK;
+            }
+            continue;
+        }
+        if (pParser->State == MSR_PARSE_ISO_DATA) {
+            Start = Pos;
+            while (Pos < Length && Data[Pos] != ESC && Data[Pos] != 0x3F) {
+                Pos++;
+            }
+            if (Pos < Length && Data[Pos] == 0x3F) {
+                Pos++;
+                _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_DATA, Data + Start, Pos - Start, 0);
+                _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_END, NULL, 0, 0);
+                pParser->State = MSR_PARSE_BLOCK;
+                continue;
+            }
+            if (Pos > Start) {
+                _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_DATA, Data + Start, Pos - Start, 0);
+            }
+            if (Pos < Length) {
+                /* MSR605: If no data on the track, 1B 2B is sent as content */
+                Pos++;
+                pParser->State = MSR_PARSE_ISO_EMPTY;
+            }
+            continue;
+        }
+
+        Byte = Data[Pos++];
+        switch (pParser->State) {
+        case MSR_PARSE_ESC:
+            if (Byte != ESC) {
+                goto unexpected;
+            }
+            pParser->State = pParser->Kind == MSR_RESPONSE_REPLY ? MSR_PARSE_REPLY : MSR_PARSE_START;
+            break;
+
+        case MSR_PARSE_REPLY:
+            pParser->Reply[pParser->ReplyCount++] = Byte;
+            if (pParser->ReplyCount == pParser->ReplyLength) {
+                _MSRParserEmit(pParser, LIBMSR_PARSE_REPLY, pParser->Reply, pParser->ReplyLength, 0);
+                _MSRParserComplete(pParser);
+            }
+            break;
+
+        case MSR_PARSE_START:
+            if (Byte != 0x73) {
+                goto unexpected;
+            }
+            pParser->State = MSR_PARSE_BLOCK;
+            break;
+
+        case MSR_PARSE_BLOCK:
+            if (Byte == ESC) {
+                pParser->State = MSR_PARSE_TRACK_ID;
+            }
+            else if (Byte == 0x3F) {
+                pParser->State = MSR_PARSE_FS;
+            }
+            else {
+                goto unexpected;
+            }
+            break;
+
+        case MSR_PARSE_TRACK_ID:
+            pParser->Track = Byte;
+            if (pParser->Kind == MSR_RESPONSE_TRACKS_RAW) {
+                pParser->State = MSR_PARSE_RAW_LENGTH;
+            }
+            else {
+                _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_BEGIN, NULL, 0, 0);
+                pParser->State = MSR_PARSE_ISO_DATA;
+            }
+            break;
+
+        case MSR_PARSE_RAW_LENGTH:
+            pParser->Remaining = Byte;
+            _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_BEGIN, NULL, Byte, 0);
+            if (Byte) {
+                pParser->State = MSR_PARSE_RAW_DATA;
+            }
+            else {
+                _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_END, NULL, 0, 0);
+                pParser->State = MSR_PARSE_BLOCK;
+            }
+            break;
+
+        case MSR_PARSE_ISO_EMPTY:
+            _MSRParserEmit(pParser, LIBMSR_PARSE_TRACK_END, NULL, 0, 0);
+            pParser->State = MSR_PARSE_BLOCK;
+            break;
+
+        case MSR_PARSE_FS:
+            if (Byte != FS) {
+                goto unexpected;
+            }
+            pParser->State = MSR_PARSE_END_ESC;
+            break;
+
+        case MSR_PARSE_END_ESC:
+            if (Byte != ESC) {
+                goto unexpected;
+            }
+            pParser->State = MSR_PARSE_END_STATUS;
+            break;
+
+        case MSR_PARSE_END_STATUS:
+            pParser->Reply[0] = Byte;
+            _MSRParserEmit(pParser, LIBMSR_PARSE_STATUS, NULL, 0, Byte);
+            _MSRParserComplete(pParser);
+            break;
+        }
+    }
+
+    *pConsumed = Pos;
+    return pParser->Status;
+
+unexpected:
+    *pConsumed = Pos;
+    pParser->State = MSR_PARSE_DONE;
+    pParser->Status = LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
+    _MSRParserEmit(pParser, LIBMSR_PARSE_ERROR, NULL, 0, Byte);
+    return pParser->Status;
+}
+
+/* The library's own parser stores events straight into the request's buffers,
+ * honouring their capacities. ISO text keeps room for the terminating NUL.
+ */
+static void LIBMSRDECL _MSRParserStoreEvent(void *Context, const LIBMSRPARSEEVENT *pEvent)
+{
+    MSRPARSER *Parser = (MSRPARSER *)Context;
+    LIBMSRREQUEST *Request = Parser->Request;
+    BOOL IsIso = Parser->Core.Kind == MSR_RESPONSE_TRACKS_ISO;
+    SIZE_T Capacity;
+    SIZE_T Space;
+    SIZE_T Length;
+    BYTE *Buffer;
+
+    switch (pEvent->Type) {
+    case LIBMSR_PARSE_TRACK_BEGIN:
+        Parser->Track = (pEvent->Track >= 1 && pEvent->Track <= 3) ? pEvent->Track - 1 : 3;
+        if (Parser->Track < 3) {
+            Request->TrackLengths[Parser->Track] = 0;
+        }
+        break;
+
+    case LIBMSR_PARSE_TRACK_DATA:
+        if (Parser->Track >= 3 || !Request->TrackBuffers[Parser->Track]) {
+            break;
+        }
+        Capacity = Request->TrackCapacities[Parser->Track];
+        if (IsIso && Capacity > 0) {
+            Capacity--;
+        }
+        Buffer = Request->TrackBuffers[Parser->Track];
+        Length = Request->TrackLengths[Parser->Track];
+        Space = Capacity - Length;
+        if (pEvent->Length > Space) {
+            Parser->Status = LIBMSR_BUFFER_TOO_SMALL;
+            memcpy(Buffer + Length, pEvent->Data, Space);
+            Request->TrackLengths[Parser->Track] = Capacity;
+        }
+        else {
+            memcpy(Buffer + Length, pEvent->Data, pEvent->Length);
+            Request->TrackLengths[Parser->Track] = Length + pEvent->Length;
+        }
+        break;
+
+    case LIBMSR_PARSE_TRACK_END:
+        if (IsIso && Parser->Track < 3 && Request->TrackBuffers[Parser->Track] && Request->TrackCapacities[Parser->Track] > 0) {
+            Request->TrackBuffers[Parser->Track][Request->TrackLengths[Parser->Track]] = 0x00;
+        }
+        Parser->Track = 3;
+        break;
+
+    case LIBMSR_PARSE_REPLY:
+        memcpy(Request->Reply, pEvent->Data, pEvent->Length);
+        break;
+
+    case LIBMSR_PARSE_STATUS:
+        Request->Reply[0] = pEvent->Byte;
+        break;
+
+    case LIBMSR_PARSE_ERROR:
+        /* A broken response outranks an overflow seen before it */
+        Parser->Status = pEvent->Status;
+        break;
+    }
+}
+
+void LIBMSRDECL _MSRParserInit(MSRPARSER *Parser, LIBMSRREQUEST *Request)
+{
+    UINT Track;
+    UINT ReplyLength;
+    UINT Kind;
+
+    Parser->Request = Request;
+    Parser->Track = 3;
+    Parser->Status = LIBMSR_OK;
+
+    Kind = _MSRRequestResponseKind(Request->Type, &ReplyLength);
+    if (Kind == MSR_RESPONSE_TRACKS_RAW || Kind == MSR_RESPONSE_TRACKS_ISO) {
+        for (Track = 0; Track < 3; ++Track) {
+            Request->TrackLengths[Track] = 0;
+        }
+    }
+    MSRParserInit(&Parser->Core, Request->Type, _MSRParserStoreEvent, Parser);
+}
+
+/* Same contract as MSRParserFeed; an overflowed track buffer turns success into LIBMSR_BUFFER_TOO_SMALL. */
+LIBMSRSTATUS LIBMSRDECL _MSRParserFeed(MSRPARSER *Parser, const BYTE *Data, SIZE_T Length, SIZE_T *pConsumed)
+{
+    LIBMSRSTATUS Status;
+
+    Status = MSRParserFeed(&Parser->Core, Data, Length, pConsumed);
+    if (Status != LIBMSR_PENDING && Parser->Status < 0) {
+        return Parser->Status;
+    }
+    return Status;
+}
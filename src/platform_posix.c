@@ -0,0 +1,280 @@
+#ifndef _WIN32
+
+#define _DEFAULT_SOURCE
+
+#include "libmsr.h"
+#include "internals.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+MSRTIME LIBMSRDECL _MSRGetTime(void)
+{
+    struct timespec Ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return (MSRTIME)Ts.tv_sec * 1000 + Ts.tv_nsec / 1000000;
+}
+
+ULONGLONG LIBMSRDECL _MSRGetTimeUs(void)
+{
+    struct timespec Ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return (ULONGLONG)Ts.tv_sec * 1000000 + Ts.tv_nsec / 1000;
+}
+
+void LIBMSRDECL _MSRSleep(UINT Milliseconds)
+{
+    struct timespec Ts;
+
+    Ts.tv_sec = Milliseconds / 1000;
+    Ts.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+    while (nanosleep(&Ts, &Ts) < 0 && errno == EINTR) {
+    }
+}
+
+typedef struct {
+    pthread_t Thread;
+    MSRTHREADPROC Proc;
+    void *Arg;
+} MSRTHREADSTART;
+
+static void *_MSRThreadMain(void *Param)
+{
+    MSRTHREADSTART *Start = (MSRTHREADSTART *)Param;
+
+    Start->Proc(Start->Arg);
+    return NULL;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRThreadCreate(MSRTHREADPROC Proc, void *Arg, MSRTHREAD *pThread)
+{
+    MSRTHREADSTART *Start;
+
+    Start = _MSRAlloc(sizeof(*Start));
+    if (!Start) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Start->Proc = Proc;
+    Start->Arg = Arg;
+    if (pthread_create(&Start->Thread, NULL, _MSRThreadMain, Start) != 0) {
+        _MSRFree(Start);
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    *pThread = Start;
+    return LIBMSR_OK;
+}
+
+void LIBMSRDECL _MSRThreadJoin(MSRTHREAD Thread)
+{
+    MSRTHREADSTART *Start = (MSRTHREADSTART *)Thread;
+
+    pthread_join(Start->Thread, NULL);
+    _MSRFree(Start);
+}
+
+void LIBMSRDECL _MSRThreadDetach(MSRTHREAD Thread)
+{
+    MSRTHREADSTART *Start = (MSRTHREADSTART *)Thread;
+
+    pthread_detach(Start->Thread);
+    _MSRFree(Start);
+}
+
+UINT LIBMSRDECL _MSRCpuCount(void)
+{
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return Count > 0 ? (UINT)Count : 1;
+}
+
+void LIBMSRDECL _MSRLockInit(MSRLOCK *Lock)
+{
+    pthread_mutex_init(Lock, NULL);
+}
+
+void LIBMSRDECL _MSRLockDelete(MSRLOCK *Lock)
+{
+    pthread_mutex_destroy(Lock);
+}
+
+void LIBMSRDECL _MSRLock(MSRLOCK *Lock)
+{
+    pthread_mutex_lock(Lock);
+}
+
+void LIBMSRDECL _MSRUnlock(MSRLOCK *Lock)
+{
+    pthread_mutex_unlock(Lock);
+}
+
+/* Timed waits are measured on the monotonic clock, like _MSRGetTime */
+void LIBMSRDECL _MSRCondInit(MSRCOND *Cond)
+{
+    pthread_condattr_t Attr;
+
+    pthread_condattr_init(&Attr);
+    pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);
+    pthread_cond_init(Cond, &Attr);
+    pthread_condattr_destroy(&Attr);
+}
+
+void LIBMSRDECL _MSRCondDelete(MSRCOND *Cond)
+{
+    pthread_cond_destroy(Cond);
+}
+
+BOOL LIBMSRDECL _MSRCondWait(MSRCOND *Cond, MSRLOCK *Lock, UINT TimeoutMs)
+{
+    struct timespec Ts;
+
+    if (TimeoutMs == LIBMSR_INFINITE) {
+        pthread_cond_wait(Cond, Lock);
+        return TRUE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    Ts.tv_sec += TimeoutMs / 1000;
+    Ts.tv_nsec += (long)(TimeoutMs % 1000) * 1000000;
+    if (Ts.tv_nsec >= 1000000000) {
+        Ts.tv_sec++;
+        Ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(Cond, Lock, &Ts) != ETIMEDOUT;
+}
+
+void LIBMSRDECL _MSRCondBroadcast(MSRCOND *Cond)
+{
+    pthread_cond_broadcast(Cond);
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRSemaphoreInit(MSRSEMAPHORE *Semaphore)
+{
+    return sem_init(Semaphore, 0, 0) == 0 ? LIBMSR_OK : LIBMSR_MEM_ALLOC_FAILED;
+}
+
+void LIBMSRDECL _MSRSemaphoreDelete(MSRSEMAPHORE *Semaphore)
+{
+    sem_destroy(Semaphore);
+}
+
+void LIBMSRDECL _MSRSemaphorePost(MSRSEMAPHORE *Semaphore)
+{
+    sem_post(Semaphore);
+}
+
+void LIBMSRDECL _MSRSemaphoreWait(MSRSEMAPHORE *Semaphore)
+{
+    while (sem_wait(Semaphore) < 0 && errno == EINTR) {
+    }
+}
+
+ULONGLONG LIBMSRDECL _MSRGetWallTime(void)
+{
+    struct timespec Ts;
+
+    clock_gettime(CLOCK_REALTIME, &Ts);
+    return (ULONGLONG)Ts.tv_sec * 1000 + Ts.tv_nsec / 1000000;
+}
+
+/*** File mapping ***/
+
+LIBMSRSTATUS LIBMSRDECL _MSRMapOpen(LPTSTR Path, LPTSTR Suffix, MSRFILEMAP *Map)
+{
+    char *FullPath;
+    struct stat St;
+    LIBMSRSTATUS Status;
+
+    FullPath = _MSRAlloc(strlen(Path) + strlen(Suffix) + 1);
+    if (!FullPath) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    strcpy(FullPath, Path);
+    strcat(FullPath, Suffix);
+    Map->Fd = open(FullPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    _MSRFree(FullPath);
+    if (Map->Fd < 0) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    Map->View = NULL;
+    Map->Size = 0;
+    if (fstat(Map->Fd, &St) < 0) {
+        Status = LIBMSR_FILE_IO_FAILED;
+        goto fail1;
+    }
+    if (St.st_size > 0) {
+        Map->View = mmap(NULL, (SIZE_T)St.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, Map->Fd, 0);
+        if (Map->View == MAP_FAILED) {
+            Map->View = NULL;
+            Status = LIBMSR_FILE_IO_FAILED;
+            goto fail1;
+        }
+        Map->Size = (SIZE_T)St.st_size;
+    }
+    return LIBMSR_OK;
+
+fail1:
+    close(Map->Fd);
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRMapResize(MSRFILEMAP *Map, SIZE_T Size)
+{
+    BYTE *View = NULL;
+
+    /* The old view stays in place until the new one is up, so a failed resize leaves the map usable */
+    if (Size > Map->Size) {
+        /* Allocate the blocks now: a full disk is an error here, not a SIGBUS on a later store */
+        if (posix_fallocate(Map->Fd, 0, (off_t)Size) != 0) {
+            return LIBMSR_FILE_IO_FAILED;
+        }
+    }
+    else if (ftruncate(Map->Fd, (off_t)Size) < 0) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    if (Size > 0) {
+        View = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Map->Fd, 0);
+        if (View == MAP_FAILED) {
+            return LIBMSR_FILE_IO_FAILED;
+        }
+    }
+    if (Map->View) {
+        munmap(Map->View, Map->Size);
+    }
+    Map->View = View;
+    Map->Size = Size;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRMapFlush(MSRFILEMAP *Map, SIZE_T Offset, SIZE_T Length, BOOL Wait)
+{
+    SIZE_T PageMask = (SIZE_T)sysconf(_SC_PAGESIZE) - 1;
+    SIZE_T Start = Offset & ~PageMask;
+
+    if (!Map->View || Length == 0) {
+        return LIBMSR_OK;
+    }
+    if (msync(Map->View + Start, Offset + Length - Start, Wait ? MS_SYNC : MS_ASYNC) < 0) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    return LIBMSR_OK;
+}
+
+void LIBMSRDECL _MSRMapClose(MSRFILEMAP *Map, SIZE_T FinalSize)
+{
+    if (Map->View) {
+        munmap(Map->View, Map->Size);
+    }
+    if (ftruncate(Map->Fd, (off_t)FinalSize) < 0) {
+        /* The file keeps its slack; the committed extent in its header still bounds the contents */
+    }
+    close(Map->Fd);
+}
+
+#endif /* !_WIN32 */
@@ -0,0 +1,291 @@
+#ifdef _WIN32
+
+#include "libmsr.h"
+#include "internals.h"
+
+MSRTIME LIBMSRDECL _MSRGetTime(void)
+{
+    static LARGE_INTEGER Frequency;
+    LARGE_INTEGER Counter;
+
+    if (!Frequency.QuadPart) {
+        QueryPerformanceFrequency(&Frequency);
+    }
+    QueryPerformanceCounter(&Counter);
+    return (MSRTIME)(Counter.QuadPart / (Frequency.QuadPart / 1000));
+}
+
+ULONGLONG LIBMSRDECL _MSRGetTimeUs(void)
+{
+    static LARGE_INTEGER Frequency;
+    LARGE_INTEGER Counter;
+
+    if (!Frequency.QuadPart) {
+        QueryPerformanceFrequency(&Frequency);
+    }
+    QueryPerformanceCounter(&Counter);
+    /* Split to keep the multiplication from overflowing */
+    return (ULONGLONG)(Counter.QuadPart / Frequency.QuadPart) * 1000000 +
+        (ULONGLONG)(Counter.QuadPart % Frequency.QuadPart) * 1000000 / Frequency.QuadPart;
+}
+
+void LIBMSRDECL _MSRSleep(UINT Milliseconds)
+{
+    Sleep(Milliseconds);
+}
+
+typedef struct {
+    HANDLE Handle;
+    MSRTHREADPROC Proc;
+    void *Arg;
+} MSRTHREADSTART;
+
+static DWORD WINAPI _MSRThreadMain(LPVOID Param)
+{
+    MSRTHREADSTART *Start = (MSRTHREADSTART *)Param;
+
+    Start->Proc(Start->Arg);
+    return 0;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRThreadCreate(MSRTHREADPROC Proc, void *Arg, MSRTHREAD *pThread)
+{
+    MSRTHREADSTART *Start;
+
+    Start = _MSRAlloc(sizeof(*Start));
+    if (!Start) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Start->Proc = Proc;
+    Start->Arg = Arg;
+    Start->Handle = CreateThread(NULL, 0, _MSRThreadMain, Start, 0, NULL);
+    if (!Start->Handle) {
+        _MSRFree(Start);
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    *pThread = Start;
+    return LIBMSR_OK;
+}
+
+void LIBMSRDECL _MSRThreadJoin(MSRTHREAD Thread)
+{
+    MSRTHREADSTART *Start = (MSRTHREADSTART *)Thread;
+
+    WaitForSingleObject(Start->Handle, INFINITE);
+    CloseHandle(Start->Handle);
+    _MSRFree(Start);
+}
+
+void LIBMSRDECL _MSRThreadDetach(MSRTHREAD Thread)
+{
+    MSRTHREADSTART *Start = (MSRTHREADSTART *)Thread;
+
+    CloseHandle(Start->Handle);
+    _MSRFree(Start);
+}
+
+UINT LIBMSRDECL _MSRCpuCount(void)
+{
+    SYSTEM_INFO Info;
+
+    GetSystemInfo(&Info);
+    return Info.dwNumberOfProcessors;
+}
+
+void LIBMSRDECL _MSRLockInit(MSRLOCK *Lock)
+{
+    InitializeCriticalSection(Lock);
+}
+
+void LIBMSRDECL _MSRLockDelete(MSRLOCK *Lock)
+{
+    DeleteCriticalSection(Lock);
+}
+
+void LIBMSRDECL _MSRLock(MSRLOCK *Lock)
+{
+    EnterCriticalSection(Lock);
+}
+
+void LIBMSRDECL _MSRUnlock(MSRLOCK *Lock)
+{
+    LeaveCriticalSection(Lock);
+}
+
+void LIBMSRDECL _MSRCondInit(MSRCOND *Cond)
+{
+    InitializeConditionVariable(Cond);
+}
+
+void LIBMSRDECL _MSRCondDelete(MSRCOND *Cond)
+{
+    /* Nothing to release */
+}
+
+BOOL LIBMSRDECL _MSRCondWait(MSRCOND *Cond, MSRLOCK *Lock, UINT TimeoutMs)
+{
+    return SleepConditionVariableCS(Cond, Lock, TimeoutMs == LIBMSR_INFINITE ? INFINITE : TimeoutMs);
+}
+
+void LIBMSRDECL _MSRCondBroadcast(MSRCOND *Cond)
+{
+    WakeAllConditionVariable(Cond);
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRSemaphoreInit(MSRSEMAPHORE *Semaphore)
+{
+    *Semaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+    return *Semaphore ? LIBMSR_OK : LIBMSR_MEM_ALLOC_FAILED;
+}
+
+void LIBMSRDECL _MSRSemaphoreDelete(MSRSEMAPHORE *Semaphore)
+{
+    CloseHandle(*Semaphore);
+}
+
+void LIBMSRDECL _MSRSemaphorePost(MSRSEMAPHORE *Semaphore)
+{
+    ReleaseSemaphore(*Semaphore, 1, NULL);
+}
+
+void LIBMSRDECL _MSRSemaphoreWait(MSRSEMAPHORE *Semaphore)
+{
+    WaitForSingleObject(*Semaphore, INFINITE);
+}
+
+ULONGLONG LIBMSRDECL _MSRGetWallTime(void)
+{
+    FILETIME Ft;
+    ULARGE_INTEGER Value;
+
+    GetSystemTimeAsFileTime(&Ft);
+    Value.LowPart = Ft.dwLowDateTime;
+    Value.HighPart = Ft.dwHighDateTime;
+    /* 100 ns units since 1601 */
+    return (Value.QuadPart - 116444736000000000ULL) / 10000;
+}
+
+/*** File mapping ***/
+
+static LIBMSRSTATUS _MSRMapView(MSRFILEMAP *Map, SIZE_T Size)
+{
+    Map->Mapping = CreateFileMapping(Map->File, NULL, PAGE_READWRITE,
+        (DWORD)((ULONGLONG)Size >> 32), (DWORD)Size, NULL);
+    if (!Map->Mapping) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    Map->View = (BYTE *)MapViewOfFile(Map->Mapping, FILE_MAP_WRITE, 0, 0, Size);
+    if (!Map->View) {
+        CloseHandle(Map->Mapping);
+        Map->Mapping = NULL;
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    Map->Size = Size;
+    return LIBMSR_OK;
+}
+
+static void _MSRUnmapView(MSRFILEMAP *Map)
+{
+    if (Map->View) {
+        UnmapViewOfFile(Map->View);
+        CloseHandle(Map->Mapping);
+        Map->View = NULL;
+        Map->Mapping = NULL;
+        Map->Size = 0;
+    }
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRMapOpen(LPTSTR Path, LPTSTR Suffix, MSRFILEMAP *Map)
+{
+    LPTSTR FullPath;
+    LARGE_INTEGER Size;
+    LIBMSRSTATUS Status;
+
+    FullPath = _MSRAlloc((lstrlen(Path) + lstrlen(Suffix) + 1) * sizeof(TCHAR));
+    if (!FullPath) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    lstrcpy(FullPath, Path);
+    lstrcat(FullPath, Suffix);
+    Map->File = CreateFile(FullPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    _MSRFree(FullPath);
+    if (Map->File == INVALID_HANDLE_VALUE) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    Map->Mapping = NULL;
+    Map->View = NULL;
+    Map->Size = 0;
+    if (!GetFileSizeEx(Map->File, &Size)) {
+        Status = LIBMSR_FILE_IO_FAILED;
+        goto fail1;
+    }
+    if (Size.QuadPart > 0) {
+        Status = _MSRMapView(Map, (SIZE_T)Size.QuadPart);
+        if (Status < 0) {
+            goto fail1;
+        }
+    }
+    return LIBMSR_OK;
+
+fail1:
+    CloseHandle(Map->File);
+    return Status;
+}
+
+static BOOL _MSRSetFileSize(HANDLE File, SIZE_T Size)
+{
+    LARGE_INTEGER Position;
+
+    Position.QuadPart = Size;
+    return SetFilePointerEx(File, Position, NULL, FILE_BEGIN) && SetEndOfFile(File);
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRMapResize(MSRFILEMAP *Map, SIZE_T Size)
+{
+    MSRFILEMAP Grown;
+    LIBMSRSTATUS Status;
+
+    /* Growing maps the larger file first, so a failure leaves the old view usable */
+    if (Size > Map->Size) {
+        Grown = *Map;
+        Status = _MSRMapView(&Grown, Size);
+        if (Status < 0) {
+            return Status;
+        }
+        _MSRUnmapView(Map);
+        *Map = Grown;
+        return LIBMSR_OK;
+    }
+    /* A mapped file cannot shrink */
+    _MSRUnmapView(Map);
+    if (!_MSRSetFileSize(Map->File, Size)) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    if (Size > 0) {
+        return _MSRMapView(Map, Size);
+    }
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRMapFlush(MSRFILEMAP *Map, SIZE_T Offset, SIZE_T Length, BOOL Wait)
+{
+    if (!Map->View || Length == 0) {
+        return LIBMSR_OK;
+    }
+    if (!FlushViewOfFile(Map->View + Offset, Length)) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    if (Wait && !FlushFileBuffers(Map->File)) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    return LIBMSR_OK;
+}
+
+void LIBMSRDECL _MSRMapClose(MSRFILEMAP *Map, SIZE_T FinalSize)
+{
+    _MSRUnmapView(Map);
+    _MSRSetFileSize(Map->File, FinalSize);
+    CloseHandle(Map->File);
+}
+
+#endif /* _WIN32 */
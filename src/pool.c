@@ -0,0 +1,594 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define MSR_POOL_MAX_EVENTS 64
+
+typedef struct _MSRPOOLDEVICE {
+    LPMSRCONTEXT Context;
+    int Fd;
+    BOOL Failed;
+    /* Requests waiting to be sent */
+    LIBMSRREQUEST *QueueHead;
+    LIBMSRREQUEST *QueueTail;
+    /* Request waiting for its response */
+    LIBMSRREQUEST *Active;
+    MSRPARSER Parser;
+    /* When the active request was sent, until its first byte arrives */
+    ULONGLONG SentAt;
+    /* When the active request times out, or 0 for never */
+    MSRTIME Deadline;
+    struct _MSRPOOLDEVICE *Next;
+} MSRPOOLDEVICE, *LPMSRPOOLDEVICE;
+
+typedef struct {
+    int EpollFd;
+    /* Readable while completed requests are waiting to be collected */
+    int EventFd;
+    LPMSRPOOLDEVICE Devices;
+    LIBMSRREQUEST *CompletedHead;
+    LIBMSRREQUEST *CompletedTail;
+    /* First failure to set or clear EventFd, reported by MSRPoolWait */
+    LIBMSRSTATUS EventStatus;
+} MSRPOOL, *LPMSRPOOL;
+
+/* Set or clear the completion event. EAGAIN only means there was nothing to clear. */
+static void _MSRPoolSignal(LPMSRPOOL Pool, BOOL Set)
+{
+    uint64_t Value = 1;
+    ssize_t Result;
+
+    do {
+        Result = Set ? write(Pool->EventFd, &Value, sizeof(Value)) : read(Pool->EventFd, &Value, sizeof(Value));
+    } while (Result < 0 && errno == EINTR);
+    if (Result < 0 && errno != EAGAIN && Pool->EventStatus == LIBMSR_OK) {
+        Pool->EventStatus = Set ? LIBMSR_PORT_WRITE_FAILED : LIBMSR_PORT_READ_FAILED;
+    }
+}
+
+/* Every pooled request ends here, so the handle's bookkeeping sees all of them */
+static void _MSRPoolComplete(LPMSRPOOL Pool, LPMSRPOOLDEVICE Device, LIBMSRREQUEST *Request, LIBMSRSTATUS Status)
+{
+    _MSRRequestCompleted(Device->Context, Request, Status);
+    Request->Status = Status;
+    Request->Next = NULL;
+    Request->Owner = NULL;
+    if (Pool->CompletedTail) {
+        Pool->CompletedTail->Next = Request;
+    }
+    else {
+        Pool->CompletedHead = Request;
+        _MSRPoolSignal(Pool, TRUE);
+    }
+    Pool->CompletedTail = Request;
+}
+
+static LIBMSRREQUEST *_MSRPoolTakeCompleted(LPMSRPOOL Pool)
+{
+    LIBMSRREQUEST *Request = Pool->CompletedHead;
+
+    Pool->CompletedHead = Request->Next;
+    if (!Pool->CompletedHead) {
+        Pool->CompletedTail = NULL;
+        _MSRPoolSignal(Pool, FALSE);
+    }
+    Request->Next = NULL;
+    return Request;
+}
+
+/* Send queued requests until one is waiting for a response or the queue is empty. */
+static void _MSRPoolStartNext(LPMSRPOOL Pool, LPMSRPOOLDEVICE Device)
+{
+    BYTE CommandBuffer[MSR_MAX_COMMAND_LENGTH];
+    SIZE_T CommandLength;
+    LIBMSRSTATUS Status;
+    LIBMSRREQUEST *Request;
+    UINT TotalMs;
+
+    while (!Device->Active && Device->QueueHead) {
+        Request = Device->QueueHead;
+        Device->QueueHead = Request->Next;
+        if (!Device->QueueHead) {
+            Device->QueueTail = NULL;
+        }
+
+        if (Device->Failed) {
+            _MSRPoolComplete(Pool, Device, Request, LIBMSR_PORT_READ_FAILED);
+            continue;
+        }
+
+        Status = _MSRRequestBuild(Request, CommandBuffer, &CommandLength);
+        if (Status < 0) {
+            _MSRPoolComplete(Pool, Device, Request, Status);
+            continue;
+        }
+        _MSRParserInit(&Device->Parser, Request);
+        _MSRPurge(Device->Context);
+        _MSRStatsCommand(Device->Context, CommandBuffer);
+        Device->SentAt = _MSRGetTimeUs();
+        Status = _MSRSend(Device->Context, CommandBuffer, CommandLength);
+        if (Status < 0) {
+            _MSRPoolComplete(Pool, Device, Request, Status);
+            continue;
+        }
+        if (Device->Parser.Core.Kind == MSR_RESPONSE_NONE) {
+            _MSRPoolComplete(Pool, Device, Request, LIBMSR_OK);
+            continue;
+        }
+        TotalMs = _MSRTakeCallTimeout(Device->Context, _MSRRequestWaitsForSwipe(Request->Type));
+        Device->Deadline = TotalMs ? _MSRGetTime() + TotalMs : 0;
+        Device->Active = Request;
+    }
+}
+
+/* Complete the active request early; the device is reset so it stops waiting for a
+ * swipe, and the line is drained so nothing it sent leaks into the next request.
+ */
+static void _MSRPoolAbort(LPMSRPOOL Pool, LPMSRPOOLDEVICE Device, LIBMSRSTATUS Status)
+{
+    static const BYTE ResetCommand[2] = { ESC, 0x61 };
+    LIBMSRREQUEST *Request = Device->Active;
+
+    Device->Active = NULL;
+    if (!Device->Failed) {
+        _MSRSend(Device->Context, ResetCommand, sizeof(ResetCommand));
+        _MSRDrain(Device->Context);
+    }
+    memset(&Device->Context->Config, 0, sizeof(Device->Context->Config));
+    _MSRPoolComplete(Pool, Device, Request, Status);
+    _MSRPoolStartNext(Pool, Device);
+}
+
+/* Time out active requests past their deadline, as the blocking calls do.
+ * Returns the milliseconds until the next deadline, or -1 if there is none.
+ */
+static int _MSRPoolExpire(LPMSRPOOL Pool)
+{
+    LPMSRPOOLDEVICE Device;
+    MSRTIME Now = _MSRGetTime();
+    MSRTIME Next = 0;
+
+    for (Device = Pool->Devices; Device; Device = Device->Next) {
+        if (Device->Active && Device->Deadline && Device->Deadline <= Now) {
+            _MSRPoolAbort(Pool, Device, LIBMSR_TIMEOUT);
+        }
+        /* The next request may have started with a deadline of its own */
+        if (Device->Active && Device->Deadline && (!Next || Device->Deadline < Next)) {
+            Next = Device->Deadline;
+        }
+    }
+    if (!Next) {
+        return -1;
+    }
+    return Next > Now ? (int)(Next - Now) : 0;
+}
+
+static void _MSRPoolFail(LPMSRPOOL Pool, LPMSRPOOLDEVICE Device, LIBMSRSTATUS Status)
+{
+    Device->Failed = TRUE;
+    epoll_ctl(Pool->EpollFd, EPOLL_CTL_DEL, Device->Fd, NULL);
+    if (Device->Active) {
+        _MSRPoolComplete(Pool, Device, Device->Active, Status);
+        Device->Active = NULL;
+    }
+    _MSRPoolStartNext(Pool, Device);
+}
+
+static void _MSRPoolReadable(LPMSRPOOL Pool, LPMSRPOOLDEVICE Device)
+{
+    LPMSRCONTEXT Context = Device->Context;
+    LIBMSRSTATUS Status;
+    SIZE_T Consumed;
+
+    /* Level-triggered: one read per wakeup never blocks, and leftovers wake us again */
+    if (Context->RecvHead == Context->RecvTail) {
+        Status = _MSRRecvFill(Context);
+        if (Status < 0) {
+            _MSRPoolFail(Pool, Device, Status);
+            return;
+        }
+    }
+
+    if (!Device->Active) {
+        /* Nobody is listening; stale bytes are dropped like a purge would */
+        Context->RecvHead = Context->RecvTail;
+        return;
+    }
+
+    if (Device->SentAt) {
+        _MSRStatsLatency(_MSRRequestWaitsForSwipe(Device->Active->Type) ? &Context->Stats.SwipeWait : &Context->Stats.RoundTrip,
+            Device->SentAt);
+        Device->SentAt = 0;
+    }
+    Status = _MSRParserFeed(&Device->Parser,
+        Context->RecvBuffer + Context->RecvHead, Context->RecvTail - Context->RecvHead, &Consumed);
+    Context->RecvHead += Consumed;
+    if (Status == LIBMSR_PENDING) {
+        return;
+    }
+    _MSRPoolComplete(Pool, Device, Device->Active, Status);
+    Device->Active = NULL;
+    _MSRPoolStartNext(Pool, Device);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolCreate(LIBMSRPOOL *pPool)
+{
+    LIBMSRSTATUS Status;
+    LPMSRPOOL Pool;
+    struct epoll_event Event;
+
+    Pool = _MSRAlloc(sizeof(*Pool));
+    if (!Pool) {
+        Status = LIBMSR_MEM_ALLOC_FAILED;
+        goto fail0;
+    }
+    Pool->EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (Pool->EpollFd < 0) {
+        Status = LIBMSR_NOT_SUPPORTED;
+        goto fail1;
+    }
+    Pool->EventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (Pool->EventFd < 0) {
+        Status = LIBMSR_NOT_SUPPORTED;
+        goto fail2;
+    }
+    /* A NULL device pointer marks the completion event */
+    Event.events = EPOLLIN;
+    Event.data.ptr = NULL;
+    if (epoll_ctl(Pool->EpollFd, EPOLL_CTL_ADD, Pool->EventFd, &Event) < 0) {
+        Status = LIBMSR_NOT_SUPPORTED;
+        goto fail3;
+    }
+    *pPool = (LIBMSRPOOL)Pool;
+    return LIBMSR_OK;
+
+fail3:
+    close(Pool->EventFd);
+
+fail2:
+    close(Pool->EpollFd);
+
+fail1:
+    _MSRFree(Pool);
+
+fail0:
+    return Status;
+}
+
+void LIBMSRAPI MSRPoolDestroy(LIBMSRPOOL PoolHandle)
+{
+    LPMSRPOOL Pool = (LPMSRPOOL)PoolHandle;
+    LPMSRPOOLDEVICE Device;
+
+    while (Pool->Devices) {
+        Device = Pool->Devices;
+        Pool->Devices = Device->Next;
+        Device->Context->PoolDevice = NULL;
+        _MSRFree(Device);
+    }
+    close(Pool->EventFd);
+    close(Pool->EpollFd);
+    _MSRFree(Pool);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolAdd(LIBMSRPOOL PoolHandle, LIBMSRHANDLE Handle)
+{
+    LPMSRPOOL Pool = (LPMSRPOOL)PoolHandle;
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    LPMSRPOOLDEVICE Device;
+    struct epoll_event Event;
+
+    if (Context->PoolDevice || Context->IoThread || !Context->Transport->GetFd) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+
+    Device = _MSRAlloc(sizeof(*Device));
+    if (!Device) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Device->Context = Context;
+    Device->Fd = Context->Transport->GetFd(Context->Port);
+
+    Event.events = EPOLLIN;
+    Event.data.ptr = Device;
+    if (epoll_ctl(Pool->EpollFd, EPOLL_CTL_ADD, Device->Fd, &Event) < 0) {
+        _MSRFree(Device);
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+
+    Device->Next = Pool->Devices;
+    Pool->Devices = Device;
+    Context->PoolDevice = Device;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolOpen(LIBMSRPOOL Pool, LPTSTR PortName, LIBMSRHANDLE *pHandle)
+{
+    LIBMSRSTATUS Status;
+    LIBMSRHANDLE Handle;
+
+    Status = MSROpen(PortName, &Handle);
+    if (Status < 0) {
+        return Status;
+    }
+    Status = MSRPoolAdd(Pool, Handle);
+    if (Status < 0) {
+        MSRClose(Handle);
+        return Status;
+    }
+    *pHandle = Handle;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolRemove(LIBMSRPOOL PoolHandle, LIBMSRHANDLE Handle)
+{
+    LPMSRPOOL Pool = (LPMSRPOOL)PoolHandle;
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    LPMSRPOOLDEVICE Device = Context->PoolDevice;
+    LPMSRPOOLDEVICE *pLink;
+
+    if (!Device) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    if (Device->Active || Device->QueueHead) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    for (pLink = &Pool->Devices; *pLink; pLink = &(*pLink)->Next) {
+        if (*pLink == Device) {
+            *pLink = Device->Next;
+            break;
+        }
+    }
+    if (!Device->Failed) {
+        epoll_ctl(Pool->EpollFd, EPOLL_CTL_DEL, Device->Fd, NULL);
+    }
+    Context->PoolDevice = NULL;
+    _MSRFree(Device);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolSubmit(LIBMSRPOOL PoolHandle, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest)
+{
+    LPMSRPOOL Pool = (LPMSRPOOL)PoolHandle;
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    LPMSRPOOLDEVICE Device = Context->PoolDevice;
+
+    if (!Device) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+
+    pRequest->Status = LIBMSR_PENDING;
+    pRequest->Next = NULL;
+    pRequest->Owner = Device;
+    if (Device->QueueTail) {
+        Device->QueueTail->Next = pRequest;
+    }
+    else {
+        Device->QueueHead = pRequest;
+    }
+    Device->QueueTail = pRequest;
+
+    _MSRPoolStartNext(Pool, Device);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolWait(LIBMSRPOOL PoolHandle, int TimeoutMs, LIBMSRREQUEST **ppRequest)
+{
+    LPMSRPOOL Pool = (LPMSRPOOL)PoolHandle;
+    struct epoll_event Events[MSR_POOL_MAX_EVENTS];
+    MSRTIME Deadline = TimeoutMs >= 0 ? _MSRGetTime() + TimeoutMs : 0;
+    BOOL Polled = FALSE;
+    int Timeout;
+    int Expiry;
+    LIBMSRSTATUS Status;
+    int Count;
+    int i;
+
+    for (;;) {
+        if (Pool->EventStatus < 0) {
+            Status = Pool->EventStatus;
+            Pool->EventStatus = LIBMSR_OK;
+            *ppRequest = NULL;
+            return Status;
+        }
+        while (Pool->CompletedHead) {
+            LIBMSRREQUEST *Request = _MSRPoolTakeCompleted(Pool);
+
+            if (Request->Callback) {
+                Request->Callback(Request);
+                continue;
+            }
+            *ppRequest = Request;
+            return LIBMSR_OK;
+        }
+
+        Expiry = _MSRPoolExpire(Pool);
+        if (Pool->CompletedHead) {
+            continue;
+        }
+        Timeout = TimeoutMs;
+        if (TimeoutMs >= 0) {
+            MSRTIME Now = _MSRGetTime();
+
+            if (Polled && Now >= Deadline) {
+                *ppRequest = NULL;
+                return LIBMSR_OK;
+            }
+            Timeout = Now < Deadline ? (int)(Deadline - Now) : 0;
+        }
+        /* Wake up in time for the nearest request deadline */
+        if (Expiry >= 0 && (Timeout < 0 || Expiry < Timeout)) {
+            Timeout = Expiry;
+        }
+        Count = epoll_wait(Pool->EpollFd, Events, MSR_POOL_MAX_EVENTS, Timeout);
+        Polled = TRUE;
+        if (Count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return LIBMSR_PORT_READ_FAILED;
+        }
+        for (i = 0; i < Count; ++i) {
+            if (Events[i].data.ptr) {
+                _MSRPoolReadable(Pool, (LPMSRPOOLDEVICE)Events[i].data.ptr);
+            }
+        }
+    }
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolGetFd(LIBMSRPOOL PoolHandle, int *pFd)
+{
+    LPMSRPOOL Pool = (LPMSRPOOL)PoolHandle;
+
+    *pFd = Pool->EpollFd;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolCancel(LIBMSRPOOL PoolHandle, LIBMSRREQUEST *pRequest)
+{
+    LPMSRPOOL Pool = (LPMSRPOOL)PoolHandle;
+    LPMSRPOOLDEVICE Device = (LPMSRPOOLDEVICE)pRequest->Owner;
+    LIBMSRREQUEST **pLink;
+    LIBMSRREQUEST *Prev;
+
+    if (!Device || pRequest->Status != LIBMSR_PENDING) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+
+    if (Device->Active == pRequest) {
+        _MSRPoolAbort(Pool, Device, LIBMSR_CANCELLED);
+        return LIBMSR_OK;
+    }
+
+    Prev = NULL;
+    for (pLink = &Device->QueueHead; *pLink; pLink = &(*pLink)->Next) {
+        if (*pLink == pRequest) {
+            *pLink = pRequest->Next;
+            if (Device->QueueTail == pRequest) {
+                Device->QueueTail = Prev;
+            }
+            _MSRPoolComplete(Pool, Device, pRequest, LIBMSR_CANCELLED);
+            return LIBMSR_OK;
+        }
+        Prev = *pLink;
+    }
+    return LIBMSR_INVALID_ARGUMENT;
+}
+
+#else /* _WIN32 */
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolCreate(LIBMSRPOOL *pPool)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+void LIBMSRAPI MSRPoolDestroy(LIBMSRPOOL Pool)
+{
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolAdd(LIBMSRPOOL Pool, LIBMSRHANDLE Handle)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolOpen(LIBMSRPOOL Pool, LPTSTR PortName, LIBMSRHANDLE *pHandle)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolRemove(LIBMSRPOOL Pool, LIBMSRHANDLE Handle)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolSubmit(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolWait(LIBMSRPOOL Pool, int TimeoutMs, LIBMSRREQUEST **ppRequest)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolGetFd(LIBMSRPOOL Pool, int *pFd)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRPoolCancel(LIBMSRPOOL Pool, LIBMSRREQUEST *pRequest)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+#endif /* _WIN32 */
+
+static void LIBMSRDECL _MSRPrepareTrackRequest(LIBMSRREQUEST *pRequest, UINT Type,
+    BYTE *pTrack1Buffer, SIZE_T Track1Size,
+    BYTE *pTrack2Buffer, SIZE_T Track2Size,
+    BYTE *pTrack3Buffer, SIZE_T Track3Size,
+    LIBMSRCOMPLETION Callback, void *UserData)
+{
+    memset(pRequest, 0, sizeof(*pRequest));
+    pRequest->Type = Type;
+    pRequest->TrackBuffers[0] = pTrack1Buffer;
+    pRequest->TrackBuffers[1] = pTrack2Buffer;
+    pRequest->TrackBuffers[2] = pTrack3Buffer;
+    if (Type == LIBMSR_REQ_WRITE_RAW) {
+        pRequest->TrackLengths[0] = Track1Size;
+        pRequest->TrackLengths[1] = Track2Size;
+        pRequest->TrackLengths[2] = Track3Size;
+    }
+    else {
+        pRequest->TrackCapacities[0] = Track1Size;
+        pRequest->TrackCapacities[1] = Track2Size;
+        pRequest->TrackCapacities[2] = Track3Size;
+    }
+    pRequest->Callback = Callback;
+    pRequest->UserData = UserData;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRCardReadRawAsync(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest,
+    BYTE *pTrack1Buffer, SIZE_T Track1Capacity,
+    BYTE *pTrack2Buffer, SIZE_T Track2Capacity,
+    BYTE *pTrack3Buffer, SIZE_T Track3Capacity,
+    LIBMSRCOMPLETION Callback, void *UserData)
+{
+    _MSRPrepareTrackRequest(pRequest, LIBMSR_REQ_READ_RAW,
+        pTrack1Buffer, Track1Capacity, pTrack2Buffer, Track2Capacity, pTrack3Buffer, Track3Capacity,
+        Callback, UserData);
+    return MSRPoolSubmit(Pool, Handle, pRequest);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRCardReadISOAsync(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest,
+    BYTE *pTrack1Buffer, SIZE_T Track1Capacity,
+    BYTE *pTrack2Buffer, SIZE_T Track2Capacity,
+    BYTE *pTrack3Buffer, SIZE_T Track3Capacity,
+    LIBMSRCOMPLETION Callback, void *UserData)
+{
+    _MSRPrepareTrackRequest(pRequest, LIBMSR_REQ_READ_ISO,
+        pTrack1Buffer, Track1Capacity, pTrack2Buffer, Track2Capacity, pTrack3Buffer, Track3Capacity,
+        Callback, UserData);
+    return MSRPoolSubmit(Pool, Handle, pRequest);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRCardWriteRawAsync(LIBMSRPOOL Pool, LIBMSRHANDLE Handle, LIBMSRREQUEST *pRequest,
+    BYTE *pTrack1Buffer, SIZE_T Track1Length,
+    BYTE *pTrack2Buffer, SIZE_T Track2Length,
+    BYTE *pTrack3Buffer, SIZE_T Track3Length,
+    LIBMSRCOMPLETION Callback, void *UserData)
+{
+    _MSRPrepareTrackRequest(pRequest, LIBMSR_REQ_WRITE_RAW,
+        pTrack1Buffer, Track1Length, pTrack2Buffer, Track2Length, pTrack3Buffer, Track3Length,
+        Callback, UserData);
+    return MSRPoolSubmit(Pool, Handle, pRequest);
+}
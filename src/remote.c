@@ -0,0 +1,517 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Swipe events kept for MSRRemoteWaitSwipe; older ones are dropped beyond this */
+#define MSR_REMOTE_MAX_EVENTS 64
+
+typedef struct _MSRREMOTEEVENT {
+    MSRMESSAGE Message;
+    BYTE Data[MSR_MESSAGE_MAX_DATA];
+    struct _MSRREMOTEEVENT *Next;
+} MSRREMOTEEVENT, *LPMSRREMOTEEVENT;
+
+typedef struct _MSRREMOTE {
+    int Fd;
+    UINT NextId;
+    /* Swipe events not collected yet, oldest first */
+    LPMSRREMOTEEVENT Head;
+    LPMSRREMOTEEVENT Tail;
+    UINT EventCount;
+} MSRREMOTE, *LPMSRREMOTE;
+
+/*** Transport ***/
+
+/* Remote handles never reach the transport for I/O; requests go to _MSRRemoteExecute */
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteRead(void *Port, BYTE *Buffer, SIZE_T Count, UINT TimeoutMs, SIZE_T *pBytesRead)
+{
+    (void)Port;
+    (void)Buffer;
+    (void)Count;
+    (void)TimeoutMs;
+    (void)pBytesRead;
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteWrite(void *Port, const BYTE *Buffer, SIZE_T Count, SIZE_T *pBytesWritten)
+{
+    (void)Port;
+    (void)Buffer;
+    (void)Count;
+    (void)pBytesWritten;
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRemotePurge(void *Port)
+{
+    (void)Port;
+    return LIBMSR_OK;
+}
+
+static void LIBMSRDECL _MSRRemoteClose(void *Port)
+{
+    LPMSRREMOTE Remote = (LPMSRREMOTE)Port;
+    LPMSRREMOTEEVENT Event;
+
+    while (Remote->Head) {
+        Event = Remote->Head;
+        Remote->Head = Event->Next;
+        _MSRFree(Event);
+    }
+    close(Remote->Fd);
+    _MSRFree(Remote);
+}
+
+static const LIBMSRTRANSPORT _MSRRemoteTransport = {
+    _MSRRemoteRead,
+    _MSRRemoteWrite,
+    _MSRRemotePurge,
+    _MSRRemoteClose,
+    NULL,
+};
+
+/*** Messages ***/
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteSend(LPMSRREMOTE Remote, const BYTE *Buffer, SIZE_T Count)
+{
+    ssize_t Sent;
+
+    while (Count > 0) {
+        Sent = send(Remote->Fd, Buffer, Count, MSG_NOSIGNAL);
+        if (Sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return LIBMSR_PORT_WRITE_FAILED;
+        }
+        Buffer += Sent;
+        Count -= Sent;
+    }
+    return LIBMSR_OK;
+}
+
+/* Receive exactly Count bytes, giving up at Deadline (0 waits forever) */
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteRecv(LPMSRREMOTE Remote, BYTE *Buffer, SIZE_T Count, MSRTIME Deadline)
+{
+    struct pollfd PollFd;
+    MSRTIME Now;
+    ssize_t Received;
+    int Timeout;
+    int Ready;
+
+    while (Count > 0) {
+        Timeout = -1;
+        if (Deadline) {
+            Now = _MSRGetTime();
+            Timeout = Now < Deadline ? (int)(Deadline - Now) : 0;
+        }
+        PollFd.fd = Remote->Fd;
+        PollFd.events = POLLIN;
+        Ready = poll(&PollFd, 1, Timeout);
+        if (Ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return LIBMSR_PORT_READ_FAILED;
+        }
+        if (Ready == 0) {
+            return LIBMSR_TIMEOUT;
+        }
+        Received = recv(Remote->Fd, Buffer, Count, 0);
+        if (Received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return LIBMSR_PORT_READ_FAILED;
+        }
+        if (Received == 0) {
+            /* The server went away */
+            return LIBMSR_PORT_READ_FAILED;
+        }
+        Buffer += Received;
+        Count -= Received;
+    }
+    return LIBMSR_OK;
+}
+
+/* Receive one message. Only the header waits for the deadline; the data is already on its way. */
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteRecvMessage(LPMSRREMOTE Remote, MSRMESSAGE *Message, BYTE *Data, MSRTIME Deadline)
+{
+    LIBMSRSTATUS Status;
+
+    Status = _MSRRemoteRecv(Remote, (BYTE *)Message, sizeof(*Message), Deadline);
+    if (Status < 0) {
+        return Status;
+    }
+    if (Message->Length > MSR_MESSAGE_MAX_DATA) {
+        return LIBMSR_PORT_READ_FAILED;
+    }
+    return _MSRRemoteRecv(Remote, Data, Message->Length, 0);
+}
+
+static void LIBMSRDECL _MSRRemoteQueueEvent(LPMSRREMOTE Remote, const MSRMESSAGE *Message, const BYTE *Data)
+{
+    LPMSRREMOTEEVENT Event;
+
+    if (Remote->EventCount == MSR_REMOTE_MAX_EVENTS) {
+        Event = Remote->Head;
+        Remote->Head = Event->Next;
+        Remote->EventCount--;
+    }
+    else {
+        Event = _MSRAlloc(sizeof(*Event));
+        if (!Event) {
+            return;
+        }
+    }
+    Event->Message = *Message;
+    memcpy(Event->Data, Data, Message->Length);
+    Event->Next = NULL;
+    if (Remote->Head) {
+        Remote->Tail->Next = Event;
+    }
+    else {
+        Remote->Head = Event;
+    }
+    Remote->Tail = Event;
+    Remote->EventCount++;
+}
+
+/* Wait for the result of message Id. Swipe events met on the way are queued;
+ * results of messages given up on earlier are dropped.
+ */
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteWaitResult(LPMSRREMOTE Remote, UINT Id, MSRMESSAGE *Message, BYTE *Data, MSRTIME Deadline)
+{
+    LIBMSRSTATUS Status;
+
+    for (;;) {
+        Status = _MSRRemoteRecvMessage(Remote, Message, Data, Deadline);
+        if (Status < 0) {
+            return Status;
+        }
+        if (Message->Type == MSR_MSG_SWIPE) {
+            _MSRRemoteQueueEvent(Remote, Message, Data);
+        }
+        else if (Message->Type == MSR_MSG_RESULT && Message->Id == Id) {
+            return LIBMSR_OK;
+        }
+    }
+}
+
+/* Send a message and wait for its result */
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteCall(LPMSRREMOTE Remote, MSRMESSAGE *Message, const BYTE *Data)
+{
+    BYTE Buffer[sizeof(MSRMESSAGE) + LIBMSR_MAX_PORT_NAME];
+    BYTE Reply[MSR_MESSAGE_MAX_DATA];
+    LIBMSRSTATUS Status;
+
+    Message->Id = Remote->NextId++;
+    memcpy(Buffer, Message, sizeof(*Message));
+    if (Message->Length) {
+        memcpy(Buffer + sizeof(*Message), Data, Message->Length);
+    }
+    Status = _MSRRemoteSend(Remote, Buffer, sizeof(*Message) + Message->Length);
+    if (Status >= 0) {
+        Status = _MSRRemoteWaitResult(Remote, Message->Id, Message, Reply, 0);
+    }
+    if (Status >= 0) {
+        Status = Message->Status;
+    }
+    return Status;
+}
+
+/* Fill the track buffers of a read from message data, as a local read would */
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteCopyTracks(LIBMSRREQUEST *Request, const MSRMESSAGE *Message, const BYTE *Data)
+{
+    LIBMSRSTATUS Status = Message->Status;
+    SIZE_T Capacity;
+    SIZE_T Length;
+    BOOL IsIso = Message->RequestType == LIBMSR_REQ_READ_ISO;
+    UINT Track;
+
+    for (Track = 0; Track < 3; ++Track) {
+        Length = Message->TrackLengths[Track];
+        Request->TrackLengths[Track] = 0;
+        if (Request->TrackBuffers[Track]) {
+            Capacity = Request->TrackCapacities[Track];
+            if (IsIso && Capacity > 0) {
+                Capacity--;
+            }
+            if (Length > Capacity) {
+                Request->TrackLengths[Track] = Capacity;
+                if (Status >= 0) {
+                    Status = LIBMSR_BUFFER_TOO_SMALL;
+                }
+            }
+            else {
+                Request->TrackLengths[Track] = Length;
+            }
+            memcpy(Request->TrackBuffers[Track], Data, Request->TrackLengths[Track]);
+            if (IsIso && Request->TrackCapacities[Track] > 0) {
+                Request->TrackBuffers[Track][Request->TrackLengths[Track]] = 0x00;
+            }
+        }
+        Data += Length;
+    }
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRRemoteExecute(LPMSRCONTEXT Context, LIBMSRREQUEST Requests[], UINT Count)
+{
+    LPMSRREMOTE Remote = Context->Remote;
+    BYTE Data[MSR_MESSAGE_MAX_DATA];
+    MSRMESSAGE Message;
+    LIBMSRSTATUS Status = LIBMSR_OK;
+    LIBMSRSTATUS Result;
+    MSRTIME Deadline = 0;
+    BYTE *Buffer;
+    SIZE_T Length = 0;
+    SIZE_T Capacity;
+    UINT FirstId = Remote->NextId;
+    UINT TotalMs;
+    UINT Track;
+    UINT i;
+
+    Buffer = _MSRAlloc(Count * (sizeof(Message) + MSR_MESSAGE_MAX_DATA));
+    if (!Buffer) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+
+    /* Everything goes out in one write, and the server takes it in one read */
+    for (i = 0; i < Count; ++i) {
+        memset(&Message, 0, sizeof(Message));
+        Message.Type = MSR_MSG_REQUEST;
+        Message.Id = FirstId + i;
+        Message.RequestType = (BYTE)Requests[i].Type;
+        memcpy(Message.Params, Requests[i].Params, sizeof(Requests[i].Params));
+        for (Track = 0; Track < 3; ++Track) {
+            if (Requests[i].Type == LIBMSR_REQ_WRITE_RAW) {
+                if (Requests[i].TrackLengths[Track] > 255) {
+                    Status = LIBMSR_INVALID_ARGUMENT;
+                    goto done;
+                }
+                Message.TrackLengths[Track] = (unsigned short)Requests[i].TrackLengths[Track];
+                memcpy(Buffer + Length + sizeof(Message) + Message.Length, Requests[i].TrackBuffers[Track], Message.TrackLengths[Track]);
+                Message.Length += Message.TrackLengths[Track];
+            }
+            else if (Requests[i].TrackBuffers[Track]) {
+                /* At least 1, since 0 means the track is not wanted; a full track fits in LIBMSR_MAX_TRACK_LENGTH + 1 */
+                Capacity = Requests[i].TrackCapacities[Track];
+                Message.TrackLengths[Track] = (unsigned short)(Capacity < 1 ? 1 : Capacity > LIBMSR_MAX_TRACK_LENGTH ? LIBMSR_MAX_TRACK_LENGTH + 1 : Capacity);
+            }
+        }
+        memcpy(Buffer + Length, &Message, sizeof(Message));
+        Length += sizeof(Message) + Message.Length;
+    }
+    Remote->NextId += Count;
+    Status = _MSRRemoteSend(Remote, Buffer, Length);
+    if (Status < 0) {
+        goto done;
+    }
+
+    /* The server has its own command timeouts; only a wait for a swipe is bounded here */
+    if (_MSRRequestWaitsForSwipe(Requests[0].Type)) {
+        TotalMs = _MSRTakeCallTimeout(Context, TRUE);
+        Deadline = TotalMs ? _MSRGetTime() + TotalMs : 0;
+    }
+
+    for (i = 0; i < Count; ++i) {
+        Result = _MSRRemoteWaitResult(Remote, FirstId + i, &Message, Data, Deadline);
+        if (Result == LIBMSR_TIMEOUT) {
+            /* Nobody swiped; have the server give up on the rest */
+            memset(&Message, 0, sizeof(Message));
+            Message.Type = MSR_MSG_CANCEL;
+            for (; i < Count; ++i) {
+                Message.Id = FirstId + i;
+                _MSRRemoteSend(Remote, (BYTE *)&Message, sizeof(Message));
+                _MSRRequestCompleted(Context, &Requests[i], LIBMSR_TIMEOUT);
+            }
+            if (Status >= 0) {
+                Status = LIBMSR_TIMEOUT;
+            }
+            break;
+        }
+        if (Result >= 0) {
+            memcpy(Requests[i].Reply, Message.Params, sizeof(Requests[i].Reply));
+            Result = Message.Status;
+            if (Requests[i].Type == LIBMSR_REQ_READ_ISO || Requests[i].Type == LIBMSR_REQ_READ_RAW) {
+                Result = _MSRRemoteCopyTracks(&Requests[i], &Message, Data);
+            }
+        }
+        _MSRRequestCompleted(Context, &Requests[i], Result);
+        if (Status >= 0 && Result < 0) {
+            Status = Result;
+        }
+    }
+
+    /* Other clients may change the settings at any time; getters still read the values just fetched */
+    Context->Config.Valid = 0;
+    memset(Context->Config.BitsPerInch, 0, sizeof(Context->Config.BitsPerInch));
+
+done:
+    _MSRFree(Buffer);
+    return Status;
+}
+
+/*** Remote handle API ***/
+
+LIBMSRSTATUS LIBMSRAPI MSROpenRemote(LPTSTR SocketPath, LPTSTR PortName, LIBMSRHANDLE *pHandle)
+{
+    struct sockaddr_un Address;
+    LPMSRREMOTE Remote;
+    LPMSRCONTEXT Context;
+    MSRMESSAGE Message;
+    LIBMSRSTATUS Status;
+    SIZE_T NameLength = PortName ? strlen(PortName) : 0;
+
+    if (strlen(SocketPath) >= sizeof(Address.sun_path) || NameLength >= LIBMSR_MAX_PORT_NAME) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    memset(&Address, 0, sizeof(Address));
+    Address.sun_family = AF_UNIX;
+    strcpy(Address.sun_path, SocketPath);
+
+    Remote = _MSRAlloc(sizeof(*Remote));
+    if (!Remote) {
+        Status = LIBMSR_MEM_ALLOC_FAILED;
+        goto fail0;
+    }
+    Remote->NextId = 1;
+    Remote->Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Remote->Fd < 0) {
+        Status = LIBMSR_PORT_OPEN_FAILED;
+        goto fail1;
+    }
+    if (connect(Remote->Fd, (struct sockaddr *)&Address, sizeof(Address)) < 0) {
+        Status = LIBMSR_PORT_OPEN_FAILED;
+        goto fail2;
+    }
+
+    memset(&Message, 0, sizeof(Message));
+    Message.Type = MSR_MSG_OPEN;
+    Message.Length = (UINT)NameLength;
+    Status = _MSRRemoteCall(Remote, &Message, (const BYTE *)PortName);
+    if (Status < 0) {
+        goto fail2;
+    }
+
+    Status = MSROpenTransport(&_MSRRemoteTransport, Remote, pHandle);
+    if (Status < 0) {
+        goto fail2;
+    }
+    Context = (LPMSRCONTEXT)*pHandle;
+    Context->Remote = Remote;
+    return LIBMSR_OK;
+
+fail2:
+    close(Remote->Fd);
+
+fail1:
+    _MSRFree(Remote);
+
+fail0:
+    return Status;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteSubscribe(LPMSRCONTEXT Context, void *Arg)
+{
+    MSRMESSAGE Message;
+
+    memset(&Message, 0, sizeof(Message));
+    Message.Type = MSR_MSG_SUBSCRIBE;
+    Message.Params[0] = (BYTE)*(UINT *)Arg;
+    return _MSRRemoteCall(Context->Remote, &Message, NULL);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRRemoteSubscribe(LIBMSRHANDLE Handle, UINT Flags)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+
+    if (!Context->Remote) {
+        return LIBMSR_NOT_SUPPORTED;
+    }
+    return _MSRCall(Context, _MSRRemoteSubscribe, &Flags);
+}
+
+typedef struct {
+    LIBMSRREQUEST *Event;
+    UINT TimeoutMs;
+} MSRREMOTEWAIT;
+
+static LIBMSRSTATUS LIBMSRDECL _MSRRemoteWaitSwipe(LPMSRCONTEXT Context, void *Arg)
+{
+    MSRREMOTEWAIT *Wait = (MSRREMOTEWAIT *)Arg;
+    LPMSRREMOTE Remote = Context->Remote;
+    LPMSRREMOTEEVENT Event;
+    MSRMESSAGE Message;
+    BYTE Data[MSR_MESSAGE_MAX_DATA];
+    LIBMSRSTATUS Status;
+    MSRTIME Deadline;
+
+    /* A zero deadline would wait forever */
+    Deadline = Wait->TimeoutMs == LIBMSR_INFINITE ? 0 : _MSRGetTime() + Wait->TimeoutMs + (Wait->TimeoutMs == 0);
+    while (!Remote->Head) {
+        Status = _MSRRemoteRecvMessage(Remote, &Message, Data, Deadline);
+        if (Status < 0) {
+            return Status;
+        }
+        /* Nothing is outstanding, so any result here is a stale one */
+        if (Message.Type == MSR_MSG_SWIPE) {
+            _MSRRemoteQueueEvent(Remote, &Message, Data);
+        }
+    }
+
+    Event = Remote->Head;
+    Remote->Head = Event->Next;
+    Remote->EventCount--;
+    Wait->Event->Type = Event->Message.RequestType;
+    Wait->Event->Status = _MSRRemoteCopyTracks(Wait->Event, &Event->Message, Event->Data);
+    _MSRFree(Event);
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRRemoteWaitSwipe(LIBMSRHANDLE Handle, LIBMSRREQUEST *pEvent, UINT TimeoutMs)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    MSRREMOTEWAIT Wait;
+
+    if (!Context->Remote) {
+        return LIBMSR_NOT_SUPPORTED;
+    }
+    Wait.Event = pEvent;
+    Wait.TimeoutMs = TimeoutMs;
+    return _MSRCall(Context, _MSRRemoteWaitSwipe, &Wait);
+}
+
+#else /* _WIN32 */
+
+LIBMSRSTATUS LIBMSRDECL _MSRRemoteExecute(LPMSRCONTEXT Context, LIBMSRREQUEST Requests[], UINT Count)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSROpenRemote(LPTSTR SocketPath, LPTSTR PortName, LIBMSRHANDLE *pHandle)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRRemoteSubscribe(LIBMSRHANDLE Handle, UINT Flags)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRRemoteWaitSwipe(LIBMSRHANDLE Handle, LIBMSRREQUEST *pEvent, UINT TimeoutMs)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,162 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+static const BYTE DensitySetting[] = { 0xA0, 0xA1, 0x4B, 0xD2, 0xC0, 0xC1 };
+
+static BYTE *_MSRRequestPutTrack(BYTE *Ptr, BYTE TrackId, const BYTE *Buffer, SIZE_T Length)
+{
+    *Ptr++ = ESC;
+    *Ptr++ = TrackId;
+    *Ptr++ = (BYTE)Length;
+    if (Length > 0) {
+        memcpy(Ptr, Buffer, Length);
+        Ptr += Length;
+    }
+    return Ptr;
+}
+
+/* Encode the command bytes for a request; Buffer must hold MSR_MAX_COMMAND_LENGTH bytes. */
+LIBMSRSTATUS LIBMSRDECL _MSRRequestBuild(const LIBMSRREQUEST *Request, BYTE *Buffer, SIZE_T *pLength)
+{
+    BYTE *Ptr = Buffer;
+    UINT Track;
+
+    *Ptr++ = ESC;
+    switch (Request->Type) {
+    case LIBMSR_REQ_RESET:
+        *Ptr++ = 0x61;
+        break;
+    case LIBMSR_REQ_TEST_COMMS:
+        *Ptr++ = 0x65;
+        break;
+    case LIBMSR_REQ_LED:
+        if (Request->Params[0] < 0x81 || Request->Params[0] > 0x85) {
+            return LIBMSR_INVALID_ARGUMENT;
+        }
+        *Ptr++ = Request->Params[0];
+        break;
+    case LIBMSR_REQ_SET_COERCIVITY:
+        *Ptr++ = Request->Params[0] ? 0x78 : 0x79;
+        break;
+    case LIBMSR_REQ_GET_COERCIVITY:
+        *Ptr++ = 0x64;
+        break;
+    case LIBMSR_REQ_SET_LEADING_ZEROS:
+        *Ptr++ = 0x7A;
+        *Ptr++ = Request->Params[0];
+        *Ptr++ = Request->Params[1];
+        break;
+    case LIBMSR_REQ_GET_LEADING_ZEROS:
+        *Ptr++ = 0x6C;
+        break;
+    case LIBMSR_REQ_SET_DENSITY:
+        if (Request->Params[0] < 1 || Request->Params[0] > 3) {
+            return LIBMSR_INVALID_ARGUMENT;
+        }
+        *Ptr++ = 0x62;
+        *Ptr++ = DensitySetting[((Request->Params[0] - 1) << 1) + !!Request->Params[1]];
+        break;
+    case LIBMSR_REQ_SET_BPC:
+        *Ptr++ = 0x6F;
+        *Ptr++ = Request->Params[0];
+        *Ptr++ = Request->Params[1];
+        *Ptr++ = Request->Params[2];
+        break;
+    case LIBMSR_REQ_ERASE:
+        if (!(Request->Params[0] & 7)) {
+            return LIBMSR_INVALID_ARGUMENT;
+        }
+        *Ptr++ = 0x63;
+        *Ptr++ = Request->Params[0] & 7;
+        break;
+    case LIBMSR_REQ_READ_ISO:
+        *Ptr++ = 0x72;
+        break;
+    case LIBMSR_REQ_READ_RAW:
+        *Ptr++ = 0x6D;
+        break;
+    case LIBMSR_REQ_WRITE_RAW:
+        *Ptr++ = 0x6E;
+        *Ptr++ = ESC;
+        *Ptr++ = 0x73;
+        for (Track = 0; Track < 3; ++Track) {
+            if (Request->TrackLengths[Track] > 255) {
+                return LIBMSR_INVALID_ARGUMENT;
+            }
+            Ptr = _MSRRequestPutTrack(Ptr, (BYTE)(Track + 1), Request->TrackBuffers[Track], Request->TrackLengths[Track]);
+        }
+        *Ptr++ = 0x3F;
+        *Ptr++ = FS;
+        break;
+    case LIBMSR_REQ_GET_MODEL:
+        *Ptr++ = 0x74;
+        break;
+    default:
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    *pLength = Ptr - Buffer;
+    return LIBMSR_OK;
+}
+
+/* What the device sends back for a request; for replies, how many bytes follow the ESC. */
+UINT LIBMSRDECL _MSRRequestResponseKind(UINT Type, UINT *pReplyLength)
+{
+    *pReplyLength = 0;
+    switch (Type) {
+    case LIBMSR_REQ_RESET:
+    case LIBMSR_REQ_LED:
+        return MSR_RESPONSE_NONE;
+    case LIBMSR_REQ_READ_ISO:
+        return MSR_RESPONSE_TRACKS_ISO;
+    case LIBMSR_REQ_READ_RAW:
+        return MSR_RESPONSE_TRACKS_RAW;
+    case LIBMSR_REQ_GET_LEADING_ZEROS:
+    case LIBMSR_REQ_GET_MODEL:
+        *pReplyLength = 2;
+        return MSR_RESPONSE_REPLY;
+    case LIBMSR_REQ_SET_BPC:
+        /* 30 b1 b2 b3 */
+        *pReplyLength = 4;
+        return MSR_RESPONSE_REPLY;
+    default:
+        *pReplyLength = 1;
+        return MSR_RESPONSE_REPLY;
+    }
+}
+
+/* Card commands wait for a swipe before the device answers. */
+BOOL LIBMSRDECL _MSRRequestWaitsForSwipe(UINT Type)
+{
+    switch (Type) {
+    case LIBMSR_REQ_READ_ISO:
+    case LIBMSR_REQ_READ_RAW:
+    case LIBMSR_REQ_WRITE_RAW:
+    case LIBMSR_REQ_ERASE:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* Interpret the reply bytes collected for a completed request. */
+LIBMSRSTATUS LIBMSRDECL _MSRRequestCheckReply(UINT Type, const BYTE *Reply)
+{
+    switch (Type) {
+    case LIBMSR_REQ_TEST_COMMS:
+        return Reply[0] == 0x79 ? LIBMSR_OK : LIBMSR_DEVICE_COMMAND_FAILED;
+    case LIBMSR_REQ_GET_COERCIVITY:
+        if (Reply[0] != 'H' && Reply[0] != 'L') {
+            return LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
+        }
+        return LIBMSR_OK;
+    case LIBMSR_REQ_GET_LEADING_ZEROS:
+        return LIBMSR_OK;
+    case LIBMSR_REQ_GET_MODEL:
+        /* Model character, then 'S' */
+        return Reply[1] == 'S' ? LIBMSR_OK : LIBMSR_DEVICE_UNEXPECTED_RESPONSE;
+    default:
+        return Reply[0] == 0x30 ? LIBMSR_OK : LIBMSR_DEVICE_COMMAND_FAILED;
+    }
+}
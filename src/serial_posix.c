@@ -0,0 +1,236 @@
+#ifndef _WIN32
+
+#define _DEFAULT_SOURCE
+
+#include "libmsr.h"
+#include "internals.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+typedef struct {
+    int Fd;
+    struct termios SavedSettings;
+} MSRSERIALPORT, *LPMSRSERIALPORT;
+
+static LIBMSRSTATUS LIBMSRDECL _MSRSerialRead(void *Port, BYTE *Buffer, SIZE_T Count, UINT TimeoutMs, SIZE_T *pBytesRead)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+    ssize_t BytesRead;
+    struct pollfd PollFd;
+    int Ready;
+
+    if (TimeoutMs != LIBMSR_INFINITE) {
+        PollFd.fd = SerialPort->Fd;
+        PollFd.events = POLLIN;
+        do {
+            Ready = poll(&PollFd, 1, (int)TimeoutMs);
+        } while (Ready < 0 && errno == EINTR);
+        if (Ready < 0) {
+            return LIBMSR_PORT_READ_FAILED;
+        }
+        if (Ready == 0) {
+            return LIBMSR_TIMEOUT;
+        }
+    }
+
+    do {
+        BytesRead = read(SerialPort->Fd, Buffer, Count);
+    } while (BytesRead < 0 && errno == EINTR);
+    if (BytesRead < 0) {
+        return LIBMSR_PORT_READ_FAILED;
+    }
+    *pBytesRead = (SIZE_T)BytesRead;
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRSerialWrite(void *Port, const BYTE *Buffer, SIZE_T Count, SIZE_T *pBytesWritten)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+    ssize_t BytesWritten;
+
+    do {
+        BytesWritten = write(SerialPort->Fd, Buffer, Count);
+    } while (BytesWritten < 0 && errno == EINTR);
+    if (BytesWritten < 0) {
+        return LIBMSR_PORT_WRITE_FAILED;
+    }
+    *pBytesWritten = (SIZE_T)BytesWritten;
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRSerialPurge(void *Port)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+
+    tcflush(SerialPort->Fd, TCIOFLUSH);
+    return LIBMSR_OK;
+}
+
+static void LIBMSRDECL _MSRSerialClose(void *Port)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+
+    tcsetattr(SerialPort->Fd, TCSANOW, &SerialPort->SavedSettings);
+    close(SerialPort->Fd);
+    _MSRFree(SerialPort);
+}
+
+static int LIBMSRDECL _MSRSerialGetFd(void *Port)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+
+    return SerialPort->Fd;
+}
+
+static const LIBMSRTRANSPORT _MSRSerialTransport = {
+    _MSRSerialRead,
+    _MSRSerialWrite,
+    _MSRSerialPurge,
+    _MSRSerialClose,
+    _MSRSerialGetFd,
+};
+
+/* Ask the driver to deliver received bytes immediately rather than batching them.
+ * Not all drivers (notably ptys) support this, so failures are ignored.
+ */
+static void _MSRSerialSetLowLatency(int Fd)
+{
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct Serial;
+
+    if (ioctl(Fd, TIOCGSERIAL, &Serial) == 0) {
+        Serial.flags |= ASYNC_LOW_LATENCY;
+        ioctl(Fd, TIOCSSERIAL, &Serial);
+    }
+#else
+    (void)Fd;
+#endif
+}
+
+LIBMSRSTATUS LIBMSRDECL _MSRSerialOpen(LPTSTR PortName, const LIBMSRTRANSPORT **pTransport, void **pPort)
+{
+    LIBMSRSTATUS Status;
+    LPMSRSERIALPORT SerialPort;
+    struct termios Settings;
+
+    SerialPort = _MSRAlloc(sizeof(*SerialPort));
+    if (!SerialPort) {
+        Status = LIBMSR_MEM_ALLOC_FAILED;
+        goto fail0;
+    }
+
+    /* Without O_NONBLOCK, opening a port with no carrier can block until one shows up */
+    SerialPort->Fd = open(PortName, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (SerialPort->Fd < 0) {
+        Status = LIBMSR_PORT_OPEN_FAILED;
+        goto fail1;
+    }
+
+    /* Match the Win32 backend, which opens the port with no sharing. */
+#ifdef TIOCEXCL
+    ioctl(SerialPort->Fd, TIOCEXCL);
+#endif
+
+    if (tcgetattr(SerialPort->Fd, &SerialPort->SavedSettings) < 0) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail2;
+    }
+
+    /* NOTE: All MSRxxx devices seem to use 9600, 8N1*/
+    Settings = SerialPort->SavedSettings;
+    cfmakeraw(&Settings);
+    Settings.c_cflag &= ~(CSTOPB | PARENB | CSIZE);
+#ifdef CRTSCTS
+    Settings.c_cflag &= ~CRTSCTS;
+#endif
+    Settings.c_cflag |= CS8 | CLOCAL | CREAD;
+    /* Block until at least one byte is available, then return what is there. */
+    Settings.c_cc[VMIN] = 1;
+    Settings.c_cc[VTIME] = 0;
+    if (cfsetispeed(&Settings, B9600) < 0 || cfsetospeed(&Settings, B9600) < 0) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail2;
+    }
+    if (tcsetattr(SerialPort->Fd, TCSANOW, &Settings) < 0) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail2;
+    }
+
+    /* CLOCAL is set now, so blocking I/O no longer waits for a carrier */
+    fcntl(SerialPort->Fd, F_SETFL, fcntl(SerialPort->Fd, F_GETFL) & ~O_NONBLOCK);
+    _MSRSerialSetLowLatency(SerialPort->Fd);
+
+    *pTransport = &_MSRSerialTransport;
+    *pPort = SerialPort;
+    return LIBMSR_OK;
+
+fail2:
+    close(SerialPort->Fd);
+
+fail1:
+    _MSRFree(SerialPort);
+
+fail0:
+    return Status;
+}
+
+/* Names of USB adapters and on-board UARTs on Linux, the BSDs and macOS */
+static const char *const _MSRSerialPrefixes[] = {
+    "ttyUSB", "ttyACM", "ttyS", "ttyAMA", "ttyU", "cuaU", "cu.usbserial", "cu.usbmodem", NULL,
+};
+
+#define MSR_SERIAL_DIR "/dev"
+
+LIBMSRSTATUS LIBMSRDECL _MSRSerialEnumerate(MSRPORTPROC Proc, void *Context)
+{
+    char Path[LIBMSR_MAX_PORT_NAME];
+    const char *const *Prefix;
+    struct dirent *Entry;
+    DIR *Dir;
+
+    Dir = opendir(MSR_SERIAL_DIR);
+    if (!Dir) {
+        return LIBMSR_FILE_IO_FAILED;
+    }
+    while ((Entry = readdir(Dir)) != NULL) {
+        for (Prefix = _MSRSerialPrefixes; *Prefix; ++Prefix) {
+            if (!strncmp(Entry->d_name, *Prefix, strlen(*Prefix))) {
+                break;
+            }
+        }
+        if (*Prefix && snprintf(Path, sizeof(Path), MSR_SERIAL_DIR "/%s", Entry->d_name) < (int)sizeof(Path)) {
+            Proc(Context, Path);
+        }
+    }
+    closedir(Dir);
+    return LIBMSR_OK;
+}
+
+/* Adding or removing a device node touches the directory */
+ULONGLONG LIBMSRDECL _MSRSerialPortsStamp(void)
+{
+    struct stat St;
+
+    if (stat(MSR_SERIAL_DIR, &St) < 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (ULONGLONG)St.st_mtimespec.tv_sec * 1000000000 + St.st_mtimespec.tv_nsec + 1;
+#else
+    return (ULONGLONG)St.st_mtim.tv_sec * 1000000000 + St.st_mtim.tv_nsec + 1;
+#endif
+}
+
+#endif /* !_WIN32 */
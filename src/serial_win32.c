@@ -0,0 +1,200 @@
+#ifdef _WIN32
+
+#include "libmsr.h"
+#include "internals.h"
+
+typedef struct {
+    HANDLE PortHandle;
+    DCB PortSettings;
+    /* Read timeout currently programmed into the port */
+    UINT ReadTimeout;
+} MSRSERIALPORT, *LPMSRSERIALPORT;
+
+/* Make ReadFile return as soon as at least one byte is available,
+ * or fail with no data after TimeoutMs.
+ */
+static BOOL _MSRSerialSetReadTimeout(LPMSRSERIALPORT SerialPort, UINT TimeoutMs)
+{
+    COMMTIMEOUTS Timeouts;
+
+    if (TimeoutMs == 0) {
+        /* Return immediately with whatever is buffered */
+        Timeouts.ReadIntervalTimeout = MAXDWORD;
+        Timeouts.ReadTotalTimeoutMultiplier = 0;
+        Timeouts.ReadTotalTimeoutConstant = 0;
+    }
+    else {
+        Timeouts.ReadIntervalTimeout = MAXDWORD;
+        Timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+        Timeouts.ReadTotalTimeoutConstant = TimeoutMs < MAXDWORD - 1 ? TimeoutMs : MAXDWORD - 1;
+    }
+    Timeouts.WriteTotalTimeoutMultiplier = 0;
+    Timeouts.WriteTotalTimeoutConstant = 0;
+    if (!SetCommTimeouts(SerialPort->PortHandle, &Timeouts)) {
+        return FALSE;
+    }
+    SerialPort->ReadTimeout = TimeoutMs;
+    return TRUE;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRSerialRead(void *Port, BYTE *Buffer, SIZE_T Count, UINT TimeoutMs, SIZE_T *pBytesRead)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+    DWORD BytesRead;
+
+    if (TimeoutMs != SerialPort->ReadTimeout && !_MSRSerialSetReadTimeout(SerialPort, TimeoutMs)) {
+        return LIBMSR_PORT_READ_FAILED;
+    }
+    if (!ReadFile(SerialPort->PortHandle, Buffer, (DWORD)Count, &BytesRead, NULL)) {
+        return LIBMSR_PORT_READ_FAILED;
+    }
+    if (BytesRead == 0) {
+        return LIBMSR_TIMEOUT;
+    }
+    *pBytesRead = BytesRead;
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRSerialWrite(void *Port, const BYTE *Buffer, SIZE_T Count, SIZE_T *pBytesWritten)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+    DWORD BytesWritten;
+
+    if (!WriteFile(SerialPort->PortHandle, Buffer, (DWORD)Count, &BytesWritten, NULL)) {
+        return LIBMSR_PORT_WRITE_FAILED;
+    }
+    *pBytesWritten = BytesWritten;
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRSerialPurge(void *Port)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+
+    PurgeComm(SerialPort->PortHandle, PURGE_RXCLEAR | PURGE_TXCLEAR);
+    return LIBMSR_OK;
+}
+
+static void LIBMSRDECL _MSRSerialClose(void *Port)
+{
+    LPMSRSERIALPORT SerialPort = (LPMSRSERIALPORT)Port;
+
+    CloseHandle(SerialPort->PortHandle);
+    _MSRFree(SerialPort);
+}
+
+static const LIBMSRTRANSPORT _MSRSerialTransport = {
+    _MSRSerialRead,
+    _MSRSerialWrite,
+    _MSRSerialPurge,
+    _MSRSerialClose,
+    NULL,
+};
+
+LIBMSRSTATUS LIBMSRDECL _MSRSerialOpen(LPTSTR PortName, const LIBMSRTRANSPORT **pTransport, void **pPort)
+{
+    LIBMSRSTATUS Status;
+    LPMSRSERIALPORT SerialPort;
+
+    SerialPort = _MSRAlloc(sizeof(*SerialPort));
+    if (!SerialPort) {
+        Status = LIBMSR_MEM_ALLOC_FAILED;
+        goto fail0;
+    }
+
+    SerialPort->PortHandle = CreateFile(
+        PortName,
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        NULL,
+        OPEN_EXISTING,
+        0,
+        NULL);
+    if (SerialPort->PortHandle == INVALID_HANDLE_VALUE) {
+        Status = LIBMSR_PORT_OPEN_FAILED;
+        goto fail1;
+    }
+
+    SerialPort->PortSettings.DCBlength = sizeof(DCB);
+    if (!GetCommState(SerialPort->PortHandle, &SerialPort->PortSettings)) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail2;
+    }
+
+    /* NOTE: All MSRxxx devices seem to use 9600, 8N1*/
+    SerialPort->PortSettings.BaudRate = CBR_9600;
+    SerialPort->PortSettings.fParity = FALSE;
+    SerialPort->PortSettings.ByteSize = 8;
+    SerialPort->PortSettings.Parity = NOPARITY;
+    SerialPort->PortSettings.StopBits = ONESTOPBIT;
+    if (!SetCommState(SerialPort->PortHandle, &SerialPort->PortSettings)) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail2;
+    }
+
+    if (!SetupComm(SerialPort->PortHandle, 1024, 1024)) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail2;
+    }
+
+    if (!_MSRSerialSetReadTimeout(SerialPort, LIBMSR_INFINITE)) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail2;
+    }
+
+    *pTransport = &_MSRSerialTransport;
+    *pPort = SerialPort;
+    return LIBMSR_OK;
+
+fail2:
+    CloseHandle(SerialPort->PortHandle);
+
+fail1:
+    _MSRFree(SerialPort);
+
+fail0:
+    return Status;
+}
+
+/* Serial port drivers list their ports under this key, value data being the port name */
+LIBMSRSTATUS LIBMSRDECL _MSRSerialEnumerate(MSRPORTPROC Proc, void *Context)
+{
+    TCHAR ValueName[256];
+    TCHAR PortName[32];
+    TCHAR Path[LIBMSR_MAX_PORT_NAME];
+    DWORD ValueNameLength;
+    DWORD DataLength;
+    DWORD Type;
+    DWORD Index;
+    HKEY Key;
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, TEXT("HARDWARE\\DEVICEMAP\\SERIALCOMM"), 0, KEY_READ, &Key) != ERROR_SUCCESS) {
+        /* No serial ports at all */
+        return LIBMSR_OK;
+    }
+    for (Index = 0;; ++Index) {
+        ValueNameLength = sizeof(ValueName) / sizeof(TCHAR);
+        DataLength = sizeof(PortName) - sizeof(TCHAR);
+        if (RegEnumValue(Key, Index, ValueName, &ValueNameLength, NULL, &Type, (LPBYTE)PortName, &DataLength) != ERROR_SUCCESS) {
+            break;
+        }
+        if (Type != REG_SZ) {
+            continue;
+        }
+        PortName[DataLength / sizeof(TCHAR)] = 0;
+        /* The device namespace form works for COM10 and up too */
+        lstrcpy(Path, TEXT("\\\\.\\"));
+        lstrcat(Path, PortName);
+        Proc(Context, Path);
+    }
+    RegCloseKey(Key);
+    return LIBMSR_OK;
+}
+
+/* No cheap change indicator; the registry is read on every poll */
+ULONGLONG LIBMSRDECL _MSRSerialPortsStamp(void)
+{
+    return 0;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,846 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MSR_SERVER_MAX_EVENTS 64
+#define MSR_SERVER_READ_SIZE 4096
+/* A client that lets this much output pile up is dropped rather than let it grow without bound */
+#define MSR_SERVER_MAX_BACKLOG (1024 * 1024)
+
+struct _MSRSERVERCLIENT;
+struct _MSRSERVERDEVICE;
+
+/* A client waiting for the outcome of a device request */
+typedef struct _MSRSERVERWAITER {
+    struct _MSRSERVERCLIENT *Client;
+    UINT Id;
+    /* Read capacities the client asked for */
+    unsigned short Capacities[3];
+    struct _MSRSERVERWAITER *Next;
+} MSRSERVERWAITER, *LPMSRSERVERWAITER;
+
+typedef struct _MSRSERVERREQUEST {
+    LIBMSRREQUEST Request;
+    struct _MSRSERVERDEVICE *Device;
+    /* Clients to answer; none for a read kept waiting for subscribers */
+    LPMSRSERVERWAITER Waiters;
+    BYTE Tracks[3][LIBMSR_MAX_TRACK_LENGTH];
+    struct _MSRSERVERREQUEST *Next;
+} MSRSERVERREQUEST, *LPMSRSERVERREQUEST;
+
+typedef struct _MSRSERVERDEVICE {
+    TCHAR PortName[LIBMSR_MAX_PORT_NAME];
+    LIBMSRHANDLE Handle;
+    /* Requests in the pool, oldest first; only the newest can be shared */
+    LPMSRSERVERREQUEST Head;
+    LPMSRSERVERREQUEST Tail;
+    /* The read kept waiting for subscribers, while it has no waiters of its own */
+    LPMSRSERVERREQUEST Listen;
+    UINT Listeners;
+    /* The last listening read failed; the device may be gone, so do not retry at once */
+    BOOL ListenFailed;
+    struct _MSRSERVERDEVICE *Next;
+} MSRSERVERDEVICE, *LPMSRSERVERDEVICE;
+
+typedef struct _MSRSERVERCLIENT {
+    int Fd;
+    LPMSRSERVERDEVICE Device;
+    UINT Subscription;
+    BYTE *In;
+    SIZE_T InLength;
+    SIZE_T InCapacity;
+    BYTE *Out;
+    SIZE_T OutLength;
+    SIZE_T OutCapacity;
+    /* Waiting for the socket to take more output */
+    BOOL Blocked;
+    BOOL Closed;
+    struct _MSRSERVERCLIENT *Next;
+} MSRSERVERCLIENT, *LPMSRSERVERCLIENT;
+
+typedef struct {
+    int ListenFd;
+    int EpollFd;
+    int PoolFd;
+    LIBMSRPOOL Pool;
+    /* In the order they were opened */
+    LPMSRSERVERDEVICE Devices;
+    LPMSRSERVERCLIENT Clients;
+    struct sockaddr_un Address;
+} MSRSERVER, *LPMSRSERVER;
+
+/*** Client connections ***/
+
+static BOOL LIBMSRDECL _MSRServerReserve(BYTE **pBuffer, SIZE_T *pCapacity, SIZE_T Needed)
+{
+    SIZE_T Capacity = *pCapacity ? *pCapacity : MSR_SERVER_READ_SIZE;
+    BYTE *Buffer;
+
+    if (Needed <= *pCapacity) {
+        return TRUE;
+    }
+    while (Capacity < Needed) {
+        Capacity *= 2;
+    }
+    Buffer = realloc(*pBuffer, Capacity);
+    if (!Buffer) {
+        return FALSE;
+    }
+    *pBuffer = Buffer;
+    *pCapacity = Capacity;
+    return TRUE;
+}
+
+/* Stop serving a client; it is freed at the end of the round */
+/* A client stopped listening; the last one out cancels the standing read */
+static void LIBMSRDECL _MSRServerUnlisten(LPMSRSERVER Server, LPMSRSERVERDEVICE Device)
+{
+    Device->Listeners--;
+    if (!Device->Listeners && Device->Listen) {
+        MSRPoolCancel(Server->Pool, &Device->Listen->Request);
+        Device->Listen = NULL;
+    }
+}
+
+static void LIBMSRDECL _MSRServerDrop(LPMSRSERVER Server, LPMSRSERVERCLIENT Client)
+{
+    LPMSRSERVERREQUEST Request;
+    LPMSRSERVERWAITER *pLink;
+    LPMSRSERVERWAITER Waiter;
+    LPMSRSERVERDEVICE Device = Client->Device;
+
+    if (Client->Closed) {
+        return;
+    }
+    Client->Closed = TRUE;
+    epoll_ctl(Server->EpollFd, EPOLL_CTL_DEL, Client->Fd, NULL);
+    close(Client->Fd);
+    if (!Device) {
+        return;
+    }
+    if ((Client->Subscription & LIBMSR_SUBSCRIBE_LISTEN) == LIBMSR_SUBSCRIBE_LISTEN) {
+        _MSRServerUnlisten(Server, Device);
+    }
+
+    /* Its requests are of no use to anyone else unless shared */
+    for (Request = Device->Head; Request; Request = Request->Next) {
+        pLink = &Request->Waiters;
+        while (*pLink) {
+            Waiter = *pLink;
+            if (Waiter->Client == Client) {
+                *pLink = Waiter->Next;
+                _MSRFree(Waiter);
+            }
+            else {
+                pLink = &Waiter->Next;
+            }
+        }
+        if (!Request->Waiters && Request != Device->Listen && Request->Request.Status == LIBMSR_PENDING) {
+            MSRPoolCancel(Server->Pool, &Request->Request);
+        }
+    }
+}
+
+/* Queue a message for the client; it goes out at the end of the round with everything else */
+static void LIBMSRDECL _MSRServerPost(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, const MSRMESSAGE *Message, const BYTE *Data)
+{
+    SIZE_T Size = sizeof(*Message) + Message->Length;
+
+    if (Client->Closed) {
+        return;
+    }
+    if (Client->OutLength + Size > MSR_SERVER_MAX_BACKLOG
+        || !_MSRServerReserve(&Client->Out, &Client->OutCapacity, Client->OutLength + Size)) {
+        _MSRServerDrop(Server, Client);
+        return;
+    }
+    memcpy(Client->Out + Client->OutLength, Message, sizeof(*Message));
+    if (Message->Length) {
+        memcpy(Client->Out + Client->OutLength + sizeof(*Message), Data, Message->Length);
+    }
+    Client->OutLength += Size;
+}
+
+static void LIBMSRDECL _MSRServerPostStatus(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, const MSRMESSAGE *For, LIBMSRSTATUS Status)
+{
+    MSRMESSAGE Message;
+
+    memset(&Message, 0, sizeof(Message));
+    Message.Type = MSR_MSG_RESULT;
+    Message.Id = For->Id;
+    Message.RequestType = For->RequestType;
+    Message.Status = Status;
+    _MSRServerPost(Server, Client, &Message, NULL);
+}
+
+/* Post a completed request, with read data cut to the given capacities (NULL for all of it) */
+static void LIBMSRDECL _MSRServerPostTracks(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, MSRMESSAGE *Message,
+    LPMSRSERVERREQUEST Request, const unsigned short *Capacities)
+{
+    BYTE Data[MSR_MESSAGE_MAX_DATA];
+    SIZE_T Length;
+    SIZE_T Capacity;
+    UINT Track;
+
+    Message->Length = 0;
+    memcpy(Message->Params, Request->Request.Reply, sizeof(Message->Params));
+    if (Request->Request.Type == LIBMSR_REQ_READ_RAW || Request->Request.Type == LIBMSR_REQ_READ_ISO) {
+        for (Track = 0; Track < 3; ++Track) {
+            Length = Request->Request.TrackLengths[Track];
+            if (Capacities) {
+                /* As with local reads, ISO text leaves room for its NUL */
+                Capacity = Capacities[Track];
+                if (Request->Request.Type == LIBMSR_REQ_READ_ISO && Capacity > 0) {
+                    Capacity--;
+                }
+                if (!Capacities[Track]) {
+                    Length = 0;
+                }
+                else if (Length > Capacity) {
+                    Length = Capacity;
+                    if (Message->Status >= 0) {
+                        Message->Status = LIBMSR_BUFFER_TOO_SMALL;
+                    }
+                }
+            }
+            memcpy(Data + Message->Length, Request->Tracks[Track], Length);
+            Message->TrackLengths[Track] = (unsigned short)Length;
+            Message->Length += (UINT)Length;
+        }
+    }
+    _MSRServerPost(Server, Client, Message, Data);
+}
+
+/*** Device requests ***/
+
+/* Reads and queries do nothing to the device, so ones that would run back to back can run once */
+static BOOL LIBMSRDECL _MSRServerCanShare(LPMSRSERVERREQUEST Request, const MSRMESSAGE *Message)
+{
+    if (!Request || Request->Request.Status != LIBMSR_PENDING || Request->Request.Type != Message->RequestType) {
+        return FALSE;
+    }
+    switch (Message->RequestType) {
+    case LIBMSR_REQ_TEST_COMMS:
+    case LIBMSR_REQ_GET_COERCIVITY:
+    case LIBMSR_REQ_GET_LEADING_ZEROS:
+    case LIBMSR_REQ_READ_ISO:
+    case LIBMSR_REQ_READ_RAW:
+    case LIBMSR_REQ_GET_MODEL:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRServerSubmit(LPMSRSERVER Server, LPMSRSERVERDEVICE Device, const MSRMESSAGE *Message,
+    const BYTE *Data, LPMSRSERVERREQUEST *pRequest)
+{
+    LPMSRSERVERREQUEST Request;
+    LIBMSRSTATUS Status;
+    UINT Track;
+
+    Request = _MSRAlloc(sizeof(*Request));
+    if (!Request) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Request->Device = Device;
+    Request->Request.Type = Message->RequestType;
+    memcpy(Request->Request.Params, Message->Params, sizeof(Request->Request.Params));
+    Request->Request.UserData = Request;
+    for (Track = 0; Track < 3; ++Track) {
+        Request->Request.TrackBuffers[Track] = Request->Tracks[Track];
+        if (Message->RequestType == LIBMSR_REQ_WRITE_RAW) {
+            memcpy(Request->Tracks[Track], Data, Message->TrackLengths[Track]);
+            Request->Request.TrackLengths[Track] = Message->TrackLengths[Track];
+            Data += Message->TrackLengths[Track];
+        }
+        else {
+            Request->Request.TrackCapacities[Track] = LIBMSR_MAX_TRACK_LENGTH;
+        }
+    }
+
+    Status = MSRPoolSubmit(Server->Pool, Device->Handle, &Request->Request);
+    if (Status < 0) {
+        _MSRFree(Request);
+        return Status;
+    }
+    if (Device->Tail) {
+        Device->Tail->Next = Request;
+    }
+    else {
+        Device->Head = Request;
+    }
+    Device->Tail = Request;
+    *pRequest = Request;
+    return LIBMSR_OK;
+}
+
+static void LIBMSRDECL _MSRServerRequest(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, const MSRMESSAGE *Message, const BYTE *Data)
+{
+    LPMSRSERVERDEVICE Device = Client->Device;
+    LPMSRSERVERREQUEST Request;
+    LPMSRSERVERWAITER Waiter;
+    LIBMSRSTATUS Status;
+    UINT Track;
+    SIZE_T Length = 0;
+
+    if (!Device || Message->RequestType < LIBMSR_REQ_RESET || Message->RequestType > LIBMSR_REQ_GET_MODEL) {
+        _MSRServerPostStatus(Server, Client, Message, LIBMSR_INVALID_ARGUMENT);
+        return;
+    }
+    if (Message->RequestType == LIBMSR_REQ_WRITE_RAW) {
+        for (Track = 0; Track < 3; ++Track) {
+            if (Message->TrackLengths[Track] > 255) {
+                break;
+            }
+            Length += Message->TrackLengths[Track];
+        }
+        if (Track < 3 || Length != Message->Length) {
+            _MSRServerPostStatus(Server, Client, Message, LIBMSR_INVALID_ARGUMENT);
+            return;
+        }
+    }
+
+    Waiter = _MSRAlloc(sizeof(*Waiter));
+    if (!Waiter) {
+        _MSRServerPostStatus(Server, Client, Message, LIBMSR_MEM_ALLOC_FAILED);
+        return;
+    }
+    Waiter->Client = Client;
+    Waiter->Id = Message->Id;
+    memcpy(Waiter->Capacities, Message->TrackLengths, sizeof(Waiter->Capacities));
+
+    Request = Device->Tail;
+    if (!_MSRServerCanShare(Request, Message)) {
+        /* The listening read would hold everything up; a raw read could have shared it */
+        if (Device->Listen) {
+            MSRPoolCancel(Server->Pool, &Device->Listen->Request);
+            Device->Listen = NULL;
+        }
+        Status = _MSRServerSubmit(Server, Device, Message, Data, &Request);
+        if (Status < 0) {
+            _MSRFree(Waiter);
+            _MSRServerPostStatus(Server, Client, Message, Status);
+            return;
+        }
+    }
+    else if (Request == Device->Listen) {
+        /* A client now waits on it; it must not be cancelled */
+        Device->Listen = NULL;
+    }
+    Waiter->Next = Request->Waiters;
+    Request->Waiters = Waiter;
+}
+
+static void LIBMSRDECL _MSRServerCancel(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, UINT Id)
+{
+    LPMSRSERVERDEVICE Device = Client->Device;
+    LPMSRSERVERREQUEST Request;
+    LPMSRSERVERWAITER *pLink;
+    LPMSRSERVERWAITER Waiter;
+
+    if (!Device) {
+        return;
+    }
+    for (Request = Device->Head; Request; Request = Request->Next) {
+        for (pLink = &Request->Waiters; *pLink; pLink = &(*pLink)->Next) {
+            Waiter = *pLink;
+            if (Waiter->Client == Client && Waiter->Id == Id) {
+                *pLink = Waiter->Next;
+                _MSRFree(Waiter);
+                if (!Request->Waiters && Request->Request.Status == LIBMSR_PENDING) {
+                    MSRPoolCancel(Server->Pool, &Request->Request);
+                }
+                return;
+            }
+        }
+    }
+}
+
+static void LIBMSRDECL _MSRServerCompleted(LPMSRSERVER Server, LPMSRSERVERREQUEST Request)
+{
+    LPMSRSERVERDEVICE Device = Request->Device;
+    LPMSRSERVERREQUEST Previous = NULL;
+    LPMSRSERVERWAITER Waiter;
+    LPMSRSERVERCLIENT Client;
+    MSRMESSAGE Message;
+    LIBMSRSTATUS Status = Request->Request.Status;
+
+    /* Completions come in submission order, so this is nearly always the head */
+    if (Device->Head != Request) {
+        for (Previous = Device->Head; Previous->Next != Request; Previous = Previous->Next) {
+        }
+        Previous->Next = Request->Next;
+    }
+    else {
+        Device->Head = Request->Next;
+    }
+    if (Device->Tail == Request) {
+        Device->Tail = Previous;
+    }
+    if (Device->Listen == Request) {
+        Device->Listen = NULL;
+        Device->ListenFailed = Status < 0 && Status != LIBMSR_CANCELLED && Status != LIBMSR_TIMEOUT;
+    }
+    else if (Status >= 0) {
+        Device->ListenFailed = FALSE;
+    }
+
+    memset(&Message, 0, sizeof(Message));
+    Message.Type = MSR_MSG_RESULT;
+    Message.RequestType = (BYTE)Request->Request.Type;
+    while (Request->Waiters) {
+        Waiter = Request->Waiters;
+        Request->Waiters = Waiter->Next;
+        Message.Id = Waiter->Id;
+        Message.Status = Status;
+        _MSRServerPostTracks(Server, Waiter->Client, &Message, Request, Waiter->Capacities);
+        _MSRFree(Waiter);
+    }
+
+    if (Status >= 0 && (Request->Request.Type == LIBMSR_REQ_READ_RAW || Request->Request.Type == LIBMSR_REQ_READ_ISO)) {
+        Message.Type = MSR_MSG_SWIPE;
+        Message.Id = 0;
+        for (Client = Server->Clients; Client; Client = Client->Next) {
+            if (Client->Device == Device && (Client->Subscription & LIBMSR_SUBSCRIBE_SWIPES)) {
+                Message.Status = Status;
+                _MSRServerPostTracks(Server, Client, &Message, Request, NULL);
+            }
+        }
+    }
+    _MSRFree(Request);
+}
+
+/* Keep a read waiting on idle devices with listeners */
+static void LIBMSRDECL _MSRServerListen(LPMSRSERVER Server)
+{
+    LPMSRSERVERDEVICE Device;
+    LPMSRSERVERREQUEST Request;
+    MSRMESSAGE Message;
+
+    memset(&Message, 0, sizeof(Message));
+    Message.RequestType = LIBMSR_REQ_READ_RAW;
+    for (Device = Server->Devices; Device; Device = Device->Next) {
+        if (Device->Listeners && !Device->Head && !Device->ListenFailed
+            && _MSRServerSubmit(Server, Device, &Message, NULL, &Request) >= 0) {
+            Device->Listen = Request;
+        }
+    }
+}
+
+/*** Messages ***/
+
+static void LIBMSRDECL _MSRServerOpenDevice(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, const MSRMESSAGE *Message, const BYTE *Data)
+{
+    LPMSRSERVERDEVICE Device;
+
+    if (Client->Device) {
+        _MSRServerPostStatus(Server, Client, Message, LIBMSR_INVALID_ARGUMENT);
+        return;
+    }
+    for (Device = Server->Devices; Device; Device = Device->Next) {
+        if (!Message->Length
+            || (Message->Length < LIBMSR_MAX_PORT_NAME && !memcmp(Device->PortName, Data, Message->Length) && !Device->PortName[Message->Length])) {
+            break;
+        }
+    }
+    Client->Device = Device;
+    _MSRServerPostStatus(Server, Client, Message, Device ? LIBMSR_OK : LIBMSR_NOT_FOUND);
+}
+
+static void LIBMSRDECL _MSRServerSubscribe(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, const MSRMESSAGE *Message)
+{
+    LPMSRSERVERDEVICE Device = Client->Device;
+    BOOL WasListening = (Client->Subscription & LIBMSR_SUBSCRIBE_LISTEN) == LIBMSR_SUBSCRIBE_LISTEN;
+    BOOL IsListening = (Message->Params[0] & LIBMSR_SUBSCRIBE_LISTEN) == LIBMSR_SUBSCRIBE_LISTEN;
+
+    if (!Device) {
+        _MSRServerPostStatus(Server, Client, Message, LIBMSR_INVALID_ARGUMENT);
+        return;
+    }
+    Client->Subscription = Message->Params[0];
+    if (IsListening && !WasListening) {
+        Device->Listeners++;
+        Device->ListenFailed = FALSE;
+    }
+    else if (WasListening && !IsListening) {
+        _MSRServerUnlisten(Server, Device);
+    }
+    _MSRServerPostStatus(Server, Client, Message, LIBMSR_OK);
+}
+
+static void LIBMSRDECL _MSRServerMessage(LPMSRSERVER Server, LPMSRSERVERCLIENT Client, const MSRMESSAGE *Message, const BYTE *Data)
+{
+    switch (Message->Type) {
+    case MSR_MSG_OPEN:
+        _MSRServerOpenDevice(Server, Client, Message, Data);
+        break;
+    case MSR_MSG_REQUEST:
+        _MSRServerRequest(Server, Client, Message, Data);
+        break;
+    case MSR_MSG_SUBSCRIBE:
+        _MSRServerSubscribe(Server, Client, Message);
+        break;
+    case MSR_MSG_CANCEL:
+        _MSRServerCancel(Server, Client, Message->Id);
+        break;
+    default:
+        _MSRServerDrop(Server, Client);
+        break;
+    }
+}
+
+/* Take in whatever the client has sent and handle every complete message */
+static void LIBMSRDECL _MSRServerReadable(LPMSRSERVER Server, LPMSRSERVERCLIENT Client)
+{
+    MSRMESSAGE Message;
+    SIZE_T Offset = 0;
+    ssize_t Count;
+
+    if (!_MSRServerReserve(&Client->In, &Client->InCapacity, Client->InLength + MSR_SERVER_READ_SIZE)) {
+        _MSRServerDrop(Server, Client);
+        return;
+    }
+    do {
+        Count = recv(Client->Fd, Client->In + Client->InLength, Client->InCapacity - Client->InLength, MSG_DONTWAIT);
+    } while (Count < 0 && errno == EINTR);
+    if (Count <= 0) {
+        if (Count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            _MSRServerDrop(Server, Client);
+        }
+        return;
+    }
+    Client->InLength += Count;
+
+    while (!Client->Closed && Client->InLength - Offset >= sizeof(Message)) {
+        memcpy(&Message, Client->In + Offset, sizeof(Message));
+        if (Message.Length > MSR_MESSAGE_MAX_DATA) {
+            _MSRServerDrop(Server, Client);
+            return;
+        }
+        if (Client->InLength - Offset < sizeof(Message) + Message.Length) {
+            break;
+        }
+        _MSRServerMessage(Server, Client, &Message, Client->In + Offset + sizeof(Message));
+        Offset += sizeof(Message) + Message.Length;
+    }
+    memmove(Client->In, Client->In + Offset, Client->InLength - Offset);
+    Client->InLength -= Offset;
+}
+
+static void LIBMSRDECL _MSRServerFlush(LPMSRSERVER Server, LPMSRSERVERCLIENT Client)
+{
+    struct epoll_event Event;
+    SIZE_T Sent = 0;
+    ssize_t Count;
+    BOOL Blocked;
+
+    while (Sent < Client->OutLength) {
+        Count = send(Client->Fd, Client->Out + Sent, Client->OutLength - Sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (Count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                _MSRServerDrop(Server, Client);
+                return;
+            }
+            break;
+        }
+        Sent += Count;
+    }
+    memmove(Client->Out, Client->Out + Sent, Client->OutLength - Sent);
+    Client->OutLength -= Sent;
+
+    /* Only ask to hear about writability while there is something to write */
+    Blocked = Client->OutLength > 0;
+    if (Blocked != Client->Blocked) {
+        Event.events = EPOLLIN | (Blocked ? EPOLLOUT : 0);
+        Event.data.ptr = Client;
+        epoll_ctl(Server->EpollFd, EPOLL_CTL_MOD, Client->Fd, &Event);
+        Client->Blocked = Blocked;
+    }
+}
+
+static void LIBMSRDECL _MSRServerAccept(LPMSRSERVER Server)
+{
+    LPMSRSERVERCLIENT Client;
+    struct epoll_event Event;
+    int Fd;
+
+    for (;;) {
+        Fd = accept(Server->ListenFd, NULL, NULL);
+        if (Fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_NONBLOCK);
+        fcntl(Fd, F_SETFD, FD_CLOEXEC);
+        Client = _MSRAlloc(sizeof(*Client));
+        if (!Client) {
+            close(Fd);
+            continue;
+        }
+        Client->Fd = Fd;
+        Event.events = EPOLLIN;
+        Event.data.ptr = Client;
+        if (epoll_ctl(Server->EpollFd, EPOLL_CTL_ADD, Fd, &Event) < 0) {
+            close(Fd);
+            _MSRFree(Client);
+            continue;
+        }
+        Client->Next = Server->Clients;
+        Server->Clients = Client;
+    }
+}
+
+static void LIBMSRDECL _MSRServerFreeClient(LPMSRSERVERCLIENT Client)
+{
+    if (Client->In) {
+        free(Client->In);
+    }
+    if (Client->Out) {
+        free(Client->Out);
+    }
+    _MSRFree(Client);
+}
+
+/*** Server API ***/
+
+LIBMSRSTATUS LIBMSRAPI MSRServerCreate(LPTSTR SocketPath, LIBMSRSERVER *pServer)
+{
+    LPMSRSERVER Server;
+    LIBMSRSTATUS Status;
+    struct epoll_event Event;
+    int Probe;
+
+    if (strlen(SocketPath) >= sizeof(Server->Address.sun_path)) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Server = _MSRAlloc(sizeof(*Server));
+    if (!Server) {
+        Status = LIBMSR_MEM_ALLOC_FAILED;
+        goto fail0;
+    }
+    Server->Address.sun_family = AF_UNIX;
+    strcpy(Server->Address.sun_path, SocketPath);
+
+    Status = MSRPoolCreate(&Server->Pool);
+    if (Status < 0) {
+        goto fail1;
+    }
+    MSRPoolGetFd(Server->Pool, &Server->PoolFd);
+
+    /* A socket file nobody answers on is left over from a server that died */
+    Probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Probe >= 0) {
+        if (connect(Probe, (struct sockaddr *)&Server->Address, sizeof(Server->Address)) == 0) {
+            close(Probe);
+            Status = LIBMSR_PORT_OPEN_FAILED;
+            goto fail2;
+        }
+        close(Probe);
+    }
+    unlink(SocketPath);
+
+    Server->ListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (Server->ListenFd < 0) {
+        Status = LIBMSR_PORT_OPEN_FAILED;
+        goto fail2;
+    }
+    if (bind(Server->ListenFd, (struct sockaddr *)&Server->Address, sizeof(Server->Address)) < 0
+        || listen(Server->ListenFd, SOMAXCONN) < 0) {
+        Status = LIBMSR_PORT_OPEN_FAILED;
+        goto fail3;
+    }
+
+    Server->EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (Server->EpollFd < 0) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail4;
+    }
+    Event.events = EPOLLIN;
+    Event.data.ptr = &Server->ListenFd;
+    if (epoll_ctl(Server->EpollFd, EPOLL_CTL_ADD, Server->ListenFd, &Event) < 0) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail5;
+    }
+    Event.data.ptr = &Server->PoolFd;
+    if (epoll_ctl(Server->EpollFd, EPOLL_CTL_ADD, Server->PoolFd, &Event) < 0) {
+        Status = LIBMSR_PORT_SETUP_FAILED;
+        goto fail5;
+    }
+
+    *pServer = (LIBMSRSERVER)Server;
+    return LIBMSR_OK;
+
+fail5:
+    close(Server->EpollFd);
+
+fail4:
+    unlink(SocketPath);
+
+fail3:
+    close(Server->ListenFd);
+
+fail2:
+    MSRPoolDestroy(Server->Pool);
+
+fail1:
+    _MSRFree(Server);
+
+fail0:
+    return Status;
+}
+
+void LIBMSRAPI MSRServerDestroy(LIBMSRSERVER ServerHandle)
+{
+    LPMSRSERVER Server = (LPMSRSERVER)ServerHandle;
+    LPMSRSERVERDEVICE Device;
+    LPMSRSERVERREQUEST Request;
+    LPMSRSERVERWAITER Waiter;
+    LPMSRSERVERCLIENT Client;
+
+    while (Server->Clients) {
+        Client = Server->Clients;
+        Server->Clients = Client->Next;
+        if (!Client->Closed) {
+            close(Client->Fd);
+        }
+        _MSRServerFreeClient(Client);
+    }
+
+    /* The pool lets go of the requests still in it */
+    MSRPoolDestroy(Server->Pool);
+    while (Server->Devices) {
+        Device = Server->Devices;
+        Server->Devices = Device->Next;
+        while (Device->Head) {
+            Request = Device->Head;
+            Device->Head = Request->Next;
+            while (Request->Waiters) {
+                Waiter = Request->Waiters;
+                Request->Waiters = Waiter->Next;
+                _MSRFree(Waiter);
+            }
+            _MSRFree(Request);
+        }
+        MSRClose(Device->Handle);
+        _MSRFree(Device);
+    }
+
+    close(Server->EpollFd);
+    close(Server->ListenFd);
+    unlink(Server->Address.sun_path);
+    _MSRFree(Server);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRServerOpen(LIBMSRSERVER ServerHandle, LPTSTR PortName)
+{
+    LPMSRSERVER Server = (LPMSRSERVER)ServerHandle;
+    LPMSRSERVERDEVICE Device;
+    LPMSRSERVERDEVICE *pLink;
+    LIBMSRSTATUS Status;
+
+    if (strlen(PortName) >= LIBMSR_MAX_PORT_NAME) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    Device = _MSRAlloc(sizeof(*Device));
+    if (!Device) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    strcpy(Device->PortName, PortName);
+    Status = MSRPoolOpen(Server->Pool, PortName, &Device->Handle);
+    if (Status < 0) {
+        _MSRFree(Device);
+        return Status;
+    }
+    for (pLink = &Server->Devices; *pLink; pLink = &(*pLink)->Next) {
+    }
+    *pLink = Device;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRServerRun(LIBMSRSERVER ServerHandle, int TimeoutMs)
+{
+    LPMSRSERVER Server = (LPMSRSERVER)ServerHandle;
+    struct epoll_event Events[MSR_SERVER_MAX_EVENTS];
+    LIBMSRREQUEST *Completed;
+    LPMSRSERVERCLIENT *pLink;
+    LPMSRSERVERCLIENT Client;
+    int Count;
+    int i;
+
+    Count = epoll_wait(Server->EpollFd, Events, MSR_SERVER_MAX_EVENTS, TimeoutMs);
+    if (Count < 0) {
+        return errno == EINTR ? LIBMSR_OK : LIBMSR_PORT_READ_FAILED;
+    }
+
+    /* Everything that came in this round is queued before anything is sent */
+    for (i = 0; i < Count; ++i) {
+        if (Events[i].data.ptr == &Server->ListenFd) {
+            _MSRServerAccept(Server);
+        }
+        else if (Events[i].data.ptr != &Server->PoolFd && (Events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            _MSRServerReadable(Server, (LPMSRSERVERCLIENT)Events[i].data.ptr);
+        }
+    }
+
+    /* Device responses, and requests the messages above finished or cancelled */
+    while (MSRPoolWait(Server->Pool, 0, &Completed) >= 0 && Completed) {
+        _MSRServerCompleted(Server, (LPMSRSERVERREQUEST)Completed->UserData);
+    }
+    _MSRServerListen(Server);
+
+    /* One write per client for all of its results and events */
+    pLink = &Server->Clients;
+    while (*pLink) {
+        Client = *pLink;
+        if (!Client->Closed && Client->OutLength) {
+            _MSRServerFlush(Server, Client);
+        }
+        if (Client->Closed) {
+            *pLink = Client->Next;
+            _MSRServerFreeClient(Client);
+        }
+        else {
+            pLink = &Client->Next;
+        }
+    }
+    return LIBMSR_OK;
+}
+
+#else /* _WIN32 */
+
+LIBMSRSTATUS LIBMSRAPI MSRServerCreate(LPTSTR SocketPath, LIBMSRSERVER *pServer)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+void LIBMSRAPI MSRServerDestroy(LIBMSRSERVER Server)
+{
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRServerOpen(LIBMSRSERVER Server, LPTSTR PortName)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRServerRun(LIBMSRSERVER Server, int TimeoutMs)
+{
+    return LIBMSR_NOT_SUPPORTED;
+}
+
+#endif /* _WIN32 */
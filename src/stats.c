@@ -0,0 +1,56 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+void LIBMSRDECL _MSRStatsLatency(LIBMSRHISTOGRAM *Histogram, ULONGLONG Start)
+{
+    ULONGLONG Us = _MSRGetTimeUs() - Start;
+    ULONGLONG Value = Us;
+    UINT Bucket = 0;
+
+    while (Value >= 2 && Bucket < LIBMSR_STATS_BUCKETS - 1) {
+        Value >>= 1;
+        Bucket++;
+    }
+    Histogram->Buckets[Bucket]++;
+    Histogram->Count++;
+    Histogram->TotalUs += Us;
+    if (Us > Histogram->MaxUs) {
+        Histogram->MaxUs = Us;
+    }
+}
+
+/* Errors are rare, so a short linear search is fine here */
+void LIBMSRDECL _MSRStatsError(LPMSRCONTEXT Context, LIBMSRSTATUS Status)
+{
+    LIBMSRERRORCOUNT *Slot;
+
+    if (Status >= 0) {
+        return;
+    }
+    for (Slot = Context->Stats.Errors; Slot < Context->Stats.Errors + LIBMSR_STATS_ERROR_SLOTS; ++Slot) {
+        if (Slot->Status == Status || Slot->Status == 0) {
+            Slot->Status = Status;
+            Slot->Count++;
+            return;
+        }
+    }
+    Context->Stats.OtherErrors++;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRGetStats(LIBMSRHANDLE Handle, LIBMSRSTATS *pStats)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+
+    *pStats = Context->Stats;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRResetStats(LIBMSRHANDLE Handle)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+
+    memset(&Context->Stats, 0, sizeof(Context->Stats));
+    return LIBMSR_OK;
+}
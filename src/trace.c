@@ -0,0 +1,104 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+/* Entries are published seqlock-style: the sequence number is cleared while an
+ * entry is rewritten and set last, so a reader on another thread can tell a
+ * stable copy from a torn one without the writer ever taking a lock.
+ */
+static LIBMSRTRACEENTRY *LIBMSRDECL _MSRTraceBegin(MSRTRACE *Trace, BYTE Kind, ULONGLONG TimeUs)
+{
+    LIBMSRTRACEENTRY *Entry = &Trace->Entries[Trace->Last % LIBMSR_TRACE_ENTRIES];
+
+    ((volatile LIBMSRTRACEENTRY *)Entry)->Sequence = 0;
+    _MSRMemoryBarrier();
+    Entry->TimeUs = TimeUs;
+    Entry->Kind = Kind;
+    Entry->Opcode = Trace->Opcode;
+    Entry->Length = 0;
+    Entry->Status = LIBMSR_OK;
+    return Entry;
+}
+
+static void LIBMSRDECL _MSRTraceEnd(MSRTRACE *Trace, LIBMSRTRACEENTRY *Entry)
+{
+    _MSRMemoryBarrier();
+    ((volatile LIBMSRTRACEENTRY *)Entry)->Sequence = ++Trace->Last;
+}
+
+void LIBMSRDECL _MSRTraceData(LPMSRCONTEXT Context, BYTE Kind, const BYTE *Data, SIZE_T Length)
+{
+    MSRTRACE *Trace = &Context->Trace;
+    LIBMSRTRACEENTRY *Entry;
+    ULONGLONG Now = _MSRGetTimeUs();
+    SIZE_T Chunk;
+
+    if (Kind == LIBMSR_CAPTURE_WRITE && Length >= 2 && Data[0] == ESC) {
+        Trace->Opcode = Data[1];
+    }
+    while (Length > 0) {
+        Chunk = Length < LIBMSR_TRACE_DATA ? Length : LIBMSR_TRACE_DATA;
+        Entry = _MSRTraceBegin(Trace, Kind, Now);
+        memcpy(Entry->Data, Data, Chunk);
+        Entry->Length = (BYTE)Chunk;
+        _MSRTraceEnd(Trace, Entry);
+        Data += Chunk;
+        Length -= Chunk;
+    }
+}
+
+void LIBMSRDECL _MSRTraceError(LPMSRCONTEXT Context, LIBMSRSTATUS Status)
+{
+    MSRTRACE *Trace = &Context->Trace;
+    LIBMSRTRACEENTRY *Entry;
+
+    Entry = _MSRTraceBegin(Trace, LIBMSR_CAPTURE_ERROR, _MSRGetTimeUs());
+    Entry->Status = Status;
+    _MSRTraceEnd(Trace, Entry);
+    if (Trace->Callback) {
+        Trace->Callback(Trace->CallbackContext, (LIBMSRHANDLE)Context, Status);
+    }
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRTraceRead(LIBMSRHANDLE Handle, LIBMSRTRACEENTRY Entries[], UINT Count, UINT *pCount)
+{
+    LPMSRCONTEXT Context = (LPMSRCONTEXT)Handle;
+    MSRTRACE *Trace = &Context->Trace;
+    volatile LIBMSRTRACEENTRY *Entry;
+    ULONGLONG Last;
+    ULONGLONG Sequence;
+    UINT Copied = 0;
+
+    if (Count > LIBMSR_TRACE_ENTRIES) {
+        Count = LIBMSR_TRACE_ENTRIES;
+    }
+    Last = ((volatile MSRTRACE *)Trace)->Last;
+    _MSRMemoryBarrier();
+    Sequence = Last >= Count ? Last - Count + 1 : 1;
+    for (; Sequence <= Last; ++Sequence) {
+        Entry = &Trace->Entries[(Sequence - 1) % LIBMSR_TRACE_ENTRIES];
+        if (Entry->Sequence != Sequence) {
+            continue;
+        }
+        _MSRMemoryBarrier();
+        memcpy(&Entries[Copied], (const void *)Entry, sizeof(*Entry));
+        _MSRMemoryBarrier();
+        if (Entry->Sequence != Sequence) {
+            /* Overwritten while we were copying it */
+            continue;
+        }
+        Entries[Copied++].Sequence = Sequence;
+    }
+    *pCount = Copied;
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRSetTraceCallback(LIBMSRHANDLE Handle, LIBMSRTRACECALLBACK Callback, void *Context)
+{
+    LPMSRCONTEXT MsrContext = (LPMSRCONTEXT)Handle;
+
+    MsrContext->Trace.Callback = Callback;
+    MsrContext->Trace.CallbackContext = Context;
+    return LIBMSR_OK;
+}
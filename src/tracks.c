@@ -0,0 +1,182 @@
+#include "libmsr.h"
+#include "internals.h"
+
+#include <string.h>
+
+typedef struct {
+    SIZE_T Capacity;
+    /* Raw[i] has Capacity bytes, Text[i] Capacity + 1; both point into the arena below */
+    BYTE *Raw[3];
+    SIZE_T RawLength[3];
+    BYTE *Text[3];
+    SIZE_T TextLength[3];
+} MSRTRACKS, *LPMSRTRACKS;
+
+LIBMSRSTATUS LIBMSRAPI MSRTracksCreate(SIZE_T Capacity, LIBMSRTRACKS *pTracks)
+{
+    LPMSRTRACKS Set;
+    BYTE *Arena;
+    UINT i;
+
+    if (Capacity == 0) {
+        Capacity = LIBMSR_MAX_TRACK_LENGTH;
+    }
+    Set = (LPMSRTRACKS)_MSRAlloc(sizeof(MSRTRACKS) + 3 * (2 * Capacity + 1));
+    if (!Set) {
+        return LIBMSR_MEM_ALLOC_FAILED;
+    }
+    Set->Capacity = Capacity;
+    Arena = (BYTE *)(Set + 1);
+    for (i = 0; i < 3; ++i) {
+        Set->Raw[i] = Arena;
+        Arena += Capacity;
+        Set->Text[i] = Arena;
+        Arena += Capacity + 1;
+    }
+    *pTracks = Set;
+    return LIBMSR_OK;
+}
+
+void LIBMSRAPI MSRTracksDestroy(LIBMSRTRACKS Tracks)
+{
+    _MSRFree(Tracks);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRTracksClear(LIBMSRTRACKS Tracks)
+{
+    LPMSRTRACKS Set = (LPMSRTRACKS)Tracks;
+    UINT i;
+
+    for (i = 0; i < 3; ++i) {
+        Set->RawLength[i] = 0;
+        Set->TextLength[i] = 0;
+        Set->Text[i][0] = 0x00;
+    }
+    return LIBMSR_OK;
+}
+
+static LIBMSRSTATUS LIBMSRDECL _MSRReadTracks(LIBMSRHANDLE Handle, LPMSRTRACKS Set, UINT Type)
+{
+    LIBMSRREQUEST Request;
+    LIBMSRSTATUS Status;
+    BOOL IsRaw = Type == LIBMSR_REQ_READ_RAW;
+    UINT i;
+
+    MSRTracksClear(Set);
+    memset(&Request, 0, sizeof(Request));
+    Request.Type = Type;
+    for (i = 0; i < 3; ++i) {
+        Request.TrackBuffers[i] = IsRaw ? Set->Raw[i] : Set->Text[i];
+        Request.TrackCapacities[i] = IsRaw ? Set->Capacity : Set->Capacity + 1;
+    }
+    Status = _MSRRun((LPMSRCONTEXT)Handle, &Request);
+    for (i = 0; i < 3; ++i) {
+        if (IsRaw) {
+            Set->RawLength[i] = Request.TrackLengths[i];
+        }
+        else {
+            Set->TextLength[i] = Request.TrackLengths[i];
+            Set->Text[i][Set->TextLength[i]] = 0x00;
+        }
+    }
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRCardReadRawTracks(LIBMSRHANDLE Handle, LIBMSRTRACKS Tracks)
+{
+    return _MSRReadTracks(Handle, (LPMSRTRACKS)Tracks, LIBMSR_REQ_READ_RAW);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRCardReadISOTracks(LIBMSRHANDLE Handle, LIBMSRTRACKS Tracks)
+{
+    return _MSRReadTracks(Handle, (LPMSRTRACKS)Tracks, LIBMSR_REQ_READ_ISO);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRCardWriteRawTracks(LIBMSRHANDLE Handle, LIBMSRTRACKS Tracks)
+{
+    LPMSRTRACKS Set = (LPMSRTRACKS)Tracks;
+
+    return MSRCardWriteRaw(Handle,
+        Set->RawLength[0] ? Set->Raw[0] : NULL, Set->RawLength[0],
+        Set->RawLength[1] ? Set->Raw[1] : NULL, Set->RawLength[1],
+        Set->RawLength[2] ? Set->Raw[2] : NULL, Set->RawLength[2]);
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRTracksDecode(LIBMSRTRACKS Tracks, UINT Track, UINT BitsPerChar)
+{
+    LPMSRTRACKS Set = (LPMSRTRACKS)Tracks;
+    LIBMSRSTATUS Status;
+    UINT i = Track - 1;
+
+    if (i >= 3) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    /* The text area is one byte larger than the raw one, which leaves room for the NUL */
+    Status = MSRDecodeTrack(BitsPerChar, Set->Raw[i], Set->RawLength[i], Set->Text[i]);
+    if (Status == LIBMSR_INVALID_ARGUMENT) {
+        return Status;
+    }
+    Set->TextLength[i] = Set->RawLength[i];
+    return Status;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRTracksEncode(LIBMSRTRACKS Tracks, UINT Track, UINT BitsPerChar)
+{
+    LPMSRTRACKS Set = (LPMSRTRACKS)Tracks;
+    LIBMSRSTATUS Status;
+    UINT i = Track - 1;
+
+    if (i >= 3) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    if (Set->TextLength[i] > Set->Capacity) {
+        return LIBMSR_BUFFER_TOO_SMALL;
+    }
+    Status = MSREncodeTrack(BitsPerChar, Set->Text[i], Set->TextLength[i], Set->Raw[i]);
+    if (Status < 0) {
+        return Status;
+    }
+    Set->RawLength[i] = Set->TextLength[i];
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRTracksGetRaw(LIBMSRTRACKS Tracks, UINT Track, const BYTE **ppData, SIZE_T *pLength)
+{
+    LPMSRTRACKS Set = (LPMSRTRACKS)Tracks;
+
+    if (Track - 1 >= 3) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    *ppData = Set->Raw[Track - 1];
+    *pLength = Set->RawLength[Track - 1];
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRTracksGetText(LIBMSRTRACKS Tracks, UINT Track, const BYTE **ppText, SIZE_T *pLength)
+{
+    LPMSRTRACKS Set = (LPMSRTRACKS)Tracks;
+
+    if (Track - 1 >= 3) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    *ppText = Set->Text[Track - 1];
+    *pLength = Set->TextLength[Track - 1];
+    return LIBMSR_OK;
+}
+
+LIBMSRSTATUS LIBMSRAPI MSRTracksSetText(LIBMSRTRACKS Tracks, UINT Track, const BYTE *Text, SIZE_T Length)
+{
+    LPMSRTRACKS Set = (LPMSRTRACKS)Tracks;
+    UINT i = Track - 1;
+
+    if (i >= 3) {
+        return LIBMSR_INVALID_ARGUMENT;
+    }
+    if (Length > Set->Capacity) {
+        return LIBMSR_BUFFER_TOO_SMALL;
+    }
+    memmove(Set->Text[i], Text, Length);
+    Set->Text[i][Length] = 0x00;
+    Set->TextLength[i] = Length;
+    return LIBMSR_OK;
+}